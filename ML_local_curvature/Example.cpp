@@ -4,7 +4,22 @@
 #include <ogx/Data/Clouds/SphericalSearchKernel.h>
 #include <ogx/Data/Primitives/PrimitiveHelpers.h>
 #include <vector>
-#include "mchtr_sgd.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include "../core/mchtr_cache.h"
+#include "../core/mchtr_crop.h"
+#include "../core/mchtr_curvature.h"
+#include "../core/mchtr_fit.h"
+#include "../core/mchtr_incremental.h"
+#include "../core/mchtr_kdtree.h"
+#include "../core/mchtr_knn_graph.h"
+#include "../core/mchtr_lod.h"
+#include "../core/mchtr_parallel.h"
+#include "../core/mchtr_profile.h"
+#include "../core/mchtr_tiling.h"
+#include "../core/mchtr_voxel_grid.h"
 
 using namespace ogx;
 using namespace ogx::Data;
@@ -14,6 +29,37 @@ struct local_curvature : public ogx::Plugin::EasyMethod {
 	// parameters
 	Data::ResourceID node_id;
 	int neighbours_count{ 15 };
+	ogx::String scales;
+	bool scales_max{ false };
+	bool scales_mean{ false };
+	int fit_method{ mchtr_fit::METHOD_SGD };
+	int threads{ 1 };
+	int max_epochs{ mchtr_sgd::no_epochs };
+	float tolerance{ 0 };
+	bool warm_start{ false };
+	int order{ mchtr_order::ORDER_STORAGE };
+	int neighbourhood_mode{ mchtr_voxel_grid::NEIGHBOURHOOD_KNN };
+	float radius{ 0 };
+	int min_neighbours{ 8 };
+	bool pipeline{ false };
+	int pipeline_batch{ 256 };
+	int pipeline_depth{ 4 };
+	int sampling{ mchtr_lod::SAMPLING_ALL };
+	float spacing{ 0 };
+	int interpolation_neighbours{ 4 };
+	float refine_threshold{ 0 };
+	bool incremental{ false };
+	float tile_size{ 0 };
+	float halo{ 0 };
+	ogx::String cache_path;
+	ogx::String report_path;
+
+	// coordinates, deleted points and curvatures of the last incremental run, so the next one refits only what an edit reached;
+	// kept by the instance, a host creating a new instance for every run gets full runs only
+	mchtr_incremental::snapshot last_run;
+	// key of last_run, a run on another node or cloud, or without incremental, releases it
+	Data::ResourceID last_run_node{ 0 };
+	const ogx::Data::Clouds::ICloud* last_run_cloud{ nullptr };
 	
 	// inheritance from EasyMethod
 	local_curvature() : EasyMethod(L"Przemysaw Wysocki", L"Calculates curvature of the surface.") {}
@@ -22,16 +68,96 @@ struct local_curvature : public ogx::Plugin::EasyMethod {
 	virtual void DefineParameters(ParameterBank& bank) {
 		bank.Add(L"node_id", node_id).AsNode();
 		bank.Add(L"neighbours_count", neighbours_count);
+		bank.Add(L"scales", scales);
+		bank.Add(L"scales_max", scales_max);
+		bank.Add(L"scales_mean", scales_mean);
+		bank.Add(L"fit_method", fit_method);
+		bank.Add(L"threads", threads);
+		bank.Add(L"max_epochs", max_epochs);
+		bank.Add(L"tolerance", tolerance);
+		bank.Add(L"warm_start", warm_start);
+		bank.Add(L"order", order);
+		bank.Add(L"neighbourhood_mode", neighbourhood_mode);
+		bank.Add(L"radius", radius);
+		bank.Add(L"min_neighbours", min_neighbours);
+		bank.Add(L"pipeline", pipeline);
+		bank.Add(L"pipeline_batch", pipeline_batch);
+		bank.Add(L"pipeline_depth", pipeline_depth);
+		bank.Add(L"sampling", sampling);
+		bank.Add(L"spacing", spacing);
+		bank.Add(L"interpolation_neighbours", interpolation_neighbours);
+		bank.Add(L"refine_threshold", refine_threshold);
+		bank.Add(L"incremental", incremental);
+		bank.Add(L"tile_size", tile_size);
+		bank.Add(L"halo", halo);
+		bank.Add(L"cache_path", cache_path);
+		bank.Add(L"report_path", report_path);
 	}
 
 	virtual void Run(Context& context) {
 
-		// check neighbours_count validity (user input)
-		if (neighbours_count < 1) {
-			ReportError(L"K of nearest neighbours lower than 1.");
+		// check the parameters (user input)
+		mchtr_curvature::options settings;
+		settings.neighbours_count = neighbours_count;
+		settings.fit_method = fit_method;
+		settings.threads = threads;
+		settings.max_epochs = max_epochs;
+		settings.tolerance = tolerance;
+		settings.warm_start = warm_start;
+		settings.order = order;
+		settings.neighbourhood.mode = neighbourhood_mode;
+		settings.neighbourhood.radius = radius;
+		settings.neighbourhood.min_points = min_neighbours;
+		settings.pipeline.enabled = pipeline;
+		settings.pipeline.batch_size = pipeline_batch;
+		settings.pipeline.depth = pipeline_depth;
+		mchtr_tiling::options tiling;
+		tiling.tile_size = tile_size;
+		tiling.halo = halo;
+		mchtr_lod::options lod;
+		lod.sampling = sampling;
+		lod.spacing = spacing;
+		lod.interpolation_neighbours = interpolation_neighbours;
+		lod.refine_threshold = refine_threshold;
+		const wchar_t* error = mchtr_curvature::validate(settings);
+		if (!error) {
+			error = mchtr_tiling::validate(tiling);
+		}
+		if (!error) {
+			error = mchtr_lod::validate(lod);
+		}
+		if (!error && sampling != mchtr_lod::SAMPLING_ALL && tile_size > 0) {
+			error = L"Sparse sampling can't be combined with tiling.";
+		}
+		if (!error && incremental && (tile_size > 0 || sampling != mchtr_lod::SAMPLING_ALL)) {
+			error = L"Incremental mode can't be combined with tiling or sparse sampling.";
+		}
+
+		// multi-scale mode: K values to fit at in one pass, empty for a single scale (neighbours_count)
+		std::vector<int> scale_list;
+		if (!error) {
+			error = mchtr_curvature::parse_scales(scales.c_str(), scale_list);
+		}
+		if (!error && !scale_list.empty() && (incremental || tile_size > 0 || sampling != mchtr_lod::SAMPLING_ALL)) {
+			error = L"Multi-scale mode can't be combined with incremental mode, tiling or sparse sampling.";
+		}
+		if (error) {
+			ReportError(error);
 			return;
 		}
 
+		// instrumentation, only if a report is wanted
+		mchtr_profile::recorder profile("local_curvature");
+		mchtr_profile::recorder* stages = report_path.empty() ? nullptr : &profile;
+		settings.profile = stages;
+
+		// persistent cache of whole runs' curvatures, only if a directory is given
+		std::unique_ptr<mchtr_cache::store> cache;
+		if (!cache_path.empty()) {
+			cache.reset(new mchtr_cache::store(cache_path));
+			settings.cache = cache.get();
+		}
+
 		// get access to the node, handle exception
 		auto node = context.m_project->TransTreeFindNode(node_id);
 		if (!node) {
@@ -52,58 +178,542 @@ struct local_curvature : public ogx::Plugin::EasyMethod {
 			OGX_LINE.Msg(ogx::Level::Error, L"Invalid cloud in the given node.");
 			return;
 		}
+
+		// the snapshot of the last incremental run serves only the same node and cloud
+		if (!incremental || node_id != last_run_node || cloud != last_run_cloud) {
+			last_run.invalidate();
+		}
+		last_run_node = node_id;
+		last_run_cloud = incremental ? cloud : nullptr;
 		
 		// get access to the points
 		ogx::Data::Clouds::PointsRange pointsRange;
 		cloud->GetAccess().GetAllPoints(pointsRange);
 
-		// KNN setup
-		auto searchKNNKernel = ogx::Data::Clouds::KNNSearchKernel(ogx::Math::Point3D(0, 0, 0), neighbours_count);
+		// deleted points (e.g. cut by cut_pancake) are left out of every neighbourhood and get no curvature, in every mode;
+		// outside incremental runs the others are fitted as a cloud of their own, kept maps its indices to the cloud's (empty if none is deleted)
+		const std::size_t points_count = pointsRange.size();
+		std::vector<std::size_t> kept;
+		if (!incremental) {
+			std::size_t index = 0;
+			for (const auto& state : Data::Clouds::RangeState(pointsRange)) {
+				if (!state.test(Data::Clouds::PS_DELETED)) {
+					kept.push_back(index);
+				}
+				++index;
+			}
+			if (kept.size() == points_count) {
+				std::vector<std::size_t>().swap(kept);
+			}
+		}
+		const std::size_t fitted_count = incremental || kept.empty() ? points_count : kept.size();
+		auto kept_coordinates = [&](std::vector<float>& coordinates) {
+			mchtr_profile::scoped_stage timer(stages, "snapshot");
+			coordinates.reserve(3 * fitted_count);
+			auto state = Data::Clouds::RangeState(pointsRange).begin();
+			for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+				if (kept.empty() || !state->test(Data::Clouds::PS_DELETED)) {
+					coordinates.push_back(xyz.x());
+					coordinates.push_back(xyz.y());
+					coordinates.push_back(xyz.z());
+				}
+				++state;
+			}
+		};
+		auto to_cloud_indices = [&](std::vector<float>& values) {
+			if (kept.empty()) {
+				return;
+			}
+			std::vector<float> all(points_count, mchtr_curvature::no_curvature);
+			for (std::size_t i = 0; i < kept.size(); ++i) {
+				all[kept[i]] = values[i];
+			}
+			values.swap(all);
+		};
+
+		// progress callback, shared by all modes
+		auto report = [&](std::size_t finished) {
+			if (!context.Feedback().Update(static_cast<float>(finished) / fitted_count)) {
+				ReportError(L"Could not update progress bar.");
+			}
+		};
+		std::vector<float> curvatures(fitted_count, 0.0f);
+		std::vector<std::vector<float>> scale_curvatures;
+
+		if (incremental) {
+
+			// snapshot of the coordinates and of which points are deleted, e.g. by cut_pancake
+			std::vector<float> coordinates;
+			std::vector<unsigned char> live;
+			{
+				mchtr_profile::scoped_stage timer(stages, "snapshot");
+				coordinates.reserve(3 * points_count);
+				live.reserve(points_count);
+				auto state = Data::Clouds::RangeState(pointsRange).begin();
+				for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+					coordinates.push_back(xyz.x());
+					coordinates.push_back(xyz.y());
+					coordinates.push_back(xyz.z());
+					live.push_back(state->test(Data::Clouds::PS_DELETED) ? 0 : 1);
+					++state;
+				}
+			}
 
-		// data collection variables
-		std::vector<ogx::Data::Clouds::Point3D> neighbouring_points;
-		std::vector<float> curvatures;
-		curvatures.reserve(pointsRange.size());
+			// the previous layer is patched, so the curvatures of the points kept from the last run stay where they are
+			const mchtr_incremental::run_stats stats = mchtr_incremental::compute_curvature(last_run, coordinates.data(), live.data(), points_count, settings,
+				report, curvatures.data());
+			if (stats.full) {
+				OGX_LINE.Msg(ogx::Level::Info, L"Brak poprzedniego przebiegu dla tej chmury i parametrw, policzono wszystkie punkty.");
+			}
+			else {
+				OGX_LINE.Msg(ogx::Level::Info, L"Zmienione punkty: " + std::to_wstring(stats.changed) + L", ponownie policzone: " + std::to_wstring(stats.recomputed) +
+					L" z " + std::to_wstring(points_count) + L".");
+			}
+		}
+		else if (!scale_list.empty()) {
 
-		// progress var for progress bar
-		int progress = 0;
+			// snapshot of the coordinates of the points that aren't deleted (x0, y0, z0, x1, ...)
+			std::vector<float> coordinates;
+			kept_coordinates(coordinates);
 
-		// iterate over all 3D points
-		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+			// one query for the largest K per point, every scale fits a prefix of its neighbours
+			scale_curvatures.assign(scale_list.size(), std::vector<float>(fitted_count, 0.0f));
+			std::vector<float*> outputs;
+			for (std::vector<float>& values : scale_curvatures) {
+				outputs.push_back(values.data());
+			}
+			const mchtr_curvature::run_info info = mchtr_curvature::compute_scales(coordinates.data(), fitted_count, scale_list, settings, report, outputs.data());
+			OGX_LINE.Msg(ogx::Level::Info, L"Liczba skal: " + std::to_wstring(scale_list.size()) + L", najwiksze K: " +
+				std::to_wstring(*std::max_element(scale_list.begin(), scale_list.end())) + L", liczba wtkw: " + std::to_wstring(info.workers) + L".");
+			for (std::vector<float>& values : scale_curvatures) {
+				to_cloud_indices(values);
+			}
+		}
+		else if (tile_size > 0) {
+
+			// tiled mode: only a tile with its halo is fitted at a time, copied from buckets filled in one pass over the cloud,
+			// bounds of the cloud come from an empty box grown point by point
+			mchtr_tiling::box bounds = mchtr_tiling::bounds_of(nullptr, 0);
+			for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+				const float point[3] = { xyz.x(), xyz.y(), xyz.z() };
+				for (int axis = 0; axis < 3; ++axis) {
+					bounds.min[axis] = std::min(bounds.min[axis], point[axis]);
+					bounds.max[axis] = std::max(bounds.max[axis], point[axis]);
+				}
+			}
+			const mchtr_tiling::grid tiles(bounds, tile_size);
+			// points that aren't deleted are copied into buckets by tile in one more pass, a tile then reads only the buckets its halo overlaps
+			mchtr_tiling::stream_loader loader(tiles);
+			{
+				std::size_t index = 0;
+				auto state = Data::Clouds::RangeState(pointsRange).begin();
+				for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+					if (kept.empty() || !state->test(Data::Clouds::PS_DELETED)) {
+						loader.add(index++, xyz.x(), xyz.y(), xyz.z());
+					}
+					++state;
+				}
+			}
+			const mchtr_tiling::run_stats stats = mchtr_tiling::compute_curvature(tiles, halo, std::cref(loader), settings, report, curvatures.data());
+			to_cloud_indices(curvatures);
+			OGX_LINE.Msg(ogx::Level::Info, L"Liczba kafli: " + std::to_wstring(stats.tiles) + L", najwikszy kafel: " + std::to_wstring(stats.largest_tile) +
+				L" punktw, ssiedztwa ucite przez margines: " + std::to_wstring(stats.inexact_neighbourhoods) + L".");
+		}
+		else {
+
+			// snapshot of the coordinates of the points that aren't deleted (x0, y0, z0, x1, ...)
+			std::vector<float> coordinates;
+			kept_coordinates(coordinates);
+
+			// stage messages of the sparse mode
+			auto stage_started = [&](int stage) {
+				if (sampling == mchtr_lod::SAMPLING_ALL) {
+					return;
+				}
+				switch (stage) {
+				case mchtr_lod::STAGE_SEEDS:
+					OGX_LINE.Msg(ogx::Level::Info, L"Wybr punktw bazowych i dopasowanie sfer.");
+					break;
+				case mchtr_lod::STAGE_INTERPOLATION:
+					OGX_LINE.Msg(ogx::Level::Info, L"Interpolacja krzywizny pozostaych punktw.");
+					break;
+				case mchtr_lod::STAGE_REFINEMENT:
+					OGX_LINE.Msg(ogx::Level::Info, L"Dopasowanie sfer w punktach o niepewnej interpolacji.");
+					break;
+				default:
+					break;
+				}
+			};
+
+			// the fitting itself lives in the core library, shared with the command line tool
+			const mchtr_lod::run_stats stats = mchtr_lod::compute_curvature(coordinates.data(), fitted_count, lod, settings, stage_started, report, curvatures.data());
+			to_cloud_indices(curvatures);
+			const mchtr_curvature::run_info& info = stats.fitting;
+			if (stats.cached) {
+				OGX_LINE.Msg(ogx::Level::Info, L"Krzywizny wczytano z pamici podrcznej.");
+			}
+			else if (sampling != mchtr_lod::SAMPLING_ALL) {
+				OGX_LINE.Msg(ogx::Level::Info, L"Punkty bazowe: " + std::to_wstring(stats.seeds) + L", interpolowane: " + std::to_wstring(fitted_count - stats.seeds) +
+					L", dopasowane ponownie: " + std::to_wstring(stats.refined) + L".");
+			}
+			if (fit_method == mchtr_fit::METHOD_SGD && !stats.cached) {
+				OGX_LINE.Msg(ogx::Level::Info, L"Dopasowanie SGD wykonano w paczkach po " + std::to_wstring(mchtr_batch::max_lanes) + L" punktw (" + mchtr_batch::isa_name(info.instruction_set) + L").");
+			}
+			if (!stats.cached) {
+				OGX_LINE.Msg(ogx::Level::Info, L"Liczba wtkw: " + std::to_wstring(info.workers) + L".");
+			}
+			if (info.sgd_fits > 0) {
+				OGX_LINE.Msg(ogx::Level::Info, L"rednio epok SGD na punkt: " + std::to_wstring(static_cast<double>(info.sgd_epochs) / info.sgd_fits) +
+					L", zbienych przed limitem: " + std::to_wstring(info.early_stops) + L", startw od ssiedniej sfery: " + std::to_wstring(info.warm_starts) + L".");
+			}
+		}
 
-			// find KNNs
-			searchKNNKernel.GetPoint() = xyz.cast<double>();
-			ogx::Data::Clouds::PointsRange neighboursRange;
-			cloud->GetAccess().FindPoints(searchKNNKernel, neighboursRange);
-			auto neighboursXYZ = ogx::Data::Clouds::RangeLocalXYZConst(neighboursRange);
+		if (!scale_list.empty()) {
+
+			// one layer per scale, then the optional maximum and mean over the scales
+			mchtr_profile::scoped_stage timer(stages, "write_layer");
+			for (std::size_t scale = 0; scale < scale_list.size(); ++scale) {
+				auto layer = cloud->CreateLayer(L"Curvatures_K" + std::to_wstring(scale_list[scale]), 0.0);
+				pointsRange.SetLayerVals(scale_curvatures[scale], *layer);
+			}
+			if (scales_max || scales_mean) {
+				std::vector<const float*> inputs;
+				for (const std::vector<float>& values : scale_curvatures) {
+					inputs.push_back(values.data());
+				}
+				curvatures.resize(points_count);
+				std::vector<float> mean(points_count, 0.0f);
+				mchtr_curvature::combine_scales(inputs.data(), inputs.size(), points_count, curvatures.data(), mean.data());
+				if (scales_max) {
+					auto layer = cloud->CreateLayer(L"Curvatures_max", 0.0);
+					pointsRange.SetLayerVals(curvatures, *layer);
+				}
+				if (scales_mean) {
+					auto layer = cloud->CreateLayer(L"Curvatures_mean", 0.0);
+					pointsRange.SetLayerVals(mean, *layer);
+				}
+			}
+		}
+		else {
+
+			// create a new layer, an incremental run reuses the one it created before
+			const auto layer_name = L"Curvatures";
+			auto layers = incremental ? cloud->FindLayers(layer_name) : std::vector<ogx::Data::Clouds::ILayer*>();
+			auto layer = layers.empty() ? cloud->CreateLayer(layer_name, 0.0) : layers.front();
+
+			// add the layer to point range and set it to curvatures
+			mchtr_profile::scoped_stage timer(stages, "write_layer");
+			pointsRange.SetLayerVals(curvatures, *layer);
+		}
+
+		if (cache) {
+			const mchtr_cache::statistics& cache_stats = cache->stats();
+			OGX_LINE.Msg(ogx::Level::Info, L"Pami podrczna: trafienia: " + std::to_wstring(cache_stats.hits) + L", chybienia: " + std::to_wstring(cache_stats.misses) +
+				L", zapisane wpisy: " + std::to_wstring(cache_stats.writes) + L", nieudane zapisy: " + std::to_wstring(cache_stats.failed_writes) + L".");
+		}
+
+		// run report
+		if (stages) {
+			try {
+				profile.write(report_path);
+				OGX_LINE.Msg(ogx::Level::Info, L"Zapisano raport: " + report_path + L".");
+			}
+			catch (const std::exception&) {
+				ReportError(L"Could not write the report.");
+			}
+		}
+
+		// success message
+		OGX_LINE.Msg(ogx::Level::Info, L"Pomylnie policzono krzywizny.");
+	}
+};
+
+struct compare_fit_methods : public ogx::Plugin::EasyMethod {
+
+	// parameters
+	Data::ResourceID node_id;
+	int neighbours_count{ 15 };
+	int sample_step{ 100 };
+
+	// inheritance from EasyMethod
+	compare_fit_methods() : EasyMethod(L"Przemysaw Wysocki", L"Compares accuracy and speed of the sphere fitting methods used for curvature.") {}
+
+	// add input parameters
+	virtual void DefineParameters(ParameterBank& bank) {
+		bank.Add(L"node_id", node_id).AsNode();
+		bank.Add(L"neighbours_count", neighbours_count);
+		bank.Add(L"sample_step", sample_step);
+	}
+
+	virtual void Run(Context& context) {
+
+		// check neighbours_count and sample_step validity (user input)
+		if (neighbours_count < 1) {
+			ReportError(L"K of nearest neighbours lower than 1.");
+			return;
+		}
+		if (sample_step < 1) {
+			ReportError(L"Sample step lower than 1.");
+			return;
+		}
+
+		// get access to the node, handle exception
+		auto node = context.m_project->TransTreeFindNode(node_id);
+		if (!node) {
+			ReportError(L"Invalid node id. Failed to run plugin.");
+			return;
+		}
+
+		// access the element
+		auto element = node->GetElement();
+		if (!element) {
+			OGX_LINE.Msg(ogx::Level::Error, L"Invalid element in the given node.");
+			return;
+		}
 
-			// clear the vector containing each points' neighbours
+		// get the cloud
+		auto cloud = element->GetData<ogx::Data::Clouds::ICloud>();
+		if (!cloud) {
+			OGX_LINE.Msg(ogx::Level::Error, L"Invalid cloud in the given node.");
+			return;
+		}
+
+		// get access to the points
+		ogx::Data::Clouds::PointsRange pointsRange;
+		cloud->GetAccess().GetAllPoints(pointsRange);
+
+		// snapshot of the coordinates (x0, y0, z0, x1, ...) and a kd-tree over them, queried into buffers reused for every point
+		std::vector<float> coordinates;
+		coordinates.reserve(3 * pointsRange.size());
+		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+			coordinates.push_back(xyz.x());
+			coordinates.push_back(xyz.y());
+			coordinates.push_back(xyz.z());
+		}
+		const std::size_t points_count = coordinates.size() / 3;
+		mchtr_kdtree::kdtree tree;
+		tree.build(coordinates.data(), points_count);
+		std::vector<mchtr_kdtree::neighbour> neighbours(neighbours_count);
+		std::vector<mchtr_geometry::point3> neighbouring_points;
+		neighbouring_points.reserve(neighbours_count);
+
+		// per method statistics, SGD (method 0) is the reference for curvature differences
+		constexpr int methods_count = 3;
+		const wchar_t* method_names[methods_count] = { L"SGD", L"algebraiczna", L"algebraiczna + Gauss-Newton" };
+		double fit_seconds[methods_count] = {};
+		double residual_sum[methods_count] = {};
+		int residual_count[methods_count] = {};
+		double curvature_difference_sum[methods_count] = {};
+		double curvature_difference_max[methods_count] = {};
+		int fitted_points = 0;
+
+		// every sample_step-th point
+		for (std::size_t index = 0; index < points_count; index += sample_step) {
+
+			// find KNNs, shared by all methods
+			const mchtr_geometry::point3 central_point(coordinates[3 * index], coordinates[3 * index + 1], coordinates[3 * index + 2]);
+			const std::size_t neighbours_found = tree.knn(central_point.x(), central_point.y(), central_point.z(), neighbours_count, neighbours.data());
 			neighbouring_points.clear();
+			for (std::size_t j = 0; j < neighbours_found; ++j) {
+				neighbouring_points.emplace_back(neighbours[j].x, neighbours[j].y, neighbours[j].z);
+			}
 
-			// iterate over KNNs of given point, add them to vector	
-			for (const auto& neighbourXYZ : neighboursXYZ) {
-				neighbouring_points.push_back(neighbourXYZ);
+			// fit with every method, timing the fit only
+			double curvatures[methods_count];
+			for (int method = 0; method < methods_count; ++method) {
+				auto start = std::chrono::steady_clock::now();
+				mchtr_sgd::sphere sphere = mchtr_fit::fit_sphere(neighbouring_points, central_point, method);
+				fit_seconds[method] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				curvatures[method] = 1.0 / sphere.r;
+				double residual = mchtr_fit::rms_residual(neighbouring_points, sphere);
+				if (std::isfinite(residual)) {
+					residual_sum[method] += residual;
+					++residual_count[method];
+				}
 			}
 
-			// fit a sphere to neighbouring points (contained in vec) and get the surface curvature
-			curvatures.push_back(static_cast<float>(1.0/(mchtr_sgd::find_sphere_r(neighbouring_points, xyz))));
+			// compare curvatures with the SGD reference
+			for (int method = 0; method < methods_count; ++method) {
+				double difference = std::fabs(curvatures[method] - curvatures[0]);
+				if (std::isfinite(difference)) {
+					curvature_difference_sum[method] += difference;
+					curvature_difference_max[method] = std::fmax(curvature_difference_max[method], difference);
+				}
+			}
+			++fitted_points;
 
 			// progress bar update
-			++progress;
-			if (!context.Feedback().Update(static_cast<float>(progress) / pointsRange.size())) {
+			if (!context.Feedback().Update(static_cast<float>(index + 1) / points_count)) {
 				ReportError(L"Could not update progress bar.");
 			}
 		}
 
-		// create a new layer
-		const auto layer_name = L"Curvatures";
-		auto layer = cloud->CreateLayer(layer_name, 0.0);
+		if (fitted_points == 0) {
+			ReportError(L"No points to compare the fit methods on.");
+			return;
+		}
+
+		// report speed (points per second, speedup over SGD) and accuracy (rms distance to the sphere, curvature difference to SGD)
+		for (int method = 0; method < methods_count; ++method) {
+			double points_per_second = fit_seconds[method] > 0 ? fitted_points / fit_seconds[method] : 0;
+			double speedup = fit_seconds[method] > 0 ? fit_seconds[0] / fit_seconds[method] : 0;
+			double mean_residual = residual_count[method] > 0 ? residual_sum[method] / residual_count[method] : 0;
+			OGX_LINE.Msg(ogx::Level::Info, std::wstring(method_names[method]) +
+				L": " + std::to_wstring(points_per_second) + L" pkt/s (x" + std::to_wstring(speedup) + L" wzgldem SGD)" +
+				L", redni bd RMS dopasowania " + std::to_wstring(mean_residual) +
+				L" (" + std::to_wstring(residual_count[method]) + L"/" + std::to_wstring(fitted_points) + L" sfer skoczonych)" +
+				L", rnica krzywizny wzgldem SGD: rednia " + std::to_wstring(curvature_difference_sum[method] / fitted_points) +
+				L", maks. " + std::to_wstring(curvature_difference_max[method]));
+		}
+		OGX_LINE.Msg(ogx::Level::Info, L"Porwnano metody dopasowania na " + std::to_wstring(fitted_points) + L" punktach.");
+	}
+};
 
-		// add the layer to point range and set it to curvatures
-		pointsRange.SetLayerVals(curvatures, *layer);
+struct knn_benchmark : public ogx::Plugin::EasyMethod {
 
-		// success message
-		OGX_LINE.Msg(ogx::Level::Info, L"Pomylnie policzono krzywizny.");
+	// parameters
+	Data::ResourceID node_id;
+	int neighbours_count{ 15 };
+	int sample_step{ 10 };
+	int threads{ 1 };
+
+	// inheritance from EasyMethod
+	knn_benchmark() : EasyMethod(L"Przemysaw Wysocki", L"Compares throughput of the cloud's KNN search with the plugins' kd-tree.") {}
+
+	// add input parameters
+	virtual void DefineParameters(ParameterBank& bank) {
+		bank.Add(L"node_id", node_id).AsNode();
+		bank.Add(L"neighbours_count", neighbours_count);
+		bank.Add(L"sample_step", sample_step);
+		bank.Add(L"threads", threads);
+	}
+
+	virtual void Run(Context& context) {
+
+		// check neighbours_count, sample_step and threads validity (user input)
+		if (neighbours_count < 1) {
+			ReportError(L"K of nearest neighbours lower than 1.");
+			return;
+		}
+		if (sample_step < 1) {
+			ReportError(L"Sample step lower than 1.");
+			return;
+		}
+		if (threads < 0) {
+			ReportError(L"Number of threads lower than 0 (0 means all cores).");
+			return;
+		}
+
+		// get access to the node, handle exception
+		auto node = context.m_project->TransTreeFindNode(node_id);
+		if (!node) {
+			ReportError(L"Invalid node id. Failed to run plugin.");
+			return;
+		}
+
+		// access the element
+		auto element = node->GetElement();
+		if (!element) {
+			OGX_LINE.Msg(ogx::Level::Error, L"Invalid element in the given node.");
+			return;
+		}
+
+		// get the cloud
+		auto cloud = element->GetData<ogx::Data::Clouds::ICloud>();
+		if (!cloud) {
+			OGX_LINE.Msg(ogx::Level::Error, L"Invalid cloud in the given node.");
+			return;
+		}
+
+		// get access to the points
+		ogx::Data::Clouds::PointsRange pointsRange;
+		cloud->GetAccess().GetAllPoints(pointsRange);
+
+		// snapshot of the coordinates (x0, y0, z0, x1, ...)
+		std::vector<float> coordinates;
+		coordinates.reserve(3 * pointsRange.size());
+		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+			coordinates.push_back(xyz.x());
+			coordinates.push_back(xyz.y());
+			coordinates.push_back(xyz.z());
+		}
+		const std::size_t points_count = coordinates.size() / 3;
+		if (points_count == 0) {
+			ReportError(L"No points to run the benchmark on.");
+			return;
+		}
+
+		// tree build
+		auto start = std::chrono::steady_clock::now();
+		mchtr_kdtree::kdtree tree;
+		tree.build(coordinates.data(), points_count);
+		const double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// every sample_step-th point is queried both ways, results are compared by sorted distances
+		auto searchKNNKernel = ogx::Data::Clouds::KNNSearchKernel(ogx::Math::Point3D(0, 0, 0), neighbours_count);
+		std::vector<mchtr_kdtree::neighbour> neighbours(neighbours_count);
+		std::vector<float> cloud_distances;
+		double cloud_seconds = 0;
+		double tree_seconds = 0;
+		std::size_t queries = 0;
+		std::size_t matching_queries = 0;
+		for (std::size_t index = 0; index < points_count; index += sample_step) {
+			const float x = coordinates[3 * index];
+			const float y = coordinates[3 * index + 1];
+			const float z = coordinates[3 * index + 2];
+
+			// the cloud's search, including reading the coordinates back from the range
+			start = std::chrono::steady_clock::now();
+			searchKNNKernel.GetPoint() = ogx::Math::Point3D(x, y, z);
+			ogx::Data::Clouds::PointsRange neighboursRange;
+			cloud->GetAccess().FindPoints(searchKNNKernel, neighboursRange);
+			cloud_distances.clear();
+			for (const auto& neighbourXYZ : ogx::Data::Clouds::RangeLocalXYZConst(neighboursRange)) {
+				const float dx = neighbourXYZ.x() - x;
+				const float dy = neighbourXYZ.y() - y;
+				const float dz = neighbourXYZ.z() - z;
+				cloud_distances.push_back(dx * dx + dy * dy + dz * dz);
+			}
+			cloud_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			// the tree's search
+			start = std::chrono::steady_clock::now();
+			const std::size_t neighbours_found = tree.knn(x, y, z, neighbours_count, neighbours.data());
+			tree_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			// same neighbourhood if the same number of points at the same distances was found (ties may pick different points)
+			std::sort(cloud_distances.begin(), cloud_distances.end());
+			bool matching = cloud_distances.size() == neighbours_found;
+			for (std::size_t j = 0; matching && j < neighbours_found; ++j) {
+				matching = std::fabs(cloud_distances[j] - neighbours[j].distance_squared) <= 1e-6f * std::fmax(1.0f, cloud_distances[j]);
+			}
+			matching_queries += matching ? 1 : 0;
+			++queries;
+
+			// progress bar update
+			if (!context.Feedback().Update(static_cast<float>(index + 1) / points_count)) {
+				ReportError(L"Could not update progress bar.");
+			}
+		}
+
+		// batched queries of all points in tree order, the way the segmentation graph is built
+		const int workers = mchtr_parallel::resolve_threads(threads);
+		std::vector<mchtr_kdtree::neighbour> all_neighbours(points_count * static_cast<std::size_t>(neighbours_count));
+		start = std::chrono::steady_clock::now();
+		tree.knn_all(neighbours_count, all_neighbours.data(), workers, [](std::size_t) {}, nullptr);
+		const double batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// report queries per second, speedup and agreement with the cloud's search
+		const double cloud_rate = cloud_seconds > 0 ? queries / cloud_seconds : 0;
+		const double tree_rate = tree_seconds > 0 ? queries / tree_seconds : 0;
+		const double batch_rate = batch_seconds > 0 ? points_count / batch_seconds : 0;
+		OGX_LINE.Msg(ogx::Level::Info, L"Budowa kd-drzewa: " + std::to_wstring(build_seconds) + L" s (" + std::to_wstring(points_count) + L" punktw).");
+		OGX_LINE.Msg(ogx::Level::Info, L"FindPoints: " + std::to_wstring(cloud_rate) + L" zapyta/s.");
+		OGX_LINE.Msg(ogx::Level::Info, L"kd-drzewo: " + std::to_wstring(tree_rate) + L" zapyta/s (x" + std::to_wstring(cloud_rate > 0 ? tree_rate / cloud_rate : 0) + L" wzgldem FindPoints).");
+		OGX_LINE.Msg(ogx::Level::Info, L"kd-drzewo, wszystkie punkty w paczce (" + std::to_wstring(workers) + L" wtkw): " + std::to_wstring(batch_rate) +
+			L" zapyta/s (x" + std::to_wstring(cloud_rate > 0 ? batch_rate / cloud_rate : 0) + L" wzgldem FindPoints).");
+		OGX_LINE.Msg(ogx::Level::Info, L"Zgodne ssiedztwa: " + std::to_wstring(matching_queries) + L"/" + std::to_wstring(queries) + L".");
 	}
 };
 
@@ -115,9 +725,14 @@ struct cut_pancake : public ogx::Plugin::EasyMethod {
 	double center_point_x{ 0 };
 	double center_point_y{ 0 };
 	double center_point_z{ 0 };
+	int region_shape{ mchtr_crop::SHAPE_SPHERE };
+	double box_size_x{ 0 };
+	double box_size_y{ 0 };
+	double box_size_z{ 0 };
+	int threads{ 1 };
 
 	// inheritance after EasyMethod
-	cut_pancake() : EasyMethod(L"Przemysaw Wysocki", L"Cuts points outside the area of a circle of given radius and center point.") {}
+	cut_pancake() : EasyMethod(L"Przemysaw Wysocki", L"Cuts points outside a sphere, a vertical cylinder or a box of given size and center point.") {}
 
 	// add input/output parameters
 	virtual void DefineParameters(ParameterBank& bank) {
@@ -126,13 +741,31 @@ struct cut_pancake : public ogx::Plugin::EasyMethod {
 		bank.Add(L"center_point_x", center_point_x);
 		bank.Add(L"center_point_y", center_point_y);
 		bank.Add(L"center_point_z", center_point_z);
+		bank.Add(L"region_shape", region_shape);
+		bank.Add(L"box_size_x", box_size_x);
+		bank.Add(L"box_size_y", box_size_y);
+		bank.Add(L"box_size_z", box_size_z);
+		bank.Add(L"threads", threads);
 	}
 
 	virtual void Run(Context& context) {
 
-		// check pancake_range validity (user input)
-		if (pancake_range < 1) {
-			ReportError(L"Pancake range cannot be lower than 1.");
+		// check the region and threads validity (user input)
+		mchtr_crop::region kept;
+		kept.shape = region_shape;
+		kept.centre[0] = center_point_x;
+		kept.centre[1] = center_point_y;
+		kept.centre[2] = center_point_z;
+		kept.radius = pancake_range;
+		kept.half_size[0] = 0.5 * box_size_x;
+		kept.half_size[1] = 0.5 * box_size_y;
+		kept.half_size[2] = 0.5 * box_size_z;
+		const wchar_t* error = mchtr_crop::validate(kept);
+		if (!error && threads < 0) {
+			error = L"Number of threads lower than 0 (0 means all cores).";
+		}
+		if (error) {
+			ReportError(error);
 			return;
 		}
 
@@ -160,35 +793,51 @@ struct cut_pancake : public ogx::Plugin::EasyMethod {
 		// get access to the points
 		ogx::Data::Clouds::PointsRange pointsRange;
 		cloud->GetAccess().GetAllPoints(pointsRange);
+		const std::size_t points_count = pointsRange.size();
 
-		// progress var for progress bar
-		int progress = 0;
-
-		// central point
-		const auto central_point = ogx::Math::Point3D(center_point_x, center_point_y, center_point_z);
-
-		// get point iterator
-		auto state_range = Data::Clouds::RangeState(pointsRange);
-		auto state = state_range.begin();
-
-		// iterate over 3D points
+		// snapshot of the coordinates (x0, y0, z0, x1, ...)
+		std::vector<float> coordinates;
+		coordinates.reserve(3 * points_count);
 		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+			coordinates.push_back(xyz.x());
+			coordinates.push_back(xyz.y());
+			coordinates.push_back(xyz.z());
+		}
 
-			// check if points lie outside of circle, if so, delete them
-			++state;
-			if (Math::CalcPointToPointDistance3D(xyz.cast<Real>(), central_point) > pancake_range) {
-				state->set(Data::Clouds::PS_DELETED);
+		// coarse pass: bounds of blocks of consecutive points, blocks entirely inside or outside the region are decided whole,
+		// only blocks the border crosses are tested point by point; the marks are the first half of the progress bar
+		mchtr_crop::blocks crop_blocks;
+		crop_blocks.build(coordinates.data(), points_count, 0, threads);
+		std::vector<unsigned char> outside(points_count, 0);
+		const mchtr_crop::run_stats stats = mchtr_crop::crop(crop_blocks, coordinates.data(), kept, threads,
+			[&](std::size_t finished) {
+				if (!context.Feedback().Update(0.5f * finished / points_count)) {
+					ReportError(L"Could not update progress bar.");
+				}
+			},
+			outside.data());
+
+		// delete the marked points, the state iterator moves together with the points, progress every block of points
+		std::size_t index = 0;
+		for (auto& state : Data::Clouds::RangeState(pointsRange)) {
+			if (outside[index]) {
+				state.set(Data::Clouds::PS_DELETED);
 			}
-
-			// progress bar update
-			++progress;
-			if (!context.Feedback().Update(static_cast<float>(progress) / pointsRange.size())) {
-				ReportError(L"Could not update progress bar.");
+			++index;
+			if (index % mchtr_crop::blocks::block_size == 0 || index == points_count) {
+				if (!context.Feedback().Update(0.5f + 0.5f * index / points_count)) {
+					ReportError(L"Could not update progress bar.");
+				}
 			}
 		}
+		OGX_LINE.Msg(ogx::Level::Info, L"Usunito " + std::to_wstring(stats.outside) + L" z " + std::to_wstring(points_count) + L" punktw (" +
+			mchtr_batch::isa_name(stats.instruction_set) + L", bloki rozstrzygnite w caoci: " + std::to_wstring(stats.blocks_inside + stats.blocks_outside) +
+			L", sprawdzane punkt po punkcie: " + std::to_wstring(stats.blocks_split) + L").");
 		OGX_LINE.Msg(ogx::Level::Info, L"Pomylnie usunito punkty.");
 	}
 };
 
 OGX_EXPORT_METHOD(local_curvature)
+OGX_EXPORT_METHOD(compare_fit_methods)
+OGX_EXPORT_METHOD(knn_benchmark)
 OGX_EXPORT_METHOD(cut_pancake)
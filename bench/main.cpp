@@ -0,0 +1,1066 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mchtr_allocations.h"
+#include "mchtr_synthetic.h"
+#include "../core/mchtr_crop.h"
+#include "../core/mchtr_curvature.h"
+#include "../core/mchtr_incremental.h"
+#include "../core/mchtr_kdtree.h"
+#include "../core/mchtr_kernels.h"
+#include "../core/mchtr_knn_graph.h"
+#include "../core/mchtr_lod.h"
+#include "../core/mchtr_order.h"
+#include "../core/mchtr_parallel.h"
+#include "../core/mchtr_planes.h"
+#include "../core/mchtr_segmentation.h"
+#include "../core/mchtr_voxel_grid.h"
+
+/*
+Benchmark and accuracy suite: runs curvature fitting and building segmentation on synthetic clouds with known ground truth,
+reports points per second and errors for every fit method, K and thread count
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	struct bench_options {
+		std::size_t points{ 20000 };
+		float noise{ 0 };
+		std::vector<int> fit_methods{ 0, 1, 2 };
+		std::vector<int> neighbours_counts{ 8, 15, 25 };
+		std::vector<int> threads{ 1, 0 };
+		int max_epochs{ mchtr_sgd::no_epochs };
+		float tolerance{ 0 };
+		bool warm_start{ false };
+		mchtr_lod::options lod;
+		int buildings{ 9 };
+		float slope{ 0.05f };
+		std::string suite{ "all" };
+		std::string csv_path;
+	};
+
+	struct shape {
+		std::string name;
+		mchtr_synthetic::cloud points;
+	};
+
+	// batched plane fits whose normal is farther than this (radians) from the one by one fit count as mismatches
+	constexpr double plane_angle_tolerance = 1e-4;
+
+	void print_usage() {
+		std::fprintf(stderr,
+			"usage: mchtr_bench [options]\n"
+			"  --suite <S>           curvature, scales, kernels, incremental, segmentation, planes, crop, order, graph, neighbourhood or all (default all)\n"
+			"  --points <N>          points per synthetic cloud (default 20000)\n"
+			"  --noise <S>           standard deviation of gaussian noise added to coordinates (default 0)\n"
+			"  --fit-methods <list>  curvature fit methods, comma separated (default 0,1,2)\n"
+			"  --k <list>            K nearest neighbours for curvature, comma separated (default 8,15,25)\n"
+			"  --threads <list>      worker threads, comma separated, 0 means all cores (default 1,0)\n"
+			"  --max-epochs <E>      SGD epochs limit per fit (default 30)\n"
+			"  --tolerance <T>       SGD early stopping tolerance, 0 never stops early (default 0)\n"
+			"  --warm-start          start SGD fits from the nearest sphere of the previous batch, if that point is a neighbour\n"
+			"  --sampling <S>        fit only seeds and interpolate the rest, 0 all points, 1 voxel grid, 2 Poisson disk (default 0)\n"
+			"  --spacing <D>         voxel size or Poisson disk radius of the seeds\n"
+			"  --refine-threshold <T>  fit points whose seeds' curvatures differ by more than T, 0 never refines (default 0)\n"
+			"  --buildings <B>       buildings in the segmentation town (default 9)\n"
+			"  --slope <S>           tilt of the town's ground (default 0.05)\n"
+			"  --csv <path>          also write the results as CSV\n");
+	}
+
+	bool parse_list(const char* text, std::vector<int>& values) {
+		values.clear();
+		const char* position = text;
+		while (*position) {
+			char* end = nullptr;
+			const long parsed = std::strtol(position, &end, 10);
+			if (end == position || (*end != ',' && *end != '\0')) {
+				return false;
+			}
+			values.push_back(static_cast<int>(parsed));
+			position = *end == ',' ? end + 1 : end;
+		}
+		return !values.empty();
+	}
+
+	bool parse_float(const char* text, float& value) {
+		char* end = nullptr;
+		const float parsed = std::strtof(text, &end);
+		if (end == text || *end != '\0') {
+			return false;
+		}
+		value = parsed;
+		return true;
+	}
+
+	double seconds_since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// one result row, printed and optionally written as CSV
+	struct row {
+		std::string suite, shape;
+		int fit_method, k, workers;
+		std::size_t points;
+		double seconds;
+		std::vector<std::pair<std::string, double>> metrics;
+	};
+
+	enum kernel {
+		KERNEL_SGD = 0,
+		KERNEL_ALGEBRAIC = 1,
+		KERNEL_ALGEBRAIC_REFINED = 2,
+		KERNEL_PLANE = 3
+	};
+
+	// one fitting kernel run over every neighbourhood of a cloud
+	struct kernel_run {
+		double seconds{ 0 };
+		std::uint64_t allocations{ 0 };
+		std::vector<double> values;		// curvature of every sphere, or normal (3 values) of every plane
+	};
+
+	template <typename T>
+	kernel_run run_kernel(int fitted, const std::vector<mchtr_geometry::point3>& neighbourhoods, std::size_t k, bool fixed, const mchtr_sgd::convergence& stopping) {
+		/*
+		Times a kernel on every neighbourhood and counts the allocations it makes.
+		@param		fitted - one of kernel
+					neighbourhoods - k points per neighbourhood, one neighbourhood after another
+					k - number of points of a neighbourhood
+					fixed - use the kernels' compile time specialisation for k (if there is one)
+					stopping - SGD epochs limit and tolerance
+		@return		time, allocations and results of the run
+		*/
+		const std::size_t count = neighbourhoods.size() / k;
+		kernel_run run;
+		run.values.assign(fitted == KERNEL_PLANE ? 3 * count : count, 0.0);
+		const std::uint64_t allocations = mchtr_allocations::of_thread();
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t n = 0; n < count; ++n) {
+			const mchtr_geometry::point3* points = neighbourhoods.data() + n * k;
+			if (fitted == KERNEL_PLANE) {
+				const mchtr_geometry::plane3 plane = mchtr_kernels::fit_plane<T>(points, k, fixed);
+				std::copy(plane.normal, plane.normal + 3, run.values.begin() + 3 * n);
+				continue;
+			}
+			mchtr_sgd::sphere sphere{ 0, 0, 0, 0 };
+			if (fitted == KERNEL_SGD) {
+				int epochs = 0;
+				sphere = mchtr_kernels::fit_sphere_sgd<T>(points, k, mchtr_sgd::init_sphere(points[0], mchtr_sgd::init_coord_offset, mchtr_sgd::init_radius),
+					stopping, epochs, fixed);
+			}
+			else if (mchtr_kernels::fit_sphere_algebraic<T>(points, k, sphere, fixed) && fitted == KERNEL_ALGEBRAIC_REFINED) {
+				mchtr_kernels::refine_sphere<T>(points, k, sphere, fixed);
+			}
+			run.values[n] = 1.0 / sphere.r;
+		}
+		run.seconds = seconds_since(start);
+		run.allocations = mchtr_allocations::of_thread() - allocations;
+		return run;
+	}
+
+	std::pair<double, double> kernel_difference(int fitted, const kernel_run& run, const kernel_run& reference) {
+		/*
+		@param		fitted - one of kernel
+					run, reference - runs of the kernel on the same neighbourhoods
+		@return		largest difference to the reference (of curvature, or 1 - |cos| of the angle between normals) over fits finite in both,
+					and the number of fits finite in only one of them
+		*/
+		double largest = 0;
+		double failures = 0;
+		if (fitted == KERNEL_PLANE) {
+			for (std::size_t i = 0; i < run.values.size(); i += 3) {
+				const double cosine = run.values[i] * reference.values[i] + run.values[i + 1] * reference.values[i + 1] + run.values[i + 2] * reference.values[i + 2];
+				largest = std::max(largest, 1 - std::fabs(cosine));
+			}
+			return { largest, failures };
+		}
+		for (std::size_t i = 0; i < run.values.size(); ++i) {
+			const bool finite = std::isfinite(run.values[i]);
+			if (finite != std::isfinite(reference.values[i])) {
+				++failures;
+			}
+			else if (finite) {
+				largest = std::max(largest, std::fabs(run.values[i] - reference.values[i]));
+			}
+		}
+		return { largest, failures };
+	}
+
+	void print_row(const row& result) {
+		std::printf("%-13s %-16s fit %d  K %3d  threads %2d  %8.0f pts/s", result.suite.c_str(), result.shape.c_str(), result.fit_method, result.k,
+			result.workers, result.points / result.seconds);
+		for (const auto& metric : result.metrics) {
+			std::printf("  %s %.4g", metric.first.c_str(), metric.second);
+		}
+		std::printf("\n");
+		std::fflush(stdout);
+	}
+
+	std::vector<std::pair<std::string, double>> curvature_errors(const mchtr_synthetic::cloud& truth, const std::vector<float>& curvatures) {
+		/*
+		Compares fitted curvatures with the ground truth on interior points.
+		@param		truth - synthetic cloud
+					curvatures - fitted curvatures (1 / radius, sign ignored)
+		@return		mean, RMS and 95th percentile of the absolute error, and the share of fits that came out non-finite
+		*/
+		std::vector<double> errors;
+		std::size_t compared = 0;
+		std::size_t failed = 0;
+		for (std::size_t i = 0; i < truth.size(); ++i) {
+			if (!truth.interior[i]) {
+				continue;
+			}
+			++compared;
+			const double fitted = std::fabs(static_cast<double>(curvatures[i]));
+			if (!std::isfinite(fitted)) {
+				++failed;
+				continue;
+			}
+			errors.push_back(std::fabs(fitted - truth.curvature[i]));
+		}
+		double sum = 0, squares = 0, percentile = 0;
+		for (double error : errors) {
+			sum += error;
+			squares += error * error;
+		}
+		if (!errors.empty()) {
+			const std::size_t rank = std::min(errors.size() - 1, static_cast<std::size_t>(0.95 * errors.size()));
+			std::nth_element(errors.begin(), errors.begin() + rank, errors.end());
+			percentile = errors[rank];
+		}
+		const double count = errors.empty() ? 1.0 : static_cast<double>(errors.size());
+		return {
+			{ "mean_abs_error", sum / count },
+			{ "rms_error", std::sqrt(squares / count) },
+			{ "p95_abs_error", percentile },
+			{ "non_finite", compared ? static_cast<double>(failed) / compared : 0.0 }
+		};
+	}
+
+	std::vector<std::pair<std::string, double>> segmentation_errors(const mchtr_synthetic::cloud& truth, const std::vector<float>& buildings, std::size_t found) {
+		/*
+		Compares building labels with the ground truth.
+		@param		truth - synthetic town
+					buildings - labels from the segmentation, 0 for points that are not roofs
+					found - number of buildings the segmentation found
+		@return		roof precision and recall, expected and found buildings, and buildings matched one to one
+					(a single label holds most of the building's roof points and is mostly made of them)
+		*/
+		std::size_t true_positives = 0, labelled = 0, roofs = 0;
+		std::map<float, std::map<float, std::size_t>> overlap;	// truth id -> label -> points
+		std::map<float, std::size_t> truth_sizes, label_sizes;
+		for (std::size_t i = 0; i < truth.size(); ++i) {
+			const bool is_roof = truth.building[i] != 0;
+			const bool is_labelled = buildings[i] != 0;
+			roofs += is_roof;
+			labelled += is_labelled;
+			true_positives += is_roof && is_labelled;
+			if (is_roof) {
+				++truth_sizes[truth.building[i]];
+			}
+			if (is_labelled) {
+				++label_sizes[buildings[i]];
+			}
+			if (is_roof && is_labelled) {
+				++overlap[truth.building[i]][buildings[i]];
+			}
+		}
+		std::size_t matched = 0;
+		for (const auto& building : overlap) {
+			for (const auto& label : building.second) {
+				if (2 * label.second > truth_sizes[building.first] && 10 * label.second >= 9 * label_sizes[label.first]) {
+					++matched;
+				}
+			}
+		}
+		return {
+			{ "roof_precision", labelled ? static_cast<double>(true_positives) / labelled : 0.0 },
+			{ "roof_recall", roofs ? static_cast<double>(true_positives) / roofs : 0.0 },
+			{ "expected", static_cast<double>(truth_sizes.size()) },
+			{ "found", static_cast<double>(found) },
+			{ "matched", static_cast<double>(matched) }
+		};
+	}
+
+	void write_csv(const std::string& path, const std::vector<row>& results) {
+		std::ofstream file(path, std::ios::binary);
+		file << "suite,shape,fit_method,k,threads,points,seconds,points_per_second,metric,value\n";
+		for (const row& result : results) {
+			for (const auto& metric : result.metrics) {
+				file << result.suite << ',' << result.shape << ',' << result.fit_method << ',' << result.k << ',' << result.workers << ','
+					<< result.points << ',' << result.seconds << ',' << result.points / result.seconds << ',' << metric.first << ',' << metric.second << '\n';
+			}
+		}
+		if (!file) {
+			throw std::runtime_error("cannot write " + path);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	mchtr_profile::thread_allocations = mchtr_allocations::of_thread;
+	bench_options settings;
+	for (int i = 1; i < argc; ++i) {
+		const std::string option = argv[i];
+		if (option == "--warm-start") {
+			settings.warm_start = true;
+			continue;
+		}
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		bool valid = value != nullptr;
+		if (valid && option == "--suite") {
+			settings.suite = value;
+			valid = settings.suite == "curvature" || settings.suite == "scales" || settings.suite == "kernels" || settings.suite == "incremental" || settings.suite == "segmentation" || settings.suite == "planes" ||
+				settings.suite == "crop" || settings.suite == "order" || settings.suite == "graph" || settings.suite == "neighbourhood" || settings.suite == "all";
+		}
+		else if (valid && option == "--points") {
+			settings.points = std::strtoul(value, nullptr, 10);
+			valid = settings.points > 0;
+		}
+		else if (valid && option == "--noise") {
+			valid = parse_float(value, settings.noise) && settings.noise >= 0;
+		}
+		else if (valid && option == "--fit-methods") {
+			valid = parse_list(value, settings.fit_methods);
+		}
+		else if (valid && option == "--k") {
+			valid = parse_list(value, settings.neighbours_counts);
+		}
+		else if (valid && option == "--threads") {
+			valid = parse_list(value, settings.threads);
+		}
+		else if (valid && option == "--max-epochs") {
+			settings.max_epochs = std::atoi(value);
+			valid = settings.max_epochs > 0;
+		}
+		else if (valid && option == "--tolerance") {
+			valid = parse_float(value, settings.tolerance) && settings.tolerance >= 0;
+		}
+		else if (valid && option == "--sampling") {
+			settings.lod.sampling = std::atoi(value);
+		}
+		else if (valid && option == "--spacing") {
+			valid = parse_float(value, settings.lod.spacing);
+		}
+		else if (valid && option == "--refine-threshold") {
+			valid = parse_float(value, settings.lod.refine_threshold);
+		}
+		else if (valid && option == "--buildings") {
+			settings.buildings = std::atoi(value);
+			valid = settings.buildings > 0;
+		}
+		else if (valid && option == "--slope") {
+			valid = parse_float(value, settings.slope);
+		}
+		else if (valid && option == "--csv") {
+			settings.csv_path = value;
+		}
+		else {
+			valid = false;
+		}
+		if (!valid) {
+			std::fprintf(stderr, "unknown or invalid option %s\n", option.c_str());
+			print_usage();
+			return 2;
+		}
+		++i;
+	}
+	const wchar_t* error = mchtr_lod::validate(settings.lod);
+	if (error) {
+		std::fprintf(stderr, "%ls\n", error);
+		return 2;
+	}
+
+	try {
+		std::vector<row> results;
+
+		// curvature: every fit method, K and thread count on every shape
+		if (settings.suite == "curvature" || settings.suite == "all") {
+			const std::vector<shape> shapes = {
+				{ "sphere_r0.5", mchtr_synthetic::sphere(settings.points, 0.5f, settings.noise, 1) },
+				{ "sphere_r1", mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2) },
+				{ "sphere_r2", mchtr_synthetic::sphere(settings.points, 2.0f, settings.noise, 3) },
+				{ "sphere_r5", mchtr_synthetic::sphere(settings.points, 5.0f, settings.noise, 4) },
+				{ "cylinder_r1", mchtr_synthetic::cylinder(settings.points, 1.0f, 4.0f, settings.noise, 5) },
+				{ "plane", mchtr_synthetic::plane(settings.points, 4.0f, settings.noise, 6) },
+				{ "saddle_a2", mchtr_synthetic::saddle(settings.points, 2.0f, 2.0f, settings.noise, 7) }
+			};
+			std::vector<float> curvatures;
+			for (const shape& cloud : shapes) {
+				curvatures.assign(cloud.points.size(), 0.0f);
+				for (int fit_method : settings.fit_methods) {
+					for (int k : settings.neighbours_counts) {
+						for (int threads : settings.threads) {
+							mchtr_curvature::options options;
+							options.neighbours_count = k;
+							options.fit_method = fit_method;
+							options.threads = threads;
+							options.max_epochs = settings.max_epochs;
+							options.tolerance = settings.tolerance;
+							options.warm_start = settings.warm_start;
+							const auto start = std::chrono::steady_clock::now();
+							const mchtr_lod::run_stats stats = mchtr_lod::compute_curvature(cloud.points.xyz.data(), cloud.points.size(), settings.lod, options,
+								[](int) {}, [](std::size_t) {}, curvatures.data());
+							const mchtr_curvature::run_info& info = stats.fitting;
+							const double seconds = seconds_since(start);
+							results.push_back(row{ "curvature", cloud.name, fit_method, k, info.workers, cloud.points.size(), seconds,
+								curvature_errors(cloud.points, curvatures) });
+							if (info.sgd_fits > 0) {
+								results.back().metrics.emplace_back("mean_epochs", static_cast<double>(info.sgd_epochs) / info.sgd_fits);
+							}
+							results.back().metrics.emplace_back("allocations_per_point", static_cast<double>(info.allocations) / cloud.points.size());
+							if (settings.lod.sampling != mchtr_lod::SAMPLING_ALL) {
+								results.back().metrics.emplace_back("seeds", static_cast<double>(stats.seeds));
+								results.back().metrics.emplace_back("refined", static_cast<double>(stats.refined));
+							}
+							print_row(results.back());
+						}
+					}
+				}
+			}
+		}
+
+		// multi-scale curvature: every K of --k at once (one query for the largest K per point) against a run per K,
+		// the curvatures must come out the same
+		if (settings.suite == "scales" || settings.suite == "all") {
+			const mchtr_synthetic::cloud sphere = mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2);
+			const std::size_t points_count = sphere.size();
+			const std::vector<int>& scales = settings.neighbours_counts;
+			std::vector<std::vector<float>> separate(scales.size(), std::vector<float>(points_count)), combined = separate;
+			std::vector<float*> outputs;
+			for (std::vector<float>& values : combined) {
+				outputs.push_back(values.data());
+			}
+			for (int fit_method : settings.fit_methods) {
+				for (int threads : settings.threads) {
+					mchtr_curvature::options options;
+					options.fit_method = fit_method;
+					options.threads = threads;
+					options.max_epochs = settings.max_epochs;
+					options.tolerance = settings.tolerance;
+					options.warm_start = settings.warm_start;
+					auto start = std::chrono::steady_clock::now();
+					for (std::size_t scale = 0; scale < scales.size(); ++scale) {
+						options.neighbours_count = scales[scale];
+						mchtr_curvature::compute(sphere.xyz.data(), points_count, options, [](std::size_t) {}, separate[scale].data());
+					}
+					const double separate_seconds = seconds_since(start);
+					start = std::chrono::steady_clock::now();
+					const mchtr_curvature::run_info info = mchtr_curvature::compute_scales(sphere.xyz.data(), points_count, scales, options, [](std::size_t) {},
+						outputs.data());
+					const double seconds = seconds_since(start);
+					std::size_t mismatches = 0;
+					for (std::size_t scale = 0; scale < scales.size(); ++scale) {
+						for (std::size_t i = 0; i < points_count; ++i) {
+							mismatches += std::memcmp(&separate[scale][i], &combined[scale][i], sizeof(float)) != 0;
+						}
+					}
+					results.push_back(row{ "scales", "sphere_r1", fit_method, *std::max_element(scales.begin(), scales.end()), info.workers, points_count, seconds,
+						{ { "scales", static_cast<double>(scales.size()) }, { "mismatches", static_cast<double>(mismatches) },
+						{ "speedup_over_separate", separate_seconds / seconds } } });
+					print_row(results.back());
+				}
+			}
+		}
+
+		// fitting kernels: every kernel on the K nearest neighbourhoods of the unit sphere's points, in float and double, through the compile time
+		// specialisation for K (if there is one) and the runtime K path, compared with the double kernel the curvature runs use
+		if (settings.suite == "kernels" || settings.suite == "all") {
+			const mchtr_synthetic::cloud sphere = mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2);
+			mchtr_kdtree::kdtree tree;
+			tree.build(sphere.xyz.data(), sphere.size());
+			mchtr_sgd::convergence stopping;
+			stopping.max_epochs = settings.max_epochs;
+			stopping.tolerance = settings.tolerance;
+			const char* kernel_names[4] = { "sgd", "algebraic", "refined", "plane" };
+			for (int k : settings.neighbours_counts) {
+				if (k < 1 || static_cast<std::size_t>(k) > sphere.size()) {
+					continue;
+				}
+				std::vector<mchtr_kdtree::neighbour> neighbours(k);
+				std::vector<mchtr_geometry::point3> neighbourhoods;
+				neighbourhoods.reserve(sphere.size() * k);
+				for (std::size_t i = 0; i < sphere.size(); ++i) {
+					tree.knn(sphere.xyz[3 * i], sphere.xyz[3 * i + 1], sphere.xyz[3 * i + 2], k, neighbours.data());
+					for (const mchtr_kdtree::neighbour& neighbour : neighbours) {
+						neighbourhoods.emplace_back(neighbour.x, neighbour.y, neighbour.z);
+					}
+				}
+				const bool specialised = mchtr_kernels::is_fixed_size(k);
+				for (int fitted = KERNEL_SGD; fitted <= KERNEL_PLANE; ++fitted) {
+					const kernel_run reference = run_kernel<double>(fitted, neighbourhoods, k, true, stopping);
+					for (int single = 1; single >= 0; --single) {
+						const kernel_run runtime = single ? run_kernel<float>(fitted, neighbourhoods, k, false, stopping) :
+							run_kernel<double>(fitted, neighbourhoods, k, false, stopping);
+						for (int fixed = 0; fixed <= (specialised ? 1 : 0); ++fixed) {
+							const kernel_run run = !fixed ? runtime : single ? run_kernel<float>(fitted, neighbourhoods, k, true, stopping) :
+								run_kernel<double>(fitted, neighbourhoods, k, true, stopping);
+							const std::pair<double, double> difference = kernel_difference(fitted, run, reference);
+							results.push_back(row{ "kernels", std::string(kernel_names[fitted]) + (single ? "_float" : "_double") + (fixed ? "_fixed" : "_runtime"),
+								fitted == KERNEL_PLANE ? -1 : fitted, k, 1, sphere.size(), run.seconds,
+								{ { "allocations_per_point", static_cast<double>(run.allocations) / sphere.size() }, { "max_difference", difference.first },
+								{ "failures", difference.second } } });
+							if (fixed) {
+								results.back().metrics.emplace_back("speedup_over_runtime", runtime.seconds / run.seconds);
+							}
+							print_row(results.back());
+						}
+					}
+				}
+			}
+		}
+
+		// incremental curvature: a cap of the unit sphere is deleted after a full run, the incremental run is timed
+		// and compared with a full run over the remaining points
+		if (settings.suite == "incremental" || settings.suite == "all") {
+			const mchtr_synthetic::cloud sphere = mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2);
+			const std::size_t points_count = sphere.size();
+			const std::vector<unsigned char> all(points_count, 1);
+			std::vector<unsigned char> cut(points_count, 1);
+			for (std::size_t i = 0; i < points_count; ++i) {
+				cut[i] = sphere.xyz[3 * i] <= 0.5f;
+			}
+			std::vector<float> curvatures(points_count, 0.0f);
+			std::vector<float> reference(points_count, 0.0f);
+			for (int fit_method : settings.fit_methods) {
+				for (int k : settings.neighbours_counts) {
+					for (int threads : settings.threads) {
+						mchtr_curvature::options options;
+						options.neighbours_count = k;
+						options.fit_method = fit_method;
+						options.threads = threads;
+						options.max_epochs = settings.max_epochs;
+						options.tolerance = settings.tolerance;
+						options.warm_start = settings.warm_start;
+						mchtr_incremental::snapshot last;
+						mchtr_incremental::compute_curvature(last, sphere.xyz.data(), all.data(), points_count, options, [](std::size_t) {}, curvatures.data());
+						auto start = std::chrono::steady_clock::now();
+						const mchtr_incremental::run_stats stats = mchtr_incremental::compute_curvature(last, sphere.xyz.data(), cut.data(), points_count, options,
+							[](std::size_t) {}, curvatures.data());
+						const double seconds = seconds_since(start);
+						mchtr_incremental::snapshot fresh;
+						start = std::chrono::steady_clock::now();
+						mchtr_incremental::compute_curvature(fresh, sphere.xyz.data(), cut.data(), points_count, options, [](std::size_t) {}, reference.data());
+						const double full_seconds = seconds_since(start);
+						double max_difference = 0;
+						for (std::size_t i = 0; i < points_count; ++i) {
+							if (cut[i] && std::isfinite(reference[i])) {
+								max_difference = std::max(max_difference, static_cast<double>(std::fabs(curvatures[i] - reference[i])));
+							}
+						}
+						results.push_back(row{ "incremental", "sphere_r1_cut", fit_method, k, stats.fitting.workers, points_count, seconds,
+							{ { "changed", static_cast<double>(stats.changed) }, { "recomputed", static_cast<double>(stats.recomputed) },
+							{ "max_difference", max_difference }, { "speedup", seconds > 0 ? full_seconds / seconds : 0 } } });
+						print_row(results.back());
+					}
+				}
+			}
+		}
+
+		// segmentation: the box town for every thread count, with the plugin's neighbour counts, refitting the smoothed cloud for the roof test,
+		// with the fused geometry stage ("town_fused"), with batched plane fits ("town_batched") and with buffered (parallel) smoothing, one pass
+		// ("town_buffered") and two ("town_buffered_x2")
+		if (settings.suite == "segmentation" || settings.suite == "all") {
+			const mchtr_synthetic::cloud town = mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 8);
+			std::vector<float> coordinates;
+			std::vector<float> buildings;
+			std::vector<mchtr_segmentation::surface> surfaces;
+			const char* variant_names[5] = { "town", "town_fused", "town_batched", "town_buffered", "town_buffered_x2" };
+			for (int threads : settings.threads) {
+				for (int variant = 0; variant < 5; ++variant) {
+					mchtr_segmentation::options options;
+					options.threads = threads;
+					options.fused_geometry = variant == 1;
+					options.batched_planes = variant == 2;
+					options.buffered_smoothing = variant >= 3;
+					options.smoothing_iterations = variant == 4 ? 2 : 1;
+					coordinates = town.xyz;
+					mchtr_knn_graph::graph knn_graph;
+					const auto start = std::chrono::steady_clock::now();
+					const std::size_t found = mchtr_segmentation::segment_buildings(coordinates.data(), town.size(), options, knn_graph, [](int) {},
+						[](std::size_t) {}, buildings, surfaces);
+					const double seconds = seconds_since(start);
+					results.push_back(row{ "segmentation", variant_names[variant], -1, options.neighbours_count, mchtr_parallel::resolve_threads(threads),
+						town.size(), seconds, segmentation_errors(town, buildings, found) });
+					print_row(results.back());
+				}
+			}
+		}
+
+		// plane fits: the K nearest neighbourhoods of the town's and the unit sphere's points, one by one with the Jacobi solver the segmentation
+		// uses by default, and batched (SIMD moments, closed-form eigensolver) with every instruction set the CPU has, compared with the former;
+		// the SDK's CalcBestPlane3D, which the plugin called before, isn't available outside FRAMES3D, the Jacobi fit replaced it there
+		// (least squares plane through the centroid, normal to the smallest principal axis, like sdk_shim's stand-in) and stands in for it here
+		if (settings.suite == "planes" || settings.suite == "all") {
+			const std::vector<shape> shapes = {
+				{ "town", mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 8) },
+				{ "sphere_r1", mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2) }
+			};
+			const mchtr_batch::isa widest = mchtr_batch::detect_isa();
+			const char* isa_names[3] = { "scalar", "avx2", "avx512" };
+			for (const shape& cloud : shapes) {
+				const std::size_t points_count = cloud.points.size();
+				mchtr_kdtree::kdtree tree;
+				tree.build(cloud.points.xyz.data(), points_count);
+				for (int k : settings.neighbours_counts) {
+					if (k < 3 || static_cast<std::size_t>(k) > points_count) {
+						continue;
+					}
+					std::vector<mchtr_kdtree::neighbour> neighbours(k);
+					std::vector<mchtr_geometry::point3> neighbourhoods;
+					neighbourhoods.reserve(points_count * k);
+					for (std::size_t i = 0; i < points_count; ++i) {
+						tree.knn(cloud.points.xyz[3 * i], cloud.points.xyz[3 * i + 1], cloud.points.xyz[3 * i + 2], k, neighbours.data());
+						for (const mchtr_kdtree::neighbour& neighbour : neighbours) {
+							neighbourhoods.emplace_back(neighbour.x, neighbour.y, neighbour.z);
+						}
+					}
+					std::vector<mchtr_geometry::local_geometry> reference(points_count), batched(points_count);
+					auto start = std::chrono::steady_clock::now();
+					for (std::size_t i = 0; i < points_count; ++i) {
+						reference[i] = mchtr_geometry::fit_local_geometry(neighbourhoods.data() + i * k, k);
+					}
+					const double jacobi_seconds = seconds_since(start);
+					results.push_back(row{ "planes", cloud.name + "_jacobi", -1, k, 1, points_count, jacobi_seconds, {} });
+					print_row(results.back());
+
+					for (int instruction_set = mchtr_batch::ISA_SCALAR; instruction_set <= widest; ++instruction_set) {
+						mchtr_batch::neighbourhood_batch batch;
+						std::vector<mchtr_geometry::point3> points(k);
+						mchtr_geometry::point3 central_points[mchtr_batch::max_lanes];
+						start = std::chrono::steady_clock::now();
+						for (std::size_t begin = 0; begin < points_count; begin += mchtr_batch::max_lanes) {
+							batch.reset(k);
+							const std::size_t end = std::min(points_count, begin + mchtr_batch::max_lanes);
+							for (std::size_t i = begin; i < end; ++i) {
+								std::copy(neighbourhoods.begin() + i * k, neighbourhoods.begin() + (i + 1) * k, points.begin());
+								central_points[i - begin] = mchtr_geometry::point3(cloud.points.xyz[3 * i], cloud.points.xyz[3 * i + 1], cloud.points.xyz[3 * i + 2]);
+								batch.add(points, central_points[i - begin], static_cast<int>(i - begin));
+							}
+							batch.pad();
+							mchtr_planes::fit_planes(batch, central_points, static_cast<mchtr_batch::isa>(instruction_set), batched.data() + begin);
+						}
+						const double seconds = seconds_since(start);
+
+						// normals are compared up to their sign, offsets with the sign of the reference normal
+						double max_angle = 0, max_offset_difference = 0, max_variation_difference = 0;
+						std::size_t mismatches = 0;
+						for (std::size_t i = 0; i < points_count; ++i) {
+							const mchtr_geometry::plane3& expected = reference[i].plane;
+							const mchtr_geometry::plane3& fitted = batched[i].plane;
+							const double cosine = expected.normal[0] * fitted.normal[0] + expected.normal[1] * fitted.normal[1] + expected.normal[2] * fitted.normal[2];
+							const double angle = std::acos(std::min(1.0, std::fabs(cosine)));
+							const double offset_difference = std::fabs(expected.offset - (cosine < 0 ? -fitted.offset : fitted.offset));
+							max_angle = std::max(max_angle, angle);
+							max_offset_difference = std::max(max_offset_difference, offset_difference);
+							max_variation_difference = std::max(max_variation_difference, std::fabs(reference[i].surface_variation - batched[i].surface_variation));
+							mismatches += !(angle <= plane_angle_tolerance);
+						}
+						results.push_back(row{ "planes", cloud.name + "_closed_form_" + isa_names[instruction_set], -1, k, 1, points_count, seconds,
+							{ { "max_angle", max_angle }, { "max_offset_difference", max_offset_difference }, { "max_variation_difference", max_variation_difference },
+							{ "mismatches", static_cast<double>(mismatches) }, { "speedup_over_jacobi", jacobi_seconds / seconds } } });
+						print_row(results.back());
+					}
+				}
+			}
+		}
+
+		// cropping: a sphere, a cylinder and a box around the town's centre, point by point and with block bounds, on the town in random
+		// and in scan order (strips along X), all checked against the scalar kernel
+		if (settings.suite == "crop" || settings.suite == "all") {
+			const mchtr_synthetic::cloud town = mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 9);
+			const std::size_t points_count = town.size();
+			float low[3] = { town.xyz[0], town.xyz[1], town.xyz[2] };
+			float high[3] = { town.xyz[0], town.xyz[1], town.xyz[2] };
+			for (std::size_t i = 0; i < points_count; ++i) {
+				for (int axis = 0; axis < 3; ++axis) {
+					low[axis] = std::min(low[axis], town.xyz[3 * i + axis]);
+					high[axis] = std::max(high[axis], town.xyz[3 * i + axis]);
+				}
+			}
+			const double reach = std::max(1.0, 0.3 * std::max(high[0] - low[0], high[1] - low[1]));
+			std::vector<mchtr_crop::region> regions(3);
+			const char* region_names[3] = { "sphere", "cylinder", "box" };
+			for (int shape = 0; shape < 3; ++shape) {
+				regions[shape].shape = shape;
+				for (int axis = 0; axis < 3; ++axis) {
+					regions[shape].centre[axis] = 0.5 * (static_cast<double>(low[axis]) + high[axis]);
+					regions[shape].half_size[axis] = axis == 2 ? 0.5 * (high[2] - low[2]) : reach;
+				}
+				regions[shape].radius = reach;
+			}
+
+			// scan order: 256 strips along X, points of a strip sorted by X
+			const float strip = std::max(1e-6f, (high[1] - low[1]) / 256);
+			std::vector<std::size_t> order(points_count);
+			for (std::size_t i = 0; i < points_count; ++i) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+				const int strip_a = static_cast<int>((town.xyz[3 * a + 1] - low[1]) / strip);
+				const int strip_b = static_cast<int>((town.xyz[3 * b + 1] - low[1]) / strip);
+				return strip_a < strip_b || (strip_a == strip_b && town.xyz[3 * a] < town.xyz[3 * b]);
+			});
+			std::vector<float> scanned(3 * points_count);
+			for (std::size_t i = 0; i < points_count; ++i) {
+				std::copy(town.xyz.begin() + 3 * order[i], town.xyz.begin() + 3 * order[i] + 3, scanned.begin() + 3 * i);
+			}
+
+			std::vector<unsigned char> reference(points_count), outside(points_count);
+			for (int scan_order = 0; scan_order < 2; ++scan_order) {
+				const float* xyz = scan_order ? scanned.data() : town.xyz.data();
+				auto start = std::chrono::steady_clock::now();
+				mchtr_crop::blocks index;
+				index.build(xyz, points_count, 0, 0);
+				const double build_seconds = seconds_since(start);
+				for (int shape = 0; shape < 3; ++shape) {
+					mchtr_crop::classify_scalar(xyz, points_count, regions[shape], reference.data());
+					for (int threads : settings.threads) {
+						for (int use_blocks = 0; use_blocks < 2; ++use_blocks) {
+							std::fill(outside.begin(), outside.end(), 2);
+							start = std::chrono::steady_clock::now();
+							const mchtr_crop::run_stats stats = use_blocks ? mchtr_crop::crop(index, xyz, regions[shape], threads, [](std::size_t) {}, outside.data()) :
+								mchtr_crop::crop(xyz, points_count, regions[shape], threads, [](std::size_t) {}, outside.data());
+							const double seconds = seconds_since(start);
+							std::size_t mismatches = 0;
+							for (std::size_t i = 0; i < points_count; ++i) {
+								mismatches += outside[i] != reference[i];
+							}
+							results.push_back(row{ "crop", std::string(scan_order ? "town_scan_" : "town_") + region_names[shape] + (use_blocks ? "_blocks" : ""), -1, 0,
+								stats.workers, points_count, seconds, { { "outside", static_cast<double>(stats.outside) }, { "mismatches", static_cast<double>(mismatches) } } });
+							if (use_blocks) {
+								results.back().metrics.emplace_back("build_seconds", build_seconds);
+								results.back().metrics.emplace_back("blocks_whole", static_cast<double>(stats.blocks_inside + stats.blocks_outside));
+								results.back().metrics.emplace_back("blocks_split", static_cast<double>(stats.blocks_split));
+							}
+							print_row(results.back());
+						}
+					}
+				}
+			}
+		}
+
+		// point ordering: curvature of the unit sphere and segmentation of the town (both generated in random order) processed in storage order
+		// and along the Morton and Hilbert curves; without warm starts the curvatures must come out the same in every order
+		if (settings.suite == "order" || settings.suite == "all") {
+			const mchtr_synthetic::cloud sphere = mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2);
+			const std::size_t points_count = sphere.size();
+			const char* order_names[3] = { "storage", "morton", "hilbert" };
+			std::vector<float> reference(points_count), curvatures(points_count);
+			for (int fit_method : settings.fit_methods) {
+				for (int k : settings.neighbours_counts) {
+					for (int threads : settings.threads) {
+						double storage_seconds = 0;
+						for (int order = mchtr_order::ORDER_STORAGE; order <= mchtr_order::ORDER_HILBERT; ++order) {
+							mchtr_curvature::options options;
+							options.neighbours_count = k;
+							options.fit_method = fit_method;
+							options.threads = threads;
+							options.max_epochs = settings.max_epochs;
+							options.tolerance = settings.tolerance;
+							options.warm_start = settings.warm_start;
+							options.order = order;
+							std::vector<float>& output = order == mchtr_order::ORDER_STORAGE ? reference : curvatures;
+							const auto start = std::chrono::steady_clock::now();
+							const mchtr_curvature::run_info info = mchtr_curvature::compute(sphere.xyz.data(), points_count, options, [](std::size_t) {}, output.data());
+							const double seconds = seconds_since(start);
+							if (order == mchtr_order::ORDER_STORAGE) {
+								storage_seconds = seconds;
+							}
+							results.push_back(row{ "order", std::string("sphere_r1_") + order_names[order], fit_method, k, info.workers, points_count, seconds,
+								curvature_errors(sphere, output) });
+							results.back().metrics.emplace_back("speedup_over_storage", storage_seconds / seconds);
+							if (!settings.warm_start) {
+								std::size_t mismatches = 0;
+								for (std::size_t i = 0; i < points_count; ++i) {
+									mismatches += std::memcmp(&reference[i], &output[i], sizeof(float)) != 0;
+								}
+								results.back().metrics.emplace_back("mismatches", static_cast<double>(mismatches));
+							}
+							if (info.sgd_fits > 0) {
+								const double mean_epochs = static_cast<double>(info.sgd_epochs) / info.sgd_fits;
+								results.back().metrics.emplace_back("mean_epochs", mean_epochs);
+
+								// warm started runs also report the epochs a cold run of the same order takes and the share warm starts saved
+								if (settings.warm_start) {
+									options.warm_start = false;
+									const mchtr_curvature::run_info cold = mchtr_curvature::compute(sphere.xyz.data(), points_count, options, [](std::size_t) {}, curvatures.data());
+									const double cold_epochs = static_cast<double>(cold.sgd_epochs) / cold.sgd_fits;
+									results.back().metrics.emplace_back("cold_mean_epochs", cold_epochs);
+									results.back().metrics.emplace_back("epoch_reduction", 1.0 - mean_epochs / cold_epochs);
+								}
+							}
+							print_row(results.back());
+						}
+					}
+				}
+			}
+
+			const mchtr_synthetic::cloud town = mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 8);
+			std::vector<float> coordinates;
+			std::vector<float> buildings;
+			std::vector<mchtr_segmentation::surface> surfaces;
+			for (int threads : settings.threads) {
+				double storage_seconds = 0;
+				for (int order = mchtr_order::ORDER_STORAGE; order <= mchtr_order::ORDER_HILBERT; ++order) {
+					mchtr_segmentation::options options;
+					options.threads = threads;
+					options.order = order;
+					coordinates = town.xyz;
+					mchtr_knn_graph::graph knn_graph;
+					const auto start = std::chrono::steady_clock::now();
+					const std::size_t found = mchtr_segmentation::segment_buildings(coordinates.data(), town.size(), options, knn_graph, [](int) {},
+						[](std::size_t) {}, buildings, surfaces);
+					const double seconds = seconds_since(start);
+					if (order == mchtr_order::ORDER_STORAGE) {
+						storage_seconds = seconds;
+					}
+					results.push_back(row{ "order", std::string("town_") + order_names[order], -1, options.neighbours_count, mchtr_parallel::resolve_threads(threads),
+						town.size(), seconds, segmentation_errors(town, buildings, found) });
+					results.back().metrics.emplace_back("speedup_over_storage", storage_seconds / seconds);
+					print_row(results.back());
+				}
+			}
+		}
+
+		// KNN graphs of the town and the unit sphere (both generated in random order), uncompressed and compressed: memory per point,
+		// build time and the time to read every row, and rows read back differently from the uncompressed graph (mismatches, expected 0)
+		if (settings.suite == "graph" || settings.suite == "all") {
+			const std::vector<shape> shapes = {
+				{ "town", mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 8) },
+				{ "sphere_r1", mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2) }
+			};
+			for (const shape& cloud : shapes) {
+				const std::size_t points_count = cloud.points.size();
+				const std::uint64_t fingerprint = mchtr_knn_graph::fingerprint_of(cloud.points.xyz.data(), points_count);
+				for (int k : settings.neighbours_counts) {
+					for (int threads : settings.threads) {
+						mchtr_knn_graph::graph graphs[2];
+						double build_seconds[2] = { 0, 0 };
+						double read_seconds[2] = { 0, 0 };
+						std::size_t checksums[2] = { 0, 0 };
+						std::vector<std::uint32_t> scratch(k + mchtr_graph_codec::decode_slack);
+						for (int compressed = 0; compressed < 2; ++compressed) {
+							graphs[compressed].compress = compressed == 1;
+							auto start = std::chrono::steady_clock::now();
+							mchtr_knn_graph::build(graphs[compressed], cloud.points.xyz.data(), points_count, k, fingerprint, threads, [](std::size_t) {}, nullptr);
+							build_seconds[compressed] = seconds_since(start);
+
+							// one pass over all rows, like the plane fits and the union-find make
+							start = std::chrono::steady_clock::now();
+							for (std::size_t i = 0; i < points_count; ++i) {
+								std::size_t count = 0;
+								const std::uint32_t* neighbours = graphs[compressed].read_row(i, k, scratch.data(), count);
+								for (std::size_t j = 0; j < count; ++j) {
+									checksums[compressed] += neighbours[j];
+								}
+							}
+							read_seconds[compressed] = seconds_since(start);
+						}
+						std::size_t mismatches = 0;
+						std::vector<std::uint32_t> decoded(k + mchtr_graph_codec::decode_slack);
+						for (std::size_t i = 0; i < points_count; ++i) {
+							std::size_t plain_count = 0, count = 0;
+							const std::uint32_t* plain = graphs[0].read_row(i, k, scratch.data(), plain_count);
+							const std::uint32_t* neighbours = graphs[1].read_row(i, k, decoded.data(), count);
+							mismatches += count != plain_count || !std::equal(plain, plain + count, neighbours);
+						}
+						for (int compressed = 0; compressed < 2; ++compressed) {
+							results.push_back(row{ "graph", cloud.name + (compressed ? "_compressed" : "_plain"), -1, k, mchtr_parallel::resolve_threads(threads),
+								points_count, build_seconds[compressed] + read_seconds[compressed], {
+									{ "bytes_per_point", static_cast<double>(graphs[compressed].bytes()) / points_count },
+									{ "memory_ratio", static_cast<double>(graphs[compressed].bytes()) / graphs[0].bytes() },
+									{ "build_seconds", build_seconds[compressed] },
+									{ "read_seconds", read_seconds[compressed] } } });
+							if (compressed) {
+								results.back().metrics.emplace_back("mismatches", static_cast<double>(mismatches + (checksums[0] != checksums[1])));
+							}
+							print_row(results.back());
+						}
+					}
+				}
+			}
+		}
+
+		// fixed radius neighbourhoods from the voxel grid against K nearest neighbours from the kd-tree: index build and query time of every point
+		// and the mean neighbourhood size, then curvature of the unit sphere and segmentation of the town with either; the radius is the mean
+		// distance to the K-th neighbour, so neighbourhoods are about as large on average (capped at 2K for curvature, at each K for segmentation)
+		if (settings.suite == "neighbourhood" || settings.suite == "all") {
+			const std::vector<shape> shapes = {
+				{ "town", mchtr_synthetic::town(settings.points, settings.buildings, settings.slope, settings.noise, 8) },
+				{ "sphere_r1", mchtr_synthetic::sphere(settings.points, 1.0f, settings.noise, 2) }
+			};
+			// mean distance to the K-th neighbour over every 16th point
+			auto mean_reach = [](const mchtr_kdtree::kdtree& tree, const float* xyz, std::size_t points_count, int k) {
+				std::vector<mchtr_kdtree::neighbour> found(k);
+				double sum = 0;
+				std::size_t samples = 0;
+				for (std::size_t i = 0; i < points_count; i += 16, ++samples) {
+					const std::size_t count = tree.knn(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], k, found.data());
+					sum += count ? std::sqrt(found[count - 1].distance_squared) : 0.0;
+				}
+				return static_cast<float>(sum / std::max<std::size_t>(samples, 1));
+			};
+			for (const shape& cloud : shapes) {
+				const std::size_t points_count = cloud.points.size();
+				const float* xyz = cloud.points.xyz.data();
+				for (int k : settings.neighbours_counts) {
+					auto start = std::chrono::steady_clock::now();
+					mchtr_kdtree::kdtree tree;
+					tree.build(xyz, points_count);
+					const double tree_seconds = seconds_since(start);
+					const float radius = mean_reach(tree, xyz, points_count, k);
+					const int cap = 2 * k;
+					const int min_points = std::min(8, k);
+
+					start = std::chrono::steady_clock::now();
+					mchtr_voxel_grid::grid grid;
+					if (!grid.build(xyz, points_count, radius)) {
+						throw std::runtime_error("neighbourhood radius too small for the bench cloud");
+					}
+					const double grid_seconds = seconds_since(start);
+
+					std::vector<mchtr_kdtree::neighbour> found(cap);
+					std::size_t tree_neighbours = 0, tree_visited = 0;
+					start = std::chrono::steady_clock::now();
+					for (std::size_t i = 0; i < points_count; ++i) {
+						std::size_t visited = 0;
+						tree_neighbours += tree.knn(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], k, found.data(), &visited);
+						tree_visited += visited;
+					}
+					const double tree_query_seconds = seconds_since(start);
+					std::size_t grid_neighbours = 0, grid_visited = 0, fallbacks = 0;
+					start = std::chrono::steady_clock::now();
+					for (std::size_t i = 0; i < points_count; ++i) {
+						std::size_t visited = 0;
+						const std::size_t count = grid.query(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], radius, cap, min_points, found.data(), &visited);
+						grid_neighbours += count;
+						grid_visited += visited;
+						fallbacks += count > 0 && found[count - 1].distance_squared > radius * radius;
+					}
+					const double grid_query_seconds = seconds_since(start);
+
+					results.push_back(row{ "neighbourhood", cloud.name + "_knn", -1, k, 1, points_count, tree_seconds + tree_query_seconds, {
+						{ "build_seconds", tree_seconds },
+						{ "query_seconds", tree_query_seconds },
+						{ "mean_neighbours", static_cast<double>(tree_neighbours) / points_count },
+						{ "mean_visited", static_cast<double>(tree_visited) / points_count } } });
+					print_row(results.back());
+					results.push_back(row{ "neighbourhood", cloud.name + "_radius", -1, k, 1, points_count, grid_seconds + grid_query_seconds, {
+						{ "radius", radius },
+						{ "build_seconds", grid_seconds },
+						{ "query_seconds", grid_query_seconds },
+						{ "mean_neighbours", static_cast<double>(grid_neighbours) / points_count },
+						{ "mean_visited", static_cast<double>(grid_visited) / points_count },
+						{ "fallbacks", static_cast<double>(fallbacks) },
+						{ "bytes_per_point", static_cast<double>(grid.bytes()) / points_count },
+						{ "query_speedup", tree_query_seconds / grid_query_seconds } } });
+					print_row(results.back());
+
+					if (cloud.name != "sphere_r1") {
+						continue;
+					}
+					std::vector<float> curvatures(points_count);
+					for (int fit_method : settings.fit_methods) {
+						for (int threads : settings.threads) {
+							double knn_seconds = 0;
+							for (int mode = mchtr_voxel_grid::NEIGHBOURHOOD_KNN; mode <= mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS; ++mode) {
+								mchtr_curvature::options options;
+								options.neighbours_count = mode == mchtr_voxel_grid::NEIGHBOURHOOD_KNN ? k : cap;
+								options.fit_method = fit_method;
+								options.threads = threads;
+								options.max_epochs = settings.max_epochs;
+								options.tolerance = settings.tolerance;
+								options.warm_start = settings.warm_start;
+								options.neighbourhood.mode = mode;
+								options.neighbourhood.radius = radius;
+								options.neighbourhood.min_points = min_points;
+								start = std::chrono::steady_clock::now();
+								const mchtr_curvature::run_info info = mchtr_curvature::compute(xyz, points_count, options, [](std::size_t) {}, curvatures.data());
+								const double seconds = seconds_since(start);
+								if (mode == mchtr_voxel_grid::NEIGHBOURHOOD_KNN) {
+									knn_seconds = seconds;
+								}
+								results.push_back(row{ "neighbourhood", cloud.name + (mode == mchtr_voxel_grid::NEIGHBOURHOOD_KNN ? "_knn_fit" : "_radius_fit"), fit_method, k,
+									info.workers, points_count, seconds, curvature_errors(cloud.points, curvatures) });
+								results.back().metrics.emplace_back("speedup_over_knn", knn_seconds / seconds);
+								print_row(results.back());
+							}
+						}
+					}
+				}
+
+				if (cloud.name != "town") {
+					continue;
+				}
+				// segmentation with the radius of its larger K
+				mchtr_segmentation::options defaults;
+				const int k = std::max(defaults.neighbours_count, defaults.neighbours_count_segmentation);
+				mchtr_kdtree::kdtree tree;
+				tree.build(xyz, points_count);
+				const float radius = mean_reach(tree, xyz, points_count, k);
+				std::vector<float> coordinates;
+				std::vector<float> buildings;
+				std::vector<mchtr_segmentation::surface> surfaces;
+				for (int threads : settings.threads) {
+					double knn_seconds = 0;
+					for (int mode = mchtr_voxel_grid::NEIGHBOURHOOD_KNN; mode <= mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS; ++mode) {
+						mchtr_segmentation::options options;
+						options.threads = threads;
+						options.neighbourhood.mode = mode;
+						options.neighbourhood.radius = radius;
+						options.neighbourhood.min_points = std::min({ 8, options.neighbours_count, options.neighbours_count_segmentation });
+						coordinates = cloud.points.xyz;
+						mchtr_knn_graph::graph knn_graph;
+						const auto start = std::chrono::steady_clock::now();
+						const std::size_t found = mchtr_segmentation::segment_buildings(coordinates.data(), points_count, options, knn_graph, [](int) {},
+							[](std::size_t) {}, buildings, surfaces);
+						const double seconds = seconds_since(start);
+						if (mode == mchtr_voxel_grid::NEIGHBOURHOOD_KNN) {
+							knn_seconds = seconds;
+						}
+						results.push_back(row{ "neighbourhood", cloud.name + (mode == mchtr_voxel_grid::NEIGHBOURHOOD_KNN ? "_knn_segment" : "_radius_segment"), -1, k,
+							mchtr_parallel::resolve_threads(threads), points_count, seconds, segmentation_errors(cloud.points, buildings, found) });
+						results.back().metrics.emplace_back("speedup_over_knn", knn_seconds / seconds);
+						print_row(results.back());
+					}
+				}
+			}
+		}
+
+		if (!settings.csv_path.empty()) {
+			write_csv(settings.csv_path, results);
+		}
+
+		// equivalence checks (scales, planes, crop, order and graph rows) fail the run, so a regression fails scripts and CI
+		std::size_t failed_rows = 0;
+		for (const row& result : results) {
+			for (const std::pair<std::string, double>& metric : result.metrics) {
+				if (metric.first == "mismatches" && metric.second != 0) {
+					std::fprintf(stderr, "error: %s %s K %d: %.0f mismatches\n", result.suite.c_str(), result.shape.c_str(), result.k, metric.second);
+					++failed_rows;
+				}
+			}
+		}
+		if (failed_rows > 0) {
+			std::fprintf(stderr, "error: %zu rows report mismatches\n", failed_rows);
+			return 1;
+		}
+	}
+	catch (const std::exception& exception) {
+		std::fprintf(stderr, "error: %s\n", exception.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include "mchtr_allocations.h"
+#include <cstdlib>
+#include <new>
+
+/*
+Allocation counting for the benchmark: the global operator new is replaced with one that counts the allocations of every thread
+(the array forms and the sized delete call these), so the benchmark can check that per point paths don't allocate.
+Kept in its own file, so the replacements are never inlined into the code they count.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	thread_local std::uint64_t allocations_of_thread = 0;
+}
+
+std::uint64_t mchtr_allocations::of_thread() {
+	/*
+	@return		number of heap allocations the calling thread has made so far
+	*/
+	return allocations_of_thread;
+}
+
+void* operator new(std::size_t size) {
+	++allocations_of_thread;
+	if (void* memory = std::malloc(size ? size : 1)) {
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+	std::free(memory);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+Allocation counting for the benchmark: the global operator new is replaced with one that counts the allocations of every thread
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_allocations
+{
+	std::uint64_t of_thread();
+}
@@ -0,0 +1,241 @@
+#include "mchtr_synthetic.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+/*
+Synthetic point clouds with analytically known curvature and building footprints, for the benchmark
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	constexpr double pi = 3.14159265358979323846;
+
+	// a box building standing on the ground
+	struct box_building {
+		float min_x, max_x, min_y, max_y;
+		float height;
+	};
+
+	void add_point(mchtr_synthetic::cloud& points, double x, double y, double z, float curvature, bool interior, float building) {
+		points.xyz.push_back(static_cast<float>(x));
+		points.xyz.push_back(static_cast<float>(y));
+		points.xyz.push_back(static_cast<float>(z));
+		points.curvature.push_back(curvature);
+		points.interior.push_back(interior ? 1 : 0);
+		points.building.push_back(building);
+	}
+
+	void add_noise(mchtr_synthetic::cloud& points, float noise, std::mt19937& generator) {
+		/*
+		Moves every coordinate by gaussian noise, ground truth stays that of the noiseless surface.
+		@param		points - cloud to disturb
+					noise - standard deviation of the noise, 0 for none
+					generator - random numbers
+		*/
+		if (noise <= 0) {
+			return;
+		}
+		std::normal_distribution<float> gaussian(0.0f, noise);
+		for (float& coordinate : points.xyz) {
+			coordinate += gaussian(generator);
+		}
+	}
+}
+
+mchtr_synthetic::cloud mchtr_synthetic::sphere(std::size_t points_count, float radius, float noise, std::uint32_t seed) {
+	/*
+	@param		points_count - number of points
+				radius - radius of the sphere (centred at the origin), curvature is 1 / radius everywhere
+				noise - standard deviation of gaussian noise added to coordinates
+				seed - random seed
+	@return		points spread uniformly over the sphere
+	*/
+	std::mt19937 generator(seed);
+	std::normal_distribution<double> gaussian(0.0, 1.0);
+	mchtr_synthetic::cloud points;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		double x, y, z, length;
+		do {
+			x = gaussian(generator);
+			y = gaussian(generator);
+			z = gaussian(generator);
+			length = std::sqrt(x * x + y * y + z * z);
+		} while (length < 1e-9);
+		add_point(points, radius * x / length, radius * y / length, radius * z / length, 1.0f / radius, true, 0);
+	}
+	add_noise(points, noise, generator);
+	return points;
+}
+
+mchtr_synthetic::cloud mchtr_synthetic::cylinder(std::size_t points_count, float radius, float length, float noise, std::uint32_t seed) {
+	/*
+	@param		points_count - number of points
+				radius - radius of the cylinder (Z axis), mean curvature is 1 / (2 * radius) everywhere
+				length - length of the cylinder, centred at the origin
+				noise - standard deviation of gaussian noise added to coordinates
+				seed - random seed
+	@return		points spread uniformly over the cylinder's side, the tenth of the length at both ends is not interior
+	*/
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> angle(0.0, 2.0 * pi);
+	std::uniform_real_distribution<double> along(-0.5 * length, 0.5 * length);
+	mchtr_synthetic::cloud points;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const double theta = angle(generator);
+		const double z = along(generator);
+		add_point(points, radius * std::cos(theta), radius * std::sin(theta), z, 0.5f / radius, std::fabs(z) < 0.4 * length, 0);
+	}
+	add_noise(points, noise, generator);
+	return points;
+}
+
+mchtr_synthetic::cloud mchtr_synthetic::plane(std::size_t points_count, float size, float noise, std::uint32_t seed) {
+	/*
+	@param		points_count - number of points
+				size - side of the square (Z = 0, centred at the origin), curvature is 0 everywhere
+				noise - standard deviation of gaussian noise added to coordinates
+				seed - random seed
+	@return		points spread uniformly over the square, the tenth of the side at every edge is not interior
+	*/
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> side(-0.5 * size, 0.5 * size);
+	mchtr_synthetic::cloud points;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const double x = side(generator);
+		const double y = side(generator);
+		add_point(points, x, y, 0.0, 0.0f, std::max(std::fabs(x), std::fabs(y)) < 0.4 * size, 0);
+	}
+	add_noise(points, noise, generator);
+	return points;
+}
+
+mchtr_synthetic::cloud mchtr_synthetic::saddle(std::size_t points_count, float size, float scale, float noise, std::uint32_t seed) {
+	/*
+	@param		points_count - number of points
+				size - side of the square the saddle is spread over (centred at the origin)
+				scale - the saddle is Z = (X^2 - Y^2) / (2 * scale), principal curvatures at the origin are +-1 / scale
+				noise - standard deviation of gaussian noise added to coordinates
+				seed - random seed
+	@return		points of the saddle, the tenth of the side at every edge is not interior
+	*/
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> side(-0.5 * size, 0.5 * size);
+	mchtr_synthetic::cloud points;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const double x = side(generator);
+		const double y = side(generator);
+
+		// mean curvature of a graph Z = f(X, Y): ((1 + fy^2) fxx - 2 fx fy fxy + (1 + fx^2) fyy) / (2 (1 + fx^2 + fy^2)^(3/2))
+		const double fx = x / scale;
+		const double fy = -y / scale;
+		const double fxx = 1.0 / scale;
+		const double fyy = -1.0 / scale;
+		const double mean_curvature = ((1 + fy * fy) * fxx + (1 + fx * fx) * fyy) / (2 * std::pow(1 + fx * fx + fy * fy, 1.5));
+		add_point(points, x, y, (x * x - y * y) / (2 * scale), static_cast<float>(std::fabs(mean_curvature)),
+			std::max(std::fabs(x), std::fabs(y)) < 0.4 * size, 0);
+	}
+	add_noise(points, noise, generator);
+	return points;
+}
+
+mchtr_synthetic::cloud mchtr_synthetic::town(std::size_t points_count, int buildings_count, float slope, float noise, std::uint32_t seed) {
+	/*
+	Box buildings with flat roofs on a tilted ground, laid out like the scans the segmentation was written for:
+	an 80 x 80 m area with the ground about 100 m below the origin, so it stays under the roof finder's ground level plane
+	and roofs, 15 to 25 m above the ground, stay over it.
+	@param		points_count - number of points (ground, walls and roofs, spread by area, walls at a third of the density)
+				buildings_count - number of buildings, each in its own cell of a square grid so they never touch
+				slope - tilt of the ground (dZ / dX, half of it along Y)
+				noise - standard deviation of gaussian noise added to coordinates
+				seed - random seed
+	@return		points, roof points carry the id (1, 2, 3...) of their building
+	*/
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	constexpr double half_side = 40.0;
+	constexpr double ground_level = -100.0;
+	auto ground_z = [&](double x, double y) { return ground_level + slope * x + 0.5 * slope * y; };
+
+	// buildings, 40 to 70% of their cell wide, at random places in it
+	std::vector<box_building> buildings;
+	const int cells = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<double>(buildings_count)))));
+	const double cell = 2.0 * half_side / cells;
+	for (int i = 0; i < buildings_count; ++i) {
+		const double width = cell * (0.4 + 0.3 * unit(generator));
+		const double depth = cell * (0.4 + 0.3 * unit(generator));
+		const double x = -half_side + (i % cells) * cell + 0.15 * cell + (0.85 * cell - width - 0.15 * cell) * unit(generator);
+		const double y = -half_side + (i / cells) * cell + 0.15 * cell + (0.85 * cell - depth - 0.15 * cell) * unit(generator);
+		buildings.push_back(box_building{ static_cast<float>(x), static_cast<float>(x + width), static_cast<float>(y), static_cast<float>(y + depth),
+			static_cast<float>(15.0 + 10.0 * unit(generator)) });
+	}
+
+	// areas to spread points by: ground, every roof, every building's walls (at a third of the density)
+	std::vector<double> areas(1, 4.0 * half_side * half_side);
+	for (const box_building& building : buildings) {
+		const double roof = static_cast<double>(building.max_x - building.min_x) * (building.max_y - building.min_y);
+		areas[0] -= roof;
+		areas.push_back(roof);
+		areas.push_back(2.0 * ((building.max_x - building.min_x) + (building.max_y - building.min_y)) * building.height / 3.0);
+	}
+	std::discrete_distribution<int> surface(areas.begin(), areas.end());
+
+	mchtr_synthetic::cloud points;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const int picked = surface(generator);
+		if (picked == 0) {
+
+			// ground, outside of every footprint
+			double x, y;
+			bool covered;
+			do {
+				x = -half_side + 2.0 * half_side * unit(generator);
+				y = -half_side + 2.0 * half_side * unit(generator);
+				covered = false;
+				for (const box_building& building : buildings) {
+					covered = covered || (x >= building.min_x && x <= building.max_x && y >= building.min_y && y <= building.max_y);
+				}
+			} while (covered);
+			add_point(points, x, y, ground_z(x, y), 0.0f, false, 0);
+			continue;
+		}
+
+		const std::size_t id = (picked - 1) / 2;
+		const box_building& building = buildings[id];
+		const double width = building.max_x - building.min_x;
+		const double depth = building.max_y - building.min_y;
+
+		// flat roof at the height above the ground under the building's lowest corner
+		const double base = std::min(ground_z(building.min_x, building.min_y), ground_z(building.max_x, building.max_y));
+		if ((picked - 1) % 2 == 0) {
+			add_point(points, building.min_x + width * unit(generator), building.min_y + depth * unit(generator), base + building.height, 0.0f, false,
+				static_cast<float>(id + 1));
+			continue;
+		}
+
+		// a wall, from the ground up to the roof
+		double x, y;
+		const double around = 2.0 * (width + depth) * unit(generator);
+		if (around < width) {
+			x = building.min_x + around;
+			y = building.min_y;
+		}
+		else if (around < width + depth) {
+			x = building.max_x;
+			y = building.min_y + (around - width);
+		}
+		else if (around < 2.0 * width + depth) {
+			x = building.max_x - (around - width - depth);
+			y = building.max_y;
+		}
+		else {
+			x = building.min_x;
+			y = building.max_y - (around - 2.0 * width - depth);
+		}
+		const double bottom = ground_z(x, y);
+		add_point(points, x, y, bottom + (base + building.height - bottom) * unit(generator), 0.0f, false, 0);
+	}
+	add_noise(points, noise, generator);
+	return points;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Synthetic point clouds with analytically known curvature and building footprints, for the benchmark
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_synthetic
+{
+	// points with their ground truth
+	struct cloud {
+		std::vector<float> xyz;						// interleaved (x0, y0, z0, x1, ...)
+		std::vector<float> curvature;				// |mean curvature| at every point, what a sphere fit to a small patch converges to
+		std::vector<unsigned char> interior;		// 1 if the point is far enough from the surface's border to have a full neighbourhood
+		std::vector<float> building;				// building id of roof points, 0 for ground, walls and other surfaces
+
+		std::size_t size() const { return xyz.size() / 3; }
+	};
+
+	cloud sphere(std::size_t, float, float, std::uint32_t);
+	cloud cylinder(std::size_t, float, float, float, std::uint32_t);
+	cloud plane(std::size_t, float, float, std::uint32_t);
+	cloud saddle(std::size_t, float, float, float, std::uint32_t);
+	cloud town(std::size_t, int, float, float, std::uint32_t);
+}
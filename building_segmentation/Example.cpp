@@ -4,8 +4,14 @@
 #include <ogx/Data/Clouds/SphericalSearchKernel.h>
 #include <ogx/Data/Primitives/PrimitiveHelpers.h>
 #include <vector>
-#include <cmath>
 #include <algorithm>
+#include <memory>
+#include "../core/mchtr_cache.h"
+#include "../core/mchtr_knn_graph.h"
+#include "../core/mchtr_profile.h"
+#include "../core/mchtr_segmentation.h"
+#include "../core/mchtr_tiling.h"
+#include "../core/mchtr_voxel_grid.h"
 
 using namespace ogx;
 using namespace ogx::Data;
@@ -15,6 +21,28 @@ struct PrzemyslawWysocki_Task_6_PointCloud_7 : public ogx::Plugin::EasyMethod {
 	// parameters
 	Data::ResourceID node_id;
 	int neighbours_count{ 25 };
+	int threads{ 1 };
+	bool compact_ids{ false };
+	bool fused_geometry{ false };
+	bool batched_planes{ false };
+	int order{ mchtr_order::ORDER_STORAGE };
+	bool buffered_smoothing{ false };
+	int smoothing_iterations{ 1 };
+	bool compressed_graph{ false };
+	int neighbourhood_mode{ mchtr_voxel_grid::NEIGHBOURHOOD_KNN };
+	float radius{ 0 };
+	int min_neighbours{ 8 };
+	bool pipeline{ false };
+	int pipeline_batch{ 256 };
+	int pipeline_depth{ 4 };
+	bool surface_layers{ false };
+	float tile_size{ 0 };		// tiles bound the kd-tree and KNN graph, per point results of the whole cloud stay in memory
+	float halo{ 0 };
+	ogx::String cache_path;
+	ogx::String report_path;
+
+	// KNN graph shared by all stages, rebuilt only when the coordinates change
+	mchtr_knn_graph::graph knn_graph;
 	
 	// inheritance from EasyMethod
 	PrzemyslawWysocki_Task_6_PointCloud_7() : EasyMethod(L"Przemysaw Wysocki", L"Performs a localization of buildings.") {}
@@ -23,229 +51,77 @@ struct PrzemyslawWysocki_Task_6_PointCloud_7 : public ogx::Plugin::EasyMethod {
 	virtual void DefineParameters(ParameterBank& bank) {
 		bank.Add(L"node_id", node_id).AsNode();
 		bank.Add(L"neighbours_count", neighbours_count);
+		bank.Add(L"threads", threads);
+		bank.Add(L"compact_ids", compact_ids);
+		bank.Add(L"fused_geometry", fused_geometry);
+		bank.Add(L"batched_planes", batched_planes);
+		bank.Add(L"order", order);
+		bank.Add(L"buffered_smoothing", buffered_smoothing);
+		bank.Add(L"smoothing_iterations", smoothing_iterations);
+		bank.Add(L"compressed_graph", compressed_graph);
+		bank.Add(L"neighbourhood_mode", neighbourhood_mode);
+		bank.Add(L"radius", radius);
+		bank.Add(L"min_neighbours", min_neighbours);
+		bank.Add(L"pipeline", pipeline);
+		bank.Add(L"pipeline_batch", pipeline_batch);
+		bank.Add(L"pipeline_depth", pipeline_depth);
+		bank.Add(L"surface_layers", surface_layers);
+		bank.Add(L"tile_size", tile_size);
+		bank.Add(L"halo", halo);
+		bank.Add(L"cache_path", cache_path);
+		bank.Add(L"report_path", report_path);
 	}
 
-	inline float dot_product(const Math::Vector3D& a, const Math::Vector3D& b) {
-		return a.x() * b.x() + a.y() * b.y() + a.z() * b.z();
-	}
-
-	inline float vector_magnitude(const Math::Vector3D& a) {
-		return std::sqrt(a.x() * a.x() + a.y() * a.y() + a.z() * a.z());
-	}
-
-	inline float get_angle_between_vectors(const Math::Vector3D& a, const Math::Vector3D& b) {
-		return std::acos(dot_product(a, b) / (vector_magnitude(a) * vector_magnitude(b)));
-	}
-
-	void cloud_smoothing(Data::Clouds::ICloud* cloud, Context& context) {
-		ogx::Data::Clouds::PointsRange pointsRange;
-		cloud->GetAccess().GetAllPoints(pointsRange);
-
-		// KNN setup
-		auto searchKNNKernel = ogx::Data::Clouds::KNNSearchKernel(ogx::Math::Point3D(0, 0, 0), neighbours_count);
-
-		// data collection variables
-		std::vector<ogx::Data::Clouds::Point3D> neighbouring_points;
-
-		// progress var for progress bar
-		int progress = 0;
-
-		// iterate over all 3D points
-		for (auto& xyz : ogx::Data::Clouds::RangeLocalXYZ(pointsRange)) {
-
-			// find KNNs
-			searchKNNKernel.GetPoint() = xyz.cast<double>();
-			ogx::Data::Clouds::PointsRange neighboursRange;
-			cloud->GetAccess().FindPoints(searchKNNKernel, neighboursRange);
-			auto neighboursXYZ = ogx::Data::Clouds::RangeLocalXYZConst(neighboursRange);
-
-			// clear the vector containing each points' neighbours
-			neighbouring_points.clear();
-
-			// iterate over KNNs of given point, add them to a vector
-			for (const auto& neighbourXYZ : neighboursXYZ) {
-				neighbouring_points.push_back(neighbourXYZ.cast<float>());
-			}
-
-			// fit a best fitting plane to KNNs
-			Math::Plane3D best_plane = Math::CalcBestPlane3D(neighbouring_points.begin(), neighbouring_points.end());
-
-			// project the point onto a best-fitted plane
-			Math::Point3D projected_point = Math::ProjectPointOntoPlane(best_plane, xyz.cast<double>());
-
-			// update the points' coordinates
-			xyz = projected_point.cast<float>();
+	virtual void Run(Context& context) {
 
-			// progress bar update
-			++progress;
-			if (!context.Feedback().Update(static_cast<float>(progress) / pointsRange.size())) {
-				ReportError(L"Could not update progress bar.");
-			}
+		// check the parameters (user input)
+		mchtr_segmentation::options settings;
+		settings.neighbours_count = neighbours_count;
+		settings.threads = threads;
+		settings.compact_ids = compact_ids;
+		settings.fused_geometry = fused_geometry;
+		settings.batched_planes = batched_planes;
+		settings.order = order;
+		settings.buffered_smoothing = buffered_smoothing;
+		settings.smoothing_iterations = smoothing_iterations;
+		settings.compressed_graph = compressed_graph;
+		settings.neighbourhood.mode = neighbourhood_mode;
+		settings.neighbourhood.radius = radius;
+		settings.neighbourhood.min_points = min_neighbours;
+		settings.pipeline.enabled = pipeline;
+		settings.pipeline.batch_size = pipeline_batch;
+		settings.pipeline.depth = pipeline_depth;
+		mchtr_tiling::options tiling;
+		tiling.tile_size = tile_size;
+		tiling.halo = halo;
+		const wchar_t* error = mchtr_segmentation::validate(settings);
+		if (!error) {
+			error = mchtr_tiling::validate(tiling);
 		}
-	}
-
-	void find_roofs(Data::Clouds::ICloud* cloud, Context& context) {
-		ogx::Data::Clouds::PointsRange pointsRange;
-		cloud->GetAccess().GetAllPoints(pointsRange);
-
-		// KNN setup
-		auto searchKNNKernel = ogx::Data::Clouds::KNNSearchKernel(ogx::Math::Point3D(0, 0, 0), neighbours_count);
-
-		// data collection variables
-		std::vector<ogx::Data::Clouds::Point3D> neighbouring_points;
-		std::vector<float> roofs;
-		roofs.reserve(pointsRange.size());
-
-		// vertical vector for calculating relative angles of normal vectors
-		Math::Vector3D vertical_vector{ 0, 0, 1 };
-
-		// for numeration of points belonging to roofs
-		float current_roof_point = 0;
-
-		// progress var for progress bar
-		int progress = 0;
-
-		// plane for reduction of point cloud tilt in Z axis
-		std::vector<Math::Point3D> z_plane_points;
-		z_plane_points.push_back(Math::Point3D(-22.6403f, 11.2198f, -90.7701f));
-		z_plane_points.push_back(Math::Point3D(-35.1771f, -27.5203f, -92.5725f));
-		z_plane_points.push_back(Math::Point3D(-1.0683f, -30.5571f, -91.7308f));
-		z_plane_points.push_back(Math::Point3D(23.9246f, 0.1567f, -88.2513f));
-		Math::Plane3D z_plane = Math::CalcBestPlane3D(z_plane_points.begin(), z_plane_points.end());
-
-		// iterate over all 3D points
-		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
-
-			// find KNNs
-			searchKNNKernel.GetPoint() = xyz.cast<double>();
-			ogx::Data::Clouds::PointsRange neighboursRange;
-			cloud->GetAccess().FindPoints(searchKNNKernel, neighboursRange);
-			auto neighboursXYZ = ogx::Data::Clouds::RangeLocalXYZConst(neighboursRange);
-
-			// clear the vector containing previous points' neighbours
-			neighbouring_points.clear();
-
-			// iterate over KNNs of given point, add them to a vector
-			for (const auto& neighbourXYZ : neighboursXYZ) {
-				neighbouring_points.push_back(neighbourXYZ.cast<float>());
-			}
-
-			// fit a best fitting plane to KNNs
-			Math::Plane3D best_plane = Math::CalcBestPlane3D(neighbouring_points.begin(), neighbouring_points.end());
-
-			// is the point below or above the Z correction plane? the answer lies in sign of the distance
-			float point_z_position = z_plane.signedDistance(xyz.cast<double>());
-
-			// calculate angle between vertical vector and vector normal to the best plane
-			float angle = get_angle_between_vectors(best_plane.normal(), vertical_vector);
-
-			// if angle is 0 +- 15 degrees (normal vector is ~horizontal) AND the point is below the Z correction plane, mark the point as a roof incrementally
-			if ((angle < 0.2618 || angle > 2.8798) && point_z_position > 0) {
-				roofs.push_back(current_roof_point);
-				++current_roof_point;
-			}
-
-			// else it's nothing important, mark as 0
-			else {
-				roofs.push_back(0);
-			}
-
-			// progress bar update
-			++progress;
-			if (!context.Feedback().Update(static_cast<float>(progress) / pointsRange.size())) {
-				ReportError(L"Could not update progress bar.");
-			}
+		if (!error && pipeline && tile_size > 0) {
+			error = L"Pipelined segmentation can't be combined with tiling.";
 		}
-
-		// create a new layer
-		const auto layer_name = L"buildings";
-		auto layer = cloud->CreateLayer(layer_name, 0.0);
-
-		// add the layer to point range and set it to curvatures
-		pointsRange.SetLayerVals(roofs, *layer);
-	}
-
-	void segment_buildings(Data::Clouds::ICloud* cloud, Context& context) {
-		ogx::Data::Clouds::PointsRange pointsRange;
-		cloud->GetAccess().GetAllPoints(pointsRange);
-
-		auto roof_layers = cloud->FindLayers(L"buildings");
-		if (roof_layers.size() != 1) {
-			ReportError(std::to_wstring(roof_layers.size()) + L" new layers found instead of 1.");
+		if (!error && smoothing_iterations > 1 && tile_size > 0) {
+			error = L"Several smoothing iterations can't be combined with tiling.";
 		}
-
-		// for retrieving layer values
-		std::vector<float> roofs;
-		roofs.reserve(pointsRange.size());
-
-		// retrieve roof layer values
-		auto roof_layer = roof_layers[0];
-		pointsRange.GetLayerVals(roofs, *roof_layer);
-
-		// segmentation neighbours range
-		const int neighbours_count_segmentation = 100;
-
-		// KNN setup
-		auto searchKNNKernel = ogx::Data::Clouds::KNNSearchKernel(ogx::Math::Point3D(0, 0, 0), neighbours_count_segmentation);
-
-		// data collection variables
-		std::vector<ogx::Data::Clouds::Point3D> neighbouring_points;
-		std::vector<float> neighbouring_points_roof_values;
-
-		// progress var for progress bar
-		int progress = 0;
-
-		// for iterating both 3D points AND roofs vector at once
-		int current_roof_point = 0;
-
-		// iterate over all 3D points
-		for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
-
-			// only for points marked as roofs
-			if (roofs[current_roof_point] != 0) {
-
-				// find KNNs
-				searchKNNKernel.GetPoint() = xyz.cast<double>();
-				ogx::Data::Clouds::PointsRange neighboursRange;
-				cloud->GetAccess().FindPoints(searchKNNKernel, neighboursRange);
-				auto neighboursXYZ = ogx::Data::Clouds::RangeLocalXYZConst(neighboursRange);
-
-				// clear the vectors containing previous points' neighbours and their values
-				neighbouring_points.clear();
-				neighbouring_points_roof_values.clear();
-
-				// retrieve roof values of neighbouring points
-				neighboursRange.GetLayerVals(neighbouring_points_roof_values, *roof_layer);
-
-				// delete values of 0 (not-roofs)
-				neighbouring_points_roof_values.erase(std::remove(neighbouring_points_roof_values.begin(), neighbouring_points_roof_values.end(), 0), neighbouring_points_roof_values.end());
-
-				// find min roof value in neighbouring points
-				float new_value = *std::min_element(neighbouring_points_roof_values.begin(), neighbouring_points_roof_values.end());
-
-				// update current point with new_value (lowest in the vincinity)
-				roofs[current_roof_point] = new_value;
-			}
-
-			// increment the current vector element counter
-			++current_roof_point;
-			
-			// progress bar update
-			++progress;
-			if (!context.Feedback().Update(static_cast<float>(progress) / pointsRange.size())) {
-				ReportError(L"Could not update progress bar.");
-			}
+		if (!error && neighbourhood_mode != mchtr_voxel_grid::NEIGHBOURHOOD_KNN && tile_size > 0) {
+			error = L"Fixed radius neighbourhoods can't be combined with tiling.";
+		}
+		if (error) {
+			ReportError(error);
+			return;
 		}
 
-		// set layer to new roof values
-		pointsRange.SetLayerVals(roofs, *roof_layer);
-	}
+		// instrumentation, only if a report is wanted
+		mchtr_profile::recorder profile("building_segmentation");
+		mchtr_profile::recorder* stages = report_path.empty() ? nullptr : &profile;
+		settings.profile = stages;
 
-	virtual void Run(Context& context) {
-		// check neighbours_count validity (user input)
-		if (neighbours_count < 1) {
-			ReportError(L"K of nearest neighbours lower than 1.");
-			return;
+		// persistent cache of KNN graphs, smoothed coordinates and surfaces, only if a directory is given; tiled runs don't use it
+		std::unique_ptr<mchtr_cache::store> cache;
+		if (!cache_path.empty()) {
+			cache.reset(new mchtr_cache::store(cache_path));
+			settings.cache = cache.get();
 		}
 
 		// get access to the node, handle exception
@@ -268,28 +144,137 @@ struct PrzemyslawWysocki_Task_6_PointCloud_7 : public ogx::Plugin::EasyMethod {
 			OGX_LINE.Msg(ogx::Level::Error, L"Invalid cloud in the given node.");
 			return;
 		}
-		
-		int steps = 3;
-		OGX_LINE.Msg(ogx::Level::Info, L"Algorytm rozpocz prac. 0/" + std::to_wstring(steps));
-		OGX_LINE.Msg(ogx::Level::Info, L"Wygadzanie chmury punktw. 0/" + std::to_wstring(steps));
 
-		// smoothing the point cloud
-		cloud_smoothing(cloud, context);
-		OGX_LINE.Msg(ogx::Level::Info, L"Chmura punktw zostaa wygadzona. 1/" + std::to_wstring(steps));
-		OGX_LINE.Msg(ogx::Level::Info, L"Rozpoczcie szukania dachw budynkw. 1/" + std::to_wstring(steps));
+		// get access to the points
+		ogx::Data::Clouds::PointsRange pointsRange;
+		cloud->GetAccess().GetAllPoints(pointsRange);
+
+		// stage messages
+		const int steps = 3;
+		auto stage_started = [&](int stage) {
+			switch (stage) {
+			case mchtr_segmentation::STAGE_SMOOTHING:
+				OGX_LINE.Msg(ogx::Level::Info, L"Algorytm rozpocz prac. 0/" + std::to_wstring(steps));
+				OGX_LINE.Msg(ogx::Level::Info, L"Wygadzanie chmury punktw. 0/" + std::to_wstring(steps));
+				break;
+			case mchtr_segmentation::STAGE_ROOFS:
+				OGX_LINE.Msg(ogx::Level::Info, L"Chmura punktw zostaa wygadzona. 1/" + std::to_wstring(steps));
+				OGX_LINE.Msg(ogx::Level::Info, L"Rozpoczcie szukania dachw budynkw. 1/" + std::to_wstring(steps));
+				break;
+			case mchtr_segmentation::STAGE_SEGMENTATION:
+				OGX_LINE.Msg(ogx::Level::Info, L"Znaleziono dachy budynkw. 2/" + std::to_wstring(steps));
+				OGX_LINE.Msg(ogx::Level::Info, L"Rozpoczcie segmentacji budynkw. 2/" + std::to_wstring(steps));
+				break;
+			default:
+				OGX_LINE.Msg(ogx::Level::Info, L"Segmentacja dachw zakoczona. 3/" + std::to_wstring(steps));
+				break;
+			}
+		};
+
+		// progress callback, shared by both modes
+		const std::size_t points_count = pointsRange.size();
+		auto report = [&](std::size_t finished) {
+			if (!context.Feedback().Update(static_cast<float>(finished) / points_count)) {
+				ReportError(L"Could not update progress bar.");
+			}
+		};
+		std::vector<float> coordinates;
+		std::vector<float> buildings;
+		std::vector<mchtr_segmentation::surface> surfaces;
+		std::size_t buildings_count = 0;
+
+		if (tile_size > 0) {
+
+			// tiled mode: only a tile with its halo is held at a time, copied from the cloud's buckets in the first pass,
+			// later passes read the smoothed coordinates, which like the other per point results are kept for the whole cloud
+			OGX_LINE.Msg(ogx::Level::Info, L"Kafle ograniczaj tylko pami drzewa kd i grafu KNN, kopia wsprzdnych podzielona na kafle i wyniki dla punktw caej chmury zajmuj okoo 68 bajtw na punkt.");
+			mchtr_tiling::box bounds = mchtr_tiling::bounds_of(nullptr, 0);
+			for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+				const float point[3] = { xyz.x(), xyz.y(), xyz.z() };
+				for (int axis = 0; axis < 3; ++axis) {
+					bounds.min[axis] = std::min(bounds.min[axis], point[axis]);
+					bounds.max[axis] = std::max(bounds.max[axis], point[axis]);
+				}
+			}
+			const mchtr_tiling::grid tiles(bounds, tile_size);
+			// points are copied into buckets by tile in one more pass over the cloud, a tile then reads only the buckets its halo overlaps
+			mchtr_tiling::stream_loader loader(tiles);
+			{
+				std::size_t index = 0;
+				for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+					loader.add(index++, xyz.x(), xyz.y(), xyz.z());
+				}
+			}
+			coordinates.resize(3 * points_count);
+			const mchtr_tiling::run_stats stats = mchtr_tiling::segment_buildings(tiles, halo, std::cref(loader), points_count, settings, stage_started, report, coordinates.data(), buildings, surfaces, buildings_count);
+			OGX_LINE.Msg(ogx::Level::Info, L"Liczba kafli: " + std::to_wstring(stats.tiles) + L", najwikszy kafel: " + std::to_wstring(stats.largest_tile) +
+				L" punktw, ssiedztwa ucite przez margines: " + std::to_wstring(stats.inexact_neighbourhoods) + L".");
+		}
+		else {
+
+			// snapshot of the coordinates (x0, y0, z0, x1, ...), the algorithm works on it and smooths it in place
+			{
+				mchtr_profile::scoped_stage timer(stages, "snapshot");
+				coordinates.reserve(3 * points_count);
+				for (const auto& xyz : ogx::Data::Clouds::RangeLocalXYZConst(pointsRange)) {
+					coordinates.push_back(xyz.x());
+					coordinates.push_back(xyz.y());
+					coordinates.push_back(xyz.z());
+				}
+			}
+
+			// the algorithm itself lives in the core library, shared with the command line tool
+			buildings_count = mchtr_segmentation::segment_buildings(coordinates.data(), points_count, settings, knn_graph, stage_started, report, buildings, surfaces);
+		}
+		OGX_LINE.Msg(ogx::Level::Info, L"----Liczba znalezionych budynkw: " + std::to_wstring(buildings_count) + L".");
+		if (cache) {
+			const mchtr_cache::statistics& cache_stats = cache->stats();
+			OGX_LINE.Msg(ogx::Level::Info, L"Pami podrczna: trafienia: " + std::to_wstring(cache_stats.hits) + L", chybienia: " + std::to_wstring(cache_stats.misses) +
+				L", zapisane wpisy: " + std::to_wstring(cache_stats.writes) + L", nieudane zapisy: " + std::to_wstring(cache_stats.failed_writes) + L".");
+		}
+
+		// write the smoothed coordinates back to the cloud
+		{
+			mchtr_profile::scoped_stage timer(stages, "write_coordinates");
+			std::size_t index = 0;
+			for (auto& xyz : ogx::Data::Clouds::RangeLocalXYZ(pointsRange)) {
+				xyz = ogx::Data::Clouds::Point3D(coordinates[3 * index], coordinates[3 * index + 1], coordinates[3 * index + 2]);
+				++index;
+			}
+		}
 
-		// finding the roofs of buildings
-		find_roofs(cloud, context);
-		OGX_LINE.Msg(ogx::Level::Info, L"Znaleziono dachy budynkw. 2/" + std::to_wstring(steps));
-		OGX_LINE.Msg(ogx::Level::Info, L"Rozpoczcie segmentacji budynkw. 2/" + std::to_wstring(steps));
+		// create a new layer and set it to building labels
+		const auto layer_name = L"buildings";
+		auto layer = cloud->CreateLayer(layer_name, 0.0);
+		{
+			mchtr_profile::scoped_stage timer(stages, "write_layer");
+			pointsRange.SetLayerVals(buildings, *layer);
+		}
+
+		// optionally the surfaces the roof test read: normal components and surface variation, one layer each
+		if (surface_layers) {
+			mchtr_profile::scoped_stage timer(stages, "write_surface_layers");
+			const wchar_t* surface_layer_names[] = { L"normal_x", L"normal_y", L"normal_z", L"surface_variation" };
+			std::vector<float> values(points_count);
+			for (int component = 0; component < 4; ++component) {
+				for (std::size_t index = 0; index < points_count; ++index) {
+					values[index] = component < 3 ? surfaces[index].normal[component] : surfaces[index].variation;
+				}
+				auto surface_layer = cloud->CreateLayer(surface_layer_names[component], 0.0);
+				pointsRange.SetLayerVals(values, *surface_layer);
+			}
+		}
 
-		// segment buildings into separate entities
-		int segmentation_steps = 30;
-		for (int i = 0; i < segmentation_steps; ++i) {
-			OGX_LINE.Msg(ogx::Level::Info, L"----Krok " + std::to_wstring(i+1) + L"/" + std::to_wstring(segmentation_steps));
-			segment_buildings(cloud, context);
+		// run report
+		if (stages) {
+			try {
+				profile.write(report_path);
+				OGX_LINE.Msg(ogx::Level::Info, L"Zapisano raport: " + report_path + L".");
+			}
+			catch (const std::exception&) {
+				ReportError(L"Could not write the report.");
+			}
 		}
-		OGX_LINE.Msg(ogx::Level::Info, L"Segmentacja dachw zakoczona. 3/" + std::to_wstring(steps));
 
 		// plugin has successfully finished working
 		OGX_LINE.Msg(ogx::Level::Info, L"Plugin zakoczy prac.");
@@ -0,0 +1,375 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mchtr_io.h"
+#include "../core/mchtr_cache.h"
+#include "../core/mchtr_curvature.h"
+#include "../core/mchtr_knn_graph.h"
+#include "../core/mchtr_lod.h"
+#include "../core/mchtr_profile.h"
+#include "../core/mchtr_segmentation.h"
+#include "../core/mchtr_tiling.h"
+
+/*
+Command line driver of the curvature and building segmentation algorithms, runs the same core code as the FRAMES3D plugins
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	void print_usage() {
+		std::fprintf(stderr,
+			"usage: mchtr_cli curvature|segmentation <input> <output> [options]\n"
+			"  input                 binary PLY, LAS or raw XYZ (float x, y, z triples), told apart by magic bytes\n"
+			"  output                *.ply: points with the result attribute, anything else: raw float per point\n"
+			"  --neighbours <K>      K nearest neighbours (curvature 15, segmentation 25)\n"
+			"  --fit-method <M>      curvature: 0 SGD, 1 algebraic, 2 algebraic + Gauss-Newton step (default 0)\n"
+			"  --neighbourhood <N>   0 K nearest neighbours, 1 up to K nearest within a fixed radius, from a voxel grid (default 0)\n"
+			"  --radius <R>          fixed radius neighbourhoods: the radius, also the voxel grid's cell size\n"
+			"  --min-neighbours <N>  fixed radius neighbourhoods: points with fewer within the radius get their N nearest (default 8)\n"
+			"  --threads <N>         worker threads, 0 means all cores (default 1)\n"
+			"  --max-epochs <E>      curvature SGD: epochs limit per fit (default 30)\n"
+			"  --tolerance <T>       curvature SGD: stop a fit once an epoch improves the loss by less than T (relative), 0 never stops early (default 0)\n"
+			"  --warm-start          curvature SGD: start a fit from the nearest sphere of the batch fitted before it, if that point is a neighbour\n"
+			"  --sampling <S>        curvature: fit only seeds and interpolate the rest, 0 all points, 1 voxel grid, 2 Poisson disk (default 0)\n"
+			"  --spacing <D>         curvature: voxel size or Poisson disk radius of the seeds\n"
+			"  --interpolation-neighbours <N>  curvature: nearest seeds a point is interpolated from (default 4)\n"
+			"  --refine-threshold <T>  curvature: fit points whose seeds' curvatures differ by more than T, 0 never refines (default 0)\n"
+			"  --compact-ids         segmentation: label buildings 1, 2, 3... instead of with their first roof value\n"
+			"  --fused-geometry      segmentation: find roofs from the planes fitted for smoothing instead of refitting the smoothed cloud\n"
+			"  --batched-planes      segmentation: fit planes 16 neighbourhoods at a time (SIMD moments, closed-form eigensolver)\n"
+			"  --buffered-smoothing  segmentation: smooth in parallel from a snapshot into a second buffer, the same result for any threads\n"
+			"  --compressed-graph    segmentation: keep KNN graph rows compressed (delta coded in Hilbert curve order), same results in less memory\n"
+			"  --smoothing-iterations <I>  segmentation: smoothing passes with the KNN graph of the unsmoothed cloud (default 1)\n"
+			"  --order <O>           process points in 0 storage order, 1 Morton curve order, 2 Hilbert curve order (default 0)\n"
+			"  --pipeline            overlap KNN queries with fitting: search threads fill blocks of neighbourhoods, fit threads drain them\n"
+			"  --pipeline-batch <B>  points per pipeline block (default 256)\n"
+			"  --pipeline-depth <D>  pipeline blocks in flight, searching waits once all are filled (default 4)\n"
+			"  --tile-size <S>       process the cloud in S x S tiles (in X and Y) to bound the KNN state, 0 means no tiling (default 0)\n"
+			"  --halo <H>            width of the border loaded around every tile, wider than the K-th neighbour distance (default 0)\n"
+			"  --cache <dir>         keep KNN graphs, smoothed clouds, surfaces and curvatures in dir and reuse them in later runs on the same points\n"
+			"  --report <path>       write stage timings and per thread counters, as CSV if the path ends with .csv, JSON otherwise\n");
+	}
+
+	bool parse_int(const char* text, int& value) {
+		char* end = nullptr;
+		const long parsed = std::strtol(text, &end, 10);
+		if (end == text || *end != '\0') {
+			return false;
+		}
+		value = static_cast<int>(parsed);
+		return true;
+	}
+
+	bool parse_float(const char* text, float& value) {
+		char* end = nullptr;
+		const float parsed = std::strtof(text, &end);
+		if (end == text || *end != '\0') {
+			return false;
+		}
+		value = parsed;
+		return true;
+	}
+
+	std::string narrow(const wchar_t* message) {
+		// core messages are plain ASCII
+		return std::string(message, message + std::wcslen(message));
+	}
+
+	bool ends_with(const std::string& text, const std::string& suffix) {
+		return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	double seconds_since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		print_usage();
+		return 2;
+	}
+	const std::string command = argv[1];
+	const std::string input_path = argv[2];
+	const std::string output_path = argv[3];
+	if (command != "curvature" && command != "segmentation") {
+		print_usage();
+		return 2;
+	}
+
+	// options, defaults are the plugins' defaults
+	mchtr_curvature::options curvature_settings;
+	mchtr_segmentation::options segmentation_settings;
+	mchtr_tiling::options tiling_settings;
+	mchtr_lod::options lod_settings;
+	std::string report_path;
+	std::string cache_path;
+	for (int i = 4; i < argc; ++i) {
+		const std::string option = argv[i];
+		int value = 0;
+		float length = 0;
+		if (option == "--compact-ids") {
+			segmentation_settings.compact_ids = true;
+		}
+		else if (option == "--fused-geometry") {
+			segmentation_settings.fused_geometry = true;
+		}
+		else if (option == "--batched-planes") {
+			segmentation_settings.batched_planes = true;
+		}
+		else if (option == "--compressed-graph") {
+			segmentation_settings.compressed_graph = true;
+		}
+		else if (option == "--buffered-smoothing") {
+			segmentation_settings.buffered_smoothing = true;
+		}
+		else if (option == "--pipeline") {
+			curvature_settings.pipeline.enabled = true;
+			segmentation_settings.pipeline.enabled = true;
+		}
+		else if (option == "--warm-start") {
+			curvature_settings.warm_start = true;
+		}
+		else if (option == "--report" && i + 1 < argc) {
+			report_path = argv[++i];
+		}
+		else if (option == "--cache" && i + 1 < argc) {
+			cache_path = argv[++i];
+		}
+		else if (i + 1 < argc && parse_float(argv[i + 1], length) && (option == "--tile-size" || option == "--halo" || option == "--tolerance" || option == "--spacing" ||
+			option == "--refine-threshold" || option == "--radius")) {
+			++i;
+			if (option == "--radius") {
+				curvature_settings.neighbourhood.radius = length;
+				segmentation_settings.neighbourhood.radius = length;
+			}
+			else if (option == "--spacing") {
+				lod_settings.spacing = length;
+			}
+			else if (option == "--refine-threshold") {
+				lod_settings.refine_threshold = length;
+			}
+			else if (option == "--tile-size") {
+				tiling_settings.tile_size = length;
+			}
+			else if (option == "--tolerance") {
+				curvature_settings.tolerance = length;
+			}
+			else {
+				tiling_settings.halo = length;
+			}
+		}
+		else if (i + 1 < argc && parse_int(argv[i + 1], value) && (option == "--neighbours" || option == "--fit-method" || option == "--threads" || option == "--max-epochs" ||
+			option == "--sampling" || option == "--interpolation-neighbours" || option == "--pipeline-batch" || option == "--pipeline-depth" || option == "--order" || option == "--smoothing-iterations" ||
+			option == "--neighbourhood" || option == "--min-neighbours")) {
+			++i;
+			if (option == "--neighbourhood") {
+				curvature_settings.neighbourhood.mode = value;
+				segmentation_settings.neighbourhood.mode = value;
+			}
+			else if (option == "--min-neighbours") {
+				curvature_settings.neighbourhood.min_points = value;
+				segmentation_settings.neighbourhood.min_points = value;
+			}
+			else if (option == "--smoothing-iterations") {
+				segmentation_settings.smoothing_iterations = value;
+			}
+			else if (option == "--order") {
+				curvature_settings.order = value;
+				segmentation_settings.order = value;
+			}
+			else if (option == "--pipeline-batch") {
+				curvature_settings.pipeline.batch_size = value;
+				segmentation_settings.pipeline.batch_size = value;
+			}
+			else if (option == "--pipeline-depth") {
+				curvature_settings.pipeline.depth = value;
+				segmentation_settings.pipeline.depth = value;
+			}
+			else if (option == "--sampling") {
+				lod_settings.sampling = value;
+			}
+			else if (option == "--interpolation-neighbours") {
+				lod_settings.interpolation_neighbours = value;
+			}
+			else if (option == "--max-epochs") {
+				curvature_settings.max_epochs = value;
+			}
+			else if (option == "--neighbours") {
+				curvature_settings.neighbours_count = value;
+				segmentation_settings.neighbours_count = value;
+			}
+			else if (option == "--fit-method") {
+				curvature_settings.fit_method = value;
+			}
+			else {
+				curvature_settings.threads = value;
+				segmentation_settings.threads = value;
+			}
+		}
+		else {
+			std::fprintf(stderr, "unknown or incomplete option %s\n", option.c_str());
+			print_usage();
+			return 2;
+		}
+	}
+	const wchar_t* error = command == "curvature" ? mchtr_curvature::validate(curvature_settings) : mchtr_segmentation::validate(segmentation_settings);
+	if (!error) {
+		error = mchtr_tiling::validate(tiling_settings);
+	}
+	if (!error && command == "curvature") {
+		error = mchtr_lod::validate(lod_settings);
+	}
+	if (!error && lod_settings.sampling != mchtr_lod::SAMPLING_ALL && tiling_settings.tile_size > 0) {
+		error = L"Sparse sampling can't be combined with tiling.";
+	}
+	if (!error && command == "segmentation" && segmentation_settings.pipeline.enabled && tiling_settings.tile_size > 0) {
+		error = L"Pipelined segmentation can't be combined with tiling.";
+	}
+	if (!error && command == "segmentation" && segmentation_settings.smoothing_iterations > 1 && tiling_settings.tile_size > 0) {
+		error = L"Several smoothing iterations can't be combined with tiling.";
+	}
+	if (!error && command == "segmentation" && segmentation_settings.neighbourhood.mode != mchtr_voxel_grid::NEIGHBOURHOOD_KNN && tiling_settings.tile_size > 0) {
+		error = L"Fixed radius neighbourhoods can't be combined with tiling.";
+	}
+	if (error) {
+		std::fprintf(stderr, "%s\n", narrow(error).c_str());
+		return 2;
+	}
+
+	// instrumentation only if a report is wanted
+	mchtr_profile::recorder profile(command);
+	if (!report_path.empty()) {
+		curvature_settings.profile = &profile;
+		segmentation_settings.profile = &profile;
+	}
+	mchtr_profile::recorder* stages = report_path.empty() ? nullptr : &profile;
+
+	// persistent cache only if a directory is given; tiled runs don't use it
+	std::unique_ptr<mchtr_cache::store> cache;
+	if (!cache_path.empty()) {
+		cache.reset(new mchtr_cache::store(cache_path));
+		curvature_settings.cache = cache.get();
+		segmentation_settings.cache = cache.get();
+	}
+
+	try {
+		// read
+		auto start = std::chrono::steady_clock::now();
+		mchtr_io::mapped_file file(input_path);
+		mchtr_io::point_cloud cloud;
+		{
+			mchtr_profile::scoped_stage timer(stages, "read");
+			mchtr_io::read_points(file, cloud);
+		}
+		const char* format_names[] = { "raw XYZ", "PLY", "LAS" };
+		std::fprintf(stderr, "read %zu points (%s%s) in %.3f s\n", cloud.count, format_names[cloud.source_format],
+			cloud.zero_copy() ? ", zero-copy" : "", seconds_since(start));
+
+		// run
+		start = std::chrono::steady_clock::now();
+		std::vector<float> values(cloud.count, 0.0f);
+		std::string attribute;
+		const float* xyz = cloud.xyz;
+		std::vector<float> smoothed;
+		std::vector<mchtr_segmentation::surface> surfaces;
+		const bool tiled = tiling_settings.tile_size > 0;
+		if (tiled) {
+			const mchtr_tiling::grid tiles(mchtr_tiling::bounds_of(cloud.xyz, cloud.count), tiling_settings.tile_size);
+			const mchtr_tiling::array_loader loader(cloud.xyz, cloud.count, tiles);
+			mchtr_tiling::run_stats stats;
+			if (command == "curvature") {
+				stats = mchtr_tiling::compute_curvature(tiles, tiling_settings.halo, std::cref(loader), curvature_settings, [](std::size_t) {}, values.data());
+				attribute = "curvature";
+			}
+			else {
+				smoothed.resize(3 * cloud.count);
+				std::size_t buildings_count = 0;
+				stats = mchtr_tiling::segment_buildings(tiles, tiling_settings.halo, std::cref(loader), cloud.count, segmentation_settings,
+					[](int) {}, [](std::size_t) {}, smoothed.data(), values, surfaces, buildings_count);
+				std::fprintf(stderr, "%zu buildings\n", buildings_count);
+				xyz = smoothed.data();
+				attribute = "building";
+			}
+			std::fprintf(stderr, "%s in %zu tiles in %.3f s, largest tile %zu points, %zu neighbourhoods cut by the halo\n", command.c_str(),
+				stats.tiles, seconds_since(start), stats.largest_tile, stats.inexact_neighbourhoods);
+		}
+		else if (command == "curvature") {
+			const mchtr_lod::run_stats stats = mchtr_lod::compute_curvature(cloud.xyz, cloud.count, lod_settings, curvature_settings, [](int) {},
+				[](std::size_t) {}, values.data());
+			const mchtr_curvature::run_info& info = stats.fitting;
+			if (stats.cached) {
+				std::fprintf(stderr, "curvature of %zu points read from the cache in %.3f s\n", cloud.count, seconds_since(start));
+			}
+			else {
+				std::fprintf(stderr, "curvature of %zu points in %.3f s (%d threads, %ls)\n", cloud.count, seconds_since(start), info.workers,
+					mchtr_batch::isa_name(info.instruction_set));
+			}
+			if (lod_settings.sampling != mchtr_lod::SAMPLING_ALL) {
+				std::fprintf(stderr, "fitted %zu seeds, interpolated %zu points, refined %zu of them\n", stats.seeds, cloud.count - stats.seeds, stats.refined);
+			}
+			if (info.sgd_fits > 0) {
+				std::fprintf(stderr, "SGD: %.2f epochs per fit on average, %zu of %zu fits converged early, %zu warm started\n",
+					static_cast<double>(info.sgd_epochs) / info.sgd_fits, info.early_stops, info.sgd_fits, info.warm_starts);
+			}
+			attribute = "curvature";
+		}
+		else {
+
+			// smoothing moves the points, so segmentation works on a copy
+			smoothed.assign(cloud.xyz, cloud.xyz + 3 * cloud.count);
+			mchtr_knn_graph::graph knn_graph;
+			const char* stage_names[] = { "smoothing", "finding roofs", "segmentation" };
+			auto stage_start = std::chrono::steady_clock::now();
+			int current_stage = -1;
+			const std::size_t buildings_count = mchtr_segmentation::segment_buildings(smoothed.data(), cloud.count, segmentation_settings, knn_graph,
+				[&](int stage) {
+					if (current_stage >= 0) {
+						std::fprintf(stderr, "  %s: %.3f s\n", stage_names[current_stage], seconds_since(stage_start));
+					}
+					current_stage = stage < mchtr_segmentation::STAGE_DONE ? stage : -1;
+					stage_start = std::chrono::steady_clock::now();
+				},
+				[](std::size_t) {}, values, surfaces);
+			std::fprintf(stderr, "%zu buildings in %.3f s\n", buildings_count, seconds_since(start));
+			xyz = smoothed.data();
+			attribute = "building";
+		}
+
+		if (cache) {
+			const mchtr_cache::statistics& cache_stats = cache->stats();
+			std::fprintf(stderr, "cache: %zu hits, %zu misses, %zu entries written, %zu failed\n", cache_stats.hits, cache_stats.misses, cache_stats.writes,
+				cache_stats.failed_writes);
+		}
+
+		// write
+		start = std::chrono::steady_clock::now();
+		{
+			mchtr_profile::scoped_stage timer(stages, "write");
+			if (ends_with(output_path, ".ply")) {
+				mchtr_io::write_ply(output_path, cloud.origin, xyz, cloud.count, attribute, values.data());
+			}
+			else {
+				mchtr_io::write_raw(output_path, values.data(), cloud.count);
+			}
+		}
+		std::fprintf(stderr, "wrote %s in %.3f s\n", output_path.c_str(), seconds_since(start));
+		if (stages) {
+			profile.write(report_path);
+			std::fprintf(stderr, "wrote report %s\n", report_path.c_str());
+		}
+	}
+	catch (const std::exception& exception) {
+		std::fprintf(stderr, "error: %s\n", exception.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,374 @@
+#include "mchtr_io.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Point cloud file functionality cpp file (memory-mapped PLY / LAS / raw XYZ readers, PLY and raw writers), Linux only
+All binary formats handled here are little endian, like the machines this runs on.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	template <typename T>
+	T read_value(const unsigned char* data) {
+		// mapped data has no alignment guarantees past the page start
+		T value;
+		std::memcpy(&value, data, sizeof(T));
+		return value;
+	}
+
+	std::size_t ply_type_size(const std::string& type) {
+		/*
+		@param		type - PLY property type name
+		@return		size of the type in bytes, 0 for an unknown type
+		*/
+		if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") {
+			return 1;
+		}
+		if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") {
+			return 2;
+		}
+		if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32") {
+			return 4;
+		}
+		if (type == "double" || type == "float64") {
+			return 8;
+		}
+		return 0;
+	}
+
+	void write_all(std::ofstream& file, const std::string& path, const void* data, std::size_t size) {
+		file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+		if (!file) {
+			throw std::runtime_error("cannot write " + path);
+		}
+	}
+}
+
+mchtr_io::mapped_file::mapped_file(const std::string& path) {
+	/*
+	Maps a file into memory, read only.
+	@param		path - file to map, throws std::runtime_error if it can't be opened or mapped
+	*/
+	const int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	struct stat status;
+	if (::fstat(descriptor, &status) != 0) {
+		::close(descriptor);
+		throw std::runtime_error("cannot stat " + path);
+	}
+	m_size = static_cast<std::size_t>(status.st_size);
+
+	// an empty file can't be mapped, it just has no data
+	if (m_size > 0) {
+		void* mapping = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapping == MAP_FAILED) {
+			::close(descriptor);
+			throw std::runtime_error("cannot map " + path);
+		}
+		::madvise(mapping, m_size, MADV_WILLNEED);
+		m_data = static_cast<const unsigned char*>(mapping);
+	}
+
+	// the mapping stays valid without the descriptor
+	::close(descriptor);
+}
+
+mchtr_io::mapped_file::~mapped_file() {
+	if (m_data) {
+		::munmap(const_cast<unsigned char*>(m_data), m_size);
+	}
+}
+
+mchtr_io::format mchtr_io::detect_format(const mchtr_io::mapped_file& file) {
+	/*
+	@param		file - mapped point cloud file
+	@return		format told by the file's magic bytes, raw XYZ if there are none
+	*/
+	if (file.size() >= 4 && std::memcmp(file.data(), "ply", 3) == 0 && (file.data()[3] == '\n' || file.data()[3] == '\r')) {
+		return mchtr_io::FORMAT_PLY;
+	}
+	if (file.size() >= 4 && std::memcmp(file.data(), "LASF", 4) == 0) {
+		return mchtr_io::FORMAT_LAS;
+	}
+	return mchtr_io::FORMAT_RAW_XYZ;
+}
+
+void mchtr_io::read_points(const mchtr_io::mapped_file& file, mchtr_io::point_cloud& cloud) {
+	/*
+	Reads coordinates of a PLY, LAS or raw XYZ file, whichever it is.
+	@param		file - mapped point cloud file, must outlive the cloud if the cloud is zero-copy
+				cloud - output, throws std::runtime_error if the file is malformed or unsupported
+	*/
+	switch (mchtr_io::detect_format(file)) {
+	case mchtr_io::FORMAT_PLY:
+		mchtr_io::read_ply(file, cloud);
+		break;
+	case mchtr_io::FORMAT_LAS:
+		mchtr_io::read_las(file, cloud);
+		break;
+	default:
+		mchtr_io::read_raw_xyz(file, cloud);
+		break;
+	}
+}
+
+void mchtr_io::read_raw_xyz(const mchtr_io::mapped_file& file, mchtr_io::point_cloud& cloud) {
+	/*
+	Reads a headerless file of float x, y, z triples, always without copying.
+	@param		file - mapped point cloud file
+				cloud - output
+	*/
+	constexpr std::size_t record_size = 3 * sizeof(float);
+	if (file.size() % record_size != 0) {
+		throw std::runtime_error("raw XYZ file size is not a multiple of 12 bytes (3 floats per point)");
+	}
+	cloud = mchtr_io::point_cloud();
+	cloud.source_format = mchtr_io::FORMAT_RAW_XYZ;
+	cloud.count = file.size() / record_size;
+	cloud.xyz = reinterpret_cast<const float*>(file.data());
+}
+
+void mchtr_io::read_ply(const mchtr_io::mapped_file& file, mchtr_io::point_cloud& cloud) {
+	/*
+	Reads vertex coordinates of a binary little endian PLY file. The file is used without copying if vertices have
+	only float x, y, z properties, otherwise coordinates (float or double) are converted.
+	@param		file - mapped point cloud file
+				cloud - output
+	*/
+
+	// the header is text ending with an end_header line
+	const char* text = reinterpret_cast<const char*>(file.data());
+	const char* header_end = nullptr;
+	for (std::size_t i = 0; i + 10 <= file.size(); ++i) {
+		if (std::memcmp(text + i, "end_header", 10) == 0 && (i == 0 || text[i - 1] == '\n')) {
+			const void* line_end = std::memchr(text + i, '\n', file.size() - i);
+			if (!line_end) {
+				break;
+			}
+			header_end = static_cast<const char*>(line_end) + 1;
+			break;
+		}
+	}
+	if (!header_end) {
+		throw std::runtime_error("PLY header has no end_header line");
+	}
+
+	// vertex data starts after all (fixed size) elements declared before the vertex element
+	std::istringstream header(std::string(text, header_end));
+	std::string line;
+	std::size_t data_offset = static_cast<std::size_t>(header_end - text);
+	std::size_t vertex_count = 0;
+	std::size_t stride = 0;
+	std::size_t property_offsets[3] = { 0, 0, 0 };
+	std::size_t property_sizes[3] = { 0, 0, 0 };
+	std::string element;
+	std::size_t element_count = 0;
+	std::size_t element_size = 0;
+	bool vertex_done = false;
+	bool binary_little_endian = false;
+	while (std::getline(header, line)) {
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		std::istringstream words(line);
+		std::string keyword;
+		words >> keyword;
+		if (keyword == "format") {
+			std::string format_name;
+			words >> format_name;
+			binary_little_endian = format_name == "binary_little_endian";
+		}
+		else if (keyword == "element") {
+			if (element == "vertex") {
+				vertex_done = true;
+			}
+			else if (!vertex_done && !element.empty()) {
+				data_offset += element_count * element_size;
+			}
+			words >> element >> element_count;
+			element_size = 0;
+			if (element == "vertex") {
+				vertex_count = element_count;
+			}
+		}
+		else if (keyword == "property") {
+			std::string type;
+			std::string name;
+			words >> type >> name;
+			if (type == "list") {
+				if (!vertex_done) {
+					throw std::runtime_error("PLY list properties before or in the vertex element are not supported");
+				}
+				continue;
+			}
+			const std::size_t size = ply_type_size(type);
+			if (size == 0) {
+				throw std::runtime_error("unknown PLY property type " + type);
+			}
+			if (element == "vertex") {
+				const int axis = name == "x" ? 0 : name == "y" ? 1 : name == "z" ? 2 : -1;
+				if (axis >= 0) {
+					if (type != "float" && type != "float32" && type != "double" && type != "float64") {
+						throw std::runtime_error("PLY coordinates must be float or double");
+					}
+					property_offsets[axis] = stride;
+					property_sizes[axis] = size;
+				}
+				stride += size;
+			}
+			element_size += size;
+		}
+	}
+	if (!binary_little_endian) {
+		throw std::runtime_error("only binary little endian PLY files are supported");
+	}
+	if (property_sizes[0] == 0 || property_sizes[1] == 0 || property_sizes[2] == 0) {
+		throw std::runtime_error("PLY vertices have no x, y, z properties");
+	}
+	if (data_offset + vertex_count * stride > file.size()) {
+		throw std::runtime_error("PLY file is truncated");
+	}
+
+	cloud = mchtr_io::point_cloud();
+	cloud.source_format = mchtr_io::FORMAT_PLY;
+	cloud.count = vertex_count;
+	const unsigned char* vertices = file.data() + data_offset;
+
+	// already interleaved floats
+	if (stride == 3 * sizeof(float) && property_offsets[0] == 0 && property_offsets[1] == 4 && property_offsets[2] == 8 &&
+		reinterpret_cast<std::uintptr_t>(vertices) % alignof(float) == 0) {
+		cloud.xyz = reinterpret_cast<const float*>(vertices);
+		return;
+	}
+
+	cloud.converted.resize(3 * vertex_count);
+	for (std::size_t i = 0; i < vertex_count; ++i) {
+		const unsigned char* vertex = vertices + i * stride;
+		for (int axis = 0; axis < 3; ++axis) {
+			cloud.converted[3 * i + axis] = property_sizes[axis] == sizeof(float) ? read_value<float>(vertex + property_offsets[axis])
+				: static_cast<float>(read_value<double>(vertex + property_offsets[axis]));
+		}
+	}
+	cloud.xyz = cloud.converted.data();
+}
+
+void mchtr_io::read_las(const mchtr_io::mapped_file& file, mchtr_io::point_cloud& cloud) {
+	/*
+	Reads point coordinates of an uncompressed LAS file (versions 1.0 - 1.4, any point format). Coordinates are
+	scaled integers, they are decoded straight from the mapping relative to the header's offset (the file's own local
+	frame), so they keep float precision for georeferenced clouds.
+	@param		file - mapped point cloud file
+				cloud - output
+	*/
+	constexpr std::size_t min_header_size = 227;
+	const unsigned char* data = file.data();
+	if (file.size() < min_header_size) {
+		throw std::runtime_error("LAS header is truncated");
+	}
+	const std::uint8_t version_minor = read_value<std::uint8_t>(data + 25);
+	const std::uint16_t header_size = read_value<std::uint16_t>(data + 94);
+	const std::uint32_t points_offset = read_value<std::uint32_t>(data + 96);
+	const std::uint8_t point_format = read_value<std::uint8_t>(data + 104);
+	const std::uint16_t record_size = read_value<std::uint16_t>(data + 105);
+	std::uint64_t count = read_value<std::uint32_t>(data + 107);
+	if (version_minor >= 4 && header_size >= 375 && file.size() >= 255) {
+		const std::uint64_t extended_count = read_value<std::uint64_t>(data + 247);
+		if (extended_count > 0) {
+			count = extended_count;
+		}
+	}
+
+	// LAZ marks compression in the top bits of the point format
+	if (point_format & 0xc0) {
+		throw std::runtime_error("compressed LAS (LAZ) files are not supported");
+	}
+	if (record_size < 12) {
+		throw std::runtime_error("LAS point records are too short");
+	}
+	if (points_offset + count * record_size > file.size()) {
+		throw std::runtime_error("LAS file is truncated");
+	}
+
+	const double scale[3] = { read_value<double>(data + 131), read_value<double>(data + 139), read_value<double>(data + 147) };
+	const double offset[3] = { read_value<double>(data + 155), read_value<double>(data + 163), read_value<double>(data + 171) };
+
+	cloud = mchtr_io::point_cloud();
+	cloud.source_format = mchtr_io::FORMAT_LAS;
+	cloud.count = static_cast<std::size_t>(count);
+	cloud.origin[0] = offset[0];
+	cloud.origin[1] = offset[1];
+	cloud.origin[2] = offset[2];
+
+	// every point format starts with int32 X, Y, Z
+	cloud.converted.resize(3 * cloud.count);
+	const unsigned char* records = data + points_offset;
+	for (std::size_t i = 0; i < cloud.count; ++i) {
+		const unsigned char* record = records + i * record_size;
+		for (int axis = 0; axis < 3; ++axis) {
+			cloud.converted[3 * i + axis] = static_cast<float>(read_value<std::int32_t>(record + 4 * axis) * scale[axis]);
+		}
+	}
+	cloud.xyz = cloud.converted.data();
+}
+
+void mchtr_io::write_ply(const std::string& path, const double* origin, const float* xyz, std::size_t count, const std::string& attribute, const float* values) {
+	/*
+	Writes points with one attribute as a binary little endian PLY file, coordinates as doubles with the origin added back.
+	@param		path - output file
+				origin - origin the coordinates are relative to
+				xyz - coordinates, interleaved (x0, y0, z0, x1, ...)
+				count - number of points
+				attribute - name of the attribute property
+				values - per point attribute values
+	*/
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot create " + path);
+	}
+	const std::string header = "ply\nformat binary_little_endian 1.0\nelement vertex " + std::to_string(count) +
+		"\nproperty double x\nproperty double y\nproperty double z\nproperty float " + attribute + "\nend_header\n";
+	write_all(file, path, header.data(), header.size());
+
+	// records go out in blocks, not one by one
+	constexpr std::size_t block_points = 65536;
+	constexpr std::size_t record_size = 3 * sizeof(double) + sizeof(float);
+	std::vector<unsigned char> block(block_points * record_size);
+	for (std::size_t begin = 0; begin < count; begin += block_points) {
+		const std::size_t end = begin + block_points < count ? begin + block_points : count;
+		unsigned char* record = block.data();
+		for (std::size_t i = begin; i < end; ++i) {
+			for (int axis = 0; axis < 3; ++axis) {
+				const double coordinate = origin[axis] + xyz[3 * i + axis];
+				std::memcpy(record + axis * sizeof(double), &coordinate, sizeof(double));
+			}
+			std::memcpy(record + 3 * sizeof(double), &values[i], sizeof(float));
+			record += record_size;
+		}
+		write_all(file, path, block.data(), (end - begin) * record_size);
+	}
+}
+
+void mchtr_io::write_raw(const std::string& path, const float* values, std::size_t count) {
+	/*
+	Writes per point values as a headerless array of floats.
+	@param		path - output file
+				values - per point values
+				count - number of points
+	*/
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot create " + path);
+	}
+	write_all(file, path, values, count * sizeof(float));
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+Point cloud file functionality header file (memory-mapped PLY / LAS / raw XYZ readers, PLY and raw writers), Linux only
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_io
+{
+	// read-only memory mapping of a whole file, unmapped when destroyed
+	class mapped_file {
+	public:
+		explicit mapped_file(const std::string&);
+		~mapped_file();
+		mapped_file(const mapped_file&) = delete;
+		mapped_file& operator=(const mapped_file&) = delete;
+
+		const unsigned char* data() const { return m_data; }
+		std::size_t size() const { return m_size; }
+
+	private:
+		const unsigned char* m_data{ nullptr };
+		std::size_t m_size{ 0 };
+	};
+
+	enum format {
+		FORMAT_RAW_XYZ = 0,
+		FORMAT_PLY = 1,
+		FORMAT_LAS = 2
+	};
+
+	// points of a mapped file: xyz points straight into the mapping when the file already stores interleaved float x, y, z
+	// (raw XYZ, PLY with only float x, y, z), otherwise into converted; coordinates are relative to origin
+	struct point_cloud {
+		format source_format{ FORMAT_RAW_XYZ };
+		std::size_t count{ 0 };
+		const float* xyz{ nullptr };
+		std::vector<float> converted;
+		double origin[3]{ 0, 0, 0 };
+
+		bool zero_copy() const { return count > 0 && converted.empty(); }
+	};
+
+	format detect_format(const mapped_file&);
+	void read_points(const mapped_file&, point_cloud&);
+	void read_raw_xyz(const mapped_file&, point_cloud&);
+	void read_ply(const mapped_file&, point_cloud&);
+	void read_las(const mapped_file&, point_cloud&);
+	void write_ply(const std::string&, const double*, const float*, std::size_t, const std::string&, const float*);
+	void write_raw(const std::string&, const float*, std::size_t);
+}
@@ -0,0 +1,434 @@
+#include "mchtr_batch.h"
+#include <cstdint>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MCHTR_BATCH_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic without per-function target flags, GCC and Clang need them
+// GCC would also contract the intrinsics' mul + add into FMA, which breaks bitwise equality with the scalar kernel
+#if defined(MCHTR_BATCH_X86) && defined(__GNUC__) && !defined(__clang__)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#elif defined(MCHTR_BATCH_X86) && !defined(_MSC_VER)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define MCHTR_TARGET_AVX2
+#define MCHTR_TARGET_AVX512
+#endif
+
+/*
+Batched (SIMD) stochastic gradient descent functionality cpp file
+All kernels do the same float operations in the same order (no FMA), so results do not depend on the instruction set used.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	constexpr float xyz_learning_rate = static_cast<float>(mchtr_sgd::xyz_learning_rate);
+	constexpr float r_learning_rate = static_cast<float>(mchtr_sgd::r_learning_rate);
+
+	// early stopping state of a batch, the same for every kernel so lanes stop after the same epoch whatever the instruction set
+	struct lane_convergence {
+		float previous_loss[mchtr_batch::max_lanes];
+		std::int32_t active[mchtr_batch::max_lanes];	// -1 (all bits set, a blend mask) while the lane is fitted, 0 once it has converged
+		int active_lanes;
+
+		explicit lane_convergence(mchtr_batch::lane_spheres& spheres) : active_lanes(mchtr_batch::max_lanes) {
+			for (int lane = 0; lane < mchtr_batch::max_lanes; ++lane) {
+				previous_loss[lane] = 0;
+				active[lane] = -1;
+				spheres.epochs[lane] = 0;
+			}
+		}
+
+		void finish_epoch(const float* loss, float tolerance, mchtr_batch::lane_spheres& spheres) {
+			/*
+			Counts an epoch of every active lane and stops lanes whose loss stopped improving.
+			@param		loss - loss of every lane in the epoch (unused if tolerance is 0)
+						tolerance - early stopping tolerance, see mchtr_sgd::has_converged
+						spheres - epochs of active lanes are incremented
+			*/
+			for (int lane = 0; lane < mchtr_batch::max_lanes; ++lane) {
+				if (!active[lane]) {
+					continue;
+				}
+				if (++spheres.epochs[lane] > 1 && mchtr_sgd::has_converged(previous_loss[lane], loss[lane], tolerance)) {
+					active[lane] = 0;
+					--active_lanes;
+				}
+				previous_loss[lane] = loss[lane];
+			}
+		}
+	};
+}
+
+void mchtr_batch::lane_spheres::cold_start() {
+	/*
+	Starts every lane from the same sphere as mchtr_sgd::fit_sphere (init_sphere near the central point).
+	*/
+	for (int lane = 0; lane < max_lanes; ++lane) {
+		x[lane] = -mchtr_sgd::init_coord_offset;
+		y[lane] = -mchtr_sgd::init_coord_offset;
+		z[lane] = -mchtr_sgd::init_coord_offset;
+		r[lane] = mchtr_sgd::init_radius;
+	}
+}
+
+void mchtr_batch::neighbourhood_batch::reset(int neighbours_count) {
+	/*
+	Empties the batch and prepares it for neighbourhoods of a given size.
+	@param		neighbours_count - number of points in every neighbourhood of the batch
+	*/
+	k = neighbours_count;
+	lanes = 0;
+	xs.resize(static_cast<size_t>(k) * max_lanes);
+	ys.resize(static_cast<size_t>(k) * max_lanes);
+	zs.resize(static_cast<size_t>(k) * max_lanes);
+}
+
+void mchtr_batch::neighbourhood_batch::add(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point, int index) {
+	/*
+	Puts a neighbourhood into the next free lane.
+	@param		data - exactly k points which the sphere will be fit to
+				central_point - the original point whose "data" points are neighbours of
+				index - index of the central point, returned with the result
+	*/
+	const int lane = lanes++;
+	for (int j = 0; j < k; ++j) {
+		xs[j * max_lanes + lane] = data[j].x() - central_point.x();
+		ys[j * max_lanes + lane] = data[j].y() - central_point.y();
+		zs[j * max_lanes + lane] = data[j].z() - central_point.z();
+	}
+	indices[lane] = index;
+}
+
+void mchtr_batch::neighbourhood_batch::pad() {
+	/*
+	Fills unused lanes with a copy of lane 0, so a partial batch can go through the full width kernels.
+	Padded lanes get index -1.
+	*/
+	for (int lane = lanes; lane < max_lanes; ++lane) {
+		for (int j = 0; j < k; ++j) {
+			xs[j * max_lanes + lane] = xs[j * max_lanes];
+			ys[j * max_lanes + lane] = ys[j * max_lanes];
+			zs[j * max_lanes + lane] = zs[j * max_lanes];
+		}
+		indices[lane] = -1;
+	}
+}
+
+mchtr_batch::isa mchtr_batch::detect_isa() {
+	/*
+	Detects the widest instruction set supported by both the CPU and the OS.
+	@return		instruction set to use for fitting
+	*/
+#if defined(MCHTR_BATCH_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return ISA_SCALAR;
+	}
+	__cpuid(info, 1);
+	const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+	if (!os_saves_ymm) {
+		return ISA_SCALAR;
+	}
+	const bool os_saves_zmm = (_xgetbv(0) & 0xe6) == 0xe6;
+	__cpuidex(info, 7, 0);
+	if (os_saves_zmm && (info[1] & (1 << 16)) != 0) {
+		return ISA_AVX512;
+	}
+	if ((info[1] & (1 << 5)) != 0) {
+		return ISA_AVX2;
+	}
+	return ISA_SCALAR;
+#elif defined(MCHTR_BATCH_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return ISA_AVX512;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		return ISA_AVX2;
+	}
+	return ISA_SCALAR;
+#else
+	return ISA_SCALAR;
+#endif
+}
+
+const wchar_t* mchtr_batch::isa_name(isa instruction_set) {
+	/*
+	@param		instruction_set - instruction set
+	@return		printable name of the instruction set
+	*/
+	switch (instruction_set) {
+	case ISA_AVX512:
+		return L"AVX-512";
+	case ISA_AVX2:
+		return L"AVX2";
+	default:
+		return L"scalar";
+	}
+}
+
+void mchtr_batch::find_spheres_r(neighbourhood_batch& batch, float* radii, isa instruction_set) {
+	/*
+	Fits spheres to all neighbourhoods of a batch with the given instruction set.
+	@param		batch - neighbourhoods, unused lanes are padded here
+				radii - output, max_lanes radii of fitted spheres (lane order)
+				instruction_set - result of detect_isa (or narrower)
+	*/
+	mchtr_batch::lane_spheres spheres;
+	mchtr_batch::find_spheres(batch, spheres, instruction_set);
+	for (int lane = 0; lane < max_lanes; ++lane) {
+		radii[lane] = spheres.r[lane];
+	}
+}
+
+void mchtr_batch::find_spheres(neighbourhood_batch& batch, lane_spheres& spheres, isa instruction_set) {
+	/*
+	Fits spheres to all neighbourhoods of a batch with the given instruction set, from init_sphere for all no_epochs.
+	@param		batch - neighbourhoods, unused lanes are padded here
+				spheres - output, fitted spheres (lane order)
+				instruction_set - result of detect_isa (or narrower)
+	*/
+	spheres.cold_start();
+	mchtr_batch::find_spheres(batch, mchtr_sgd::convergence(), spheres, instruction_set);
+}
+
+void mchtr_batch::find_spheres(neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres, isa instruction_set) {
+	/*
+	Fits spheres to all neighbourhoods of a batch with the given instruction set, from given spheres and until they converge.
+	@param		batch - neighbourhoods, unused lanes are padded here
+				stopping - maximum number of epochs and early stopping tolerance
+				spheres - starting spheres of the used lanes going in, fitted spheres (lane order) coming out
+				instruction_set - result of detect_isa (or narrower)
+	*/
+	batch.pad();
+	for (int lane = batch.lanes; lane < max_lanes; ++lane) {
+		spheres.x[lane] = spheres.x[0];
+		spheres.y[lane] = spheres.y[0];
+		spheres.z[lane] = spheres.z[0];
+		spheres.r[lane] = spheres.r[0];
+	}
+	switch (instruction_set) {
+	case ISA_AVX512:
+		mchtr_batch::fit_spheres_avx512(batch, stopping, spheres);
+		break;
+	case ISA_AVX2:
+		mchtr_batch::fit_spheres_avx2(batch, stopping, spheres);
+		break;
+	default:
+		mchtr_batch::fit_spheres_scalar(batch, stopping, spheres);
+		break;
+	}
+}
+
+double mchtr_batch::mean_squared_residual(const neighbourhood_batch& batch, const lane_spheres& spheres, int lane) {
+	/*
+	Calculates the SGD loss of a lane after fitting, the mean squared distance between its points and the sphere surface.
+	@param		batch - fitted neighbourhoods
+				spheres - spheres fitted to them
+				lane - lane to evaluate
+	@return		mean squared point to surface distance
+	*/
+	double sum = 0;
+	for (int j = 0; j < batch.k; ++j) {
+		const double dx = spheres.x[lane] - batch.xs[j * max_lanes + lane];
+		const double dy = spheres.y[lane] - batch.ys[j * max_lanes + lane];
+		const double dz = spheres.z[lane] - batch.zs[j * max_lanes + lane];
+		const double residual = sqrt(dx * dx + dy * dy + dz * dz) - spheres.r[lane];
+		sum += residual * residual;
+	}
+	return batch.k > 0 ? sum / batch.k : 0.0;
+}
+
+void mchtr_batch::fit_spheres_scalar(const neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres) {
+	/*
+	Portable fallback: the same stochastic gradient descent as mchtr_sgd::fit_sphere, for max_lanes spheres in lockstep.
+	Lanes that converged keep their sphere while the others go on.
+	@param		batch - padded neighbourhoods
+				stopping - maximum number of epochs and early stopping tolerance
+				spheres - starting spheres going in, fitted spheres coming out
+	*/
+	float sx[max_lanes], sy[max_lanes], sz[max_lanes], sr[max_lanes];
+	for (int lane = 0; lane < max_lanes; ++lane) {
+		sx[lane] = spheres.x[lane];
+		sy[lane] = spheres.y[lane];
+		sz[lane] = spheres.z[lane];
+		sr[lane] = spheres.r[lane];
+	}
+
+	lane_convergence convergence(spheres);
+	const bool tracking = stopping.tolerance > 0;
+	for (int epoch = 0; epoch < stopping.max_epochs && convergence.active_lanes > 0; ++epoch) {
+		float loss[max_lanes] = {};
+		for (int j = 0; j < batch.k; ++j) {
+			const float* px = &batch.xs[j * max_lanes];
+			const float* py = &batch.ys[j * max_lanes];
+			const float* pz = &batch.zs[j * max_lanes];
+			for (int lane = 0; lane < max_lanes; ++lane) {
+				if (!convergence.active[lane]) {
+					continue;
+				}
+				const float dx = sx[lane] - px[lane];
+				const float dy = sy[lane] - py[lane];
+				const float dz = sz[lane] - pz[lane];
+				const float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+				const float error = distance - sr[lane];
+				if (tracking) {
+					loss[lane] += error * error;
+				}
+
+				// d/dx = 2 * (x - px) * error / distance, same for y and z; d/dr = -2 * error
+				const float gradient_scale = (2.0f * error) / distance;
+				sx[lane] = sx[lane] - xyz_learning_rate * (gradient_scale * dx);
+				sy[lane] = sy[lane] - xyz_learning_rate * (gradient_scale * dy);
+				sz[lane] = sz[lane] - xyz_learning_rate * (gradient_scale * dz);
+				sr[lane] = sr[lane] + r_learning_rate * (2.0f * error);
+			}
+		}
+		convergence.finish_epoch(loss, stopping.tolerance, spheres);
+	}
+
+	for (int lane = 0; lane < max_lanes; ++lane) {
+		spheres.x[lane] = sx[lane];
+		spheres.y[lane] = sy[lane];
+		spheres.z[lane] = sz[lane];
+		spheres.r[lane] = sr[lane];
+	}
+}
+
+#if defined(MCHTR_BATCH_X86)
+
+MCHTR_TARGET_AVX2 void mchtr_batch::fit_spheres_avx2(const neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres) {
+	/*
+	AVX2 kernel: two 8-lane registers per parameter, interleaved so the sqrt/div latency of one hides behind the other.
+	Updates are blended under the lanes' active mask, so converged lanes keep their sphere.
+	@param		batch - padded neighbourhoods
+				stopping - maximum number of epochs and early stopping tolerance
+				spheres - starting spheres going in, fitted spheres coming out
+	*/
+	const __m256 xyz_rate = _mm256_set1_ps(xyz_learning_rate);
+	const __m256 r_rate = _mm256_set1_ps(r_learning_rate);
+	const __m256 two = _mm256_set1_ps(2.0f);
+
+	__m256 sx[2], sy[2], sz[2], sr[2];
+	for (int half = 0; half < 2; ++half) {
+		sx[half] = _mm256_loadu_ps(spheres.x + half * 8);
+		sy[half] = _mm256_loadu_ps(spheres.y + half * 8);
+		sz[half] = _mm256_loadu_ps(spheres.z + half * 8);
+		sr[half] = _mm256_loadu_ps(spheres.r + half * 8);
+	}
+
+	lane_convergence convergence(spheres);
+	const bool tracking = stopping.tolerance > 0;
+	for (int epoch = 0; epoch < stopping.max_epochs && convergence.active_lanes > 0; ++epoch) {
+		__m256 active[2], loss[2];
+		for (int half = 0; half < 2; ++half) {
+			active[half] = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(convergence.active + half * 8)));
+			loss[half] = _mm256_setzero_ps();
+		}
+		for (int j = 0; j < batch.k; ++j) {
+			for (int half = 0; half < 2; ++half) {
+				const int offset = j * max_lanes + half * 8;
+				const __m256 dx = _mm256_sub_ps(sx[half], _mm256_loadu_ps(&batch.xs[offset]));
+				const __m256 dy = _mm256_sub_ps(sy[half], _mm256_loadu_ps(&batch.ys[offset]));
+				const __m256 dz = _mm256_sub_ps(sz[half], _mm256_loadu_ps(&batch.zs[offset]));
+				const __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+				const __m256 error = _mm256_sub_ps(distance, sr[half]);
+				if (tracking) {
+					loss[half] = _mm256_add_ps(loss[half], _mm256_mul_ps(error, error));
+				}
+				const __m256 gradient_scale = _mm256_div_ps(_mm256_mul_ps(two, error), distance);
+				sx[half] = _mm256_blendv_ps(sx[half], _mm256_sub_ps(sx[half], _mm256_mul_ps(xyz_rate, _mm256_mul_ps(gradient_scale, dx))), active[half]);
+				sy[half] = _mm256_blendv_ps(sy[half], _mm256_sub_ps(sy[half], _mm256_mul_ps(xyz_rate, _mm256_mul_ps(gradient_scale, dy))), active[half]);
+				sz[half] = _mm256_blendv_ps(sz[half], _mm256_sub_ps(sz[half], _mm256_mul_ps(xyz_rate, _mm256_mul_ps(gradient_scale, dz))), active[half]);
+				sr[half] = _mm256_blendv_ps(sr[half], _mm256_add_ps(sr[half], _mm256_mul_ps(r_rate, _mm256_mul_ps(two, error))), active[half]);
+			}
+		}
+		float epoch_loss[max_lanes];
+		_mm256_storeu_ps(epoch_loss, loss[0]);
+		_mm256_storeu_ps(epoch_loss + 8, loss[1]);
+		convergence.finish_epoch(epoch_loss, stopping.tolerance, spheres);
+	}
+
+	for (int half = 0; half < 2; ++half) {
+		_mm256_storeu_ps(spheres.x + half * 8, sx[half]);
+		_mm256_storeu_ps(spheres.y + half * 8, sy[half]);
+		_mm256_storeu_ps(spheres.z + half * 8, sz[half]);
+		_mm256_storeu_ps(spheres.r + half * 8, sr[half]);
+	}
+}
+
+MCHTR_TARGET_AVX512 void mchtr_batch::fit_spheres_avx512(const neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres) {
+	/*
+	AVX-512 kernel: one 16-lane register per parameter, converged lanes are masked out of the updates.
+	@param		batch - padded neighbourhoods
+				stopping - maximum number of epochs and early stopping tolerance
+				spheres - starting spheres going in, fitted spheres coming out
+	*/
+	const __m512 xyz_rate = _mm512_set1_ps(xyz_learning_rate);
+	const __m512 r_rate = _mm512_set1_ps(r_learning_rate);
+	const __m512 two = _mm512_set1_ps(2.0f);
+
+	__m512 sx = _mm512_loadu_ps(spheres.x);
+	__m512 sy = _mm512_loadu_ps(spheres.y);
+	__m512 sz = _mm512_loadu_ps(spheres.z);
+	__m512 sr = _mm512_loadu_ps(spheres.r);
+
+	lane_convergence convergence(spheres);
+	const bool tracking = stopping.tolerance > 0;
+	for (int epoch = 0; epoch < stopping.max_epochs && convergence.active_lanes > 0; ++epoch) {
+		__mmask16 active = 0;
+		for (int lane = 0; lane < max_lanes; ++lane) {
+			active |= convergence.active[lane] ? static_cast<__mmask16>(1u << lane) : 0;
+		}
+		__m512 loss = _mm512_setzero_ps();
+		for (int j = 0; j < batch.k; ++j) {
+			const int offset = j * max_lanes;
+			const __m512 dx = _mm512_sub_ps(sx, _mm512_loadu_ps(&batch.xs[offset]));
+			const __m512 dy = _mm512_sub_ps(sy, _mm512_loadu_ps(&batch.ys[offset]));
+			const __m512 dz = _mm512_sub_ps(sz, _mm512_loadu_ps(&batch.zs[offset]));
+			const __m512 distance = _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)), _mm512_mul_ps(dz, dz)));
+			const __m512 error = _mm512_sub_ps(distance, sr);
+			if (tracking) {
+				loss = _mm512_add_ps(loss, _mm512_mul_ps(error, error));
+			}
+			const __m512 gradient_scale = _mm512_div_ps(_mm512_mul_ps(two, error), distance);
+			sx = _mm512_mask_sub_ps(sx, active, sx, _mm512_mul_ps(xyz_rate, _mm512_mul_ps(gradient_scale, dx)));
+			sy = _mm512_mask_sub_ps(sy, active, sy, _mm512_mul_ps(xyz_rate, _mm512_mul_ps(gradient_scale, dy)));
+			sz = _mm512_mask_sub_ps(sz, active, sz, _mm512_mul_ps(xyz_rate, _mm512_mul_ps(gradient_scale, dz)));
+			sr = _mm512_mask_add_ps(sr, active, sr, _mm512_mul_ps(r_rate, _mm512_mul_ps(two, error)));
+		}
+		float epoch_loss[max_lanes];
+		_mm512_storeu_ps(epoch_loss, loss);
+		convergence.finish_epoch(epoch_loss, stopping.tolerance, spheres);
+	}
+
+	_mm512_storeu_ps(spheres.x, sx);
+	_mm512_storeu_ps(spheres.y, sy);
+	_mm512_storeu_ps(spheres.z, sz);
+	_mm512_storeu_ps(spheres.r, sr);
+}
+
+#else
+
+void mchtr_batch::fit_spheres_avx2(const neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres) {
+	// not an x86 build, detect_isa never selects this
+	mchtr_batch::fit_spheres_scalar(batch, stopping, spheres);
+}
+
+void mchtr_batch::fit_spheres_avx512(const neighbourhood_batch& batch, const mchtr_sgd::convergence& stopping, lane_spheres& spheres) {
+	// not an x86 build, detect_isa never selects this
+	mchtr_batch::fit_spheres_scalar(batch, stopping, spheres);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include "mchtr_geometry.h"
+#include "mchtr_sgd.h"
+
+/*
+Batched (SIMD) stochastic gradient descent functionality header file
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_batch
+{
+	// neighbourhoods fitted in lockstep, 16 float lanes = one AVX-512 register or two AVX2 registers
+	constexpr int max_lanes = 16;
+
+	enum isa {
+		ISA_SCALAR = 0,
+		ISA_AVX2 = 1,
+		ISA_AVX512 = 2
+	};
+
+	// neighbourhoods in structure-of-arrays layout: coordinate of point j of lane l is at [j * max_lanes + l],
+	// stored relative to the lane's central point so float precision does not depend on the cloud's position
+	struct neighbourhood_batch {
+		int k{ 0 };
+		int lanes{ 0 };
+		std::vector<float> xs, ys, zs;
+		int indices[max_lanes];
+
+		void reset(int);
+		bool full() const { return lanes == max_lanes; }
+		void add(const std::vector<mchtr_geometry::point3>&, const mchtr_geometry::point3&, int);
+		void pad();
+	};
+
+	// spheres of a batch, one per lane, centres relative to the lane's central point: the starting spheres going in, the fitted ones coming out
+	struct lane_spheres {
+		float x[max_lanes], y[max_lanes], z[max_lanes], r[max_lanes];
+		int epochs[max_lanes];	// output, epochs each lane ran
+
+		void cold_start();
+	};
+
+	isa detect_isa();
+	const wchar_t* isa_name(isa);
+	void find_spheres_r(neighbourhood_batch&, float*, isa);
+	void find_spheres(neighbourhood_batch&, lane_spheres&, isa);
+	void find_spheres(neighbourhood_batch&, const mchtr_sgd::convergence&, lane_spheres&, isa);
+	double mean_squared_residual(const neighbourhood_batch&, const lane_spheres&, int);
+	void fit_spheres_scalar(const neighbourhood_batch&, const mchtr_sgd::convergence&, lane_spheres&);
+	void fit_spheres_avx2(const neighbourhood_batch&, const mchtr_sgd::convergence&, lane_spheres&);
+	void fit_spheres_avx512(const neighbourhood_batch&, const mchtr_sgd::convergence&, lane_spheres&);
+}
@@ -0,0 +1,386 @@
+#include "mchtr_cache.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+Persistent cache functionality cpp file: versioned binary files in a directory, one per entry, keyed by a fingerprint of the cloud's
+coordinates and a hash of the parameters the entry was computed with, memory-mapped when read so later runs can use them without copying
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// start of every cache file; sections follow it, each starting at a multiple of section_alignment
+	struct file_header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t byte_order;		// byte_order_mark as the writing machine stored it
+		std::uint32_t kind;
+		std::uint32_t sections_count;
+		std::uint64_t fingerprint;
+		std::uint64_t parameters;
+		std::uint64_t count;
+		std::uint64_t tag;
+		std::uint64_t section_bytes[mchtr_cache::max_sections];
+	};
+
+	constexpr char file_magic[8] = { 'M', 'C', 'H', 'T', 'R', 'C', 'C', 'H' };
+	constexpr std::uint32_t byte_order_mark = 0x01020304;
+	constexpr std::uint64_t section_alignment = 64;
+	const char* const kind_names[] = { "knn_graph", "smoothed", "surfaces", "curvatures" };
+
+	std::uint64_t aligned(std::uint64_t bytes) {
+		/*
+		@param		bytes - size of a header or section
+		@return		bytes rounded up to section_alignment
+		*/
+		return (bytes + section_alignment - 1) / section_alignment * section_alignment;
+	}
+
+	std::string hex(std::uint64_t value) {
+		/*
+		@param		value - key part
+		@return		value as 16 lowercase hexadecimal digits
+		*/
+		char digits[17];
+		std::snprintf(digits, sizeof(digits), "%016llx", static_cast<unsigned long long>(value));
+		return digits;
+	}
+
+	std::string unique_suffix() {
+		/*
+		@return		suffix of a temporary file no other writer (thread or process) uses at the same time
+		*/
+		static std::atomic<std::uint64_t> counter{ 0 };
+		const std::uint64_t ticks = static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		int local = 0;
+		return hex(ticks ^ reinterpret_cast<std::uintptr_t>(&local)) + hex(counter++);
+	}
+
+#if !defined(_WIN32)
+	std::string utf8(const std::wstring& path) {
+		/*
+		@param		path - wide path (as plugin parameters come)
+		@return		the path in UTF-8, as narrow paths are elsewhere
+		*/
+		std::string narrow;
+		for (wchar_t character : path) {
+			const std::uint32_t code = static_cast<std::uint32_t>(character);
+			if (code < 0x80) {
+				narrow += static_cast<char>(code);
+			}
+			else if (code < 0x800) {
+				narrow += static_cast<char>(0xc0 | (code >> 6));
+				narrow += static_cast<char>(0x80 | (code & 0x3f));
+			}
+			else if (code < 0x10000) {
+				narrow += static_cast<char>(0xe0 | (code >> 12));
+				narrow += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+				narrow += static_cast<char>(0x80 | (code & 0x3f));
+			}
+			else {
+				narrow += static_cast<char>(0xf0 | (code >> 18));
+				narrow += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+				narrow += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+				narrow += static_cast<char>(0x80 | (code & 0x3f));
+			}
+		}
+		return narrow;
+	}
+#endif
+}
+
+mchtr_cache::parameters& mchtr_cache::parameters::add(std::uint64_t value) {
+	/*
+	@param		value - next parameter
+	@return		this, to chain calls
+	*/
+	for (int byte = 0; byte < 8; ++byte) {
+		m_hash = (m_hash ^ ((value >> (8 * byte)) & 0xff)) * 1099511628211ull;
+	}
+	return *this;
+}
+
+mchtr_cache::parameters& mchtr_cache::parameters::add(float value) {
+	/*
+	@param		value - next parameter, added by its bit pattern
+	@return		this, to chain calls
+	*/
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return add(static_cast<std::uint64_t>(bits));
+}
+
+mchtr_cache::mapping::~mapping() {
+	if (!m_data) {
+		return;
+	}
+#if defined(_WIN32)
+	::UnmapViewOfFile(m_data);
+#else
+	::munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+}
+
+mchtr_cache::store::store(const std::string& directory) {
+	/*
+	Opens a cache directory, creating it (one level) if it doesn't exist yet.
+	@param		directory - path of the directory, UTF-8
+	*/
+#if defined(_WIN32)
+	const int length = ::MultiByteToWideChar(CP_UTF8, 0, directory.c_str(), static_cast<int>(directory.size()), nullptr, 0);
+	m_directory.resize(length);
+	if (length > 0) {
+		::MultiByteToWideChar(CP_UTF8, 0, directory.c_str(), static_cast<int>(directory.size()), &m_directory[0], length);
+	}
+	::CreateDirectoryW(m_directory.c_str(), nullptr);
+#else
+	m_directory = directory;
+	::mkdir(m_directory.c_str(), 0777);
+#endif
+}
+
+mchtr_cache::store::store(const std::wstring& directory) {
+	/*
+	Opens a cache directory given as a wide path (as plugin parameters come), creating it (one level) if it doesn't exist yet.
+	@param		directory - path of the directory
+	*/
+#if defined(_WIN32)
+	m_directory = directory;
+	::CreateDirectoryW(m_directory.c_str(), nullptr);
+#else
+	m_directory = utf8(directory);
+	::mkdir(m_directory.c_str(), 0777);
+#endif
+}
+
+mchtr_cache::store::native_path mchtr_cache::store::file_name(int kind, std::uint64_t fingerprint, std::uint64_t parameters) const {
+	/*
+	@param		kind - one of mchtr_cache::kind
+				fingerprint - fingerprint of the coordinates the entry was computed from
+				parameters - hash of the parameters it was computed with
+	@return		path of the entry's file, e.g. <directory>/surfaces_<fingerprint>_<parameters>.mchtr
+	*/
+	const std::string name = std::string(kind_names[kind]) + "_" + hex(fingerprint) + "_" + hex(parameters) + ".mchtr";
+	native_path path = m_directory;
+	if (!path.empty() && path.back() != '/' && path.back() != '\\') {
+		path += '/';
+	}
+
+	// the name is plain ASCII either way
+	return path + native_path(name.begin(), name.end());
+}
+
+std::shared_ptr<const mchtr_cache::mapping> mchtr_cache::store::map(const native_path& path) {
+	/*
+	Maps a whole file into memory, read only.
+	@param		path - file to map
+	@return		the mapping, nullptr if the file doesn't exist, is empty or can't be mapped
+	*/
+	std::shared_ptr<mapping> file = std::make_shared<mapping>();
+#if defined(_WIN32)
+	const HANDLE handle = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	if (!::GetFileSizeEx(handle, &size) || size.QuadPart <= 0) {
+		::CloseHandle(handle);
+		return nullptr;
+	}
+	const HANDLE section = ::CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	::CloseHandle(handle);
+	if (!section) {
+		return nullptr;
+	}
+	const void* view = ::MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+
+	// the view stays valid without the handles
+	::CloseHandle(section);
+	if (!view) {
+		return nullptr;
+	}
+	file->m_data = static_cast<const unsigned char*>(view);
+	file->m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+	const int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return nullptr;
+	}
+	struct stat status;
+	if (::fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+		::close(descriptor);
+		return nullptr;
+	}
+	void* view = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+
+	// the mapping stays valid without the descriptor
+	::close(descriptor);
+	if (view == MAP_FAILED) {
+		return nullptr;
+	}
+	file->m_data = static_cast<const unsigned char*>(view);
+	file->m_size = static_cast<std::size_t>(status.st_size);
+#endif
+	return file;
+}
+
+bool mchtr_cache::store::find(int kind, std::uint64_t fingerprint, std::uint64_t parameters, mchtr_cache::entry& found) {
+	/*
+	Looks an entry up and maps its file. A file of another format version or byte order, for other coordinates or parameters
+	(a hash collision of the name) or cut short counts as a miss.
+	@param		kind - one of mchtr_cache::kind
+				fingerprint - fingerprint of the current coordinates, see mchtr_knn_graph::fingerprint
+				parameters - hash of the parameters the caller needs the entry for
+				found - output, the entry if there is one
+	@return		true if the entry was found
+	*/
+	const std::shared_ptr<const mapping> file = map(file_name(kind, fingerprint, parameters));
+	file_header header;
+	bool valid = file && file->size() >= sizeof(header);
+	if (valid) {
+		std::memcpy(&header, file->data(), sizeof(header));
+		valid = std::memcmp(header.magic, file_magic, sizeof(file_magic)) == 0 && header.version == format_version && header.byte_order == byte_order_mark &&
+			header.kind == static_cast<std::uint32_t>(kind) && header.fingerprint == fingerprint && header.parameters == parameters &&
+			header.sections_count <= static_cast<std::uint32_t>(max_sections);
+	}
+	if (valid) {
+		std::uint64_t offset = aligned(sizeof(header));
+		found = entry();
+		for (std::uint32_t section = 0; section < header.sections_count && valid; ++section) {
+			valid = header.section_bytes[section] <= file->size() && offset <= file->size() - header.section_bytes[section];
+			found.sections[section] = file->data() + offset;
+			found.section_bytes[section] = header.section_bytes[section];
+			offset += aligned(header.section_bytes[section]);
+		}
+		found.file = file;
+		found.count = header.count;
+		found.tag = header.tag;
+		found.sections_count = static_cast<int>(header.sections_count);
+	}
+	if (!valid) {
+		found = entry();
+		++m_stats.misses;
+		return false;
+	}
+	++m_stats.hits;
+	return true;
+}
+
+bool mchtr_cache::store::save(int kind, std::uint64_t fingerprint, std::uint64_t parameters, std::uint64_t count, std::uint64_t tag,
+	const void* const* sections, const std::uint64_t* section_bytes, int sections_count) {
+	/*
+	Writes an entry, replacing the previous one with the same key. The file is written under a temporary name and renamed,
+	so a run reading the cache at the same time sees either the old or the new file, never a partial one.
+	@param		kind - one of mchtr_cache::kind
+				fingerprint - fingerprint of the coordinates the entry was computed from
+				parameters - hash of the parameters it was computed with
+				count - number of points (or floats of a plain array) the entry is for
+				tag - kind specific value, K of a KNN graph
+				sections, section_bytes - arrays the entry is made of and their sizes in bytes
+				sections_count - number of arrays, at most max_sections
+	@return		true if the entry was written
+	*/
+	file_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, file_magic, sizeof(file_magic));
+	header.version = format_version;
+	header.byte_order = byte_order_mark;
+	header.kind = static_cast<std::uint32_t>(kind);
+	header.sections_count = static_cast<std::uint32_t>(sections_count);
+	header.fingerprint = fingerprint;
+	header.parameters = parameters;
+	header.count = count;
+	header.tag = tag;
+	for (int section = 0; section < sections_count; ++section) {
+		header.section_bytes[section] = section_bytes[section];
+	}
+
+	const native_path path = file_name(kind, fingerprint, parameters);
+	const std::string suffix = "." + unique_suffix() + ".tmp";
+	const native_path temporary = path + native_path(suffix.begin(), suffix.end());
+	bool written = sections_count <= max_sections;
+	if (written) {
+		std::ofstream file(temporary, std::ios::binary);
+		const std::vector<char> padding(section_alignment, 0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(padding.data(), static_cast<std::streamsize>(aligned(sizeof(header)) - sizeof(header)));
+		for (int section = 0; section < sections_count; ++section) {
+			file.write(static_cast<const char*>(sections[section]), static_cast<std::streamsize>(section_bytes[section]));
+			file.write(padding.data(), static_cast<std::streamsize>(aligned(section_bytes[section]) - section_bytes[section]));
+		}
+		file.close();
+		written = static_cast<bool>(file);
+	}
+#if defined(_WIN32)
+
+	// fails while another run still has the old file mapped, the old entry then stays
+	written = written && ::MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+	if (!written) {
+		::DeleteFileW(temporary.c_str());
+	}
+#else
+	written = written && std::rename(temporary.c_str(), path.c_str()) == 0;
+	if (!written) {
+		std::remove(temporary.c_str());
+	}
+#endif
+	++(written ? m_stats.writes : m_stats.failed_writes);
+	return written;
+}
+
+bool mchtr_cache::store::load_values(int kind, std::uint64_t fingerprint, std::uint64_t parameters, std::size_t count, float* values) {
+	/*
+	Reads an entry made of one array of floats, e.g. curvatures of every point.
+	@param		kind - one of mchtr_cache::kind
+				fingerprint - fingerprint of the current coordinates
+				parameters - hash of the parameters the caller needs the values for
+				count - number of floats expected
+				values - output, count floats, untouched on a miss
+	@return		true if the entry was found and holds count floats
+	*/
+	mchtr_cache::entry found;
+	if (!find(kind, fingerprint, parameters, found)) {
+		return false;
+	}
+	if (found.sections_count != 1 || found.section_bytes[0] != count * sizeof(float)) {
+		--m_stats.hits;
+		++m_stats.misses;
+		return false;
+	}
+	std::memcpy(values, found.sections[0], count * sizeof(float));
+	return true;
+}
+
+bool mchtr_cache::store::save_values(int kind, std::uint64_t fingerprint, std::uint64_t parameters, std::size_t count, const float* values) {
+	/*
+	Writes an entry made of one array of floats.
+	@param		kind - one of mchtr_cache::kind
+				fingerprint - fingerprint of the coordinates the values were computed from
+				parameters - hash of the parameters they were computed with
+				count - number of floats
+				values - the floats
+	@return		true if the entry was written
+	*/
+	const void* sections[1] = { values };
+	const std::uint64_t bytes[1] = { count * sizeof(float) };
+	return save(kind, fingerprint, parameters, count, 0, sections, bytes, 1);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+Persistent cache functionality header file: versioned binary files in a directory, one per entry, keyed by a fingerprint of the cloud's
+coordinates and a hash of the parameters the entry was computed with, memory-mapped when read so later runs can use them without copying
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_cache
+{
+	// bumped whenever the layout of a file or of an entry changes, files of other versions are ignored (and overwritten)
+	constexpr std::uint32_t format_version = 1;
+
+	// what an entry holds, part of its file name
+	enum kind {
+		KIND_KNN_GRAPH = 0,		// KNN graph rows (CSR offsets and indices), see mchtr_knn_graph
+		KIND_SMOOTHED = 1,		// smoothed coordinates, 3 floats per point
+		KIND_SURFACES = 2,		// normals and surface variations, 4 floats per point
+		KIND_CURVATURES = 3		// curvature of the fitted spheres, 1 float per point
+	};
+
+	// sections (arrays) of one entry at most
+	constexpr int max_sections = 2;
+
+	// hash of the parameters an entry depends on (FNV-1a), every value is added as 64 bits
+	class parameters {
+	public:
+		parameters& add(std::uint64_t);
+		parameters& add(int value) { return add(static_cast<std::uint64_t>(static_cast<std::int64_t>(value))); }
+		parameters& add(bool value) { return add(static_cast<std::uint64_t>(value ? 1 : 0)); }
+		parameters& add(float);
+		std::uint64_t value() const { return m_hash; }
+
+	private:
+		std::uint64_t m_hash{ 14695981039346656037ull };
+	};
+
+	// read-only memory mapping of a whole file, unmapped when destroyed
+	class mapping {
+	public:
+		mapping() = default;
+		~mapping();
+		mapping(const mapping&) = delete;
+		mapping& operator=(const mapping&) = delete;
+
+		const unsigned char* data() const { return m_data; }
+		std::size_t size() const { return m_size; }
+
+	private:
+		friend class store;
+		const unsigned char* m_data{ nullptr };
+		std::size_t m_size{ 0 };
+	};
+
+	// an entry found in the cache: its sections point into the mapping, which stays mapped as long as anything holds file
+	struct entry {
+		std::shared_ptr<const mapping> file;
+		std::uint64_t count{ 0 };		// points (or floats of a plain array) the entry is for
+		std::uint64_t tag{ 0 };			// kind specific, K of a KNN graph
+		int sections_count{ 0 };
+		const unsigned char* sections[max_sections]{ nullptr, nullptr };
+		std::uint64_t section_bytes[max_sections]{ 0, 0 };
+	};
+
+	// what the cache did during a run, for reporting
+	struct statistics {
+		std::size_t hits{ 0 };
+		std::size_t misses{ 0 };
+		std::size_t writes{ 0 };
+		std::size_t failed_writes{ 0 };		// entries that couldn't be written (no space, read-only directory, file mapped by another run...)
+	};
+
+	// a cache directory; reading and writing never throw, a missing, damaged or foreign file is just a miss and a failed write is only counted,
+	// so a run with a broken cache does all the work itself
+	class store {
+	public:
+		explicit store(const std::string&);
+		explicit store(const std::wstring&);
+
+		bool find(int, std::uint64_t, std::uint64_t, entry&);
+		bool save(int, std::uint64_t, std::uint64_t, std::uint64_t, std::uint64_t, const void* const*, const std::uint64_t*, int);
+		bool load_values(int, std::uint64_t, std::uint64_t, std::size_t, float*);
+		bool save_values(int, std::uint64_t, std::uint64_t, std::size_t, const float*);
+		const statistics& stats() const { return m_stats; }
+
+	private:
+#if defined(_WIN32)
+		using native_path = std::wstring;
+#else
+		using native_path = std::string;
+#endif
+		native_path file_name(int, std::uint64_t, std::uint64_t) const;
+		static std::shared_ptr<const mapping> map(const native_path&);
+
+		native_path m_directory;
+		statistics m_stats;
+	};
+}
@@ -0,0 +1,401 @@
+#include "mchtr_crop.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MCHTR_CROP_X86
+#include <immintrin.h>
+#endif
+
+// MSVC accepts any intrinsic without per-function target flags, GCC and Clang need them
+// no FMA contraction, so every kernel rounds the squared distances the same way and whole-block decisions agree with them
+#if defined(MCHTR_CROP_X86) && defined(__GNUC__) && !defined(__clang__)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#elif defined(MCHTR_CROP_X86) && !defined(_MSC_VER)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define MCHTR_TARGET_AVX2
+#define MCHTR_TARGET_AVX512
+#endif
+
+/*
+Region cropping functionality cpp file
+Distances are compared squared, in double precision like the plugin's original CalcPointToPointDistance3D test.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	bool outside_point(const float* point, const mchtr_crop::region& kept) {
+		/*
+		@param		point - x, y, z of a point
+					kept - the kept region
+		@return		true if the point lies outside the region
+		*/
+		const double dx = static_cast<double>(point[0]) - kept.centre[0];
+		const double dy = static_cast<double>(point[1]) - kept.centre[1];
+		const double dz = static_cast<double>(point[2]) - kept.centre[2];
+		switch (kept.shape) {
+		case mchtr_crop::SHAPE_CYLINDER:
+			return dx * dx + dy * dy > kept.radius * kept.radius;
+		case mchtr_crop::SHAPE_BOX:
+			return std::fabs(dx) > kept.half_size[0] || std::fabs(dy) > kept.half_size[1] || std::fabs(dz) > kept.half_size[2];
+		default:
+			return dx * dx + dy * dy + dz * dz > kept.radius * kept.radius;
+		}
+	}
+
+	// whole-block decision
+	enum block_side {
+		BLOCK_INSIDE,
+		BLOCK_OUTSIDE,
+		BLOCK_SPLIT
+	};
+
+	block_side classify_block(const float* bounds, const mchtr_crop::region& kept) {
+		/*
+		Decides a block by the bounds of its points. Rounding is monotone, so a point's squared distance is never above the farthest corner's
+		or below the nearest's, and the decision always matches the per point test. Bounds with a non-finite point are NaN, the block is split.
+		@param		bounds - min x, y, z, max x, y, z of the block's points
+					kept - the kept region
+		@return		BLOCK_INSIDE or BLOCK_OUTSIDE if all points of the block are on that side, BLOCK_SPLIT otherwise
+		*/
+		double nearest[3], farthest[3];
+		bool box_inside = true;
+		bool box_outside = false;
+		for (int axis = 0; axis < 3; ++axis) {
+			const double low = static_cast<double>(bounds[axis]) - kept.centre[axis];
+			const double high = static_cast<double>(bounds[3 + axis]) - kept.centre[axis];
+			farthest[axis] = std::max(low * low, high * high);
+			nearest[axis] = low <= 0 && high >= 0 ? 0.0 : std::min(low * low, high * high);
+			box_inside = box_inside && std::fabs(low) <= kept.half_size[axis] && std::fabs(high) <= kept.half_size[axis];
+			box_outside = box_outside || low > kept.half_size[axis] || high < -kept.half_size[axis];
+		}
+		const double radius_squared = kept.radius * kept.radius;
+		bool inside = false;
+		bool outside = false;
+		switch (kept.shape) {
+		case mchtr_crop::SHAPE_CYLINDER:
+			inside = farthest[0] + farthest[1] <= radius_squared;
+			outside = nearest[0] + nearest[1] > radius_squared;
+			break;
+		case mchtr_crop::SHAPE_BOX:
+			inside = box_inside;
+			outside = box_outside;
+			break;
+		default:
+			inside = farthest[0] + farthest[1] + farthest[2] <= radius_squared;
+			outside = nearest[0] + nearest[1] + nearest[2] > radius_squared;
+			break;
+		}
+		return inside ? BLOCK_INSIDE : (outside ? BLOCK_OUTSIDE : BLOCK_SPLIT);
+	}
+}
+
+void mchtr_crop::blocks::build(const float* xyz, std::size_t points_count, std::uint64_t coordinates_fingerprint, int threads) {
+	/*
+	Records the bounds of every block_size consecutive points, blocks in parallel.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				coordinates_fingerprint - fingerprint of the coordinates, kept for valid_for
+				threads - number of workers, 0 means all cores
+	*/
+	fingerprint = coordinates_fingerprint;
+	m_points_count = points_count;
+	m_bounds.assign(6 * ((points_count + block_size - 1) / block_size), 0.0f);
+	mchtr_parallel::run_chunks(points_count, block_size, mchtr_parallel::resolve_threads(threads),
+		[&](std::size_t begin, std::size_t end, int) {
+			float* bounds = m_bounds.data() + 6 * (begin / block_size);
+			bool finite = true;
+			for (int axis = 0; axis < 3; ++axis) {
+				bounds[axis] = std::numeric_limits<float>::infinity();
+				bounds[3 + axis] = -std::numeric_limits<float>::infinity();
+			}
+			for (std::size_t i = begin; i < end; ++i) {
+				for (int axis = 0; axis < 3; ++axis) {
+					const float value = xyz[3 * i + axis];
+					finite = finite && std::isfinite(value);
+					bounds[axis] = std::min(bounds[axis], value);
+					bounds[3 + axis] = std::max(bounds[3 + axis], value);
+				}
+			}
+			if (!finite) {
+				std::fill(bounds, bounds + 6, std::numeric_limits<float>::quiet_NaN());
+			}
+		},
+		[](std::size_t) {});
+}
+
+const wchar_t* mchtr_crop::validate(const mchtr_crop::region& kept) {
+	/*
+	@param		kept - user supplied region
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (kept.shape != SHAPE_SPHERE && kept.shape != SHAPE_CYLINDER && kept.shape != SHAPE_BOX) {
+		return L"Unknown region shape, use 0 (sphere), 1 (vertical cylinder) or 2 (box).";
+	}
+	if (kept.shape != SHAPE_BOX && !(kept.radius >= 1)) {
+		return L"Pancake range cannot be lower than 1.";
+	}
+	if (kept.shape == SHAPE_BOX && !(kept.half_size[0] > 0 && kept.half_size[1] > 0 && kept.half_size[2] > 0)) {
+		return L"Box size must be above 0 along every axis.";
+	}
+	return nullptr;
+}
+
+std::size_t mchtr_crop::classify(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, mchtr_batch::isa instruction_set, unsigned char* outside) {
+	/*
+	Marks the points outside the region with the given instruction set, all of them give the same marks.
+	@param		xyz - coordinates of the points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				kept - the kept region
+				instruction_set - result of mchtr_batch::detect_isa (or narrower)
+				outside - output, points_count marks, 1 outside the region, 0 inside
+	@return		number of points outside
+	*/
+	switch (instruction_set) {
+	case mchtr_batch::ISA_AVX512:
+		return mchtr_crop::classify_avx512(xyz, points_count, kept, outside);
+	case mchtr_batch::ISA_AVX2:
+		return mchtr_crop::classify_avx2(xyz, points_count, kept, outside);
+	default:
+		return mchtr_crop::classify_scalar(xyz, points_count, kept, outside);
+	}
+}
+
+std::size_t mchtr_crop::classify_scalar(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, unsigned char* outside) {
+	/*
+	Portable kernel, also finishes the tails of the SIMD ones.
+	@param		xyz, points_count, kept, outside - see classify
+	@return		number of points outside
+	*/
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		outside[i] = outside_point(xyz + 3 * i, kept) ? 1 : 0;
+		count += outside[i];
+	}
+	return count;
+}
+
+#if defined(MCHTR_CROP_X86)
+
+namespace
+{
+	MCHTR_TARGET_AVX2 int outside_mask_avx2(__m256d dx, __m256d dy, __m256d dz, const mchtr_crop::region& kept) {
+		/*
+		@param		dx, dy, dz - offsets of 4 points from the region's centre
+					kept - the kept region
+		@return		4 bit mask of the points outside
+		*/
+		if (kept.shape == mchtr_crop::SHAPE_BOX) {
+			const __m256d sign = _mm256_set1_pd(-0.0);
+			const __m256d beyond_x = _mm256_cmp_pd(_mm256_andnot_pd(sign, dx), _mm256_set1_pd(kept.half_size[0]), _CMP_GT_OQ);
+			const __m256d beyond_y = _mm256_cmp_pd(_mm256_andnot_pd(sign, dy), _mm256_set1_pd(kept.half_size[1]), _CMP_GT_OQ);
+			const __m256d beyond_z = _mm256_cmp_pd(_mm256_andnot_pd(sign, dz), _mm256_set1_pd(kept.half_size[2]), _CMP_GT_OQ);
+			return _mm256_movemask_pd(_mm256_or_pd(_mm256_or_pd(beyond_x, beyond_y), beyond_z));
+		}
+		__m256d distance = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+		if (kept.shape == mchtr_crop::SHAPE_SPHERE) {
+			distance = _mm256_add_pd(distance, _mm256_mul_pd(dz, dz));
+		}
+		return _mm256_movemask_pd(_mm256_cmp_pd(distance, _mm256_set1_pd(kept.radius * kept.radius), _CMP_GT_OQ));
+	}
+}
+
+MCHTR_TARGET_AVX2 std::size_t mchtr_crop::classify_avx2(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, unsigned char* outside) {
+	/*
+	AVX2 kernel: 8 points per step, three loads deinterleaved into x, y and z by shuffles, compared as 2 x 4 doubles.
+	@param		xyz, points_count, kept, outside - see classify
+	@return		number of points outside
+	*/
+	const __m256d centre_x = _mm256_set1_pd(kept.centre[0]);
+	const __m256d centre_y = _mm256_set1_pd(kept.centre[1]);
+	const __m256d centre_z = _mm256_set1_pd(kept.centre[2]);
+	std::size_t count = 0;
+	std::size_t i = 0;
+	for (; i + 8 <= points_count; i += 8) {
+
+		// 128 bit lanes hold points 0-3 and 4-7, both deinterleaved the same way
+		const float* points = xyz + 3 * i;
+		const __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(points)), _mm_loadu_ps(points + 12), 1);
+		const __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(points + 4)), _mm_loadu_ps(points + 16), 1);
+		const __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(points + 8)), _mm_loadu_ps(points + 20), 1);
+		const __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+		const __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+		const __m256 x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+		const __m256 y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+		const __m256 z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+
+		const int low = outside_mask_avx2(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), centre_x),
+			_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(y)), centre_y), _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(z)), centre_z), kept);
+		const int high = outside_mask_avx2(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), centre_x),
+			_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(y, 1)), centre_y), _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(z, 1)), centre_z), kept);
+		const int mask = low | (high << 4);
+		for (int lane = 0; lane < 8; ++lane) {
+			outside[i + lane] = static_cast<unsigned char>((mask >> lane) & 1);
+			count += outside[i + lane];
+		}
+	}
+	return count + mchtr_crop::classify_scalar(xyz + 3 * i, points_count - i, kept, outside + i);
+}
+
+namespace
+{
+	MCHTR_TARGET_AVX512 __mmask8 outside_mask_avx512(__m512d dx, __m512d dy, __m512d dz, const mchtr_crop::region& kept) {
+		/*
+		@param		dx, dy, dz - offsets of 8 points from the region's centre
+					kept - the kept region
+		@return		8 bit mask of the points outside
+		*/
+		if (kept.shape == mchtr_crop::SHAPE_BOX) {
+			const __m512d sign = _mm512_set1_pd(-0.0);
+			const __m512d abs_x = _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(sign), _mm512_castpd_si512(dx)));
+			const __m512d abs_y = _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(sign), _mm512_castpd_si512(dy)));
+			const __m512d abs_z = _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_castpd_si512(sign), _mm512_castpd_si512(dz)));
+			return static_cast<__mmask8>(_mm512_cmp_pd_mask(abs_x, _mm512_set1_pd(kept.half_size[0]), _CMP_GT_OQ) |
+				_mm512_cmp_pd_mask(abs_y, _mm512_set1_pd(kept.half_size[1]), _CMP_GT_OQ) | _mm512_cmp_pd_mask(abs_z, _mm512_set1_pd(kept.half_size[2]), _CMP_GT_OQ));
+		}
+		__m512d distance = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+		if (kept.shape == mchtr_crop::SHAPE_SPHERE) {
+			distance = _mm512_add_pd(distance, _mm512_mul_pd(dz, dz));
+		}
+		return _mm512_cmp_pd_mask(distance, _mm512_set1_pd(kept.radius * kept.radius), _CMP_GT_OQ);
+	}
+
+	MCHTR_TARGET_AVX512 __m256 upper_half(__m512 values) {
+		// AVX-512F alone has no 256 bit float extract, the double one moves the same bits
+		return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(values), 1));
+	}
+}
+
+MCHTR_TARGET_AVX512 std::size_t mchtr_crop::classify_avx512(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, unsigned char* outside) {
+	/*
+	AVX-512 kernel: 16 points per step, three loads deinterleaved into x, y and z by two-source permutes, compared as 2 x 8 doubles.
+	@param		xyz, points_count, kept, outside - see classify
+	@return		number of points outside
+	*/
+	// x of point p is float 3p of the 48: the first permute gathers what lies in the first two registers, the second adds the rest from the third
+	const __m512i x_first = _mm512_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21, 24, 27, 30, 0, 0, 0, 0, 0);
+	const __m512i x_second = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 17, 20, 23, 26, 29);
+	const __m512i y_first = _mm512_setr_epi32(1, 4, 7, 10, 13, 16, 19, 22, 25, 28, 31, 0, 0, 0, 0, 0);
+	const __m512i y_second = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 18, 21, 24, 27, 30);
+	const __m512i z_first = _mm512_setr_epi32(2, 5, 8, 11, 14, 17, 20, 23, 26, 29, 0, 0, 0, 0, 0, 0);
+	const __m512i z_second = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 19, 22, 25, 28, 31);
+	const __m512d centre_x = _mm512_set1_pd(kept.centre[0]);
+	const __m512d centre_y = _mm512_set1_pd(kept.centre[1]);
+	const __m512d centre_z = _mm512_set1_pd(kept.centre[2]);
+	std::size_t count = 0;
+	std::size_t i = 0;
+	for (; i + 16 <= points_count; i += 16) {
+		const float* points = xyz + 3 * i;
+		const __m512 a = _mm512_loadu_ps(points);
+		const __m512 b = _mm512_loadu_ps(points + 16);
+		const __m512 c = _mm512_loadu_ps(points + 32);
+		const __m512 x = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, x_first, b), x_second, c);
+		const __m512 y = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, y_first, b), y_second, c);
+		const __m512 z = _mm512_permutex2var_ps(_mm512_permutex2var_ps(a, z_first, b), z_second, c);
+
+		const __mmask8 low = outside_mask_avx512(_mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(x)), centre_x),
+			_mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(y)), centre_y), _mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(z)), centre_z), kept);
+		const __mmask8 high = outside_mask_avx512(_mm512_sub_pd(_mm512_cvtps_pd(upper_half(x)), centre_x),
+			_mm512_sub_pd(_mm512_cvtps_pd(upper_half(y)), centre_y), _mm512_sub_pd(_mm512_cvtps_pd(upper_half(z)), centre_z), kept);
+		const __mmask16 mask = static_cast<__mmask16>(low | (static_cast<unsigned int>(high) << 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(outside + i), _mm512_cvtepi32_epi8(_mm512_maskz_set1_epi32(mask, 1)));
+		count += std::bitset<16>(mask).count();
+	}
+	return count + mchtr_crop::classify_scalar(xyz + 3 * i, points_count - i, kept, outside + i);
+}
+
+#else
+
+std::size_t mchtr_crop::classify_avx2(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, unsigned char* outside) {
+	// not an x86 build, detect_isa never selects this
+	return mchtr_crop::classify_scalar(xyz, points_count, kept, outside);
+}
+
+std::size_t mchtr_crop::classify_avx512(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, unsigned char* outside) {
+	// not an x86 build, detect_isa never selects this
+	return mchtr_crop::classify_scalar(xyz, points_count, kept, outside);
+}
+
+#endif
+
+mchtr_crop::run_stats mchtr_crop::crop(const float* xyz, std::size_t points_count, const mchtr_crop::region& kept, int threads,
+	const mchtr_parallel::progress_function& report, unsigned char* outside) {
+	/*
+	Marks the points outside the region, chunks of points in parallel, every point tested by the widest SIMD kernel available.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				kept - the kept region, see validate
+				threads - number of workers, 0 means all cores
+				report - receives the number of processed points once per chunk, on the calling thread
+				outside - output, points_count marks, 1 outside the region, 0 inside
+	@return		number of points outside, instruction set and number of workers used
+	*/
+	mchtr_crop::run_stats stats;
+	stats.instruction_set = mchtr_batch::detect_isa();
+	stats.workers = mchtr_parallel::resolve_threads(threads);
+	std::atomic<std::size_t> count{ 0 };
+	constexpr std::size_t chunk_size = 1 << 16;
+	mchtr_parallel::run_chunks(points_count, chunk_size, stats.workers,
+		[&](std::size_t begin, std::size_t end, int) {
+			count += mchtr_crop::classify(xyz + 3 * begin, end - begin, kept, stats.instruction_set, outside + begin);
+		},
+		report);
+	stats.outside = count;
+	return stats;
+}
+
+mchtr_crop::run_stats mchtr_crop::crop(const mchtr_crop::blocks& index, const float* xyz, const mchtr_crop::region& kept, int threads,
+	const mchtr_parallel::progress_function& report, unsigned char* outside) {
+	/*
+	Marks the points outside the region block by block: blocks entirely inside or outside are marked as a whole without reading their points,
+	only blocks the region's border crosses are tested by the SIMD kernel. Gives the same marks as the crop without blocks.
+	@param		index - block bounds built from the same coordinates
+				xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				kept - the kept region, see validate
+				threads - number of workers, 0 means all cores
+				report - receives the number of processed points once per chunk of blocks, on the calling thread
+				outside - output, marks of all points, 1 outside the region, 0 inside
+	@return		number of points outside, numbers of blocks decided as a whole and tested point by point, instruction set and number of workers used
+	*/
+	mchtr_crop::run_stats stats;
+	stats.instruction_set = mchtr_batch::detect_isa();
+	stats.workers = mchtr_parallel::resolve_threads(threads);
+	const std::size_t points_count = index.points_count();
+	const std::size_t block_size = mchtr_crop::blocks::block_size;
+	std::atomic<std::size_t> count{ 0 }, inside_blocks{ 0 }, outside_blocks{ 0 }, split_blocks{ 0 };
+	constexpr std::size_t chunk_size = 16 * block_size;
+	mchtr_parallel::run_chunks(points_count, chunk_size, stats.workers,
+		[&](std::size_t begin, std::size_t end, int) {
+			std::size_t own_count = 0, own_inside = 0, own_outside = 0, own_split = 0;
+			for (std::size_t first = begin; first < end; first += block_size) {
+				const std::size_t last = std::min(end, first + block_size);
+				const block_side side = classify_block(index.bounds(first / block_size), kept);
+				if (side == BLOCK_SPLIT) {
+					own_count += mchtr_crop::classify(xyz + 3 * first, last - first, kept, stats.instruction_set, outside + first);
+					++own_split;
+					continue;
+				}
+				std::fill(outside + first, outside + last, side == BLOCK_OUTSIDE ? 1 : 0);
+				own_count += side == BLOCK_OUTSIDE ? last - first : 0;
+				own_inside += side == BLOCK_INSIDE;
+				own_outside += side == BLOCK_OUTSIDE;
+			}
+			count += own_count;
+			inside_blocks += own_inside;
+			outside_blocks += own_outside;
+			split_blocks += own_split;
+		},
+		report);
+	stats.outside = count;
+	stats.blocks_inside = inside_blocks;
+	stats.blocks_outside = outside_blocks;
+	stats.blocks_split = split_blocks;
+	return stats;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "mchtr_batch.h"
+#include "mchtr_parallel.h"
+
+/*
+Region cropping functionality header file: marks points outside a sphere, a vertical cylinder or a box,
+with SIMD kernels over chunks processed in parallel and block bounds deciding whole blocks of points at once
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_crop
+{
+	enum shape {
+		SHAPE_SPHERE = 0,		// distance in 3D
+		SHAPE_CYLINDER = 1,		// distance in X and Y only, a vertical cylinder (the "pancake" seen from above)
+		SHAPE_BOX = 2			// axis-aligned box
+	};
+
+	// the kept region, points outside it are cropped; a point exactly on the border is kept
+	struct region {
+		int shape{ SHAPE_SPHERE };
+		double centre[3]{ 0, 0, 0 };
+		double radius{ 0 };						// sphere and cylinder
+		double half_size[3]{ 0, 0, 0 };			// box, half of its edges' lengths
+	};
+
+	struct run_stats {
+		std::size_t outside{ 0 };
+		std::size_t blocks_inside{ 0 }, blocks_outside{ 0 }, blocks_split{ 0 };		// block runs only, blocks decided as a whole and blocks tested point by point
+		mchtr_batch::isa instruction_set{ mchtr_batch::ISA_SCALAR };
+		int workers{ 1 };
+	};
+
+	// bounds of blocks of consecutive points, the coarse cells of the crop: on clouds stored in scan or spatial order blocks are compact,
+	// so most of them lie entirely inside or outside a region and are decided without reading their points
+	class blocks {
+	public:
+		static constexpr std::size_t block_size = 4096;
+
+		std::uint64_t fingerprint{ 0 };		// of the coordinates the bounds were built from (see mchtr_knn_graph::fingerprint), 0 if not kept between runs
+
+		void build(const float*, std::size_t, std::uint64_t, int);
+		bool valid_for(std::uint64_t fingerprint_now, std::size_t points_count) const { return fingerprint == fingerprint_now && m_points_count == points_count && m_points_count > 0; }
+		std::size_t size() const { return m_bounds.size() / 6; }
+		std::size_t points_count() const { return m_points_count; }
+		const float* bounds(std::size_t block) const { return m_bounds.data() + 6 * block; }
+
+	private:
+		std::size_t m_points_count{ 0 };
+		std::vector<float> m_bounds;		// min x, y, z, max x, y, z of every block, NaN if a point of the block has a non-finite coordinate
+	};
+
+	const wchar_t* validate(const region&);
+	std::size_t classify(const float*, std::size_t, const region&, mchtr_batch::isa, unsigned char*);
+	std::size_t classify_scalar(const float*, std::size_t, const region&, unsigned char*);
+	std::size_t classify_avx2(const float*, std::size_t, const region&, unsigned char*);
+	std::size_t classify_avx512(const float*, std::size_t, const region&, unsigned char*);
+	run_stats crop(const float*, std::size_t, const region&, int, const mchtr_parallel::progress_function&, unsigned char*);
+	run_stats crop(const blocks&, const float*, const region&, int, const mchtr_parallel::progress_function&, unsigned char*);
+}
@@ -0,0 +1,732 @@
+#include "mchtr_curvature.h"
+#include <algorithm>
+#include <cmath>
+#include <cwchar>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "mchtr_kdtree.h"
+#include "mchtr_pipeline.h"
+#include "mchtr_voxel_grid.h"
+
+/*
+Local curvature functionality cpp file (sphere fits to K nearest neighbours of every point), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// per thread state, nothing in it is shared between workers
+	struct worker_state {
+		std::vector<mchtr_kdtree::neighbour> neighbours;
+		std::vector<mchtr_geometry::point3> neighbouring_points;
+		mchtr_batch::neighbourhood_batch batch;
+		mchtr_batch::lane_spheres spheres;		// starting spheres of the batch's lanes, fitted ones after fit_batch
+
+		// SGD fits of the chunk's previous batch (absolute sphere centres), every lane of the next batch warm starts from the nearest of them
+		int previous_count{ 0 };
+		mchtr_geometry::point3 previous_points[mchtr_batch::max_lanes];
+		double previous_x[mchtr_batch::max_lanes], previous_y[mchtr_batch::max_lanes], previous_z[mchtr_batch::max_lanes];
+		float previous_r[mchtr_batch::max_lanes];
+
+		// SGD iteration statistics and allocations of the per point path, summed into run_info after the run
+		std::size_t sgd_fits{ 0 }, sgd_epochs{ 0 }, early_stops{ 0 }, warm_starts{ 0 }, allocations{ 0 };
+
+		explicit worker_state(int neighbours_count) : neighbours(neighbours_count) {
+			neighbouring_points.reserve(neighbours_count);
+			batch.reset(neighbours_count);
+		}
+	};
+
+	void count_sgd_fit(worker_state& state, int epochs, int max_epochs) {
+		++state.sgd_fits;
+		state.sgd_epochs += epochs;
+		state.early_stops += epochs < max_epochs;
+	}
+
+	void start_lane(worker_state& state, const mchtr_geometry::point3& central_point, float neighbourhood_radius_squared, bool warm_start) {
+		/*
+		Sets the starting sphere of the next free lane of the batch. Points along a curve order (or a tile) are fitted next to each other,
+		so the previous batch's spheres lie near this batch's points, lane by lane.
+		@param		state - the worker's state, holding the batch and the previous batch's fitted spheres
+					central_point - point whose neighbourhood goes into the lane
+					neighbourhood_radius_squared - squared distance to its farthest neighbour
+					warm_start - start from the previous batch's sphere whose point is nearest, if it lies in this point's neighbourhood
+		*/
+		const int lane = state.batch.lanes;
+		int nearest = -1;
+		float nearest_distance = neighbourhood_radius_squared;
+		for (int previous = 0; warm_start && previous < state.previous_count; ++previous) {
+			const float dx = state.previous_points[previous].x() - central_point.x();
+			const float dy = state.previous_points[previous].y() - central_point.y();
+			const float dz = state.previous_points[previous].z() - central_point.z();
+			const float distance = dx * dx + dy * dy + dz * dz;
+			if (distance <= nearest_distance) {
+				nearest = previous;
+				nearest_distance = distance;
+			}
+		}
+		if (nearest >= 0) {
+			state.spheres.x[lane] = static_cast<float>(state.previous_x[nearest] - central_point.x());
+			state.spheres.y[lane] = static_cast<float>(state.previous_y[nearest] - central_point.y());
+			state.spheres.z[lane] = static_cast<float>(state.previous_z[nearest] - central_point.z());
+			state.spheres.r[lane] = state.previous_r[nearest];
+			++state.warm_starts;
+		}
+		else {
+			state.spheres.x[lane] = -mchtr_sgd::init_coord_offset;
+			state.spheres.y[lane] = -mchtr_sgd::init_coord_offset;
+			state.spheres.z[lane] = -mchtr_sgd::init_coord_offset;
+			state.spheres.r[lane] = mchtr_sgd::init_radius;
+		}
+	}
+
+	mchtr_sgd::sphere fit_single(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point, int fit_method,
+		const mchtr_sgd::convergence& stopping, int& iterations) {
+		/*
+		Fits a sphere to a neighbourhood that doesn't go through a batch.
+		@param		data - neighbouring points
+					central_point - the original point whose "data" points are neighbours of
+					fit_method - one of mchtr_fit::method
+					stopping - SGD epochs limit and early stopping tolerance
+					iterations - output, epochs (SGD) or linear solves (closed-form methods) the fit took
+		@return		fitted sphere, see mchtr_fit::fit_sphere
+		*/
+		if (fit_method == mchtr_fit::METHOD_SGD || data.size() < 4) {
+			return mchtr_sgd::fit_sphere(data, mchtr_sgd::init_sphere(central_point, mchtr_sgd::init_coord_offset, mchtr_sgd::init_radius), stopping, iterations);
+		}
+		iterations = fit_method == mchtr_fit::METHOD_ALGEBRAIC_REFINED ? 2 : 1;
+		return mchtr_fit::fit_sphere(data, central_point, fit_method);
+	}
+
+	void fit_batch(worker_state& state, const float* xyz, const mchtr_sgd::convergence& stopping, mchtr_batch::isa instruction_set, float* curvatures,
+		mchtr_profile::worker_stats* stats) {
+		/*
+		Fits all neighbourhoods waiting in a batch, stores their curvatures, remembers the spheres for warm starts and empties the batch.
+		@param		state - the worker's state with a filled (possibly partially) batch and its starting spheres
+					xyz - coordinates of all points
+					stopping - epochs limit and early stopping tolerance
+					instruction_set - instruction set used for fitting
+					curvatures - output, curvatures indexed like the points
+					stats - the worker's counters, nullptr if profiling is off
+		*/
+		mchtr_batch::neighbourhood_batch& batch = state.batch;
+		mchtr_batch::lane_spheres& spheres = state.spheres;
+		{
+			mchtr_profile::scoped_timer timer(stats ? &stats->fit_nanoseconds : nullptr);
+			mchtr_batch::find_spheres(batch, stopping, spheres, instruction_set);
+		}
+		for (int lane = 0; lane < batch.lanes; ++lane) {
+			curvatures[batch.indices[lane]] = static_cast<float>(1.0 / spheres.r[lane]);
+			count_sgd_fit(state, spheres.epochs[lane], stopping.max_epochs);
+			if (stats) {
+				stats->add_fit(spheres.epochs[lane], mchtr_batch::mean_squared_residual(batch, spheres, lane));
+			}
+		}
+
+		for (int lane = 0; lane < batch.lanes; ++lane) {
+			const float* point = xyz + 3 * static_cast<std::size_t>(batch.indices[lane]);
+			state.previous_points[lane] = mchtr_geometry::point3(point[0], point[1], point[2]);
+			state.previous_x[lane] = static_cast<double>(point[0]) + spheres.x[lane];
+			state.previous_y[lane] = static_cast<double>(point[1]) + spheres.y[lane];
+			state.previous_z[lane] = static_cast<double>(point[2]) + spheres.z[lane];
+			state.previous_r[lane] = spheres.r[lane];
+		}
+		state.previous_count = batch.lanes;
+		batch.reset(batch.k);
+	}
+
+	void fit_neighbourhood(worker_state& state, const float* xyz, std::size_t index, const mchtr_geometry::point3& central_point, const mchtr_kdtree::neighbour* neighbours,
+		std::size_t neighbours_found, int k, const mchtr_curvature::options& settings, const mchtr_sgd::convergence& stopping, mchtr_batch::isa instruction_set,
+		float* curvatures, mchtr_profile::worker_stats* stats) {
+		/*
+		Fits a sphere to one neighbourhood (gathered into state.neighbouring_points) or puts it into the batch, see fit_range.
+		@param		state - the worker's state for this K
+					xyz - coordinates of all points
+					index - index of the central point
+					central_point - its coordinates
+					neighbours - its nearest neighbours, sorted nearest first, the first neighbours_found of them are the neighbourhood
+					neighbours_found - number of points of the neighbourhood
+					k - K of the neighbourhood, a shorter one (cloud smaller than K) doesn't go through a batch
+					settings - fit method and warm starts
+					stopping - SGD epochs limit and tolerance
+					instruction_set - instruction set used for batched SGD fitting
+					curvatures - output, curvatures indexed like the points
+					stats - the worker's counters, nullptr if profiling is off
+		*/
+		// SGD fits wait in the batch (a short neighbourhood can't share it)
+		if (settings.fit_method == mchtr_fit::METHOD_SGD && static_cast<int>(neighbours_found) == k) {
+			start_lane(state, central_point, neighbours[neighbours_found - 1].distance_squared, settings.warm_start);
+			state.batch.add(state.neighbouring_points, central_point, static_cast<int>(index));
+			if (state.batch.full()) {
+				fit_batch(state, xyz, stopping, instruction_set, curvatures, stats);
+			}
+			return;
+		}
+
+		mchtr_sgd::sphere sphere;
+		int iterations = 0;
+		{
+			mchtr_profile::scoped_timer timer(stats ? &stats->fit_nanoseconds : nullptr);
+			sphere = fit_single(state.neighbouring_points, central_point, settings.fit_method, stopping, iterations);
+		}
+		curvatures[index] = static_cast<float>(1.0 / sphere.r);
+		if (settings.fit_method == mchtr_fit::METHOD_SGD || neighbours_found < 4) {
+			count_sgd_fit(state, iterations, stopping.max_epochs);
+		}
+		if (stats) {
+			const double residual = mchtr_fit::rms_residual(state.neighbouring_points, sphere);
+			stats->add_fit(iterations, residual * residual);
+		}
+	}
+
+	mchtr_sgd::convergence stopping_of(const mchtr_curvature::options& settings) {
+		/*
+		@param		settings - options of the run
+		@return		SGD epochs limit and early stopping tolerance
+		*/
+		mchtr_sgd::convergence stopping;
+		stopping.max_epochs = settings.max_epochs;
+		stopping.tolerance = settings.tolerance;
+		return stopping;
+	}
+
+	// where neighbourhoods come from: the kd-tree's K nearest neighbours, or the voxel grid's neighbours within a radius if grid is set
+	struct searcher {
+		const mchtr_kdtree::kdtree* tree;
+		const mchtr_voxel_grid::grid* grid;
+		float radius;
+		int min_points;
+	};
+
+	std::size_t find_neighbours(const searcher& search, const mchtr_geometry::point3& central_point, int k, mchtr_kdtree::neighbour* neighbours,
+		std::size_t* visited) {
+		/*
+		@param		search - the structure to query
+					central_point - the point to query
+					k - number of neighbours (the most kept within the radius)
+					neighbours - output, room for k neighbours, sorted nearest first
+					visited - optional output (may be nullptr), number of points distances were calculated to
+		@return		number of neighbours found
+		*/
+		if (search.grid) {
+			return search.grid->query(central_point.x(), central_point.y(), central_point.z(), search.radius, k, search.min_points, neighbours, visited);
+		}
+		return search.tree->knn(central_point.x(), central_point.y(), central_point.z(), k, neighbours, visited);
+	}
+
+	std::size_t query_neighbours(const searcher& search, const mchtr_geometry::point3& central_point, int k, mchtr_kdtree::neighbour* neighbours,
+		mchtr_profile::worker_stats* stats) {
+		/*
+		Finds the neighbourhood of a point: K nearest neighbours, or up to K nearest within the radius; both return their coordinates directly.
+		@param		search - kd-tree or voxel grid of all points
+					central_point - the point to query
+					k - number of neighbours
+					neighbours - output, room for k neighbours, sorted nearest first
+					stats - the worker's counters, nullptr if profiling is off
+		@return		number of neighbours found (less than k only in clouds smaller than k, or within a radius)
+		*/
+		if (!stats) {
+			return find_neighbours(search, central_point, k, neighbours, nullptr);
+		}
+		std::size_t visited = 0;
+		mchtr_profile::scoped_timer timer(&stats->knn_nanoseconds);
+		const std::size_t neighbours_found = find_neighbours(search, central_point, k, neighbours, &visited);
+		stats->add_query(visited);
+		return neighbours_found;
+	}
+
+	void build_grid(mchtr_voxel_grid::grid& grid, const float* xyz, std::size_t points_count, const mchtr_curvature::options& settings) {
+		/*
+		Builds the voxel grid of a radius mode run, cells as large as the radius.
+		@param		grid - output
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					points_count - number of points
+					settings - options of the run, throws std::invalid_argument if the radius is too small for the cloud's extent
+		*/
+		mchtr_profile::scoped_stage stage(settings.profile, "voxel_grid_build");
+		if (!grid.build(xyz, points_count, settings.neighbourhood.radius)) {
+			throw std::invalid_argument("Neighbourhood radius too small for the extent of the cloud.");
+		}
+	}
+
+	searcher searcher_of(const mchtr_kdtree::kdtree* tree, const mchtr_voxel_grid::grid* grid, const mchtr_curvature::options& settings) {
+		/*
+		@param		tree - kd-tree of all points, nullptr in radius mode
+					grid - voxel grid of all points, nullptr in KNN mode
+					settings - options of the run
+		@return		the searcher of the run
+		*/
+		return searcher{ tree, grid, settings.neighbourhood.radius, settings.neighbourhood.min_points };
+	}
+
+	void fit_scales(std::vector<worker_state>& states, const float* xyz, std::size_t index, const mchtr_kdtree::neighbour* neighbours, std::size_t neighbours_found,
+		const mchtr_curvature::options& settings, const std::vector<int>& scales, const mchtr_sgd::convergence& stopping, mchtr_batch::isa instruction_set,
+		float* const* curvatures, mchtr_profile::worker_stats* stats) {
+		/*
+		Fits a sphere to the neighbourhood of one point at every scale and gets the surface curvature, all scales read the same (largest K) neighbours.
+		@param		states - the worker's neighbour buffers and batches, one per scale
+					xyz - coordinates of all points
+					index - index of the point
+					neighbours - its nearest neighbours, sorted nearest first
+					neighbours_found - number of them
+					settings - fit method and warm starts
+					scales - K of every scale
+					stopping - SGD epochs limit and tolerance
+					instruction_set - instruction set used for batched SGD fitting
+					curvatures - output, per scale curvatures indexed like the points
+					stats - the worker's counters, nullptr if profiling is off
+		*/
+		const mchtr_geometry::point3 central_point(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2]);
+		for (std::size_t scale = 0; scale < scales.size(); ++scale) {
+			worker_state& state = states[scale];
+			const std::size_t scale_found = std::min(neighbours_found, static_cast<std::size_t>(scales[scale]));
+			state.neighbouring_points.clear();
+			for (std::size_t j = 0; j < scale_found; ++j) {
+				state.neighbouring_points.emplace_back(neighbours[j].x, neighbours[j].y, neighbours[j].z);
+			}
+			fit_neighbourhood(state, xyz, index, central_point, neighbours, scale_found, scales[scale], settings, stopping, instruction_set, curvatures[scale], stats);
+		}
+	}
+
+	void finish_batches(std::vector<worker_state>& states, const float* xyz, const mchtr_sgd::convergence& stopping, mchtr_batch::isa instruction_set,
+		float* const* curvatures, mchtr_profile::worker_stats* stats) {
+		/*
+		Fits the last, partial batches of a chunk (or block) of every scale, the chunk is finished only when they are.
+		@param		states - the worker's batches, one per scale
+					xyz - coordinates of all points
+					stopping - SGD epochs limit and tolerance
+					instruction_set - instruction set used for batched SGD fitting
+					curvatures - output, per scale curvatures indexed like the points
+					stats - the worker's counters, nullptr if profiling is off
+		*/
+		for (std::size_t scale = 0; scale < states.size(); ++scale) {
+			if (states[scale].batch.lanes > 0) {
+				fit_batch(states[scale], xyz, stopping, instruction_set, curvatures[scale], stats);
+			}
+		}
+	}
+
+	void fit_range(const searcher& search, const float* xyz, const std::size_t* subset, std::size_t begin, std::size_t end,
+		const mchtr_curvature::options& settings, const std::vector<int>& scales, std::vector<worker_state>& states, mchtr_batch::isa instruction_set,
+		float* const* curvatures, float* kth_distances, mchtr_profile::worker_stats* stats) {
+		/*
+		Calculates curvatures of points [begin, end) (of the subset, if given) at every scale, runs on a single worker.
+		Every point is queried once for settings.neighbours_count (the largest scale) neighbours; the tree (and the grid) sorts them by distance with ties
+		broken by index, so the first K of them are exactly what a query for K would return and each scale fits the same neighbourhood as a run of its own.
+		Warm starts never cross chunks, so results don't depend on which worker got which chunk.
+		@param		search - kd-tree or voxel grid of all points, used for neighbourhood queries
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					subset - indices of the points to process, nullptr to process points [begin, end) themselves
+					begin, end - range of positions in the subset (or of point indices) to process
+					settings - neighbours count (the largest scale), fit method and SGD stopping
+					scales - K of every scale
+					states - the worker's own neighbour buffers and batches, one per scale; the first one's buffer holds the query's result
+					instruction_set - instruction set used for batched SGD fitting
+					curvatures - output, per scale curvatures indexed like the points (only the processed points are written)
+					kth_distances - optional output, squared distance to the farthest of the neighbours queried (only the processed points are written)
+					stats - the worker's counters, nullptr if profiling is off
+		*/
+		const mchtr_sgd::convergence stopping = stopping_of(settings);
+		for (worker_state& state : states) {
+			state.previous_count = 0;
+		}
+		mchtr_kdtree::neighbour* neighbours = states.front().neighbours.data();
+		for (std::size_t position = begin; position < end; ++position) {
+			const std::size_t index = subset ? subset[position] : position;
+			const mchtr_geometry::point3 central_point(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2]);
+			const std::size_t neighbours_found = query_neighbours(search, central_point, settings.neighbours_count, neighbours, stats);
+			if (kth_distances) {
+				kth_distances[index] = neighbours_found > 0 ? neighbours[neighbours_found - 1].distance_squared : 0.0f;
+			}
+			fit_scales(states, xyz, index, neighbours, neighbours_found, settings, scales, stopping, instruction_set, curvatures, stats);
+		}
+		finish_batches(states, xyz, stopping, instruction_set, curvatures, stats);
+	}
+
+	// neighbourhoods of a block of points of a pipelined run, filled by a search worker and fitted by a fit worker
+	struct neighbourhood_block {
+		std::vector<mchtr_kdtree::neighbour> neighbours;	// settings.neighbours_count per point of the block
+		std::vector<std::size_t> found;
+
+		neighbourhood_block(int batch_size, int neighbours_count) :
+			neighbours(static_cast<std::size_t>(batch_size) * neighbours_count), found(batch_size) {}
+	};
+
+	mchtr_curvature::run_info fit_points(const searcher& search, const float* xyz, const std::size_t* subset, std::size_t fitted_count,
+		const mchtr_curvature::options& settings, const std::vector<int>& scales, const mchtr_parallel::progress_function& report, float* const* curvatures,
+		float* kth_distances) {
+		/*
+		Fits spheres to the neighbourhoods of a prefix or a subset of points in parallel at one or more scales, the options are already validated.
+		@param		search - kd-tree or voxel grid of all points
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					subset - indices of the points to fit, nullptr to fit the first fitted_count points
+					fitted_count - number of points to fit
+					settings - neighbours count (the largest of scales), fit method, number of threads, pipelining and the order to fit points in
+					scales - K of every scale, settings.neighbours_count alone for a single scale run
+					report - receives the number of processed points, on the calling thread
+					curvatures - output, one array per scale, indexed like the points
+					kth_distances - optional output (may be nullptr), indexed like the points
+		@return		instruction set, number of workers and SGD statistics
+		*/
+		// fit the points along a space-filling curve, consecutive queries then share most of their neighbours (and warm starts find them)
+		std::vector<std::size_t> ordered;
+		if (settings.order != mchtr_order::ORDER_STORAGE) {
+			mchtr_profile::scoped_stage stage(settings.profile, "ordering");
+			mchtr_order::sort_points(xyz, subset, fitted_count, settings.order, ordered);
+			subset = ordered.data();
+		}
+
+		// pipelined, the workers are split between searching and fitting and only the fit workers need fitting state
+		mchtr_curvature::run_info info{ mchtr_batch::detect_isa(), mchtr_parallel::resolve_threads(settings.threads), 0, 0, 0, 0, 0 };
+		int search_workers = 0, fit_workers = info.workers;
+		if (settings.pipeline.enabled) {
+			mchtr_pipeline::split_threads(info.workers, search_workers, fit_workers);
+			info.workers = search_workers + fit_workers;
+		}
+
+		// one neighbour buffer and batch per fitting worker and scale
+		std::vector<std::vector<worker_state>> states(fit_workers);
+		for (std::vector<worker_state>& scale_states : states) {
+			scale_states.emplace_back(settings.neighbours_count);
+			scale_states.front().batch.reset(scales.front());
+			for (std::size_t scale = 1; scale < scales.size(); ++scale) {
+				scale_states.emplace_back(scales[scale]);
+			}
+		}
+
+		// per worker counters, only if profiling (search workers first in a pipelined run)
+		mchtr_profile::worker_stats* stats = nullptr;
+		if (settings.profile) {
+			stats = settings.profile->workers(info.workers).data();
+			settings.profile->set_value("points", static_cast<double>(fitted_count));
+			settings.profile->set_value("neighbours_count", settings.neighbours_count);
+			settings.profile->set_value("scales", static_cast<double>(scales.size()));
+			settings.profile->set_value("fit_method", settings.fit_method);
+			settings.profile->set_value("max_epochs", settings.max_epochs);
+			settings.profile->set_value("tolerance", settings.tolerance);
+			settings.profile->set_value("warm_start", settings.warm_start ? 1 : 0);
+			settings.profile->set_value("order", settings.order);
+			settings.profile->set_value("neighbourhood_mode", settings.neighbourhood.mode);
+			if (search.grid) {
+				settings.profile->set_value("radius", settings.neighbourhood.radius);
+				settings.profile->set_value("min_neighbours", settings.neighbourhood.min_points);
+				settings.profile->set_value("voxel_grid_bytes", static_cast<double>(search.grid->bytes()));
+			}
+			settings.profile->set_value("workers", info.workers);
+			settings.profile->set_value("instruction_set", info.instruction_set);
+		}
+
+		// fit chunks of points in parallel, progress is reported from the calling thread only
+		std::vector<std::size_t> search_allocations(search_workers, 0);
+		if (!settings.pipeline.enabled) {
+			mchtr_profile::scoped_stage stage(settings.profile, "fitting");
+			constexpr std::size_t chunk_size = 1024;
+			mchtr_parallel::run_chunks(fitted_count, chunk_size, info.workers,
+				[&](std::size_t begin, std::size_t end, int worker) {
+					mchtr_profile::worker_stats* own = stats ? stats + worker : nullptr;
+					mchtr_profile::scoped_timer timer(own ? &own->busy_nanoseconds : nullptr);
+					const std::uint64_t allocations = mchtr_profile::thread_allocations ? mchtr_profile::thread_allocations() : 0;
+					fit_range(search, xyz, subset, begin, end, settings, scales, states[worker], info.instruction_set, curvatures, kth_distances, own);
+					if (mchtr_profile::thread_allocations) {
+						states[worker].front().allocations += mchtr_profile::thread_allocations() - allocations;
+					}
+					if (own) {
+						own->points += end - begin;
+					}
+				},
+				report);
+		}
+
+		// or search blocks of points into the ring while fitting the ones searched before; warm starts never cross blocks,
+		// so results don't depend on which worker got which block (and equal a chunked run's when batch_size is its chunk size)
+		else {
+			mchtr_profile::scoped_stage stage(settings.profile, "fitting");
+			const mchtr_sgd::convergence stopping = stopping_of(settings);
+			const std::size_t k = static_cast<std::size_t>(settings.neighbours_count);
+			std::vector<neighbourhood_block> blocks(std::min<std::size_t>(settings.pipeline.depth, (fitted_count + settings.pipeline.batch_size - 1) / settings.pipeline.batch_size),
+				neighbourhood_block(settings.pipeline.batch_size, settings.neighbours_count));
+			const mchtr_pipeline::run_stats pipeline = mchtr_pipeline::run(fitted_count, settings.pipeline, search_workers, fit_workers,
+				[&](std::size_t begin, std::size_t end, std::size_t slot, int worker) {
+					mchtr_profile::worker_stats* own = stats ? stats + worker : nullptr;
+					mchtr_profile::scoped_timer timer(own ? &own->busy_nanoseconds : nullptr);
+					const std::uint64_t allocations = mchtr_profile::thread_allocations ? mchtr_profile::thread_allocations() : 0;
+					neighbourhood_block& block = blocks[slot];
+					for (std::size_t position = begin; position < end; ++position) {
+						const std::size_t index = subset ? subset[position] : position;
+						mchtr_kdtree::neighbour* neighbours = block.neighbours.data() + (position - begin) * k;
+						const std::size_t neighbours_found = query_neighbours(search, mchtr_geometry::point3(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2]),
+							settings.neighbours_count, neighbours, own);
+						block.found[position - begin] = neighbours_found;
+						if (kth_distances) {
+							kth_distances[index] = neighbours_found > 0 ? neighbours[neighbours_found - 1].distance_squared : 0.0f;
+						}
+					}
+					if (mchtr_profile::thread_allocations) {
+						search_allocations[worker] += mchtr_profile::thread_allocations() - allocations;
+					}
+				},
+				[&](std::size_t begin, std::size_t end, std::size_t slot, int worker) {
+					mchtr_profile::worker_stats* own = stats ? stats + search_workers + worker : nullptr;
+					mchtr_profile::scoped_timer timer(own ? &own->busy_nanoseconds : nullptr);
+					const std::uint64_t allocations = mchtr_profile::thread_allocations ? mchtr_profile::thread_allocations() : 0;
+					const neighbourhood_block& block = blocks[slot];
+					std::vector<worker_state>& own_states = states[worker];
+					for (worker_state& state : own_states) {
+						state.previous_count = 0;
+					}
+					for (std::size_t position = begin; position < end; ++position) {
+						fit_scales(own_states, xyz, subset ? subset[position] : position, block.neighbours.data() + (position - begin) * k, block.found[position - begin],
+							settings, scales, stopping, info.instruction_set, curvatures, own);
+					}
+					finish_batches(own_states, xyz, stopping, info.instruction_set, curvatures, own);
+					if (mchtr_profile::thread_allocations) {
+						own_states.front().allocations += mchtr_profile::thread_allocations() - allocations;
+					}
+					if (own) {
+						own->points += end - begin;
+					}
+				},
+				report);
+			if (settings.profile) {
+				settings.profile->set_value("pipeline_batch", settings.pipeline.batch_size);
+				settings.profile->set_value("pipeline_depth", settings.pipeline.depth);
+				settings.profile->set_value("pipeline_search_workers", pipeline.search_workers);
+				settings.profile->set_value("pipeline_search_waits", static_cast<double>(pipeline.search_waits));
+				settings.profile->set_value("pipeline_fit_waits", static_cast<double>(pipeline.fit_waits));
+			}
+		}
+
+		for (std::size_t allocations : search_allocations) {
+			info.allocations += allocations;
+		}
+
+		for (const std::vector<worker_state>& scale_states : states) {
+			for (const worker_state& state : scale_states) {
+				info.sgd_fits += state.sgd_fits;
+				info.sgd_epochs += state.sgd_epochs;
+				info.early_stops += state.early_stops;
+				info.warm_starts += state.warm_starts;
+				info.allocations += state.allocations;
+			}
+		}
+		if (settings.profile && info.sgd_fits > 0) {
+			settings.profile->set_value("sgd_mean_epochs", static_cast<double>(info.sgd_epochs) / info.sgd_fits);
+			settings.profile->set_value("sgd_early_stops", static_cast<double>(info.early_stops));
+			settings.profile->set_value("sgd_warm_starts", static_cast<double>(info.warm_starts));
+		}
+		if (settings.profile && mchtr_profile::thread_allocations) {
+			settings.profile->set_value("fitting_allocations", static_cast<double>(info.allocations));
+		}
+		return info;
+	}
+}
+
+const wchar_t* mchtr_curvature::validate(const mchtr_curvature::options& settings) {
+	/*
+	@param		settings - user supplied options
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (settings.neighbours_count < 1) {
+		return L"K of nearest neighbours lower than 1.";
+	}
+	if (!mchtr_fit::is_valid_method(settings.fit_method)) {
+		return L"Unknown fit method, use 0 (SGD), 1 (algebraic) or 2 (algebraic + Gauss-Newton step).";
+	}
+	if (settings.threads < 0) {
+		return L"Number of threads lower than 0 (0 means all cores).";
+	}
+	if (settings.max_epochs < 1) {
+		return L"Maximum number of SGD epochs lower than 1.";
+	}
+	if (!(settings.tolerance >= 0)) {
+		return L"SGD tolerance lower than 0 (0 never stops early).";
+	}
+	if (!mchtr_order::is_valid_curve(settings.order)) {
+		return L"Unknown order, use 0 (storage order), 1 (Morton curve) or 2 (Hilbert curve).";
+	}
+	const wchar_t* error = mchtr_voxel_grid::validate(settings.neighbourhood, settings.neighbours_count);
+	if (error) {
+		return error;
+	}
+	return mchtr_pipeline::validate(settings.pipeline);
+}
+
+const wchar_t* mchtr_curvature::parse_scales(const wchar_t* text, std::vector<int>& scales) {
+	/*
+	Reads the K of every scale of a multi-scale run.
+	@param		text - K values separated by commas (spaces allowed), e.g. "8, 15, 25"; empty means a single scale run
+				scales - output, the K values in the given order, cleared first
+	@return		description of the problem, nullptr if the list is valid
+	*/
+	scales.clear();
+	const wchar_t* position = text;
+	while (*position) {
+		while (*position == L' ' || *position == L',') {
+			++position;
+		}
+		if (!*position) {
+			break;
+		}
+		wchar_t* end = nullptr;
+		const long value = std::wcstol(position, &end, 10);
+		if (end == position || value < 1 || value > std::numeric_limits<int>::max()) {
+			return L"Scales must be a comma separated list of K values, each at least 1.";
+		}
+		if (std::find(scales.begin(), scales.end(), static_cast<int>(value)) != scales.end()) {
+			return L"Every scale must be a different K.";
+		}
+		scales.push_back(static_cast<int>(value));
+		position = end;
+		if (*position && *position != L' ' && *position != L',') {
+			return L"Scales must be a comma separated list of K values, each at least 1.";
+		}
+	}
+	return nullptr;
+}
+
+mchtr_curvature::run_info mchtr_curvature::compute(const float* xyz, std::size_t points_count, const mchtr_curvature::options& settings,
+	const mchtr_parallel::progress_function& report, float* curvatures) {
+	/*
+	Calculates local curvature (1 / radius of a sphere fitted to K nearest neighbours) of every point.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				settings - neighbours count, fit method and number of threads, throws std::invalid_argument if invalid
+				report - receives the number of processed points, on the calling thread
+				curvatures - output, points_count curvatures
+	@return		instruction set and number of workers used
+	*/
+	return mchtr_curvature::compute(xyz, points_count, points_count, settings, report, curvatures, nullptr);
+}
+
+mchtr_curvature::run_info mchtr_curvature::compute(const float* xyz, std::size_t points_count, std::size_t fitted_count, const mchtr_curvature::options& settings,
+	const mchtr_parallel::progress_function& report, float* curvatures, float* kth_distances) {
+	/*
+	Calculates local curvature of the first fitted_count points, all points serve as their neighbours (e.g. a tile and its halo).
+	Curvatures are written by point index, so the result doesn't depend on the number of threads.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				fitted_count - number of points (a prefix) to calculate curvature of
+				settings - neighbours count, fit method and number of threads, throws std::invalid_argument if invalid
+				report - receives the number of processed points, on the calling thread
+				curvatures - output, fitted_count curvatures
+				kth_distances - optional output (may be nullptr), fitted_count squared distances to the farthest neighbour used
+	@return		instruction set and number of workers used
+	*/
+	const wchar_t* error = mchtr_curvature::validate(settings);
+	if (error) {
+		// the messages are plain ASCII
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+
+	// KNN queries go to a kd-tree built once per run, radius queries to a voxel grid
+	float* outputs[1] = { curvatures };
+	if (settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS) {
+		mchtr_voxel_grid::grid grid;
+		build_grid(grid, xyz, points_count, settings);
+		return fit_points(searcher_of(nullptr, &grid, settings), xyz, nullptr, fitted_count, settings, { settings.neighbours_count }, report, outputs, kth_distances);
+	}
+	mchtr_kdtree::kdtree tree;
+	{
+		mchtr_profile::scoped_stage stage(settings.profile, "kdtree_build");
+		tree.build(xyz, points_count);
+	}
+	return fit_points(searcher_of(&tree, nullptr, settings), xyz, nullptr, fitted_count, settings, { settings.neighbours_count }, report, outputs, kth_distances);
+}
+
+mchtr_curvature::run_info mchtr_curvature::compute(const mchtr_kdtree::kdtree& tree, const float* xyz, const std::size_t* subset, std::size_t subset_count,
+	const mchtr_curvature::options& settings, const mchtr_parallel::progress_function& report, float* curvatures, float* kth_distances) {
+	/*
+	Calculates local curvature of a subset of points with an already built kd-tree (e.g. the seeds of a sparse run, then the points to refine);
+	in radius mode a voxel grid of the tree's points is built from xyz instead.
+	@param		tree - kd-tree of all points
+				xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), the ones the tree was built from
+				subset - indices of the points to calculate curvature of
+				subset_count - number of indices
+				settings - neighbours count, fit method and number of threads, throws std::invalid_argument if invalid
+				report - receives the number of processed subset points, on the calling thread
+				curvatures - output, indexed like the points, only the subset's points are written
+				kth_distances - optional output (may be nullptr), indexed like the points, only the subset's points are written
+	@return		instruction set and number of workers used
+	*/
+	const wchar_t* error = mchtr_curvature::validate(settings);
+	if (error) {
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+	float* outputs[1] = { curvatures };
+	if (settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS) {
+		mchtr_voxel_grid::grid grid;
+		build_grid(grid, xyz, tree.size(), settings);
+		return fit_points(searcher_of(nullptr, &grid, settings), xyz, subset, subset_count, settings, { settings.neighbours_count }, report, outputs, kth_distances);
+	}
+	return fit_points(searcher_of(&tree, nullptr, settings), xyz, subset, subset_count, settings, { settings.neighbours_count }, report, outputs, kth_distances);
+}
+
+mchtr_curvature::run_info mchtr_curvature::compute_scales(const float* xyz, std::size_t points_count, const std::vector<int>& scales,
+	const mchtr_curvature::options& settings, const mchtr_parallel::progress_function& report, float* const* curvatures) {
+	/*
+	Calculates local curvature of every point at several scales (values of K) in one pass: every point is queried once for the largest K
+	and each scale fits the nearest K of those neighbours, giving the same curvatures as a run of its own per scale.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				scales - K of every scale, different and at least 1 (see parse_scales), throws std::invalid_argument if empty
+				settings - fit method and number of threads (neighbours_count is ignored), throws std::invalid_argument if invalid
+				report - receives the number of processed points, on the calling thread
+				curvatures - output, one array of points_count curvatures per scale, in the order of scales
+	@return		instruction set, number of workers and SGD statistics over all scales
+	*/
+	if (scales.empty()) {
+		throw std::invalid_argument("No scales given.");
+	}
+	// the smallest K is validated with the other options, the run queries the largest
+	mchtr_curvature::options largest = settings;
+	largest.neighbours_count = *std::min_element(scales.begin(), scales.end());
+	const wchar_t* error = mchtr_curvature::validate(largest);
+	if (error) {
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+	largest.neighbours_count = *std::max_element(scales.begin(), scales.end());
+
+	// in radius mode every scale keeps at most its K of the nearest points within the radius
+	if (settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS) {
+		mchtr_voxel_grid::grid grid;
+		build_grid(grid, xyz, points_count, settings);
+		return fit_points(searcher_of(nullptr, &grid, settings), xyz, nullptr, points_count, largest, scales, report, curvatures, nullptr);
+	}
+	mchtr_kdtree::kdtree tree;
+	{
+		mchtr_profile::scoped_stage stage(settings.profile, "kdtree_build");
+		tree.build(xyz, points_count);
+	}
+	return fit_points(searcher_of(&tree, nullptr, settings), xyz, nullptr, points_count, largest, scales, report, curvatures, nullptr);
+}
+
+void mchtr_curvature::combine_scales(const float* const* curvatures, std::size_t scales_count, std::size_t points_count, float* maximum, float* mean) {
+	/*
+	Summarises the curvatures of a multi-scale run per point, over the scales whose curvature came out finite.
+	@param		curvatures - one array of points_count curvatures per scale
+				scales_count - number of scales
+				points_count - number of points
+				maximum - optional output (may be nullptr), the largest curvature of every point, NaN if none is finite
+				mean - optional output (may be nullptr), the mean curvature of every point, NaN if none is finite
+	*/
+	for (std::size_t i = 0; i < points_count; ++i) {
+		double sum = 0;
+		float largest = -std::numeric_limits<float>::infinity();
+		std::size_t finite = 0;
+		for (std::size_t scale = 0; scale < scales_count; ++scale) {
+			const float value = curvatures[scale][i];
+			if (std::isfinite(value)) {
+				sum += value;
+				largest = std::max(largest, value);
+				++finite;
+			}
+		}
+		if (maximum) {
+			maximum[i] = finite ? largest : std::numeric_limits<float>::quiet_NaN();
+		}
+		if (mean) {
+			mean[i] = finite ? static_cast<float>(sum / finite) : std::numeric_limits<float>::quiet_NaN();
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include "mchtr_batch.h"
+#include "mchtr_cache.h"
+#include "mchtr_fit.h"
+#include "mchtr_kdtree.h"
+#include "mchtr_order.h"
+#include "mchtr_parallel.h"
+#include "mchtr_pipeline.h"
+#include "mchtr_profile.h"
+#include "mchtr_voxel_grid.h"
+
+/*
+Local curvature functionality header file (sphere fits to K nearest neighbours of every point), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_curvature
+{
+	// curvature of a deleted point, which is in no neighbourhood and gets no fit
+	constexpr float no_curvature = std::numeric_limits<float>::quiet_NaN();
+
+	struct options {
+		int neighbours_count{ 15 };
+		int fit_method{ mchtr_fit::METHOD_SGD };
+		int threads{ 1 };
+		int max_epochs{ mchtr_sgd::no_epochs };		// SGD only
+		float tolerance{ 0 };						// SGD only, relative loss improvement below which a fit stops early, 0 never stops early
+		bool warm_start{ false };					// SGD only, start from the nearest sphere of the previous batch if it's near, instead of init_sphere
+		mchtr_pipeline::options pipeline;			// overlap KNN queries with fitting, see mchtr_pipeline
+		int order{ mchtr_order::ORDER_STORAGE };	// one of mchtr_order::curve, the order points are fitted in (results are still written by point index)
+		mchtr_voxel_grid::options neighbourhood;	// K nearest neighbours, or up to K nearest within a radius, see mchtr_voxel_grid
+		mchtr_cache::store* cache{ nullptr };		// persistent cache of whole runs' curvatures (see mchtr_lod::compute_curvature), off if nullptr
+		mchtr_profile::recorder* profile{ nullptr };	// instrumentation, off if nullptr
+	};
+
+	// what a run ended up using, for reporting
+	struct run_info {
+		mchtr_batch::isa instruction_set;
+		int workers;
+		std::size_t sgd_fits;			// SGD fits and the epochs they took
+		std::size_t sgd_epochs;
+		std::size_t early_stops;		// SGD fits that converged before max_epochs
+		std::size_t warm_starts;		// SGD fits started from a neighbour's sphere
+		std::size_t allocations;		// heap allocations of the per point path, counted only if mchtr_profile::thread_allocations is set
+	};
+
+	const wchar_t* validate(const options&);
+	const wchar_t* parse_scales(const wchar_t*, std::vector<int>&);
+	run_info compute(const float*, std::size_t, const options&, const mchtr_parallel::progress_function&, float*);
+	run_info compute(const float*, std::size_t, std::size_t, const options&, const mchtr_parallel::progress_function&, float*, float*);
+	run_info compute(const mchtr_kdtree::kdtree&, const float*, const std::size_t*, std::size_t, const options&, const mchtr_parallel::progress_function&, float*, float*);
+	run_info compute_scales(const float*, std::size_t, const std::vector<int>&, const options&, const mchtr_parallel::progress_function&, float* const*);
+	void combine_scales(const float* const*, std::size_t, std::size_t, float*, float*);
+}
@@ -0,0 +1,100 @@
+#include "mchtr_fit.h"
+#include <math.h>
+#include <cmath>
+#include <limits>
+#include "mchtr_kernels.h"
+
+/*
+Sphere fitting functionality cpp file (closed-form least squares fit and fit method selection)
+Author: Przemyslaw Wysocki
+*/
+
+bool mchtr_fit::is_valid_method(int method) {
+	/*
+	Checks whether a user given fit method (plugin parameter) is one of the known ones.
+	@param		method - fit method id
+	@return		true if the method is known
+	*/
+	return method == METHOD_SGD || method == METHOD_ALGEBRAIC || method == METHOD_ALGEBRAIC_REFINED;
+}
+
+double mchtr_fit::find_sphere_r(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point, int method) {
+	/*
+	Fits a sphere to n 3D points with the selected method, same contract as mchtr_sgd::find_sphere_r.
+	@param		data - points which the sphere will be fit to
+				central_point - the original point whose "data" points are neighbours of
+				method - one of mchtr_fit::method
+	@return		radius of the fitted sphere, infinity for flat neighbourhoods
+	*/
+	return mchtr_fit::fit_sphere(data, central_point, method).r;
+}
+
+mchtr_sgd::sphere mchtr_fit::fit_sphere(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point, int method) {
+	/*
+	Fits a sphere to n 3D points with the selected method.
+	Closed-form methods fall back to SGD when there are too few points to determine a sphere (less than 4).
+	@param		data - points which the sphere will be fit to
+				central_point - the original point whose "data" points are neighbours of
+				method - one of mchtr_fit::method
+	@return		fitted sphere, its radius is infinity for flat neighbourhoods
+	*/
+	if (method == METHOD_SGD || data.size() < 4) {
+		return mchtr_sgd::fit_sphere(data, central_point);
+	}
+
+	mchtr_sgd::sphere sphere;
+	if (!mchtr_fit::fit_sphere_algebraic(data, sphere)) {
+
+		// points are coplanar (or collinear), the best fitting "sphere" is a plane
+		return mchtr_sgd::sphere{ central_point.x(), central_point.y(), central_point.z(), std::numeric_limits<float>::infinity() };
+	}
+
+	if (method == METHOD_ALGEBRAIC_REFINED) {
+		mchtr_fit::refine_sphere(data, sphere);
+	}
+	return sphere;
+}
+
+bool mchtr_fit::fit_sphere_algebraic(const std::vector<mchtr_geometry::point3>& data, mchtr_sgd::sphere& sphere) {
+	/*
+	Fits a sphere to n 3D points in closed form (Kasa method).
+	Minimises the algebraic distance sum((x^2 + y^2 + z^2 + D*x + E*y + F*z + G)^2), which is linear in D, E, F, G,
+	so the fit boils down to a single 4x4 normal system. Points are shifted to their centroid first for conditioning.
+	@param		data - points which the sphere will be fit to (at least 4)
+				sphere - output, fitted sphere
+	@return		false if the points do not determine a sphere (coplanar, collinear or too few)
+	*/
+	return mchtr_kernels::fit_sphere_algebraic<double>(data.data(), data.size(), sphere);
+}
+
+bool mchtr_fit::refine_sphere(const std::vector<mchtr_geometry::point3>& data, mchtr_sgd::sphere& sphere) {
+	/*
+	Does a single Gauss-Newton step on the geometric loss sum((|p - c| - r)^2), starting from the given sphere.
+	Removes most of the bias the algebraic fit has towards smaller spheres on short arcs.
+	@param		data - points which the sphere is fit to
+				sphere - sphere to refine, updated in place
+	@return		false if the step could not be computed (sphere is left unchanged)
+	*/
+	return mchtr_kernels::refine_sphere<double>(data.data(), data.size(), sphere);
+}
+
+double mchtr_fit::rms_residual(const std::vector<mchtr_geometry::point3>& data, const mchtr_sgd::sphere& sphere) {
+	/*
+	Calculates the root mean square distance between points and the sphere surface, a method independent measure of fit quality.
+	@param		data - points the sphere was fit to
+				sphere - fitted sphere
+	@return		rms of point to surface distances, infinity for a degenerate (infinite) sphere or no points
+	*/
+	if (data.empty() || !std::isfinite(sphere.r)) {
+		return std::numeric_limits<double>::infinity();
+	}
+	double sum = 0;
+	for (const mchtr_geometry::point3& point : data) {
+		const double dx = sphere.x - point.x();
+		const double dy = sphere.y - point.y();
+		const double dz = sphere.z - point.z();
+		const double residual = sqrt(dx * dx + dy * dy + dz * dz) - sphere.r;
+		sum += residual * residual;
+	}
+	return sqrt(sum / data.size());
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include "mchtr_geometry.h"
+#include "mchtr_sgd.h"
+
+/*
+Sphere fitting functionality header file (closed-form least squares fit and fit method selection)
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_fit
+{
+	enum method {
+		METHOD_SGD = 0,
+		METHOD_ALGEBRAIC = 1,
+		METHOD_ALGEBRAIC_REFINED = 2
+	};
+
+	bool is_valid_method(int);
+	double find_sphere_r(const std::vector<mchtr_geometry::point3>&, const mchtr_geometry::point3&, int);
+	mchtr_sgd::sphere fit_sphere(const std::vector<mchtr_geometry::point3>&, const mchtr_geometry::point3&, int);
+	bool fit_sphere_algebraic(const std::vector<mchtr_geometry::point3>&, mchtr_sgd::sphere&);
+	bool refine_sphere(const std::vector<mchtr_geometry::point3>&, mchtr_sgd::sphere&);
+	double rms_residual(const std::vector<mchtr_geometry::point3>&, const mchtr_sgd::sphere&);
+}
@@ -0,0 +1,134 @@
+#include "mchtr_geometry.h"
+#include <cmath>
+#include "mchtr_kernels.h"
+
+/*
+Geometry functionality cpp file (point and plane types, best fitting plane), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	double smallest_eigenvector(double a[3][3], double vector[3]) {
+		/*
+		Finds the eigenvector of the smallest eigenvalue of a symmetric 3x3 matrix with cyclic Jacobi rotations.
+		@param		a - symmetric matrix, diagonalised in place
+					vector - output, unit eigenvector
+		@return		the smallest eigenvalue
+		*/
+		double v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+		constexpr int max_sweeps = 50;
+		for (int sweep = 0; sweep < max_sweeps; ++sweep) {
+			const double off_diagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+			if (off_diagonal < 1e-30) {
+				break;
+			}
+			for (int p = 0; p < 2; ++p) {
+				for (int q = p + 1; q < 3; ++q) {
+					if (std::abs(a[p][q]) < 1e-300) {
+						continue;
+					}
+
+					// rotation zeroing a[p][q]
+					const double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+					const double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+					const double c = 1 / std::sqrt(t * t + 1);
+					const double s = t * c;
+					for (int k = 0; k < 3; ++k) {
+						const double akp = a[k][p];
+						const double akq = a[k][q];
+						a[k][p] = c * akp - s * akq;
+						a[k][q] = s * akp + c * akq;
+					}
+					for (int k = 0; k < 3; ++k) {
+						const double apk = a[p][k];
+						const double aqk = a[q][k];
+						a[p][k] = c * apk - s * aqk;
+						a[q][k] = s * apk + c * aqk;
+					}
+					for (int k = 0; k < 3; ++k) {
+						const double vkp = v[k][p];
+						const double vkq = v[k][q];
+						v[k][p] = c * vkp - s * vkq;
+						v[k][q] = s * vkp + c * vkq;
+					}
+				}
+			}
+		}
+
+		int smallest = 0;
+		for (int i = 1; i < 3; ++i) {
+			if (a[i][i] < a[smallest][smallest]) {
+				smallest = i;
+			}
+		}
+		const double norm = std::sqrt(v[0][smallest] * v[0][smallest] + v[1][smallest] * v[1][smallest] + v[2][smallest] * v[2][smallest]);
+		for (int i = 0; i < 3; ++i) {
+			vector[i] = norm > 0 ? v[i][smallest] / norm : v[i][smallest];
+		}
+		return a[smallest][smallest];
+	}
+}
+
+double mchtr_geometry::plane3::signed_distance(const mchtr_geometry::point3& point) const {
+	/*
+	@param		point - any point
+	@return		distance of the point to the plane, positive on the normal's side
+	*/
+	return normal[0] * point.x() + normal[1] * point.y() + normal[2] * point.z() + offset;
+}
+
+mchtr_geometry::point3 mchtr_geometry::plane3::project(const mchtr_geometry::point3& point) const {
+	/*
+	@param		point - any point
+	@return		orthogonal projection of the point onto the plane (computed in double precision)
+	*/
+	const double distance = signed_distance(point);
+	return mchtr_geometry::point3(static_cast<float>(point.x() - normal[0] * distance),
+		static_cast<float>(point.y() - normal[1] * distance),
+		static_cast<float>(point.z() - normal[2] * distance));
+}
+
+mchtr_geometry::plane3 mchtr_geometry::fit_plane(const mchtr_geometry::point3* points, std::size_t count) {
+	/*
+	Fits a least squares plane to points: through their mean, normal to the direction of their smallest variance.
+	@param		points - points to fit to
+				count - number of points
+	@return		best fitting plane, the z = 0 plane for no points
+	*/
+	return mchtr_kernels::fit_plane<double>(points, count);
+}
+
+mchtr_geometry::local_geometry mchtr_geometry::fit_local_geometry(const mchtr_geometry::point3* points, std::size_t count) {
+	/*
+	Fits a least squares plane to points and measures how far they are from lying in it, from a single covariance.
+	@param		points - points to fit to
+				count - number of points
+	@return		best fitting plane (the z = 0 plane for no points) and surface variation
+	*/
+	return mchtr_kernels::fit_local_geometry<double>(points, count);
+}
+
+mchtr_geometry::local_geometry mchtr_geometry::geometry_from_covariance(const double mean[3], double covariance[3][3]) {
+	/*
+	Builds the least squares plane of points and their surface variation from their mean and covariance.
+	@param		mean - mean of the points
+				covariance - covariance (or scatter) matrix of the points, diagonalised in place
+	@return		plane through the mean, normal to the direction of the smallest variance, and surface variation (0 for coincident points)
+	*/
+	const double trace = covariance[0][0] + covariance[1][1] + covariance[2][2];
+	mchtr_geometry::local_geometry geometry;
+	const double smallest = smallest_eigenvector(covariance, geometry.plane.normal);
+	geometry.plane.offset = -(geometry.plane.normal[0] * mean[0] + geometry.plane.normal[1] * mean[1] + geometry.plane.normal[2] * mean[2]);
+	geometry.surface_variation = trace > 0 ? std::fmax(smallest, 0.0) / trace : 0.0;
+	return geometry;
+}
+
+float mchtr_geometry::angle_to_vertical(const mchtr_geometry::plane3& plane) {
+	/*
+	@param		plane - any plane
+	@return		angle between the plane's normal and the Z axis in radians, 0 to pi (a horizontal plane gives 0 or pi)
+	*/
+	const float length = static_cast<float>(std::sqrt(plane.normal[0] * plane.normal[0] + plane.normal[1] * plane.normal[1] + plane.normal[2] * plane.normal[2]));
+	return std::acos(static_cast<float>(plane.normal[2]) / length);
+}
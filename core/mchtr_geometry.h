@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+Geometry functionality header file (point and plane types, best fitting plane, surface variation), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_geometry
+{
+	// single precision point with the same accessors as the SDK's Point3D, so the fitting code reads the same with both
+	struct point3 {
+		float coordinates[3];
+
+		point3() : coordinates{ 0, 0, 0 } {}
+		point3(float x, float y, float z) : coordinates{ x, y, z } {}
+		float x() const { return coordinates[0]; }
+		float y() const { return coordinates[1]; }
+		float z() const { return coordinates[2]; }
+	};
+
+	// plane n . p + offset = 0 with a unit normal
+	struct plane3 {
+		double normal[3];
+		double offset;
+
+		double signed_distance(const point3&) const;
+		point3 project(const point3&) const;
+	};
+
+	// least squares plane of a neighbourhood and its surface variation, the smallest eigenvalue of the covariance over the sum of all three:
+	// 0 on a plane, up to 1/3 for scatter with no preferred direction, a cheap curvature estimate
+	struct local_geometry {
+		plane3 plane;
+		double surface_variation;
+	};
+
+	plane3 fit_plane(const point3*, std::size_t);
+	local_geometry fit_local_geometry(const point3*, std::size_t);
+	local_geometry geometry_from_covariance(const double[3], double[3][3]);
+	float angle_to_vertical(const plane3&);
+}
@@ -0,0 +1,310 @@
+#include "mchtr_graph_codec.h"
+#include <algorithm>
+#include "mchtr_order.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MCHTR_CODEC_X86
+#include <immintrin.h>
+#endif
+
+// MSVC accepts any intrinsic without per-function target flags, GCC and Clang need them
+#if defined(MCHTR_CODEC_X86) && !defined(_MSC_VER)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MCHTR_TARGET_AVX2
+#endif
+
+/*
+Compressed KNN graph rows functionality cpp file
+A row is the number of neighbours (LEB128), the control bytes of its groups of 4 neighbours (2 bits per neighbour: byte length - 1)
+and the neighbours' bytes, little endian. A neighbour is stored as the zig-zag encoded difference of its curve position from the point's,
+which on a spatially coherent curve is small whatever order the cloud is stored in.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// largest encoded row of k neighbours: count, control bytes, 4 bytes per neighbour
+	std::size_t max_row_bytes(int k) {
+		return 5 + (static_cast<std::size_t>(k) + 3) / 4 + 4 * static_cast<std::size_t>(k);
+	}
+
+	// bytes past the end of the rows a 16 byte load of a row's last group can reach
+	constexpr std::size_t padding = 16;
+
+	// rows of one chunk of curve positions, encoded by one worker before they are put together
+	struct chunk_rows {
+		std::vector<unsigned char> bytes;
+		std::vector<std::uint64_t> block_starts;
+	};
+
+	// lengths (in bytes) and byte shuffles of the 4 values of every control byte
+	struct group_tables {
+		unsigned char lengths[256];
+		unsigned char shuffles[256][16];
+
+		group_tables() {
+			for (int control = 0; control < 256; ++control) {
+				int offset = 0;
+				for (int value = 0; value < 4; ++value) {
+					const int length = ((control >> (2 * value)) & 3) + 1;
+					for (int byte = 0; byte < 4; ++byte) {
+
+						// bytes of shorter values come from nowhere (0x80 makes the shuffle write 0)
+						shuffles[control][4 * value + byte] = static_cast<unsigned char>(byte < length ? offset + byte : 0x80);
+					}
+					offset += length;
+				}
+				lengths[control] = static_cast<unsigned char>(offset);
+			}
+		}
+	};
+
+	const group_tables& tables() {
+		static const group_tables instance;
+		return instance;
+	}
+
+	std::uint32_t zigzag(std::int64_t difference) {
+		/*
+		@param		difference - difference of two curve positions, |difference| < 2^31
+		@return		the same as an unsigned value, small differences of either sign stay small
+		*/
+		return static_cast<std::uint32_t>(static_cast<std::uint64_t>(difference) << 1) ^ (difference < 0 ? 0xffffffffu : 0u);
+	}
+
+	std::size_t read_count(const unsigned char*& row) {
+		/*
+		@param		row - start of an encoded row, moved past its neighbour count
+		@return		the row's neighbour count
+		*/
+		std::size_t count = 0;
+		for (int shift = 0; ; shift += 7) {
+			const unsigned char byte = *row++;
+			count |= static_cast<std::size_t>(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return count;
+			}
+		}
+	}
+
+	void encode_row(const std::uint32_t* neighbours, std::size_t count, std::uint32_t position, const std::uint32_t* positions, std::vector<unsigned char>& bytes) {
+		/*
+		Appends an encoded row.
+		@param		neighbours - point indices of the neighbours, nearest first
+					count - number of neighbours
+					position - curve position of the row's point
+					positions - curve position of every point
+					bytes - output, the row is appended
+		*/
+		for (std::size_t value = count; ; value >>= 7) {
+			bytes.push_back(static_cast<unsigned char>((value & 0x7f) | (value >= 0x80 ? 0x80 : 0)));
+			if (value < 0x80) {
+				break;
+			}
+		}
+		const std::size_t controls = bytes.size();
+		bytes.resize(controls + (count + 3) / 4, 0);
+		for (std::size_t j = 0; j < count; ++j) {
+			std::uint32_t value = zigzag(static_cast<std::int64_t>(positions[neighbours[j]]) - static_cast<std::int64_t>(position));
+			const int length = value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+			bytes[controls + j / 4] |= static_cast<unsigned char>((length - 1) << (2 * (j % 4)));
+			for (int byte = 0; byte < length; ++byte, value >>= 8) {
+				bytes.push_back(static_cast<unsigned char>(value & 0xff));
+			}
+		}
+	}
+}
+
+bool mchtr_graph_codec::packed_rows::encode(const float* xyz, std::size_t points_count, int k, int threads, const mchtr_graph_codec::row_function& rows,
+	const mchtr_parallel::progress_function& report) {
+	/*
+	Encodes the rows of all points, chunk by chunk in parallel, straight from the row function (the rows are never all held uncompressed).
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), give the curve order
+				points_count - number of points (rows)
+				k - longest row
+				threads - number of workers
+				rows - gives the neighbours of a point
+				report - receives the number of encoded rows
+	@return		false (and nothing encoded) if there are too many points for 32 bit curve position differences
+	*/
+	clear();
+	if (points_count >= (std::size_t(1) << 31)) {
+		return false;
+	}
+
+	// rows in Hilbert curve order, neighbours of a point are then mostly a few hundred positions away
+	{
+		std::vector<std::size_t> order;
+		mchtr_order::sort_points(xyz, nullptr, points_count, mchtr_order::ORDER_HILBERT, order);
+		m_points.assign(order.begin(), order.end());
+	}
+	m_positions.resize(points_count);
+	for (std::size_t position = 0; position < points_count; ++position) {
+		m_positions[m_points[position]] = static_cast<std::uint32_t>(position);
+	}
+
+	// as many rows per block as always fit 16 bit offsets
+	const std::size_t row_bytes = max_row_bytes(k);
+	m_block_shift = 0;
+	while ((std::size_t(2) << m_block_shift) * row_bytes <= 65536) {
+		++m_block_shift;
+	}
+	const std::size_t block_rows = std::size_t(1) << m_block_shift;
+	const std::size_t chunk_size = std::max<std::size_t>(block_rows, 1024);
+	const int workers = mchtr_parallel::resolve_threads(threads);
+	std::vector<chunk_rows> chunks((points_count + chunk_size - 1) / chunk_size);
+	std::vector<std::vector<std::uint32_t>> neighbours(workers, std::vector<std::uint32_t>(std::max(k, 1)));
+	m_row_offsets.resize(points_count);
+	mchtr_parallel::run_chunks(points_count, chunk_size, workers,
+		[&](std::size_t begin, std::size_t end, int worker) {
+			chunk_rows& chunk = chunks[begin / chunk_size];
+			chunk.bytes.reserve((end - begin) * (2 * static_cast<std::size_t>(k) + 2));
+			std::uint64_t block_start = 0;
+			for (std::size_t position = begin; position < end; ++position) {
+				if ((position & (block_rows - 1)) == 0) {
+					block_start = chunk.bytes.size();
+					chunk.block_starts.push_back(block_start);
+				}
+				m_row_offsets[position] = static_cast<std::uint16_t>(chunk.bytes.size() - block_start);
+				const std::size_t count = rows(m_points[position], worker, neighbours[worker].data());
+				encode_row(neighbours[worker].data(), count, static_cast<std::uint32_t>(position), m_positions.data(), chunk.bytes);
+			}
+		},
+		report);
+
+	// put the chunks together, in curve order
+	std::size_t total = 0;
+	for (const chunk_rows& chunk : chunks) {
+		total += chunk.bytes.size();
+	}
+	m_bytes.reserve(total + padding);
+	m_block_offsets.reserve((points_count + block_rows - 1) / block_rows);
+	for (chunk_rows& chunk : chunks) {
+		for (std::uint64_t start : chunk.block_starts) {
+			m_block_offsets.push_back(m_bytes.size() + start);
+		}
+		m_bytes.insert(m_bytes.end(), chunk.bytes.begin(), chunk.bytes.end());
+		std::vector<unsigned char>().swap(chunk.bytes);
+	}
+	m_bytes.resize(m_bytes.size() + padding, 0);
+	m_isa = mchtr_batch::detect_isa();
+	return true;
+}
+
+void mchtr_graph_codec::packed_rows::clear() {
+	/*
+	Drops all rows and lets go of their memory.
+	*/
+	std::vector<std::uint32_t>().swap(m_points);
+	std::vector<std::uint32_t>().swap(m_positions);
+	std::vector<std::uint64_t>().swap(m_block_offsets);
+	std::vector<std::uint16_t>().swap(m_row_offsets);
+	std::vector<unsigned char>().swap(m_bytes);
+}
+
+const unsigned char* mchtr_graph_codec::packed_rows::row_bytes(std::size_t i) const {
+	/*
+	@param		i - point index
+	@return		start of the point's encoded row
+	*/
+	const std::size_t position = m_positions[i];
+	return m_bytes.data() + m_block_offsets[position >> m_block_shift] + m_row_offsets[position];
+}
+
+std::size_t mchtr_graph_codec::packed_rows::row_size(std::size_t i) const {
+	/*
+	@param		i - point index
+	@return		number of neighbours in the point's row
+	*/
+	const unsigned char* row = row_bytes(i);
+	return read_count(row);
+}
+
+std::size_t mchtr_graph_codec::packed_rows::decode(std::size_t i, std::size_t limit, std::uint32_t* neighbours) const {
+	/*
+	@param		i - point index
+				limit - number of nearest neighbours wanted, the row's prefix
+				neighbours - output, point indices of the neighbours, nearest first; room for limit + decode_slack values
+	@return		number of neighbours decoded, the smaller of limit and the row's length
+	*/
+	if (m_isa != mchtr_batch::ISA_SCALAR) {
+		return mchtr_graph_codec::decode_avx2(row_bytes(i), limit, m_positions[i], m_points.data(), neighbours);
+	}
+	return mchtr_graph_codec::decode_scalar(row_bytes(i), limit, m_positions[i], m_points.data(), neighbours);
+}
+
+std::size_t mchtr_graph_codec::packed_rows::bytes() const {
+	/*
+	@return		memory held by the rows and their indexing
+	*/
+	return m_points.size() * sizeof(std::uint32_t) + m_positions.size() * sizeof(std::uint32_t) + m_block_offsets.size() * sizeof(std::uint64_t) +
+		m_row_offsets.size() * sizeof(std::uint16_t) + m_bytes.size();
+}
+
+std::size_t mchtr_graph_codec::decode_scalar(const unsigned char* row, std::size_t limit, std::uint32_t position, const std::uint32_t* points,
+	std::uint32_t* neighbours) {
+	/*
+	Scalar decoder, one neighbour at a time.
+	@param		row - start of an encoded row
+				limit - number of nearest neighbours wanted
+				position - curve position of the row's point
+				points - index of the point at every curve position
+				neighbours - output, point indices of the neighbours, nearest first
+	@return		number of neighbours decoded
+	*/
+	const std::size_t count = read_count(row);
+	const std::size_t decoded = std::min(count, limit);
+	const unsigned char* data = row + (count + 3) / 4;
+	for (std::size_t j = 0; j < decoded; ++j) {
+		const int length = ((row[j / 4] >> (2 * (j % 4))) & 3) + 1;
+		std::uint32_t value = 0;
+		for (int byte = 0; byte < length; ++byte) {
+			value |= static_cast<std::uint32_t>(data[byte]) << (8 * byte);
+		}
+		data += length;
+		const std::uint32_t difference = (value >> 1) ^ (0u - (value & 1));
+		neighbours[j] = points[position + difference];
+	}
+	return decoded;
+}
+
+#if defined(MCHTR_CODEC_X86)
+
+MCHTR_TARGET_AVX2 std::size_t mchtr_graph_codec::decode_avx2(const unsigned char* row, std::size_t limit, std::uint32_t position, const std::uint32_t* points,
+	std::uint32_t* neighbours) {
+	/*
+	AVX2 decoder, 4 neighbours per step: one byte shuffle spreads a group's bytes into 4 values, the zig-zag decoding and the curve
+	positions are computed in a vector and the point indices gathered (lanes past the row's end gather nothing).
+	@param		row, limit, position, points, neighbours - see decode_scalar
+	@return		number of neighbours decoded
+	*/
+	const group_tables& table = tables();
+	const std::size_t count = read_count(row);
+	const std::size_t decoded = std::min(count, limit);
+	const unsigned char* data = row + (count + 3) / 4;
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i base = _mm_set1_epi32(static_cast<int>(position));
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	for (std::size_t j = 0; j < decoded; j += 4) {
+		const unsigned char control = row[j / 4];
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+		const __m128i values = _mm_shuffle_epi8(bytes, _mm_loadu_si128(reinterpret_cast<const __m128i*>(table.shuffles[control])));
+		data += table.lengths[control];
+		const __m128i differences = _mm_xor_si128(_mm_srli_epi32(values, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(values, one)));
+		const __m128i valid = _mm_cmpgt_epi32(_mm_set1_epi32(static_cast<int>(decoded - j)), lanes);
+		const __m128i indices = _mm_mask_i32gather_epi32(_mm_setzero_si128(), reinterpret_cast<const int*>(points), _mm_add_epi32(base, differences), valid, 4);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(neighbours + j), indices);
+	}
+	return decoded;
+}
+
+#else
+
+std::size_t mchtr_graph_codec::decode_avx2(const unsigned char* row, std::size_t limit, std::uint32_t position, const std::uint32_t* points,
+	std::uint32_t* neighbours) {
+	// not an x86 build, detect_isa never selects this
+	return mchtr_graph_codec::decode_scalar(row, limit, position, points, neighbours);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "mchtr_batch.h"
+#include "mchtr_parallel.h"
+
+/*
+Compressed KNN graph rows functionality header file: rows stored in Hilbert curve order of their points, every neighbour as the zig-zag
+encoded difference of its curve position from the point's, in Stream VByte groups (a control byte with the byte lengths of 4 values,
+then their bytes), so a row takes 1 - 2 bytes per neighbour instead of 4 and decodes with one byte shuffle per 4 neighbours
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_graph_codec
+{
+	// values decode may write past the ones asked for, its output buffer needs that many extra slots
+	constexpr std::size_t decode_slack = 4;
+
+	// writes the neighbours of a point (nearest first, at most k) into the buffer and returns their number; called on the worker threads
+	using row_function = std::function<std::size_t(std::size_t, int, std::uint32_t*)>;
+
+	// rows of a KNN graph, encoded once and then only decoded; blocks of rows start at 64 bit offsets, rows within a block at 16 bit ones
+	class packed_rows {
+	public:
+		bool encode(const float*, std::size_t, int, int, const row_function&, const mchtr_parallel::progress_function&);
+		void clear();
+		bool empty() const { return m_points.empty(); }
+		std::size_t size() const { return m_points.size(); }
+		std::size_t row_size(std::size_t) const;
+		std::size_t decode(std::size_t, std::size_t, std::uint32_t*) const;
+		std::size_t bytes() const;
+
+	private:
+		const unsigned char* row_bytes(std::size_t) const;
+
+		std::vector<std::uint32_t> m_points;		// index of the point at every curve position
+		std::vector<std::uint32_t> m_positions;		// curve position of every point
+		std::vector<std::uint64_t> m_block_offsets;	// first byte of every block of rows
+		std::vector<std::uint16_t> m_row_offsets;	// first byte of every row (by curve position), relative to its block
+		std::vector<unsigned char> m_bytes;			// the rows, padded so 16 byte loads never leave the buffer
+		int m_block_shift{ 0 };						// rows per block = 1 << m_block_shift
+		mchtr_batch::isa m_isa{ mchtr_batch::ISA_SCALAR };
+	};
+
+	std::size_t decode_scalar(const unsigned char*, std::size_t, std::uint32_t, const std::uint32_t*, std::uint32_t*);
+	std::size_t decode_avx2(const unsigned char*, std::size_t, std::uint32_t, const std::uint32_t*, std::uint32_t*);
+}
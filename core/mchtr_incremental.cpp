@@ -0,0 +1,199 @@
+#include "mchtr_incremental.h"
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "mchtr_kdtree.h"
+
+/*
+Incremental curvature functionality cpp file
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	bool same_point(const float* a, const float* b) {
+		// bit patterns, like the KNN graph's fingerprint, so -0 and 0 differ and NaN equals itself
+		return std::memcmp(a, b, 3 * sizeof(float)) == 0;
+	}
+
+	mchtr_curvature::run_info fit_live_points(mchtr_incremental::snapshot& last, const float* xyz, const unsigned char* live, std::size_t points_count,
+		const std::vector<std::size_t>& fitted, const mchtr_curvature::options& settings, const mchtr_parallel::progress_function& report) {
+		/*
+		Fits the given points against the K nearest live points and stores their curvatures and K-th neighbour distances in the snapshot.
+		@param		last - snapshot whose curvatures and kth_distances are written, sized to points_count
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					live - 1 for every point that isn't deleted
+					points_count - number of points
+					fitted - indices of the live points to fit, ascending
+					settings - options of the fits
+					report - receives the number of fitted points, scaled to points_count
+		@return		instruction set, number of workers and SGD statistics
+		*/
+		// deleted points are left out of the kd-tree, so its indices are positions among the live points
+		std::vector<float> live_xyz;
+		std::vector<std::size_t> position_of(points_count, 0);
+		live_xyz.reserve(3 * points_count);
+		for (std::size_t i = 0; i < points_count; ++i) {
+			if (live[i]) {
+				position_of[i] = live_xyz.size() / 3;
+				live_xyz.insert(live_xyz.end(), xyz + 3 * i, xyz + 3 * i + 3);
+			}
+		}
+		const std::size_t live_count = live_xyz.size() / 3;
+		mchtr_kdtree::kdtree tree;
+		{
+			mchtr_profile::scoped_stage stage(settings.profile, "kdtree_build");
+			tree.build(live_xyz.data(), live_count);
+		}
+
+		std::vector<std::size_t> subset(fitted.size());
+		for (std::size_t j = 0; j < fitted.size(); ++j) {
+			subset[j] = position_of[fitted[j]];
+		}
+		std::vector<float> curvatures(live_count, 0.0f);
+		std::vector<float> kth_distances(live_count, 0.0f);
+		const std::size_t fitted_count = fitted.size();
+		const mchtr_curvature::run_info info = mchtr_curvature::compute(tree, live_xyz.data(), subset.data(), subset.size(), settings,
+			[&report, fitted_count, points_count](std::size_t finished) { report(fitted_count > 0 ? finished * points_count / fitted_count : points_count); },
+			curvatures.data(), kth_distances.data());
+
+		// with fewer live points than K every neighbourhood holds all of them, so any edit anywhere reaches it;
+		// a radius neighbourhood with room left takes in any point moved within the radius, so that far is reached too
+		const bool short_rows = live_count < static_cast<std::size_t>(settings.neighbours_count);
+		const float radius_squared = settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS ?
+			settings.neighbourhood.radius * settings.neighbourhood.radius : 0.0f;
+		for (std::size_t j = 0; j < fitted.size(); ++j) {
+			last.curvatures[fitted[j]] = curvatures[subset[j]];
+			last.kth_distances[fitted[j]] = short_rows ? std::numeric_limits<float>::infinity() : std::max(kth_distances[subset[j]], radius_squared);
+		}
+		return info;
+	}
+}
+
+void mchtr_incremental::snapshot::invalidate() {
+	/*
+	Drops the snapshot and releases its memory, the next run fits every point.
+	*/
+	std::vector<float>().swap(xyz);
+	std::vector<unsigned char>().swap(live);
+	std::vector<float>().swap(curvatures);
+	std::vector<float>().swap(kth_distances);
+}
+
+bool mchtr_incremental::snapshot::valid_for(std::size_t points_count, const mchtr_curvature::options& current) const {
+	/*
+	Checks whether a run can start from the snapshot.
+	@param		points_count - number of points of the cloud now
+				current - options of the run
+	@return		true if the snapshot has the same number of points and was fitted with options giving the same curvatures
+	*/
+	return !live.empty() && live.size() == points_count && settings.neighbours_count == current.neighbours_count && settings.fit_method == current.fit_method &&
+		settings.max_epochs == current.max_epochs && settings.tolerance == current.tolerance && settings.warm_start == current.warm_start &&
+		settings.order == current.order && mchtr_voxel_grid::key(settings.neighbourhood) == mchtr_voxel_grid::key(current.neighbourhood);
+}
+
+mchtr_incremental::run_stats mchtr_incremental::compute_curvature(mchtr_incremental::snapshot& last, const float* xyz, const unsigned char* live,
+	std::size_t points_count, const mchtr_curvature::options& settings, const mchtr_parallel::progress_function& report, float* curvatures) {
+	/*
+	Calculates local curvature of every live point, fitting again only the points whose neighbourhood an edit since the snapshot may have reached:
+	points that were moved or restored themselves, and points with a moved, deleted or restored point (at its old or new position)
+	no farther than their previous K-th neighbour. Without warm starts the result is the same as fitting every live point.
+	@param		last - snapshot of the previous run, updated to this run; invalid snapshots are rebuilt by fitting every live point
+				xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), deleted ones included
+				live - 1 for every point that isn't deleted
+				points_count - number of points
+				settings - options of the fits, throws std::invalid_argument if invalid
+				report - receives the number of processed points, on the calling thread
+				curvatures - output, points_count curvatures, deleted points get mchtr_curvature::no_curvature
+	@return		whether the run was a full one, numbers of changed and fitted points, fitting statistics
+	*/
+	const wchar_t* error = mchtr_curvature::validate(settings);
+	if (error) {
+
+		// the messages are plain ASCII
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+
+	mchtr_incremental::run_stats stats;
+	std::vector<std::size_t> fitted;
+	if (!last.valid_for(points_count, settings)) {
+		last.curvatures.assign(points_count, 0.0f);
+		last.kth_distances.assign(points_count, 0.0f);
+		for (std::size_t i = 0; i < points_count; ++i) {
+			if (live[i]) {
+				fitted.push_back(i);
+			}
+		}
+		stats.changed = points_count;
+	}
+	else {
+		stats.full = false;
+		mchtr_profile::scoped_stage stage(settings.profile, "change_detection");
+
+		// changed points and the positions they were changed from and to
+		std::vector<unsigned char> changed(points_count, 0);
+		std::vector<float> changed_xyz;
+		for (std::size_t i = 0; i < points_count; ++i) {
+			const bool was_live = last.live[i] != 0;
+			const bool is_live = live[i] != 0;
+			if (was_live == is_live && (!is_live || same_point(last.xyz.data() + 3 * i, xyz + 3 * i))) {
+				continue;
+			}
+			changed[i] = 1;
+			++stats.changed;
+			if (was_live) {
+				changed_xyz.insert(changed_xyz.end(), last.xyz.data() + 3 * i, last.xyz.data() + 3 * i + 3);
+			}
+			if (is_live) {
+				changed_xyz.insert(changed_xyz.end(), xyz + 3 * i, xyz + 3 * i + 3);
+			}
+		}
+
+		// a live point is dirty if it changed itself or a changed position is within its previous K-th neighbour distance
+		if (!changed_xyz.empty()) {
+			mchtr_kdtree::kdtree changes;
+			changes.build(changed_xyz.data(), changed_xyz.size() / 3);
+			std::vector<unsigned char> dirty(points_count, 0);
+			constexpr std::size_t chunk_size = 4096;
+			mchtr_parallel::run_chunks(points_count, chunk_size, mchtr_parallel::resolve_threads(settings.threads),
+				[&](std::size_t begin, std::size_t end, int) {
+					for (std::size_t i = begin; i < end; ++i) {
+						dirty[i] = live[i] && (changed[i] || changes.any_within(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], last.kth_distances[i]));
+					}
+				},
+				[](std::size_t) {});
+			for (std::size_t i = 0; i < points_count; ++i) {
+				if (dirty[i]) {
+					fitted.push_back(i);
+				}
+			}
+		}
+	}
+
+	stats.recomputed = fitted.size();
+	if (!fitted.empty()) {
+		stats.fitting = fit_live_points(last, xyz, live, points_count, fitted, settings, report);
+	}
+	else {
+		stats.fitting.workers = mchtr_parallel::resolve_threads(settings.threads);
+	}
+	last.settings = settings;
+	last.settings.profile = nullptr;
+	last.xyz.assign(xyz, xyz + 3 * points_count);
+	last.live.assign(live, live + points_count);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		if (!live[i]) {
+			last.curvatures[i] = mchtr_curvature::no_curvature;
+		}
+	}
+	std::copy(last.curvatures.begin(), last.curvatures.end(), curvatures);
+	if (settings.profile) {
+		settings.profile->set_value("points", static_cast<double>(points_count));
+		settings.profile->set_value("changed", static_cast<double>(stats.changed));
+		settings.profile->set_value("recomputed", static_cast<double>(stats.recomputed));
+	}
+	return stats;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "mchtr_curvature.h"
+#include "mchtr_parallel.h"
+
+/*
+Incremental curvature functionality header file: after points were moved, deleted or restored only the points whose K nearest
+neighbours could have changed are fitted again, the rest keep the curvature of the previous run
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_incremental
+{
+	// what the previous run saw and produced, kept by the caller between runs; points are identified by index,
+	// a deleted point keeps its slot, with mchtr_curvature::no_curvature
+	struct snapshot {
+		mchtr_curvature::options settings;
+		std::vector<float> xyz;
+		std::vector<unsigned char> live;
+		std::vector<float> curvatures;
+		std::vector<float> kth_distances;		// squared distance to the K-th neighbour (at least the squared radius in radius mode), an edit farther from a point than this doesn't change its neighbourhood
+
+		void invalidate();
+		bool valid_for(std::size_t, const mchtr_curvature::options&) const;
+	};
+
+	struct run_stats {
+		bool full{ true };				// no usable snapshot, every live point was fitted
+		std::size_t changed{ 0 };		// points moved, deleted or restored since the snapshot
+		std::size_t recomputed{ 0 };	// points fitted by this run
+		mchtr_curvature::run_info fitting{ mchtr_batch::ISA_SCALAR, 1, 0, 0, 0, 0, 0 };
+	};
+
+	run_stats compute_curvature(snapshot&, const float*, const unsigned char*, std::size_t, const mchtr_curvature::options&,
+		const mchtr_parallel::progress_function&, float*);
+}
@@ -0,0 +1,247 @@
+#include "mchtr_kdtree.h"
+#include <algorithm>
+#include <limits>
+
+/*
+Spatial index functionality cpp file (flat kd-tree with K nearest neighbours queries), shared by the plugins
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	inline bool closer(const mchtr_kdtree::neighbour& a, const mchtr_kdtree::neighbour& b) {
+		// ties go to the smaller index, so results don't depend on the tree's layout
+		return a.distance_squared < b.distance_squared || (a.distance_squared == b.distance_squared && a.index < b.index);
+	}
+}
+
+void mchtr_kdtree::kdtree::build(const float* xyz, std::size_t points_count) {
+	/*
+	Builds the tree: nodes split at the median of their widest axis until at most leaf_size points are left.
+	@param		xyz - coordinates of the points, interleaved (x0, y0, z0, x1, ...), not referenced after the build
+				points_count - number of points
+	*/
+	const std::uint32_t count = static_cast<std::uint32_t>(points_count);
+	m_nodes.clear();
+	m_indices.resize(count);
+	for (std::uint32_t i = 0; i < count; ++i) {
+		m_indices[i] = i;
+	}
+	if (count == 0) {
+		m_xyz.clear();
+		return;
+	}
+
+	m_nodes.reserve(2 * (count / leaf_size + 1));
+	m_nodes.push_back(node{ 0, 0, 0, count, 0 });
+	build_node(0, xyz);
+
+	// copy coordinates in tree order, every leaf reads one contiguous block
+	m_xyz.resize(3 * static_cast<std::size_t>(count));
+	for (std::uint32_t slot = 0; slot < count; ++slot) {
+		m_xyz[3 * slot] = xyz[3 * static_cast<std::size_t>(m_indices[slot])];
+		m_xyz[3 * slot + 1] = xyz[3 * static_cast<std::size_t>(m_indices[slot]) + 1];
+		m_xyz[3 * slot + 2] = xyz[3 * static_cast<std::size_t>(m_indices[slot]) + 2];
+	}
+}
+
+void mchtr_kdtree::kdtree::build_node(std::uint32_t id, const float* xyz) {
+	/*
+	Splits a node (recursively), its two children are always stored next to each other.
+	@param		id - index of the node, its begin and end are already set
+				xyz - coordinates of the points, interleaved
+	*/
+	const std::uint32_t begin = m_nodes[id].begin;
+	const std::uint32_t end = m_nodes[id].end;
+	if (end - begin <= leaf_size) {
+		return;
+	}
+
+	// widest axis of the node's bounding box
+	float low[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+	float high[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+	for (std::uint32_t i = begin; i < end; ++i) {
+		for (int axis = 0; axis < 3; ++axis) {
+			const float value = xyz[3 * static_cast<std::size_t>(m_indices[i]) + axis];
+			low[axis] = std::min(low[axis], value);
+			high[axis] = std::max(high[axis], value);
+		}
+	}
+	std::uint32_t axis = 0;
+	for (std::uint32_t candidate = 1; candidate < 3; ++candidate) {
+		if (high[candidate] - low[candidate] > high[axis] - low[axis]) {
+			axis = candidate;
+		}
+	}
+
+	// all points at the same place, nothing to split
+	if (high[axis] == low[axis]) {
+		return;
+	}
+
+	// median split, left points are <= split, right points are >= split
+	const std::uint32_t middle = begin + (end - begin) / 2;
+	std::nth_element(m_indices.begin() + begin, m_indices.begin() + middle, m_indices.begin() + end,
+		[xyz, axis](std::uint32_t a, std::uint32_t b) { return xyz[3 * static_cast<std::size_t>(a) + axis] < xyz[3 * static_cast<std::size_t>(b) + axis]; });
+
+	const std::uint32_t child = static_cast<std::uint32_t>(m_nodes.size());
+	m_nodes[id].split = xyz[3 * static_cast<std::size_t>(m_indices[middle]) + axis];
+	m_nodes[id].axis = axis;
+	m_nodes[id].child = child;
+	m_nodes.push_back(node{ 0, 0, begin, middle, 0 });
+	m_nodes.push_back(node{ 0, 0, middle, end, 0 });
+	build_node(child, xyz);
+	build_node(child + 1, xyz);
+}
+
+std::size_t mchtr_kdtree::kdtree::knn(float x, float y, float z, int k, neighbour* result, std::size_t* visited_count) const {
+	/*
+	Finds K nearest neighbours of a point (the point itself included if it's in the tree).
+	The result array doubles as a bounded max-heap while searching, nothing is allocated.
+	@param		x, y, z - query point
+				k - number of neighbours
+				result - output, k neighbours sorted nearest first (index and coordinates)
+				visited_count - optional output (may be nullptr), number of points distances were calculated to
+	@return		number of neighbours found, min(k, size())
+	*/
+	if (visited_count) {
+		*visited_count = 0;
+	}
+	if (m_nodes.empty() || k <= 0) {
+		return 0;
+	}
+	std::size_t visited_points = 0;
+	const std::size_t wanted = std::min(static_cast<std::size_t>(k), size());
+	const float query[3] = { x, y, z };
+	std::size_t found = 0;
+
+	// nodes to visit with a lower bound of their distance, a median split tree is never deeper than this
+	struct pending {
+		std::uint32_t node;
+		float distance_squared;
+	};
+	pending stack[64];
+	int top = 0;
+	stack[top++] = pending{ 0, 0.0f };
+
+	while (top > 0) {
+		const pending current = stack[--top];
+		if (found == wanted && current.distance_squared > result[0].distance_squared) {
+			continue;
+		}
+
+		const node& visited = m_nodes[current.node];
+		if (visited.child == 0) {
+			visited_points += visited.end - visited.begin;
+			for (std::uint32_t slot = visited.begin; slot < visited.end; ++slot) {
+				const float px = m_xyz[3 * static_cast<std::size_t>(slot)];
+				const float py = m_xyz[3 * static_cast<std::size_t>(slot) + 1];
+				const float pz = m_xyz[3 * static_cast<std::size_t>(slot) + 2];
+				const float dx = px - x;
+				const float dy = py - y;
+				const float dz = pz - z;
+				const neighbour candidate{ dx * dx + dy * dy + dz * dz, m_indices[slot], px, py, pz };
+				if (found < wanted) {
+					result[found++] = candidate;
+					std::push_heap(result, result + found, closer);
+				}
+				else if (closer(candidate, result[0])) {
+					std::pop_heap(result, result + found, closer);
+					result[found - 1] = candidate;
+					std::push_heap(result, result + found, closer);
+				}
+			}
+			continue;
+		}
+
+		// visit the child on the query's side first, the other one only if the split plane is close enough
+		const float difference = query[visited.axis] - visited.split;
+		const std::uint32_t near_child = difference < 0 ? visited.child : visited.child + 1;
+		const std::uint32_t far_child = difference < 0 ? visited.child + 1 : visited.child;
+		stack[top++] = pending{ far_child, std::max(current.distance_squared, difference * difference) };
+		stack[top++] = pending{ near_child, current.distance_squared };
+	}
+
+	std::sort_heap(result, result + found, closer);
+	if (visited_count) {
+		*visited_count = visited_points;
+	}
+	return found;
+}
+
+bool mchtr_kdtree::kdtree::any_within(float x, float y, float z, float radius_squared) const {
+	/*
+	Checks whether any point of the tree lies within a radius, stops at the first one found.
+	Nodes farther than the radius are never visited, so far queries are cheap, unlike a nearest neighbour search.
+	@param		x, y, z - query point
+				radius_squared - squared radius, a point exactly on the sphere counts
+	@return		true if a point no farther than the radius exists
+	*/
+	if (m_nodes.empty()) {
+		return false;
+	}
+	const float query[3] = { x, y, z };
+	struct pending {
+		std::uint32_t node;
+		float distance_squared;
+	};
+	pending stack[64];
+	int top = 0;
+	stack[top++] = pending{ 0, 0.0f };
+
+	while (top > 0) {
+		const pending current = stack[--top];
+		if (current.distance_squared > radius_squared) {
+			continue;
+		}
+		const node& visited = m_nodes[current.node];
+		if (visited.child == 0) {
+			for (std::uint32_t slot = visited.begin; slot < visited.end; ++slot) {
+				const float dx = m_xyz[3 * static_cast<std::size_t>(slot)] - x;
+				const float dy = m_xyz[3 * static_cast<std::size_t>(slot) + 1] - y;
+				const float dz = m_xyz[3 * static_cast<std::size_t>(slot) + 2] - z;
+				if (dx * dx + dy * dy + dz * dz <= radius_squared) {
+					return true;
+				}
+			}
+			continue;
+		}
+		const float difference = query[visited.axis] - visited.split;
+		const std::uint32_t near_child = difference < 0 ? visited.child : visited.child + 1;
+		const std::uint32_t far_child = difference < 0 ? visited.child + 1 : visited.child;
+		stack[top++] = pending{ far_child, std::max(current.distance_squared, difference * difference) };
+		stack[top++] = pending{ near_child, current.distance_squared };
+	}
+	return false;
+}
+
+void mchtr_kdtree::kdtree::knn_all(int k, neighbour* results, int threads, const mchtr_parallel::progress_function& report,
+	mchtr_profile::worker_stats* stats) const {
+	/*
+	Finds K nearest neighbours of every point in the tree, a batch of queries in tree (spatial) order,
+	so consecutive queries walk the same leaves.
+	@param		k - number of neighbours
+				results - output, size() rows of k neighbours, row of point i starts at results[i * k]
+				threads - number of workers
+				report - receives the number of processed points
+				stats - optional (may be nullptr), per worker counters, at least threads of them
+	*/
+	constexpr std::size_t chunk_size = 1024;
+	mchtr_parallel::run_chunks(size(), chunk_size, threads,
+		[&](std::size_t begin, std::size_t end, int worker) {
+			mchtr_profile::worker_stats* own = stats ? stats + worker : nullptr;
+			mchtr_profile::scoped_timer busy_timer(own ? &own->busy_nanoseconds : nullptr);
+			mchtr_profile::scoped_timer knn_timer(own ? &own->knn_nanoseconds : nullptr);
+			for (std::size_t slot = begin; slot < end; ++slot) {
+				std::size_t visited = 0;
+				knn(m_xyz[3 * slot], m_xyz[3 * slot + 1], m_xyz[3 * slot + 2], k, results + static_cast<std::size_t>(m_indices[slot]) * k, own ? &visited : nullptr);
+				if (own) {
+					own->add_query(visited);
+				}
+			}
+			if (own) {
+				own->points += end - begin;
+			}
+		},
+		report);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "mchtr_parallel.h"
+#include "mchtr_profile.h"
+
+/*
+Spatial index functionality header file (flat kd-tree with K nearest neighbours queries), shared by the plugins
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_kdtree
+{
+	struct neighbour {
+		float distance_squared;
+		std::uint32_t index;
+		float x, y, z;
+	};
+
+	// kd-tree in a flat node array; points are reordered so every leaf's points are contiguous in memory
+	class kdtree {
+	public:
+		static constexpr std::uint32_t leaf_size = 16;
+
+		void build(const float*, std::size_t);
+		std::size_t size() const { return m_indices.size(); }
+		std::size_t knn(float x, float y, float z, int k, neighbour* result) const { return knn(x, y, z, k, result, nullptr); }
+		std::size_t knn(float, float, float, int, neighbour*, std::size_t*) const;
+		void knn_all(int, neighbour*, int, const mchtr_parallel::progress_function&, mchtr_profile::worker_stats*) const;
+		bool any_within(float, float, float, float) const;
+
+	private:
+		struct node {
+			float split;
+			std::uint32_t axis;
+			std::uint32_t begin, end;
+			std::uint32_t child;
+		};
+
+		void build_node(std::uint32_t, const float*);
+
+		std::vector<node> m_nodes;
+		std::vector<float> m_xyz;
+		std::vector<std::uint32_t> m_indices;
+	};
+}
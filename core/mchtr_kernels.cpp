@@ -0,0 +1,413 @@
+#include "mchtr_kernels.h"
+#include <cmath>
+
+/*
+Fitting kernels functionality cpp file
+With double arithmetic the kernels do the same operations in the same order as the fits did before they were templated,
+so their results are bitwise the same.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// neighbourhood of a size known at compile time, copied into stack arrays (structure of arrays)
+	template <int K>
+	struct fixed_points {
+		float xs[K], ys[K], zs[K];
+
+		explicit fixed_points(const mchtr_geometry::point3* points) {
+			for (int i = 0; i < K; ++i) {
+				xs[i] = points[i].x();
+				ys[i] = points[i].y();
+				zs[i] = points[i].z();
+			}
+		}
+		static constexpr std::size_t size() { return K; }
+		float x(std::size_t i) const { return xs[i]; }
+		float y(std::size_t i) const { return ys[i]; }
+		float z(std::size_t i) const { return zs[i]; }
+	};
+
+	// neighbourhood of any other size, read in place
+	struct runtime_points {
+		const mchtr_geometry::point3* points;
+		std::size_t count;
+
+		runtime_points(const mchtr_geometry::point3* neighbourhood, std::size_t neighbours_count) : points(neighbourhood), count(neighbours_count) {}
+		std::size_t size() const { return count; }
+		float x(std::size_t i) const { return points[i].x(); }
+		float y(std::size_t i) const { return points[i].y(); }
+		float z(std::size_t i) const { return points[i].z(); }
+	};
+
+	template <typename F>
+	auto with_points(const mchtr_geometry::point3* points, std::size_t count, bool fixed, F kernel) -> decltype(kernel(runtime_points(points, count))) {
+		/*
+		Runs a kernel on a neighbourhood, specialised for its size if it's one of mchtr_kernels::fixed_sizes.
+		@param		points - the neighbourhood
+					count - number of points
+					fixed - false always runs the runtime size kernel
+					kernel - generic callable taking fixed_points<K> or runtime_points
+		@return		what the kernel returns
+		*/
+		if (fixed) {
+			switch (count) {
+			case 8: return kernel(fixed_points<8>(points));
+			case 15: return kernel(fixed_points<15>(points));
+			case 25: return kernel(fixed_points<25>(points));
+			case 32: return kernel(fixed_points<32>(points));
+			case 100: return kernel(fixed_points<100>(points));
+			default: break;
+			}
+		}
+		return kernel(runtime_points(points, count));
+	}
+
+	// smallest pivot of a 4x4 solve relative to the largest matrix entry
+	template <typename T> T pivot_tolerance();
+	template <> float pivot_tolerance<float>() { return 1e-6f; }
+	template <> double pivot_tolerance<double>() { return 1e-12; }
+
+	template <typename T>
+	bool solve_4x4(T a[4][4], T b[4]) {
+		/*
+		Solves a 4x4 linear system in place with gaussian elimination and partial pivoting.
+		@param		a - system matrix, destroyed during elimination
+					b - right hand side, replaced with the solution
+		@return		false if the system is (numerically) singular
+		*/
+		T scale = 0;
+		for (int i = 0; i < 4; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				scale = std::fmax(scale, std::fabs(a[i][j]));
+			}
+		}
+		if (scale == 0) {
+			return false;
+		}
+		const T min_pivot = scale * pivot_tolerance<T>();
+
+		for (int col = 0; col < 4; ++col) {
+
+			// pick the largest pivot in the column
+			int pivot = col;
+			for (int row = col + 1; row < 4; ++row) {
+				if (std::fabs(a[row][col]) > std::fabs(a[pivot][col])) {
+					pivot = row;
+				}
+			}
+			if (std::fabs(a[pivot][col]) < min_pivot) {
+				return false;
+			}
+			if (pivot != col) {
+				for (int j = 0; j < 4; ++j) {
+					T tmp = a[col][j];
+					a[col][j] = a[pivot][j];
+					a[pivot][j] = tmp;
+				}
+				T tmp = b[col];
+				b[col] = b[pivot];
+				b[pivot] = tmp;
+			}
+
+			// eliminate the column below the pivot
+			for (int row = col + 1; row < 4; ++row) {
+				T factor = a[row][col] / a[col][col];
+				for (int j = col; j < 4; ++j) {
+					a[row][j] -= factor * a[col][j];
+				}
+				b[row] -= factor * b[col];
+			}
+		}
+
+		// back substitution
+		for (int row = 3; row >= 0; --row) {
+			T sum = b[row];
+			for (int j = row + 1; j < 4; ++j) {
+				sum -= a[row][j] * b[j];
+			}
+			b[row] = sum / a[row][row];
+		}
+		return true;
+	}
+
+	template <typename T, typename P>
+	mchtr_sgd::sphere sgd(const P& points, const mchtr_sgd::sphere& start, const mchtr_sgd::convergence& stopping, int& epochs) {
+		/*
+		Stochastic gradient descent on the loss L = (sqrt((x-a)^2 + (y-b)^2 + (z-c)^2) - r)^2 summed over the points,
+		one update per point, see mchtr_sgd::fit_sphere.
+		@param		points - the neighbourhood
+					start - initial sphere
+					stopping - maximum number of epochs and early stopping tolerance
+					epochs - output, number of epochs run
+		@return		fitted sphere
+		*/
+		const T xyz_learning_rate = static_cast<T>(mchtr_sgd::xyz_learning_rate);
+		const T r_learning_rate = static_cast<T>(mchtr_sgd::r_learning_rate);
+		mchtr_sgd::sphere sphere = start;
+		T previous_loss = 0;
+		for (epochs = 0; epochs < stopping.max_epochs; ) {
+			T loss = 0;
+			for (std::size_t i = 0; i < points.size(); ++i) {
+
+				// offsets are taken in single precision, like the sphere and the points are stored
+				const float dx = sphere.x - points.x(i);
+				const float dy = sphere.y - points.y(i);
+				const float dz = sphere.z - points.z(i);
+				const T distance = std::sqrt(static_cast<T>(dx) * dx + static_cast<T>(dy) * dy + static_cast<T>(dz) * dz);
+				const T error = distance - sphere.r;
+				if (stopping.tolerance > 0) {
+					loss += error * error;
+				}
+
+				// gradients of the loss with respect to x, y, z and r, all taken before the update
+				const T x_gradient = static_cast<T>(2 * dx) * error / distance;
+				const T y_gradient = static_cast<T>(2 * dy) * error / distance;
+				const T z_gradient = static_cast<T>(2 * dz) * error / distance;
+				const T r_gradient = -2 * error;
+				sphere.x = static_cast<float>(sphere.x - xyz_learning_rate * x_gradient);
+				sphere.y = static_cast<float>(sphere.y - xyz_learning_rate * y_gradient);
+				sphere.z = static_cast<float>(sphere.z - xyz_learning_rate * z_gradient);
+				sphere.r = static_cast<float>(sphere.r - r_learning_rate * r_gradient);
+			}
+			if (++epochs > 1 && mchtr_sgd::has_converged(previous_loss, loss, stopping.tolerance)) {
+				break;
+			}
+			previous_loss = loss;
+		}
+		return sphere;
+	}
+
+	template <typename T, typename P>
+	bool algebraic(const P& points, mchtr_sgd::sphere& sphere) {
+		/*
+		Kasa fit, see mchtr_fit::fit_sphere_algebraic.
+		@param		points - the neighbourhood
+					sphere - output, fitted sphere
+		@return		false if the points do not determine a sphere
+		*/
+		const std::size_t count = points.size();
+		if (count < 4) {
+			return false;
+		}
+
+		// centroid of the points
+		T mx = 0, my = 0, mz = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			mx += points.x(i);
+			my += points.y(i);
+			mz += points.z(i);
+		}
+		mx /= static_cast<T>(count);
+		my /= static_cast<T>(count);
+		mz /= static_cast<T>(count);
+
+		// accumulate normal equations A^T*A*p = A^T*b for rows A = [x y z 1], b = -(x^2 + y^2 + z^2)
+		T ata[4][4] = {};
+		T atb[4] = {};
+		for (std::size_t i = 0; i < count; ++i) {
+			const T row[4] = { points.x(i) - mx, points.y(i) - my, points.z(i) - mz, 1 };
+			const T rhs = -(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]);
+			for (int a = 0; a < 4; ++a) {
+				for (int b = a; b < 4; ++b) {
+					ata[a][b] += row[a] * row[b];
+				}
+				atb[a] += row[a] * rhs;
+			}
+		}
+		for (int a = 1; a < 4; ++a) {
+			for (int b = 0; b < a; ++b) {
+				ata[a][b] = ata[b][a];
+			}
+		}
+
+		if (!solve_4x4(ata, atb)) {
+			return false;
+		}
+
+		// center = -(D, E, F) / 2, r^2 = |center|^2 - G (in centroid coordinates)
+		const T cx = static_cast<T>(-0.5) * atb[0];
+		const T cy = static_cast<T>(-0.5) * atb[1];
+		const T cz = static_cast<T>(-0.5) * atb[2];
+		const T r_squared = cx * cx + cy * cy + cz * cz - atb[3];
+		if (!(r_squared > 0)) {
+			return false;
+		}
+		sphere = mchtr_sgd::sphere{ static_cast<float>(mx + cx), static_cast<float>(my + cy), static_cast<float>(mz + cz), static_cast<float>(std::sqrt(r_squared)) };
+		return true;
+	}
+
+	template <typename T, typename P>
+	bool gauss_newton(const P& points, mchtr_sgd::sphere& sphere) {
+		/*
+		A single Gauss-Newton step on the geometric loss, see mchtr_fit::refine_sphere.
+		@param		points - the neighbourhood
+					sphere - sphere to refine, updated in place
+		@return		false if the step could not be computed (sphere is left unchanged)
+		*/
+		T jtj[4][4] = {};
+		T jtr[4] = {};
+		for (std::size_t i = 0; i < points.size(); ++i) {
+			const T dx = sphere.x - points.x(i);
+			const T dy = sphere.y - points.y(i);
+			const T dz = sphere.z - points.z(i);
+			const T distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+			if (distance == 0) {
+				continue;
+			}
+
+			// jacobian row of the residual (distance - r) with respect to (x, y, z, r)
+			const T row[4] = { dx / distance, dy / distance, dz / distance, -1 };
+			const T residual = distance - sphere.r;
+			for (int a = 0; a < 4; ++a) {
+				for (int b = 0; b < 4; ++b) {
+					jtj[a][b] += row[a] * row[b];
+				}
+				jtr[a] -= row[a] * residual;
+			}
+		}
+
+		if (!solve_4x4(jtj, jtr)) {
+			return false;
+		}
+		sphere.x = static_cast<float>(sphere.x + jtr[0]);
+		sphere.y = static_cast<float>(sphere.y + jtr[1]);
+		sphere.z = static_cast<float>(sphere.z + jtr[2]);
+		sphere.r = static_cast<float>(sphere.r + jtr[3]);
+		return true;
+	}
+
+	template <typename T, typename P>
+	mchtr_geometry::local_geometry plane(const P& points) {
+		/*
+		Least squares plane and surface variation, see mchtr_geometry::fit_local_geometry; mean and covariance are accumulated in T,
+		the eigenvector is found in double.
+		@param		points - the neighbourhood
+		@return		best fitting plane (the z = 0 plane for no points) and surface variation
+		*/
+		const std::size_t count = points.size();
+		if (count == 0) {
+			return mchtr_geometry::local_geometry{ { { 0, 0, 1 }, 0 }, 0 };
+		}
+
+		T mean[3] = { 0, 0, 0 };
+		for (std::size_t i = 0; i < count; ++i) {
+			mean[0] += points.x(i);
+			mean[1] += points.y(i);
+			mean[2] += points.z(i);
+		}
+		for (int axis = 0; axis < 3; ++axis) {
+			mean[axis] /= static_cast<T>(count);
+		}
+
+		T covariance[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+		for (std::size_t i = 0; i < count; ++i) {
+			const T d[3] = { points.x(i) - mean[0], points.y(i) - mean[1], points.z(i) - mean[2] };
+			for (int row = 0; row < 3; ++row) {
+				for (int column = 0; column < 3; ++column) {
+					covariance[row][column] += d[row] * d[column];
+				}
+			}
+		}
+
+		double mean_double[3];
+		double covariance_double[3][3];
+		for (int row = 0; row < 3; ++row) {
+			mean_double[row] = mean[row];
+			for (int column = 0; column < 3; ++column) {
+				covariance_double[row][column] = covariance[row][column];
+			}
+		}
+		return mchtr_geometry::geometry_from_covariance(mean_double, covariance_double);
+	}
+}
+
+bool mchtr_kernels::is_fixed_size(std::size_t count) {
+	/*
+	@param		count - number of points of a neighbourhood
+	@return		true if the kernels have a compile time specialisation for this size
+	*/
+	for (std::size_t size : fixed_sizes) {
+		if (size == count) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename T>
+mchtr_sgd::sphere mchtr_kernels::fit_sphere_sgd(const mchtr_geometry::point3* points, std::size_t count, const mchtr_sgd::sphere& start,
+	const mchtr_sgd::convergence& stopping, int& epochs, bool fixed) {
+	/*
+	Fits a sphere with stochastic gradient descent, from a given sphere and until it converges.
+	@param		points - points which the sphere will be fit to
+				count - number of points
+				start - initial sphere
+				stopping - maximum number of epochs and early stopping tolerance
+				epochs - output, number of epochs run
+				fixed - use the compile time specialisation for the size if there is one
+	@return		fitted sphere
+	*/
+	return with_points(points, count, fixed, [&](const auto& neighbourhood) { return sgd<T>(neighbourhood, start, stopping, epochs); });
+}
+
+template <typename T>
+bool mchtr_kernels::fit_sphere_algebraic(const mchtr_geometry::point3* points, std::size_t count, mchtr_sgd::sphere& sphere, bool fixed) {
+	/*
+	Fits a sphere in closed form (Kasa method).
+	@param		points - points which the sphere will be fit to (at least 4)
+				count - number of points
+				sphere - output, fitted sphere
+				fixed - use the compile time specialisation for the size if there is one
+	@return		false if the points do not determine a sphere (coplanar, collinear or too few)
+	*/
+	return with_points(points, count, fixed, [&](const auto& neighbourhood) { return algebraic<T>(neighbourhood, sphere); });
+}
+
+template <typename T>
+bool mchtr_kernels::refine_sphere(const mchtr_geometry::point3* points, std::size_t count, mchtr_sgd::sphere& sphere, bool fixed) {
+	/*
+	Does a single Gauss-Newton step on the geometric loss sum((|p - c| - r)^2), starting from the given sphere.
+	@param		points - points which the sphere is fit to
+				count - number of points
+				sphere - sphere to refine, updated in place
+				fixed - use the compile time specialisation for the size if there is one
+	@return		false if the step could not be computed (sphere is left unchanged)
+	*/
+	return with_points(points, count, fixed, [&](const auto& neighbourhood) { return gauss_newton<T>(neighbourhood, sphere); });
+}
+
+template <typename T>
+mchtr_geometry::plane3 mchtr_kernels::fit_plane(const mchtr_geometry::point3* points, std::size_t count, bool fixed) {
+	/*
+	Fits a least squares plane to points: through their mean, normal to the direction of their smallest variance.
+	@param		points - points to fit to
+				count - number of points
+				fixed - use the compile time specialisation for the size if there is one
+	@return		best fitting plane, the z = 0 plane for no points
+	*/
+	return with_points(points, count, fixed, [](const auto& neighbourhood) { return plane<T>(neighbourhood).plane; });
+}
+
+template <typename T>
+mchtr_geometry::local_geometry mchtr_kernels::fit_local_geometry(const mchtr_geometry::point3* points, std::size_t count, bool fixed) {
+	/*
+	Fits a least squares plane to points and finds their surface variation, both from a single mean and covariance.
+	@param		points - points to fit to
+				count - number of points
+				fixed - use the compile time specialisation for the size if there is one
+	@return		best fitting plane (the z = 0 plane for no points) and surface variation
+	*/
+	return with_points(points, count, fixed, [](const auto& neighbourhood) { return plane<T>(neighbourhood); });
+}
+
+template mchtr_sgd::sphere mchtr_kernels::fit_sphere_sgd<float>(const mchtr_geometry::point3*, std::size_t, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&, bool);
+template mchtr_sgd::sphere mchtr_kernels::fit_sphere_sgd<double>(const mchtr_geometry::point3*, std::size_t, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&, bool);
+template bool mchtr_kernels::fit_sphere_algebraic<float>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+template bool mchtr_kernels::fit_sphere_algebraic<double>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+template bool mchtr_kernels::refine_sphere<float>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+template bool mchtr_kernels::refine_sphere<double>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+template mchtr_geometry::plane3 mchtr_kernels::fit_plane<float>(const mchtr_geometry::point3*, std::size_t, bool);
+template mchtr_geometry::plane3 mchtr_kernels::fit_plane<double>(const mchtr_geometry::point3*, std::size_t, bool);
+template mchtr_geometry::local_geometry mchtr_kernels::fit_local_geometry<float>(const mchtr_geometry::point3*, std::size_t, bool);
+template mchtr_geometry::local_geometry mchtr_kernels::fit_local_geometry<double>(const mchtr_geometry::point3*, std::size_t, bool);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include "mchtr_geometry.h"
+#include "mchtr_sgd.h"
+
+/*
+Fitting kernels functionality header file: sphere (SGD, algebraic, Gauss-Newton step) and plane fits to a single neighbourhood,
+templated on the scalar type of their arithmetic and specialised at compile time for the common neighbourhood sizes
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_kernels
+{
+	// neighbourhood sizes whose kernels copy the points into fixed-size stack arrays and run loops of a known length,
+	// any other size goes through the same kernels reading the points in place
+	constexpr std::size_t fixed_sizes[] = { 8, 15, 25, 32, 100 };
+
+	bool is_fixed_size(std::size_t);
+
+	// T is float or double, the precision of the arithmetic; points and spheres stay single precision.
+	// The last argument set to false runs the runtime size kernel whatever the size (for benchmarking the specialisation).
+	// None of the kernels allocate.
+	template <typename T>
+	mchtr_sgd::sphere fit_sphere_sgd(const mchtr_geometry::point3*, std::size_t, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&, bool = true);
+	template <typename T>
+	bool fit_sphere_algebraic(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool = true);
+	template <typename T>
+	bool refine_sphere(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool = true);
+	template <typename T>
+	mchtr_geometry::plane3 fit_plane(const mchtr_geometry::point3*, std::size_t, bool = true);
+	template <typename T>
+	mchtr_geometry::local_geometry fit_local_geometry(const mchtr_geometry::point3*, std::size_t, bool = true);
+
+	// instantiated in mchtr_kernels.cpp
+	extern template mchtr_sgd::sphere fit_sphere_sgd<float>(const mchtr_geometry::point3*, std::size_t, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&, bool);
+	extern template mchtr_sgd::sphere fit_sphere_sgd<double>(const mchtr_geometry::point3*, std::size_t, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&, bool);
+	extern template bool fit_sphere_algebraic<float>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+	extern template bool fit_sphere_algebraic<double>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+	extern template bool refine_sphere<float>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+	extern template bool refine_sphere<double>(const mchtr_geometry::point3*, std::size_t, mchtr_sgd::sphere&, bool);
+	extern template mchtr_geometry::plane3 fit_plane<float>(const mchtr_geometry::point3*, std::size_t, bool);
+	extern template mchtr_geometry::plane3 fit_plane<double>(const mchtr_geometry::point3*, std::size_t, bool);
+	extern template mchtr_geometry::local_geometry fit_local_geometry<float>(const mchtr_geometry::point3*, std::size_t, bool);
+	extern template mchtr_geometry::local_geometry fit_local_geometry<double>(const mchtr_geometry::point3*, std::size_t, bool);
+}
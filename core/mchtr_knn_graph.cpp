@@ -0,0 +1,503 @@
+#include "mchtr_knn_graph.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "mchtr_kdtree.h"
+
+/*
+KNN graph functionality cpp file (neighbour lists built once per cloud and reused between stages)
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	void unmap(mchtr_knn_graph::graph& graph) {
+		/*
+		Lets go of the rows of a graph loaded from a cache file, before the graph gets rows of its own.
+		@param		graph - graph to detach
+		*/
+		graph.mapped.reset();
+		graph.mapped_offsets = nullptr;
+		graph.mapped_indices = nullptr;
+		graph.mapped_rows = 0;
+	}
+
+	void pack(mchtr_knn_graph::graph& graph, const float* xyz, std::size_t points_count, int threads) {
+		/*
+		Compresses the rows of a graph built uncompressed (by the pipeline, which writes rows in place) and frees them.
+		@param		graph - graph with rows of its own and compress set
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					points_count - number of points
+					threads - number of workers
+		*/
+		const bool packed = graph.packed.encode(xyz, points_count, graph.k, threads,
+			[&](std::size_t index, int, std::uint32_t* neighbours) {
+				const std::size_t count = graph.offsets[index + 1] - graph.offsets[index];
+				std::copy(graph.row(index), graph.row(index) + count, neighbours);
+				return count;
+			},
+			[](std::size_t) {});
+		if (packed) {
+			std::vector<std::size_t>().swap(graph.offsets);
+			std::vector<std::uint32_t>().swap(graph.indices);
+		}
+	}
+
+	void build_radius(mchtr_knn_graph::graph& graph, const float* xyz, std::size_t points_count, int k, std::uint64_t coordinates_fingerprint, int threads,
+		const mchtr_parallel::progress_function& report, mchtr_profile::recorder* profile) {
+		/*
+		Queries the neighbours within graph.neighbourhood's radius of every point from a voxel grid (up to K nearest, at least its minimum) and stores them in the graph.
+		@param		graph - output graph, in radius mode
+					xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					points_count - number of points
+					k - most neighbours to store per point
+					coordinates_fingerprint - fingerprint of the coordinates
+					threads - number of workers
+					report - receives the number of processed points
+					profile - instrumentation, nullptr if off
+		*/
+		const mchtr_voxel_grid::options& neighbourhood = graph.neighbourhood;
+		mchtr_voxel_grid::grid grid;
+		{
+			mchtr_profile::scoped_stage stage(profile, "voxel_grid_build");
+			if (!grid.build(xyz, points_count, neighbourhood.radius)) {
+				throw std::invalid_argument("Neighbourhood radius too small for the extent of the cloud.");
+			}
+		}
+		if (profile) {
+			profile->set_value("voxel_grid_bytes", static_cast<double>(grid.bytes()));
+		}
+
+		mchtr_profile::scoped_stage stage(profile, "voxel_grid_queries");
+		const int workers = mchtr_parallel::resolve_threads(threads);
+		mchtr_profile::worker_stats* stats = profile ? profile->workers(workers).data() : nullptr;
+		std::vector<std::vector<mchtr_kdtree::neighbour>> rows(workers, std::vector<mchtr_kdtree::neighbour>(k));
+		auto query = [&](std::size_t index, int worker, std::uint32_t* neighbours) {
+			mchtr_profile::worker_stats* own = stats ? stats + worker : nullptr;
+			mchtr_profile::scoped_timer knn_timer(own ? &own->knn_nanoseconds : nullptr);
+			std::size_t visited = 0;
+			mchtr_kdtree::neighbour* row = rows[worker].data();
+			const std::size_t found = grid.query(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2], neighbourhood.radius, k, neighbourhood.min_points, row,
+				own ? &visited : nullptr);
+			for (std::size_t j = 0; j < found; ++j) {
+				neighbours[j] = row[j].index;
+			}
+			if (own) {
+				own->add_query(visited);
+				++own->points;
+			}
+			return found;
+		};
+
+		// compressed, every worker encodes the rows it queries, as in build
+		if (graph.compress) {
+			graph.reset(k, coordinates_fingerprint, 0);
+			if (graph.packed.encode(xyz, points_count, k, threads, query, report)) {
+				return;
+			}
+		}
+
+		// rows of any length are queried into slots of k, then appended in point order
+		std::vector<std::uint32_t> neighbours(points_count * static_cast<std::size_t>(k));
+		std::vector<std::uint32_t> found(points_count);
+		constexpr std::size_t chunk_size = 4096;
+		mchtr_parallel::run_chunks(points_count, chunk_size, workers,
+			[&](std::size_t begin, std::size_t end, int worker) {
+				for (std::size_t index = begin; index < end; ++index) {
+					found[index] = static_cast<std::uint32_t>(query(index, worker, neighbours.data() + index * k));
+				}
+			},
+			report);
+		graph.reset(k, coordinates_fingerprint, points_count);
+		for (std::size_t index = 0; index < points_count; ++index) {
+			graph.add_row(neighbours.data() + index * k, found[index]);
+		}
+	}
+}
+
+void mchtr_knn_graph::graph::reset(int neighbours_count, std::uint64_t coordinates_fingerprint, std::size_t points_count) {
+	/*
+	Empties the graph before adding rows.
+	@param		neighbours_count - K the graph is built for (longest row)
+				coordinates_fingerprint - fingerprint of the coordinates the graph is built from
+				points_count - number of points (rows) that will be added
+	*/
+	unmap(*this);
+	packed.clear();
+	k = neighbours_count;
+	fingerprint = coordinates_fingerprint;
+	neighbourhood_key = mchtr_voxel_grid::key(neighbourhood);
+	offsets.clear();
+	offsets.reserve(points_count + 1);
+	offsets.push_back(0);
+	indices.clear();
+	indices.reserve(points_count * static_cast<std::size_t>(neighbours_count));
+}
+
+void mchtr_knn_graph::graph::add_row(const std::uint32_t* neighbours, std::size_t count) {
+	/*
+	Appends neighbours of the next point.
+	@param		neighbours - neighbour indices, nearest first
+				count - number of neighbours (at most k)
+	*/
+	indices.insert(indices.end(), neighbours, neighbours + count);
+	offsets.push_back(indices.size());
+}
+
+void mchtr_knn_graph::graph::reset_rows(int neighbours_count, std::uint64_t coordinates_fingerprint, std::size_t points_count, std::size_t row_length) {
+	/*
+	Empties the graph and makes room for rows of equal length, which can then be written in any order (and from several threads) through mutable_row.
+	@param		neighbours_count - K the graph is built for (longest row)
+				coordinates_fingerprint - fingerprint of the coordinates the graph is built from
+				points_count - number of points (rows)
+				row_length - number of neighbours of every row (at most k)
+	*/
+	unmap(*this);
+	packed.clear();
+	k = neighbours_count;
+	fingerprint = coordinates_fingerprint;
+	neighbourhood_key = mchtr_voxel_grid::key(neighbourhood);
+	offsets.resize(points_count + 1);
+	for (std::size_t i = 0; i <= points_count; ++i) {
+		offsets[i] = i * row_length;
+	}
+	indices.assign(points_count * row_length, 0);
+}
+
+void mchtr_knn_graph::graph::invalidate() {
+	/*
+	Drops the graph, e.g. after the coordinates were changed in place.
+	*/
+	unmap(*this);
+	packed.clear();
+	k = 0;
+	fingerprint = 0;
+	neighbourhood_key = 0;
+	offsets.clear();
+	indices.clear();
+}
+
+bool mchtr_knn_graph::graph::valid_for(std::uint64_t coordinates_fingerprint, int neighbours_count) const {
+	/*
+	Checks whether the graph can answer queries for given coordinates and K, with the neighbourhood currently set.
+	@param		coordinates_fingerprint - fingerprint of the current coordinates
+				neighbours_count - K needed by the caller
+	@return		true if the graph was built from the same coordinates with at least K neighbours, and the same neighbourhood
+	*/
+	return k > 0 && k >= neighbours_count && fingerprint == coordinates_fingerprint && neighbourhood_key == mchtr_voxel_grid::key(neighbourhood);
+}
+
+std::size_t mchtr_knn_graph::graph::row_size(std::size_t i, int neighbours_count) const {
+	/*
+	@param		i - point index
+				neighbours_count - K needed by the caller (at most the build k)
+	@return		number of neighbours of point i to read from row(i), the K nearest are a prefix of the row
+	*/
+	const std::size_t length = mapped ? static_cast<std::size_t>(mapped_offsets[i + 1] - mapped_offsets[i]) :
+		!packed.empty() ? packed.row_size(i) : offsets[i + 1] - offsets[i];
+	return std::min(length, static_cast<std::size_t>(neighbours_count));
+}
+
+const std::uint32_t* mchtr_knn_graph::graph::read_row(std::size_t i, int neighbours_count, std::uint32_t* scratch, std::size_t& count) const {
+	/*
+	Reads the K nearest neighbours of a point whichever way the rows are stored.
+	@param		i - point index
+				neighbours_count - K needed by the caller (at most the build k)
+				scratch - room for K + mchtr_graph_codec::decode_slack indices, compressed rows are decoded into it
+				count - output, number of neighbours read
+	@return		the neighbours, nearest first: the row itself, or scratch
+	*/
+	if (!packed.empty()) {
+		count = packed.decode(i, static_cast<std::size_t>(neighbours_count), scratch);
+		return scratch;
+	}
+	count = row_size(i, neighbours_count);
+	return row(i);
+}
+
+std::size_t mchtr_knn_graph::graph::bytes() const {
+	/*
+	@return		memory the rows take (0 for rows mapped from a cache file, the system pages those in and out)
+	*/
+	if (mapped) {
+		return 0;
+	}
+	return !packed.empty() ? packed.bytes() : offsets.size() * sizeof(std::size_t) + indices.size() * sizeof(std::uint32_t);
+}
+
+void mchtr_knn_graph::fingerprint::add(float x, float y, float z) {
+	/*
+	Adds a point to the fingerprint (FNV-1a over the coordinates' bit patterns).
+	@param		x, y, z - coordinates of the next point
+	*/
+	const float coordinates[3] = { x, y, z };
+	std::uint32_t bits[3];
+	std::memcpy(bits, coordinates, sizeof(bits));
+	for (std::uint32_t word : bits) {
+		m_hash = (m_hash ^ word) * 1099511628211ull;
+	}
+	++m_count;
+}
+
+std::uint64_t mchtr_knn_graph::fingerprint_of(const float* xyz, std::size_t points_count) {
+	/*
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+	@return		fingerprint of the coordinates, see mchtr_knn_graph::fingerprint
+	*/
+	mchtr_knn_graph::fingerprint fingerprint;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		fingerprint.add(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+	}
+	return fingerprint.value();
+}
+
+bool mchtr_knn_graph::update(mchtr_knn_graph::graph& graph, const float* xyz, std::size_t points_count, int k, int threads,
+	const mchtr_parallel::progress_function& report, mchtr_profile::recorder* profile, mchtr_cache::store* cache) {
+	/*
+	Keeps a cached graph usable for the current coordinates, rebuilding it only if they changed since it was built or it has less than k neighbours
+	(and the persistent cache has no graph for them either); a rebuilt graph is saved to the persistent cache.
+	@param		graph - cached graph
+				xyz - current coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				k - number of nearest neighbours needed by the caller
+				threads - number of workers for a rebuild
+				report - receives the number of processed points during a rebuild
+				profile - instrumentation, nullptr if off
+				cache - persistent cache, nullptr if off
+	@return		true if the graph was rebuilt
+	*/
+	const std::uint64_t fingerprint = mchtr_knn_graph::fingerprint_of(xyz, points_count);
+	if (graph.valid_for(fingerprint, k)) {
+		return false;
+	}
+	if (cache) {
+		mchtr_profile::scoped_stage stage(profile, "knn_graph_cache_load");
+		if (mchtr_knn_graph::load(graph, *cache, fingerprint, points_count, k)) {
+			return false;
+		}
+	}
+	mchtr_knn_graph::build(graph, xyz, points_count, k, fingerprint, threads, report, profile);
+	if (cache) {
+		mchtr_profile::scoped_stage stage(profile, "knn_graph_cache_save");
+		mchtr_knn_graph::save(graph, *cache);
+	}
+	return true;
+}
+
+void mchtr_knn_graph::build(mchtr_knn_graph::graph& graph, const float* xyz, std::size_t points_count, int k, std::uint64_t coordinates_fingerprint, int threads,
+	const mchtr_parallel::progress_function& report, mchtr_profile::recorder* profile) {
+	/*
+	Queries K nearest neighbours of every point once, in one batch from a kd-tree, and stores them in the graph;
+	in radius mode (graph.neighbourhood) the neighbours within the radius come from a voxel grid instead.
+	@param		graph - output graph
+				xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				k - number of nearest neighbours to store
+				coordinates_fingerprint - fingerprint of the coordinates
+				threads - number of workers
+				report - receives the number of processed points
+				profile - instrumentation, nullptr if off
+	*/
+	if (graph.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS) {
+		build_radius(graph, xyz, points_count, k, coordinates_fingerprint, threads, report, profile);
+		return;
+	}
+	mchtr_kdtree::kdtree tree;
+	{
+		mchtr_profile::scoped_stage stage(profile, "knn_graph_tree_build");
+		tree.build(xyz, points_count);
+	}
+
+	// rows come back nearest first, so the neighbours for any smaller K are a prefix of the row
+	mchtr_profile::scoped_stage stage(profile, "knn_graph_queries");
+	const std::size_t neighbours_found = std::min(static_cast<std::size_t>(k), points_count);
+
+	// compressed, every worker encodes the rows it queries, so the uncompressed rows never exist all at once
+	if (graph.compress) {
+		const int workers = mchtr_parallel::resolve_threads(threads);
+		mchtr_profile::worker_stats* stats = profile ? profile->workers(workers).data() : nullptr;
+		std::vector<std::vector<mchtr_kdtree::neighbour>> rows(workers, std::vector<mchtr_kdtree::neighbour>(neighbours_found));
+		graph.reset(k, coordinates_fingerprint, 0);
+		const bool packed = graph.packed.encode(xyz, points_count, k, threads,
+			[&](std::size_t index, int worker, std::uint32_t* neighbours) {
+				mchtr_profile::worker_stats* own = stats ? stats + worker : nullptr;
+				mchtr_profile::scoped_timer knn_timer(own ? &own->knn_nanoseconds : nullptr);
+				std::size_t visited = 0;
+				mchtr_kdtree::neighbour* row = rows[worker].data();
+				tree.knn(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2], static_cast<int>(neighbours_found), row, own ? &visited : nullptr);
+				for (std::size_t j = 0; j < neighbours_found; ++j) {
+					neighbours[j] = row[j].index;
+				}
+				if (own) {
+					own->add_query(visited);
+					++own->points;
+				}
+				return neighbours_found;
+			},
+			report);
+		if (packed) {
+			return;
+		}
+	}
+	std::vector<mchtr_kdtree::neighbour> neighbours(points_count * neighbours_found);
+	tree.knn_all(static_cast<int>(neighbours_found), neighbours.data(), threads, report,
+		profile ? profile->workers(mchtr_parallel::resolve_threads(threads)).data() : nullptr);
+
+	// move the indices into the graph
+	std::vector<std::uint32_t> row(neighbours_found);
+	graph.reset(k, coordinates_fingerprint, points_count);
+	for (std::size_t index = 0; index < points_count; ++index) {
+		for (std::size_t j = 0; j < neighbours_found; ++j) {
+			row[j] = neighbours[index * neighbours_found + j].index;
+		}
+		graph.add_row(row.data(), row.size());
+	}
+}
+
+bool mchtr_knn_graph::update_pipelined(mchtr_knn_graph::graph& graph, const float* xyz, std::size_t points_count, int k, const std::size_t* order,
+	const mchtr_pipeline::options& pipeline,
+	int search_workers, int fit_workers, const mchtr_pipeline::block_function& fit, const mchtr_parallel::progress_function& report, mchtr_profile::recorder* profile,
+	mchtr_cache::store* cache, mchtr_pipeline::run_stats& stats) {
+	/*
+	Like update, but a rebuild goes through a pipeline: search workers query blocks of rows into the graph while fit workers
+	already process the blocks whose rows are complete (every block's rows are visible to the fit worker that gets it).
+	@param		graph - cached graph
+				xyz - current coordinates of all points, interleaved (x0, y0, z0, x1, ...); the tree keeps its own copy,
+					  so fit may move points of the blocks it was given
+				points_count - number of points
+				k - number of nearest neighbours needed by the caller
+				order - points_count indices, the order rows are queried (and blocks handed to fit) in, nullptr for index order
+				pipeline - block size and depth
+				search_workers, fit_workers - number of workers of each stage
+				fit - processes the points at positions [begin, end) of the order, whose rows are in the graph, called only if the graph is rebuilt
+				report - receives the number of fitted points during a rebuild
+				profile - instrumentation, nullptr if off
+				cache - persistent cache the graph is loaded from instead of rebuilt if it has one, and saved to after a rebuild, nullptr if off
+				stats - output, how the pipeline went, left untouched if the graph is still valid
+	@return		true if the graph was rebuilt (and fit called), false if it still matches (or was loaded) and the caller has to process the points itself
+	*/
+	const std::uint64_t fingerprint = mchtr_knn_graph::fingerprint_of(xyz, points_count);
+	if (graph.valid_for(fingerprint, k)) {
+		return false;
+	}
+	if (cache) {
+		mchtr_profile::scoped_stage stage(profile, "knn_graph_cache_load");
+		if (mchtr_knn_graph::load(graph, *cache, fingerprint, points_count, k)) {
+			return false;
+		}
+	}
+
+	mchtr_kdtree::kdtree tree;
+	{
+		mchtr_profile::scoped_stage stage(profile, "knn_graph_tree_build");
+		tree.build(xyz, points_count);
+	}
+
+	// every row has the same length, so search workers write them in place
+	mchtr_profile::scoped_stage stage(profile, "knn_graph_pipelined");
+	const std::size_t neighbours_found = std::min(static_cast<std::size_t>(k), points_count);
+	graph.reset_rows(k, fingerprint, points_count, neighbours_found);
+	std::vector<std::vector<mchtr_kdtree::neighbour>> neighbours(std::max(search_workers, 1), std::vector<mchtr_kdtree::neighbour>(neighbours_found));
+	mchtr_profile::worker_stats* workers = profile ? profile->workers(std::max(search_workers, 1)).data() : nullptr;
+	stats = mchtr_pipeline::run(points_count, pipeline, search_workers, fit_workers,
+		[&](std::size_t begin, std::size_t end, std::size_t, int worker) {
+			mchtr_profile::worker_stats* own = workers ? workers + worker : nullptr;
+			mchtr_profile::scoped_timer busy_timer(own ? &own->busy_nanoseconds : nullptr);
+			mchtr_profile::scoped_timer knn_timer(own ? &own->knn_nanoseconds : nullptr);
+			mchtr_kdtree::neighbour* row = neighbours[worker].data();
+			for (std::size_t position = begin; position < end; ++position) {
+				const std::size_t index = order ? order[position] : position;
+				std::size_t visited = 0;
+				tree.knn(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2], static_cast<int>(neighbours_found), row, own ? &visited : nullptr);
+				std::uint32_t* indices = graph.mutable_row(index);
+				for (std::size_t j = 0; j < neighbours_found; ++j) {
+					indices[j] = row[j].index;
+				}
+				if (own) {
+					own->add_query(visited);
+				}
+			}
+			if (own) {
+				own->points += end - begin;
+			}
+		},
+		fit, report);
+	if (cache) {
+		mchtr_profile::scoped_stage save_stage(profile, "knn_graph_cache_save");
+		mchtr_knn_graph::save(graph, *cache);
+	}
+	if (graph.compress) {
+		mchtr_profile::scoped_stage pack_stage(profile, "knn_graph_compression");
+		pack(graph, xyz, points_count, search_workers + fit_workers);
+	}
+	return true;
+}
+
+bool mchtr_knn_graph::load(mchtr_knn_graph::graph& graph, mchtr_cache::store& cache, std::uint64_t coordinates_fingerprint, std::size_t points_count, int k) {
+	/*
+	Loads a graph from the persistent cache, without copying: the rows are read from the file's mapping for as long as the graph keeps them.
+	@param		graph - output, left untouched on a miss
+				cache - persistent cache
+				coordinates_fingerprint - fingerprint of the current coordinates
+				points_count - number of points
+				k - number of nearest neighbours needed by the caller
+	@return		true if the cache had a graph of these coordinates and graph.neighbourhood with at least k neighbours, all of them points of the cloud
+	*/
+	mchtr_cache::entry found;
+	const std::uint64_t neighbourhood_key = mchtr_voxel_grid::key(graph.neighbourhood);
+	if (!cache.find(mchtr_cache::KIND_KNN_GRAPH, coordinates_fingerprint, neighbourhood_key, found)) {
+		return false;
+	}
+
+	// a graph built for a smaller K, or a file whose rows don't add up, is rebuilt (and overwritten)
+	const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(found.sections[0]);
+	bool usable = found.tag >= static_cast<std::uint64_t>(k) && found.count == points_count && found.sections_count == 2 &&
+		found.section_bytes[0] == (points_count + 1) * sizeof(std::uint64_t) && offsets[0] == 0;
+	for (std::size_t i = 0; usable && i < points_count; ++i) {
+		usable = offsets[i] <= offsets[i + 1];
+	}
+	if (!usable || found.section_bytes[1] != offsets[points_count] * sizeof(std::uint32_t)) {
+		return false;
+	}
+
+	// so is one with a neighbour outside the cloud, which callers would index their coordinates with
+	const std::uint32_t* indices = reinterpret_cast<const std::uint32_t*>(found.sections[1]);
+	for (std::uint64_t i = 0; i < offsets[points_count]; ++i) {
+		if (indices[i] >= points_count) {
+			return false;
+		}
+	}
+	graph.offsets.clear();
+	graph.indices.clear();
+	graph.packed.clear();
+	graph.k = static_cast<int>(found.tag);
+	graph.fingerprint = coordinates_fingerprint;
+	graph.neighbourhood_key = neighbourhood_key;
+	graph.mapped = found.file;
+	graph.mapped_offsets = offsets;
+	graph.mapped_indices = indices;
+	graph.mapped_rows = points_count;
+	return true;
+}
+
+bool mchtr_knn_graph::save(const mchtr_knn_graph::graph& graph, mchtr_cache::store& cache) {
+	/*
+	Saves a graph to the persistent cache, under the fingerprint of the coordinates it was built from and its neighbourhood; later runs load it for any K up to graph.k.
+	@param		graph - graph with rows of its own
+				cache - persistent cache
+	@return		true if the graph was written; compressed rows aren't, they would have to be decompressed whole
+	*/
+	if (!graph.packed.empty()) {
+		return false;
+	}
+	std::vector<std::uint64_t> converted;
+	const void* offsets = graph.offsets.data();
+	if (sizeof(std::size_t) != sizeof(std::uint64_t)) {
+		converted.assign(graph.offsets.begin(), graph.offsets.end());
+		offsets = converted.data();
+	}
+	const void* sections[2] = { offsets, graph.indices.data() };
+	const std::uint64_t bytes[2] = { graph.offsets.size() * sizeof(std::uint64_t), graph.indices.size() * sizeof(std::uint32_t) };
+	return cache.save(mchtr_cache::KIND_KNN_GRAPH, graph.fingerprint, graph.neighbourhood_key, graph.size(), static_cast<std::uint64_t>(graph.k), sections, bytes, 2);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "mchtr_cache.h"
+#include "mchtr_graph_codec.h"
+#include "mchtr_parallel.h"
+#include "mchtr_pipeline.h"
+#include "mchtr_profile.h"
+#include "mchtr_voxel_grid.h"
+
+/*
+KNN graph functionality header file (neighbour lists built once per cloud and reused between stages)
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_knn_graph
+{
+	// neighbour lists in CSR layout: neighbours of point i are indices[offsets[i], offsets[i + 1]), nearest first,
+	// so the k nearest for any k up to the build k are a prefix of the row
+	struct graph {
+		int k{ 0 };
+		std::uint64_t fingerprint{ 0 };
+		std::vector<std::size_t> offsets;
+		std::vector<std::uint32_t> indices;
+		// rows of a graph loaded from a cache file, read from the file's mapping, offsets and indices stay empty then
+		std::shared_ptr<const mchtr_cache::mapping> mapped;
+		const std::uint64_t* mapped_offsets{ nullptr };
+		const std::uint32_t* mapped_indices{ nullptr };
+		std::size_t mapped_rows{ 0 };
+		// rows kept only compressed (see mchtr_graph_codec), read through read_row
+		mchtr_graph_codec::packed_rows packed;
+		// builds fill packed instead of offsets and indices
+		bool compress{ false };
+		// in radius mode a row holds up to k nearest within the radius, so rows differ in length
+		mchtr_voxel_grid::options neighbourhood;		// what builds put into rows, K nearest neighbours by default
+		std::uint64_t neighbourhood_key{ 0 };			// mchtr_voxel_grid::key of the neighbourhood the rows were built with
+
+		void reset(int, std::uint64_t, std::size_t);
+		void add_row(const std::uint32_t*, std::size_t);
+		void reset_rows(int, std::uint64_t, std::size_t, std::size_t);
+		std::uint32_t* mutable_row(std::size_t i) { return indices.data() + offsets[i]; }
+		void invalidate();
+		bool valid_for(std::uint64_t, int) const;
+		std::size_t size() const { return mapped ? mapped_rows : !packed.empty() ? packed.size() : offsets.empty() ? 0 : offsets.size() - 1; }
+		const std::uint32_t* row(std::size_t i) const { return mapped ? mapped_indices + mapped_offsets[i] : indices.data() + offsets[i]; }
+		std::size_t row_size(std::size_t, int) const;
+		const std::uint32_t* read_row(std::size_t, int, std::uint32_t*, std::size_t&) const;
+		std::size_t bytes() const;
+	};
+
+	// hash of point coordinates, any change of any coordinate (or of the point count) changes it
+	class fingerprint {
+	public:
+		void add(float, float, float);
+		std::uint64_t value() const { return m_hash ^ m_count; }
+
+	private:
+		std::uint64_t m_hash{ 14695981039346656037ull };
+		std::uint64_t m_count{ 0 };
+	};
+
+	std::uint64_t fingerprint_of(const float*, std::size_t);
+	bool update(graph&, const float*, std::size_t, int, int, const mchtr_parallel::progress_function&, mchtr_profile::recorder*, mchtr_cache::store*);
+	void build(graph&, const float*, std::size_t, int, std::uint64_t, int, const mchtr_parallel::progress_function&, mchtr_profile::recorder*);
+	bool update_pipelined(graph&, const float*, std::size_t, int, const std::size_t*, const mchtr_pipeline::options&, int, int, const mchtr_pipeline::block_function&,
+		const mchtr_parallel::progress_function&, mchtr_profile::recorder*, mchtr_cache::store*, mchtr_pipeline::run_stats&);
+	bool load(graph&, mchtr_cache::store&, std::uint64_t, std::size_t, int);
+	bool save(const graph&, mchtr_cache::store&);
+}
@@ -0,0 +1,396 @@
+#include "mchtr_lod.h"
+#include <algorithm>
+#include <cmath>
+#include <cwchar>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include "mchtr_kdtree.h"
+#include "mchtr_knn_graph.h"
+
+/*
+Level of detail (sparse) curvature functionality cpp file
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// integer coordinates of a cell of a uniform grid
+	struct cell {
+		std::int64_t x, y, z;
+
+		bool operator==(const cell& other) const { return x == other.x && y == other.y && z == other.z; }
+		bool operator<(const cell& other) const { return x < other.x || (x == other.x && (y < other.y || (y == other.y && z < other.z))); }
+	};
+
+	struct cell_hash {
+		std::size_t operator()(const cell& key) const {
+			return static_cast<std::size_t>(static_cast<std::uint64_t>(key.x) * 73856093u ^ static_cast<std::uint64_t>(key.y) * 19349663u ^
+				static_cast<std::uint64_t>(key.z) * 83492791u);
+		}
+	};
+
+	void lower_corner(const float* xyz, std::size_t points_count, float* corner) {
+		/*
+		@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					points_count - number of points
+					corner - output, smallest X, Y and Z, the origin of the grids
+		*/
+		for (int axis = 0; axis < 3; ++axis) {
+			corner[axis] = points_count > 0 ? xyz[axis] : 0.0f;
+		}
+		for (std::size_t i = 1; i < points_count; ++i) {
+			for (int axis = 0; axis < 3; ++axis) {
+				corner[axis] = std::min(corner[axis], xyz[3 * i + axis]);
+			}
+		}
+	}
+
+	cell cell_of(const float* point, const float* corner, float cell_size) {
+		return cell{ static_cast<std::int64_t>(std::floor((point[0] - corner[0]) / cell_size)),
+			static_cast<std::int64_t>(std::floor((point[1] - corner[1]) / cell_size)),
+			static_cast<std::int64_t>(std::floor((point[2] - corner[2]) / cell_size)) };
+	}
+
+	float distance_squared(const float* a, const float* b) {
+		const float dx = a[0] - b[0];
+		const float dy = a[1] - b[1];
+		const float dz = a[2] - b[2];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	mchtr_parallel::progress_function scaled(const mchtr_parallel::progress_function& report, std::size_t stage_count, std::size_t points_count) {
+		/*
+		@param		report - progress callback of the whole run, expects counts up to points_count
+					stage_count - number of points the stage processes
+					points_count - number of points of the cloud
+		@return		callback of the stage, counts of the stage's points scaled to points_count
+		*/
+		return [&report, stage_count, points_count](std::size_t finished) {
+			report(stage_count > 0 ? finished * points_count / stage_count : points_count);
+		};
+	}
+
+	float interpolate(const mchtr_kdtree::neighbour* seeds, std::size_t seeds_found, const float* seed_curvatures, float& spread) {
+		/*
+		Inverse squared distance weighting of the curvatures of the nearest seeds.
+		@param		seeds - nearest seeds, nearest first
+					seeds_found - number of seeds
+					seed_curvatures - curvatures of all seeds, indexed like the seed kd-tree
+					spread - output, max - min of the seeds' curvatures, infinity if one of them isn't finite
+		@return		interpolated curvature, the nearest seed's if the point coincides with a seed or no seed has a finite curvature
+		*/
+		double weighted_sum = 0;
+		double weights = 0;
+		float lowest = std::numeric_limits<float>::infinity();
+		float highest = -std::numeric_limits<float>::infinity();
+		bool all_finite = true;
+		for (std::size_t j = 0; j < seeds_found; ++j) {
+			const float value = seed_curvatures[seeds[j].index];
+			if (!std::isfinite(value)) {
+				all_finite = false;
+				continue;
+			}
+			lowest = std::min(lowest, value);
+			highest = std::max(highest, value);
+			if (seeds[j].distance_squared == 0.0f) {
+				weighted_sum = value;
+				weights = 1;
+				break;
+			}
+			const double weight = 1.0 / seeds[j].distance_squared;
+			weighted_sum += weight * value;
+			weights += weight;
+		}
+		spread = all_finite ? highest - lowest : std::numeric_limits<float>::infinity();
+		if (weights == 0) {
+			return seeds_found > 0 ? seed_curvatures[seeds[0].index] : 0.0f;
+		}
+		return static_cast<float>(weighted_sum / weights);
+	}
+
+	std::uint64_t cache_key(const mchtr_lod::options& settings, const mchtr_curvature::options& fitting) {
+		/*
+		@param		settings - sampling, interpolation and refinement options
+					fitting - options of the sphere fits
+		@return		hash of everything curvatures of a run depend on: the number of threads doesn't change them, the order of the points
+					and pipeline blocks only through warm starts, and SGD fits round differently per instruction set
+		*/
+		mchtr_cache::parameters key;
+		key.add(fitting.neighbours_count).add(fitting.fit_method).add(fitting.max_epochs).add(fitting.tolerance).add(fitting.warm_start);
+		if (fitting.fit_method == mchtr_fit::METHOD_SGD) {
+			key.add(static_cast<int>(mchtr_batch::detect_isa()));
+		}
+		if (fitting.warm_start) {
+			key.add(fitting.order).add(fitting.pipeline.enabled).add(fitting.pipeline.enabled ? fitting.pipeline.batch_size : 0);
+		}
+		if (fitting.neighbourhood.mode != mchtr_voxel_grid::NEIGHBOURHOOD_KNN) {
+			key.add(mchtr_voxel_grid::key(fitting.neighbourhood));
+		}
+		key.add(settings.sampling);
+		if (settings.sampling != mchtr_lod::SAMPLING_ALL) {
+			key.add(settings.spacing).add(settings.interpolation_neighbours).add(settings.refine_threshold);
+		}
+		return key.value();
+	}
+}
+
+const wchar_t* mchtr_lod::validate(const mchtr_lod::options& settings) {
+	/*
+	@param		settings - user supplied options
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (settings.sampling != SAMPLING_ALL && settings.sampling != SAMPLING_VOXEL && settings.sampling != SAMPLING_POISSON) {
+		return L"Unknown sampling, use 0 (all points), 1 (voxel grid) or 2 (Poisson disk).";
+	}
+	if (settings.sampling != SAMPLING_ALL && !(settings.spacing > 0)) {
+		return L"Seed spacing must be above 0 when sampling.";
+	}
+	if (settings.interpolation_neighbours < 1) {
+		return L"Number of seeds to interpolate from lower than 1.";
+	}
+	if (!(settings.refine_threshold >= 0)) {
+		return L"Refinement threshold lower than 0 (0 never refines).";
+	}
+	return nullptr;
+}
+
+void mchtr_lod::select_voxel_seeds(const float* xyz, std::size_t points_count, float spacing, std::vector<std::size_t>& seeds) {
+	/*
+	Picks one seed per occupied voxel, the point nearest the voxel's centre (the lower index on ties).
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				spacing - voxel size, voxels start at the cloud's lower corner
+				seeds - output, indices of the seeds in ascending order
+	*/
+	struct candidate {
+		cell voxel;
+		float distance_squared;
+		std::size_t index;
+	};
+	float corner[3];
+	lower_corner(xyz, points_count, corner);
+	std::vector<candidate> candidates(points_count);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const cell voxel = cell_of(xyz + 3 * i, corner, spacing);
+		const float centre[3] = { corner[0] + (voxel.x + 0.5f) * spacing, corner[1] + (voxel.y + 0.5f) * spacing, corner[2] + (voxel.z + 0.5f) * spacing };
+		candidates[i] = candidate{ voxel, distance_squared(xyz + 3 * i, centre), i };
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) {
+		if (!(a.voxel == b.voxel)) {
+			return a.voxel < b.voxel;
+		}
+		return a.distance_squared < b.distance_squared || (a.distance_squared == b.distance_squared && a.index < b.index);
+	});
+
+	seeds.clear();
+	for (std::size_t i = 0; i < candidates.size(); ++i) {
+		if (i == 0 || !(candidates[i].voxel == candidates[i - 1].voxel)) {
+			seeds.push_back(candidates[i].index);
+		}
+	}
+	std::sort(seeds.begin(), seeds.end());
+}
+
+void mchtr_lod::select_poisson_seeds(const float* xyz, std::size_t points_count, float spacing, std::uint32_t random_seed, std::vector<std::size_t>& seeds) {
+	/*
+	Picks seeds by Poisson disk sampling: points are visited in a pseudo-random order and kept if no kept point is closer than the spacing.
+	A background grid with cells of spacing / sqrt(3) holds at most one seed per cell, so only the 5 x 5 x 5 cells around a point are checked,
+	nearest first, as most points are rejected by a seed next to them.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				spacing - smallest distance between two seeds
+				random_seed - seed of the visiting order, the same seed gives the same seeds on every platform
+				seeds - output, indices of the seeds in ascending order
+	*/
+	float corner[3];
+	lower_corner(xyz, points_count, corner);
+	const float cell_size = spacing / std::sqrt(3.0f);
+	const float spacing_squared = spacing * spacing;
+
+	// Fisher-Yates shuffle on raw mt19937 output, std::shuffle differs between standard libraries
+	std::vector<std::size_t> order(points_count);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		order[i] = i;
+	}
+	std::mt19937 generator(random_seed);
+	for (std::size_t i = points_count; i > 1; --i) {
+		std::swap(order[i - 1], order[generator() % i]);
+	}
+
+	std::vector<cell> offsets;
+	for (std::int64_t dx = -2; dx <= 2; ++dx) {
+		for (std::int64_t dy = -2; dy <= 2; ++dy) {
+			for (std::int64_t dz = -2; dz <= 2; ++dz) {
+				offsets.push_back(cell{ dx, dy, dz });
+			}
+		}
+	}
+	std::stable_sort(offsets.begin(), offsets.end(), [](const cell& a, const cell& b) {
+		return a.x * a.x + a.y * a.y + a.z * a.z < b.x * b.x + b.y * b.y + b.z * b.z;
+	});
+
+	std::unordered_map<cell, std::size_t, cell_hash> occupied;
+	seeds.clear();
+	for (std::size_t index : order) {
+		const float* point = xyz + 3 * index;
+		const cell home = cell_of(point, corner, cell_size);
+		bool free = true;
+		for (std::size_t j = 0; free && j < offsets.size(); ++j) {
+			const auto found = occupied.find(cell{ home.x + offsets[j].x, home.y + offsets[j].y, home.z + offsets[j].z });
+			free = found == occupied.end() || distance_squared(point, xyz + 3 * found->second) >= spacing_squared;
+		}
+		if (free) {
+			occupied.emplace(home, index);
+			seeds.push_back(index);
+		}
+	}
+	std::sort(seeds.begin(), seeds.end());
+}
+
+mchtr_lod::run_stats mchtr_lod::compute_curvature(const float* xyz, std::size_t points_count, const mchtr_lod::options& settings,
+	const mchtr_curvature::options& fitting, const mchtr_lod::stage_function& stage, const mchtr_parallel::progress_function& report, float* curvatures) {
+	/*
+	Calculates local curvature of every point, fitting spheres only at seeds and interpolating between them.
+	Progress of every stage is scaled to points_count.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+				settings - sampling, interpolation and refinement options, throws std::invalid_argument if invalid
+				fitting - options of the sphere fits, throws std::invalid_argument if invalid
+				stage - called when a stage starts
+				report - receives the number of processed points, on the calling thread
+				curvatures - output, points_count curvatures
+	@return		number of seeds and refined points, fitting statistics, or that the curvatures came from the persistent cache (fitting.cache)
+	*/
+	const wchar_t* error = mchtr_lod::validate(settings);
+	if (!error) {
+		error = mchtr_curvature::validate(fitting);
+	}
+	if (error) {
+
+		// the messages are plain ASCII
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+
+	mchtr_lod::run_stats stats;
+	stage(STAGE_SEEDS);
+
+	// a run with the same coordinates and parameters before left its curvatures in the cache
+	std::uint64_t fingerprint = 0;
+	const std::uint64_t key = fitting.cache ? cache_key(settings, fitting) : 0;
+	if (fitting.cache) {
+		mchtr_profile::scoped_stage timer(fitting.profile, "cache_load");
+		fingerprint = mchtr_knn_graph::fingerprint_of(xyz, points_count);
+		stats.cached = fitting.cache->load_values(mchtr_cache::KIND_CURVATURES, fingerprint, key, points_count, curvatures);
+		if (fitting.profile) {
+			fitting.profile->set_value("cache_hit", stats.cached ? 1 : 0);
+		}
+	}
+	if (stats.cached) {
+		report(points_count);
+		stage(STAGE_DONE);
+		return stats;
+	}
+	auto save = [&]() {
+		if (fitting.cache) {
+			mchtr_profile::scoped_stage timer(fitting.profile, "cache_save");
+			fitting.cache->save_values(mchtr_cache::KIND_CURVATURES, fingerprint, key, points_count, curvatures);
+		}
+	};
+
+	if (settings.sampling == SAMPLING_ALL) {
+		stats.seeds = points_count;
+		stats.fitting = mchtr_curvature::compute(xyz, points_count, fitting, report, curvatures);
+		save();
+		stage(STAGE_DONE);
+		return stats;
+	}
+
+	// one kd-tree of all points serves the seeds' fits and the refinement
+	mchtr_kdtree::kdtree tree;
+	{
+		mchtr_profile::scoped_stage timer(fitting.profile, "kdtree_build");
+		tree.build(xyz, points_count);
+	}
+	std::vector<std::size_t> seeds;
+	{
+		mchtr_profile::scoped_stage timer(fitting.profile, "seed_selection");
+		if (settings.sampling == SAMPLING_VOXEL) {
+			mchtr_lod::select_voxel_seeds(xyz, points_count, settings.spacing, seeds);
+		}
+		else {
+			mchtr_lod::select_poisson_seeds(xyz, points_count, settings.spacing, 1, seeds);
+		}
+	}
+	stats.seeds = seeds.size();
+	if (seeds.empty()) {
+		stage(STAGE_DONE);
+		return stats;
+	}
+	stats.fitting = mchtr_curvature::compute(tree, xyz, seeds.data(), seeds.size(), fitting, scaled(report, seeds.size(), points_count), curvatures, nullptr);
+
+	// interpolation from a kd-tree of the seeds alone, every other point looks up its nearest seeds
+	stage(STAGE_INTERPOLATION);
+	std::vector<unsigned char> refine(points_count, 0);
+	{
+		mchtr_profile::scoped_stage timer(fitting.profile, "interpolation");
+		std::vector<float> seed_xyz(3 * seeds.size());
+		std::vector<float> seed_curvatures(seeds.size());
+		std::vector<unsigned char> is_seed(points_count, 0);
+		for (std::size_t i = 0; i < seeds.size(); ++i) {
+			std::copy(xyz + 3 * seeds[i], xyz + 3 * seeds[i] + 3, seed_xyz.begin() + 3 * i);
+			seed_curvatures[i] = curvatures[seeds[i]];
+			is_seed[seeds[i]] = 1;
+		}
+		mchtr_kdtree::kdtree seed_tree;
+		seed_tree.build(seed_xyz.data(), seeds.size());
+
+		const int k = static_cast<int>(std::min<std::size_t>(settings.interpolation_neighbours, seeds.size()));
+		const int workers = mchtr_parallel::resolve_threads(fitting.threads);
+		std::vector<std::vector<mchtr_kdtree::neighbour>> buffers(workers, std::vector<mchtr_kdtree::neighbour>(k));
+		constexpr std::size_t chunk_size = 4096;
+		mchtr_parallel::run_chunks(points_count, chunk_size, workers,
+			[&](std::size_t begin, std::size_t end, int worker) {
+				mchtr_kdtree::neighbour* nearest = buffers[worker].data();
+				for (std::size_t i = begin; i < end; ++i) {
+					if (is_seed[i]) {
+						continue;
+					}
+					const std::size_t found = seed_tree.knn(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], k, nearest);
+					float spread = 0;
+					curvatures[i] = interpolate(nearest, found, seed_curvatures.data(), spread);
+					refine[i] = settings.refine_threshold > 0 && !(spread <= settings.refine_threshold);
+				}
+			},
+			report);
+	}
+
+	// refinement: full fits where the seeds around a point disagree
+	std::vector<std::size_t> refined;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		if (refine[i]) {
+			refined.push_back(i);
+		}
+	}
+	stats.refined = refined.size();
+	if (!refined.empty()) {
+		stage(STAGE_REFINEMENT);
+		const mchtr_curvature::run_info info = mchtr_curvature::compute(tree, xyz, refined.data(), refined.size(), fitting,
+			scaled(report, refined.size(), points_count), curvatures, nullptr);
+		stats.fitting.sgd_fits += info.sgd_fits;
+		stats.fitting.sgd_epochs += info.sgd_epochs;
+		stats.fitting.early_stops += info.early_stops;
+		stats.fitting.warm_starts += info.warm_starts;
+		stats.fitting.allocations += info.allocations;
+	}
+	if (fitting.profile) {
+		fitting.profile->set_value("points", static_cast<double>(points_count));
+		fitting.profile->set_value("seeds", static_cast<double>(stats.seeds));
+		fitting.profile->set_value("refined", static_cast<double>(stats.refined));
+	}
+	save();
+	stage(STAGE_DONE);
+	return stats;
+}
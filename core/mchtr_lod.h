@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "mchtr_curvature.h"
+#include "mchtr_parallel.h"
+
+/*
+Level of detail (sparse) curvature functionality header file: spheres are fitted only at seed points picked by voxel grid or
+Poisson disk subsampling, curvature of the other points is interpolated from the nearest seeds and optionally refined where it varies strongly
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_lod
+{
+	enum sampling {
+		SAMPLING_ALL = 0,			// every point is fitted, no interpolation
+		SAMPLING_VOXEL = 1,			// the point nearest the centre of every occupied voxel
+		SAMPLING_POISSON = 2		// points no closer to each other than the spacing, picked in a fixed pseudo-random order
+	};
+
+	struct options {
+		int sampling{ SAMPLING_ALL };
+		float spacing{ 0 };						// voxel size or Poisson disk radius, in the cloud's units
+		int interpolation_neighbours{ 4 };		// nearest seeds a point's curvature is interpolated from (inverse squared distance weights)
+		float refine_threshold{ 0 };			// points whose interpolation seeds differ by more than this (max - min curvature) are fitted too, 0 never refines
+	};
+
+	enum stage {
+		STAGE_SEEDS = 0,
+		STAGE_INTERPOLATION = 1,
+		STAGE_REFINEMENT = 2,
+		STAGE_DONE = 3
+	};
+
+	// called on the calling thread when a stage starts (STAGE_DONE after the last one), progress restarts from 0 with every stage
+	using stage_function = std::function<void(int)>;
+
+	struct run_stats {
+		std::size_t seeds{ 0 };
+		std::size_t refined{ 0 };
+		bool cached{ false };		// the curvatures came from the persistent cache, nothing was fitted
+		mchtr_curvature::run_info fitting{ mchtr_batch::ISA_SCALAR, 1, 0, 0, 0, 0, 0 };		// of all fits, SGD statistics summed over seeds and refinement
+	};
+
+	const wchar_t* validate(const options&);
+	void select_voxel_seeds(const float*, std::size_t, float, std::vector<std::size_t>&);
+	void select_poisson_seeds(const float*, std::size_t, float, std::uint32_t, std::vector<std::size_t>&);
+	run_stats compute_curvature(const float*, std::size_t, const options&, const mchtr_curvature::options&, const stage_function&,
+		const mchtr_parallel::progress_function&, float*);
+}
@@ -0,0 +1,176 @@
+#include "mchtr_order.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/*
+Point ordering functionality cpp file: Morton (Z-order) and Hilbert keys of quantised coordinates, and the order
+the points are processed in, so that consecutive KNN queries touch overlapping neighbourhoods whatever order the cloud is stored in
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// a point's key and index, sorted by key
+	struct keyed_point {
+		std::uint64_t key;
+		std::size_t index;
+	};
+
+	std::uint64_t spread_bits(std::uint32_t value) {
+		/*
+		@param		value - key_bits low bits of a coordinate
+		@return		the same bits two zero bits apart (bit i moved to bit 3i)
+		*/
+		std::uint64_t bits = value & 0x1fffff;
+		bits = (bits | bits << 32) & 0x1f00000000ffffull;
+		bits = (bits | bits << 16) & 0x1f0000ff0000ffull;
+		bits = (bits | bits << 8) & 0x100f00f00f00f00full;
+		bits = (bits | bits << 4) & 0x10c30c30c30c30c3ull;
+		bits = (bits | bits << 2) & 0x1249249249249249ull;
+		return bits;
+	}
+
+	void radix_sort(std::vector<keyed_point>& points) {
+		/*
+		Sorts points by key, least significant digit first; stable, so points with equal keys keep their order.
+		@param		points - points to sort, in place
+		*/
+		constexpr int digit_bits = 11;
+		constexpr std::size_t buckets = std::size_t(1) << digit_bits;
+		std::vector<keyed_point> sorted(points.size());
+		std::vector<std::size_t> counts(buckets);
+		for (int shift = 0; shift < 3 * mchtr_order::key_bits; shift += digit_bits) {
+			std::fill(counts.begin(), counts.end(), 0);
+			for (const keyed_point& point : points) {
+				++counts[(point.key >> shift) & (buckets - 1)];
+			}
+
+			// a digit all keys share doesn't change the order
+			if (counts[(points.front().key >> shift) & (buckets - 1)] == points.size()) {
+				continue;
+			}
+			std::size_t offset = 0;
+			for (std::size_t& count : counts) {
+				const std::size_t bucket_size = count;
+				count = offset;
+				offset += bucket_size;
+			}
+			for (const keyed_point& point : points) {
+				sorted[counts[(point.key >> shift) & (buckets - 1)]++] = point;
+			}
+			points.swap(sorted);
+		}
+	}
+}
+
+bool mchtr_order::is_valid_curve(int curve) {
+	/*
+	Checks whether a user given ordering (plugin parameter) is one of the known ones.
+	@param		curve - ordering id
+	@return		true if the ordering is known
+	*/
+	return curve == ORDER_STORAGE || curve == ORDER_MORTON || curve == ORDER_HILBERT;
+}
+
+std::uint64_t mchtr_order::morton_key(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+	/*
+	@param		x, y, z - quantised coordinates, key_bits bits each
+	@return		position of the cell on the Z-order curve
+	*/
+	return spread_bits(x) << 2 | spread_bits(y) << 1 | spread_bits(z);
+}
+
+std::uint64_t mchtr_order::hilbert_key(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+	/*
+	Position of a cell on the Hilbert curve, with Skilling's transform ("Programming the Hilbert curve", 2004): the coordinates are turned
+	into the curve's transposed key in place, whose bits interleaved like a Morton key give the position.
+	@param		x, y, z - quantised coordinates, key_bits bits each
+	@return		position of the cell on the Hilbert curve
+	*/
+	std::uint32_t axes[3] = { x & 0x1fffff, y & 0x1fffff, z & 0x1fffff };
+
+	// inverse undo of the excess work
+	for (std::uint32_t bit = 1u << (key_bits - 1); bit > 1; bit >>= 1) {
+		const std::uint32_t lower = bit - 1;
+		for (std::uint32_t& axis : axes) {
+			if (axis & bit) {
+				axes[0] ^= lower;
+			}
+			else {
+				const std::uint32_t swapped = (axes[0] ^ axis) & lower;
+				axes[0] ^= swapped;
+				axis ^= swapped;
+			}
+		}
+	}
+
+	// Gray encode
+	axes[1] ^= axes[0];
+	axes[2] ^= axes[1];
+	std::uint32_t flips = 0;
+	for (std::uint32_t bit = 1u << (key_bits - 1); bit > 1; bit >>= 1) {
+		if (axes[2] & bit) {
+			flips ^= bit - 1;
+		}
+	}
+	for (std::uint32_t& axis : axes) {
+		axis ^= flips;
+	}
+	return morton_key(axes[0], axes[1], axes[2]);
+}
+
+void mchtr_order::sort_points(const float* xyz, const std::size_t* subset, std::size_t count, int curve, std::vector<std::size_t>& order) {
+	/*
+	Orders points along a space-filling curve over their bounding box (cubic cells, the same size along every axis).
+	Points in the same cell keep their relative order and points with a non-finite coordinate go last, so the order is deterministic.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+				subset - indices of the points to order, nullptr to order points [0, count)
+				count - number of points to order
+				curve - one of mchtr_order::curve, ORDER_STORAGE keeps the given order
+				order - output, count point indices in processing order
+	*/
+	order.resize(count);
+	for (std::size_t position = 0; position < count; ++position) {
+		order[position] = subset ? subset[position] : position;
+	}
+	if (curve == ORDER_STORAGE || count < 2) {
+		return;
+	}
+
+	// cubic bounding box of the finite points
+	double low[3] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+	double high[3] = { std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest() };
+	for (std::size_t index : order) {
+		const float* point = xyz + 3 * index;
+		if (std::isfinite(point[0]) && std::isfinite(point[1]) && std::isfinite(point[2])) {
+			for (int axis = 0; axis < 3; ++axis) {
+				low[axis] = std::min(low[axis], static_cast<double>(point[axis]));
+				high[axis] = std::max(high[axis], static_cast<double>(point[axis]));
+			}
+		}
+	}
+	const double extent = std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+	const std::uint32_t largest_cell = (1u << key_bits) - 1;
+	const double scale = extent > 0 ? largest_cell / extent : 0;
+
+	std::vector<keyed_point> points(count);
+	for (std::size_t position = 0; position < count; ++position) {
+		const std::size_t index = order[position];
+		const float* point = xyz + 3 * index;
+		if (!(std::isfinite(point[0]) && std::isfinite(point[1]) && std::isfinite(point[2]))) {
+			points[position] = { std::numeric_limits<std::uint64_t>::max(), index };
+			continue;
+		}
+		std::uint32_t cell[3];
+		for (int axis = 0; axis < 3; ++axis) {
+			cell[axis] = std::min(largest_cell, static_cast<std::uint32_t>((point[axis] - low[axis]) * scale));
+		}
+		const std::uint64_t key = curve == ORDER_HILBERT ? hilbert_key(cell[0], cell[1], cell[2]) : morton_key(cell[0], cell[1], cell[2]);
+		points[position] = { key, index };
+	}
+	radix_sort(points);
+	for (std::size_t position = 0; position < count; ++position) {
+		order[position] = points[position].index;
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Point ordering functionality header file: Morton (Z-order) and Hilbert keys of quantised coordinates, and the order
+the points are processed in, so that consecutive KNN queries touch overlapping neighbourhoods whatever order the cloud is stored in
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_order
+{
+	enum curve {
+		ORDER_STORAGE = 0,		// points processed in the order they are stored in
+		ORDER_MORTON = 1,		// Z-order curve, bits of the three coordinates interleaved
+		ORDER_HILBERT = 2		// Hilbert curve, consecutive keys are always adjacent cells
+	};
+
+	// bits per axis of a key, 3 * 21 = 63 bits
+	constexpr int key_bits = 21;
+
+	bool is_valid_curve(int);
+	std::uint64_t morton_key(std::uint32_t, std::uint32_t, std::uint32_t);
+	std::uint64_t hilbert_key(std::uint32_t, std::uint32_t, std::uint32_t);
+	void sort_points(const float*, const std::size_t*, std::size_t, int, std::vector<std::size_t>&);
+}
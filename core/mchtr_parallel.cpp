@@ -0,0 +1,173 @@
+#include "mchtr_parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Parallel execution functionality cpp file (work-stealing chunk scheduler), shared by the plugins
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// chunks [front, back) still owned by one worker, the owner takes from the front, thieves from the back
+	struct chunk_queue {
+		std::mutex mutex;
+		std::size_t front{ 0 };
+		std::size_t back{ 0 };
+	};
+
+	bool take_chunk(chunk_queue* queues, int threads, int worker, std::size_t& chunk) {
+		/*
+		Takes the next chunk of a worker, steals half of another worker's chunks when its own queue is empty.
+		@param		queues - one queue per worker
+					threads - number of workers
+					worker - worker asking for work
+					chunk - output, index of the chunk to process
+		@return		false if there is no work left anywhere
+		*/
+		{
+			std::lock_guard<std::mutex> lock(queues[worker].mutex);
+			if (queues[worker].front < queues[worker].back) {
+				chunk = queues[worker].front++;
+				return true;
+			}
+		}
+
+		for (int offset = 1; offset < threads; ++offset) {
+			chunk_queue& victim = queues[(worker + offset) % threads];
+			std::size_t stolen_front, stolen_back;
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				const std::size_t remaining = victim.back - victim.front;
+				if (remaining == 0) {
+					continue;
+				}
+				stolen_back = victim.back;
+				stolen_front = victim.back - (remaining + 1) / 2;
+				victim.back = stolen_front;
+			}
+
+			// never hold two locks at once, the own queue is empty so nobody steals from it meanwhile
+			std::lock_guard<std::mutex> lock(queues[worker].mutex);
+			queues[worker].front = stolen_front + 1;
+			queues[worker].back = stolen_back;
+			chunk = stolen_front;
+			return true;
+		}
+		return false;
+	}
+}
+
+int mchtr_parallel::resolve_threads(int requested) {
+	/*
+	Turns a user given thread count (plugin parameter) into the number of workers.
+	@param		requested - number of threads, 0 means all cores
+	@return		number of workers, at least 1
+	*/
+	if (requested > 0) {
+		return requested;
+	}
+	const unsigned int cores = std::thread::hardware_concurrency();
+	return cores > 0 ? static_cast<int>(cores) : 1;
+}
+
+void mchtr_parallel::run_chunks(std::size_t count, std::size_t chunk_size, int threads, const chunk_function& body, const progress_function& report) {
+	/*
+	Processes points [0, count) in chunks on a pool of workers. Every worker starts with an equal, contiguous share
+	of the chunks and steals from the others once it runs out, so uneven chunks (e.g. dense regions) still balance.
+	The calling thread is worker 0 and the only one calling report, so progress bars are never touched from workers.
+	An exception thrown by any worker stops the others and is rethrown here.
+	@param		count - number of points
+				chunk_size - number of points per chunk
+				threads - number of workers, see resolve_threads
+				body - processes a chunk
+				report - receives the number of finished points
+	*/
+	if (count == 0) {
+		return;
+	}
+	chunk_size = std::max<std::size_t>(chunk_size, 1);
+	const std::size_t chunks = (count + chunk_size - 1) / chunk_size;
+	threads = static_cast<int>(std::min<std::size_t>(static_cast<std::size_t>(std::max(threads, 1)), chunks));
+
+	// single worker, no threads needed
+	if (threads == 1) {
+		for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+			const std::size_t begin = chunk * chunk_size;
+			const std::size_t end = std::min(count, begin + chunk_size);
+			body(begin, end, 0);
+			report(end);
+		}
+		return;
+	}
+
+	// equal initial shares
+	std::unique_ptr<chunk_queue[]> queues(new chunk_queue[threads]);
+	for (int worker = 0; worker < threads; ++worker) {
+		queues[worker].front = chunks * worker / threads;
+		queues[worker].back = chunks * (worker + 1) / threads;
+	}
+
+	std::atomic<std::size_t> finished_points{ 0 };
+	std::atomic<bool> cancelled{ false };
+	std::exception_ptr error;
+	std::mutex state_mutex;
+	std::condition_variable state_changed;
+	int running = threads;
+
+	auto work = [&](int worker, bool reporting) {
+		try {
+			std::size_t chunk;
+			while (!cancelled && take_chunk(queues.get(), threads, worker, chunk)) {
+				const std::size_t begin = chunk * chunk_size;
+				const std::size_t end = std::min(count, begin + chunk_size);
+				body(begin, end, worker);
+				finished_points += end - begin;
+				if (reporting) {
+					report(finished_points);
+				}
+			}
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(state_mutex);
+			if (!error) {
+				error = std::current_exception();
+			}
+			cancelled = true;
+		}
+		std::lock_guard<std::mutex> lock(state_mutex);
+		--running;
+		state_changed.notify_all();
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (int worker = 1; worker < threads; ++worker) {
+		pool.emplace_back(work, worker, false);
+	}
+	work(0, true);
+
+	// out of work on the calling thread, keep the progress going until the others finish
+	{
+		std::unique_lock<std::mutex> lock(state_mutex);
+		while (running > 0) {
+			state_changed.wait_for(lock, std::chrono::milliseconds(100));
+			lock.unlock();
+			report(finished_points);
+			lock.lock();
+		}
+	}
+	for (std::thread& thread : pool) {
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+/*
+Parallel execution functionality header file (work-stealing chunk scheduler), shared by the plugins
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_parallel
+{
+	// processes points [begin, end) on the given worker (0 <= worker < threads)
+	using chunk_function = std::function<void(std::size_t, std::size_t, int)>;
+
+	// called on the calling thread only, with the number of points finished so far
+	using progress_function = std::function<void(std::size_t)>;
+
+	int resolve_threads(int);
+	void run_chunks(std::size_t, std::size_t, int, const chunk_function&, const progress_function&);
+}
@@ -0,0 +1,204 @@
+#include "mchtr_pipeline.h"
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+Pipelined execution functionality cpp file: search workers fill blocks of neighbourhoods into a bounded lock-free ring,
+fit workers drain them, so memory-bound KNN queries and compute-bound fits run at the same time
+Author: Przemyslaw Wysocki
+*/
+
+mchtr_pipeline::ring::ring(std::size_t capacity) : m_capacity(std::max<std::size_t>(capacity, 1)), m_cells(new cell[m_capacity]) {
+	/*
+	@param		capacity - number of slots, at least 1
+	*/
+	for (std::size_t slot = 0; slot < m_capacity; ++slot) {
+		m_cells[slot].sequence.store(2 * slot, std::memory_order_relaxed);
+	}
+}
+
+bool mchtr_pipeline::ring::wait_for(std::size_t ticket, std::size_t expected, std::size_t& waits) const {
+	/*
+	Waits until the sequence of the ticket's slot reaches the expected value: spins a little (the other side is usually about to finish),
+	then yields the core, which matters when there are more workers than cores.
+	@param		ticket - ticket whose slot to watch
+				expected - sequence to wait for
+				waits - incremented if the slot wasn't ready at once
+	@return		false if the ring was cancelled while waiting
+	*/
+	const std::atomic<std::size_t>& sequence = m_cells[ticket % m_capacity].sequence;
+	if (sequence.load(std::memory_order_acquire) == expected) {
+		return true;
+	}
+	++waits;
+	for (int spins = 0; sequence.load(std::memory_order_acquire) != expected; ++spins) {
+		if (m_cancelled.load(std::memory_order_relaxed)) {
+			return false;
+		}
+		if (spins >= 64) {
+			std::this_thread::yield();
+		}
+	}
+	return true;
+}
+
+bool mchtr_pipeline::ring::wait_writable(std::size_t ticket, std::size_t& waits) const {
+	/*
+	Waits until the ticket's slot was released by the ticket capacity places before it (the ring is full until then).
+	@param		ticket - producer's ticket
+				waits - incremented if the producer had to wait
+	@return		false if the ring was cancelled while waiting
+	*/
+	return wait_for(ticket, 2 * ticket, waits);
+}
+
+void mchtr_pipeline::ring::publish(std::size_t ticket) {
+	/*
+	Hands the filled slot over to the consumer of the ticket, everything written to the slot's storage before is visible to it.
+	@param		ticket - producer's ticket
+	*/
+	m_cells[ticket % m_capacity].sequence.store(2 * ticket + 1, std::memory_order_release);
+}
+
+bool mchtr_pipeline::ring::wait_readable(std::size_t ticket, std::size_t& waits) const {
+	/*
+	Waits until the ticket's slot was published (the ring is empty until then).
+	@param		ticket - consumer's ticket
+				waits - incremented if the consumer had to wait
+	@return		false if the ring was cancelled while waiting
+	*/
+	return wait_for(ticket, 2 * ticket + 1, waits);
+}
+
+void mchtr_pipeline::ring::release(std::size_t ticket) {
+	/*
+	Gives the drained slot back to the producer of the ticket capacity places later.
+	@param		ticket - consumer's ticket
+	*/
+	m_cells[ticket % m_capacity].sequence.store(2 * (ticket + m_capacity), std::memory_order_release);
+}
+
+const wchar_t* mchtr_pipeline::validate(const mchtr_pipeline::options& settings) {
+	/*
+	@param		settings - user supplied options
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (settings.batch_size < 1) {
+		return L"Pipeline batch size lower than 1.";
+	}
+	if (settings.depth < 1) {
+		return L"Pipeline depth lower than 1.";
+	}
+	return nullptr;
+}
+
+void mchtr_pipeline::split_threads(int workers, int& search_workers, int& fit_workers) {
+	/*
+	Splits the workers of a run between the two stages, evenly; a pipeline needs one of each, so a single thread run gets two.
+	@param		workers - number of workers, see mchtr_parallel::resolve_threads
+				search_workers, fit_workers - output
+	*/
+	search_workers = std::max(1, workers / 2);
+	fit_workers = std::max(1, workers - search_workers);
+}
+
+mchtr_pipeline::run_stats mchtr_pipeline::run(std::size_t count, const mchtr_pipeline::options& settings, int search_workers, int fit_workers,
+	const mchtr_pipeline::block_function& search, const mchtr_pipeline::block_function& fit, const mchtr_parallel::progress_function& report) {
+	/*
+	Processes points [0, count) in blocks of batch_size points: a search worker takes the next block, waits for its slot of the ring to be free,
+	fills it and publishes it; a fit worker takes the next block in the same order, waits for it to be published, fits it and releases the slot.
+	Blocks are started and fitted in point order, so a single fit worker sees them exactly as a sequential loop would.
+	The calling thread is fit worker 0 and the only one calling report. An exception thrown by any worker cancels the ring and is rethrown here.
+	@param		count - number of points
+				settings - block size and depth (slots of the ring)
+				search_workers, fit_workers - number of workers of each stage, at least 1
+				search - fills the slot with the block's neighbourhoods
+				fit - fits the neighbourhoods in the slot
+				report - receives the number of fitted points
+	@return		number of blocks and how often each stage waited for the other
+	*/
+	run_stats stats{ std::max(search_workers, 1), std::max(fit_workers, 1), 0, 0, 0 };
+	if (count == 0) {
+		return stats;
+	}
+	const std::size_t batch_size = static_cast<std::size_t>(std::max(settings.batch_size, 1));
+	stats.blocks = (count + batch_size - 1) / batch_size;
+	ring slots(std::min<std::size_t>(static_cast<std::size_t>(std::max(settings.depth, 1)), stats.blocks));
+
+	std::atomic<std::size_t> next_search{ 0 }, next_fit{ 0 };
+	std::atomic<std::size_t> finished_points{ 0 }, search_waits{ 0 }, fit_waits{ 0 };
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto fail = [&]() {
+		std::lock_guard<std::mutex> lock(error_mutex);
+		if (!error) {
+			error = std::current_exception();
+		}
+		slots.cancel();
+	};
+
+	auto search_work = [&](int worker) {
+		std::size_t waits = 0;
+		try {
+			for (std::size_t ticket = next_search++; ticket < stats.blocks; ticket = next_search++) {
+				if (!slots.wait_writable(ticket, waits)) {
+					break;
+				}
+				const std::size_t begin = ticket * batch_size;
+				search(begin, std::min(count, begin + batch_size), ticket % slots.capacity(), worker);
+				slots.publish(ticket);
+			}
+		}
+		catch (...) {
+			fail();
+		}
+		search_waits += waits;
+	};
+	auto fit_work = [&](int worker) {
+		std::size_t waits = 0;
+		try {
+			for (std::size_t ticket = next_fit++; ticket < stats.blocks; ticket = next_fit++) {
+				if (!slots.wait_readable(ticket, waits)) {
+					break;
+				}
+				const std::size_t begin = ticket * batch_size;
+				const std::size_t end = std::min(count, begin + batch_size);
+				fit(begin, end, ticket % slots.capacity(), worker);
+				slots.release(ticket);
+				finished_points += end - begin;
+				if (worker == 0) {
+					report(finished_points);
+				}
+			}
+		}
+		catch (...) {
+			fail();
+		}
+		fit_waits += waits;
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(stats.search_workers + stats.fit_workers - 1);
+	for (int worker = 0; worker < stats.search_workers; ++worker) {
+		pool.emplace_back(search_work, worker);
+	}
+	for (int worker = 1; worker < stats.fit_workers; ++worker) {
+		pool.emplace_back(fit_work, worker);
+	}
+	fit_work(0);
+
+	// out of blocks on the calling thread, the other fit workers are finishing their last ones
+	for (std::thread& thread : pool) {
+		thread.join();
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	report(finished_points);
+	stats.search_waits = search_waits;
+	stats.fit_waits = fit_waits;
+	return stats;
+}
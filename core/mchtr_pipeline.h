@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include "mchtr_parallel.h"
+
+/*
+Pipelined execution functionality header file: search workers fill blocks of neighbourhoods into a bounded lock-free ring,
+fit workers drain them, so memory-bound KNN queries and compute-bound fits run at the same time
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_pipeline
+{
+	struct options {
+		bool enabled{ false };
+		int batch_size{ 256 };		// points per block
+		int depth{ 4 };				// blocks in flight, search workers wait (backpressure) once all of them are filled and not yet fitted
+	};
+
+	// what a run ended up doing, for tuning depth and the thread split
+	struct run_stats {
+		int search_workers;
+		int fit_workers;
+		std::size_t blocks;
+		std::size_t search_waits;	// times a search worker found its slot still being fitted (the ring was full)
+		std::size_t fit_waits;		// times a fit worker found its block not searched yet (the ring was empty)
+	};
+
+	// bounded ring of slots handed over by ticket: ticket t goes through slot t % capacity. Every slot has a sequence number
+	// (as in Vyukov's bounded queue, doubled so that a single slot ring works too): a producer may fill the slot once it reads 2t,
+	// a consumer may drain it once it reads 2t + 1, so the ring itself takes no locks and a slot is never reused before its previous ticket was released
+	class ring {
+	public:
+		explicit ring(std::size_t);
+		std::size_t capacity() const { return m_capacity; }
+		bool wait_writable(std::size_t, std::size_t&) const;
+		void publish(std::size_t);
+		bool wait_readable(std::size_t, std::size_t&) const;
+		void release(std::size_t);
+		void cancel() { m_cancelled = true; }
+
+	private:
+		// one cache line per sequence, so producers and consumers of neighbouring slots don't share lines
+		struct cell {
+			std::atomic<std::size_t> sequence;
+			char padding[64 - sizeof(std::atomic<std::size_t>)];
+		};
+
+		bool wait_for(std::size_t, std::size_t, std::size_t&) const;
+
+		std::size_t m_capacity;
+		std::unique_ptr<cell[]> m_cells;
+		std::atomic<bool> m_cancelled{ false };
+	};
+
+	// processes points [begin, end) of a block held in slot (0 <= slot < depth), on the given worker of the stage (0 <= worker < stage's workers)
+	using block_function = std::function<void(std::size_t, std::size_t, std::size_t, int)>;
+
+	const wchar_t* validate(const options&);
+	void split_threads(int, int&, int&);
+	run_stats run(std::size_t, const options&, int, int, const block_function&, const block_function&, const mchtr_parallel::progress_function&);
+}
@@ -0,0 +1,293 @@
+#include "mchtr_planes.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MCHTR_PLANES_X86
+#include <immintrin.h>
+#endif
+
+// MSVC accepts any intrinsic without per-function target flags, GCC and Clang need them
+// no FMA contraction, so every kernel rounds the products the same way and the moments don't depend on the instruction set
+#if defined(MCHTR_PLANES_X86) && defined(__GNUC__) && !defined(__clang__)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2"), optimize("fp-contract=off")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f"), optimize("fp-contract=off")))
+#elif defined(MCHTR_PLANES_X86) && !defined(_MSC_VER)
+#define MCHTR_TARGET_AVX2 __attribute__((target("avx2")))
+#define MCHTR_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define MCHTR_TARGET_AVX2
+#define MCHTR_TARGET_AVX512
+#endif
+
+/*
+Batched plane fitting functionality cpp file
+Moments are summed in float relative to each lane's central point (a neighbourhood is small next to the cloud's coordinates),
+the covariance and its eigenpair are computed in double.
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// the rows of A - lambda I are treated as rank 1 (a repeated smallest eigenvalue) once their cross products fall this far below them
+	constexpr double degenerate_rows = 1e-24;
+
+	void cross(const double* a, const double* b, double* product) {
+		product[0] = a[1] * b[2] - a[2] * b[1];
+		product[1] = a[2] * b[0] - a[0] * b[2];
+		product[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	double squared_length(const double* vector) {
+		return vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2];
+	}
+}
+
+double mchtr_planes::smallest_eigenpair(const double a[3][3], double vector[3]) {
+	/*
+	Finds the smallest eigenvalue of a symmetric 3x3 matrix in closed form (the trigonometric solution of its characteristic cubic)
+	and its eigenvector as the longest cross product of two rows of A - lambda I.
+	@param		a - symmetric matrix, left unchanged
+				vector - output, unit eigenvector; for a repeated smallest eigenvalue any unit vector of its eigenspace
+	@return		the smallest eigenvalue
+	*/
+	const double off_diagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+	if (off_diagonal == 0) {
+
+		// diagonal, the smallest entry's axis (the first of equal ones, like the Jacobi solver)
+		int smallest = 0;
+		for (int i = 1; i < 3; ++i) {
+			if (a[i][i] < a[smallest][smallest]) {
+				smallest = i;
+			}
+		}
+		for (int i = 0; i < 3; ++i) {
+			vector[i] = i == smallest ? 1.0 : 0.0;
+		}
+		return a[smallest][smallest];
+	}
+
+	// eigenvalues are q + 2p cos(phi + 2 pi j / 3), with B = (A - qI) / p and cos(3 phi) = det(B) / 2
+	const double q = (a[0][0] + a[1][1] + a[2][2]) / 3;
+	const double d0 = a[0][0] - q, d1 = a[1][1] - q, d2 = a[2][2] - q;
+	const double p = std::sqrt((d0 * d0 + d1 * d1 + d2 * d2 + 2 * off_diagonal) / 6);
+	const double b01 = a[0][1] / p, b02 = a[0][2] / p, b12 = a[1][2] / p;
+	const double b00 = d0 / p, b11 = d1 / p, b22 = d2 / p;
+	const double determinant = b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02);
+	const double r = std::min(1.0, std::max(-1.0, determinant / 2));
+	const double phi = std::acos(r) / 3;
+	const double two_thirds_pi = 2.0943951023931957;
+	const double value = q + 2 * p * std::cos(phi + two_thirds_pi);
+
+	// the eigenvector is orthogonal to every row of A - lambda I
+	const double rows[3][3] = {
+		{ a[0][0] - value, a[0][1], a[0][2] },
+		{ a[0][1], a[1][1] - value, a[1][2] },
+		{ a[0][2], a[1][2], a[2][2] - value }
+	};
+	double products[3][3];
+	cross(rows[0], rows[1], products[0]);
+	cross(rows[0], rows[2], products[1]);
+	cross(rows[1], rows[2], products[2]);
+	int longest = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (squared_length(products[i]) > squared_length(products[longest])) {
+			longest = i;
+		}
+	}
+	int longest_row = 0;
+	for (int i = 1; i < 3; ++i) {
+		if (squared_length(rows[i]) > squared_length(rows[longest_row])) {
+			longest_row = i;
+		}
+	}
+	const double row_length = squared_length(rows[longest_row]);
+	double candidate[3] = { products[longest][0], products[longest][1], products[longest][2] };
+	if (squared_length(candidate) <= degenerate_rows * row_length * row_length) {
+
+		// the smallest eigenvalue is repeated, any vector orthogonal to the remaining row will do: cross it with the axis it leans on least
+		const double* row = rows[longest_row];
+		int axis = 0;
+		for (int i = 1; i < 3; ++i) {
+			if (std::fabs(row[i]) < std::fabs(row[axis])) {
+				axis = i;
+			}
+		}
+		const double unit[3] = { axis == 0 ? 1.0 : 0.0, axis == 1 ? 1.0 : 0.0, axis == 2 ? 1.0 : 0.0 };
+		cross(row, unit, candidate);
+	}
+	const double length = std::sqrt(squared_length(candidate));
+	for (int i = 0; i < 3; ++i) {
+		vector[i] = candidate[i] / length;
+	}
+	return value;
+}
+
+mchtr_geometry::local_geometry mchtr_planes::geometry_from_moments(const mchtr_planes::lane_moments& moments, int lane, int k, const mchtr_geometry::point3& central_point) {
+	/*
+	Builds the least squares plane and surface variation of one lane's neighbourhood from its moments.
+	@param		moments - moments of a batch
+				lane - lane of the neighbourhood
+				k - number of points of every neighbourhood of the batch
+				central_point - the point the lane's coordinates are relative to
+	@return		plane through the neighbourhood's mean (in the cloud's coordinates), normal to its smallest variance, and surface variation
+	*/
+	double sums[9];
+	for (int i = 0; i < 9; ++i) {
+		sums[i] = moments.sums[i][lane];
+	}
+	const double count = k;
+	const double mean[3] = { sums[0] / count, sums[1] / count, sums[2] / count };
+	const double covariance[3][3] = {
+		{ sums[3] / count - mean[0] * mean[0], sums[4] / count - mean[0] * mean[1], sums[5] / count - mean[0] * mean[2] },
+		{ sums[4] / count - mean[0] * mean[1], sums[6] / count - mean[1] * mean[1], sums[7] / count - mean[1] * mean[2] },
+		{ sums[5] / count - mean[0] * mean[2], sums[7] / count - mean[1] * mean[2], sums[8] / count - mean[2] * mean[2] }
+	};
+	const double trace = covariance[0][0] + covariance[1][1] + covariance[2][2];
+	mchtr_geometry::local_geometry geometry;
+	const double smallest = mchtr_planes::smallest_eigenpair(covariance, geometry.plane.normal);
+	const double centre[3] = { mean[0] + central_point.x(), mean[1] + central_point.y(), mean[2] + central_point.z() };
+	geometry.plane.offset = -(geometry.plane.normal[0] * centre[0] + geometry.plane.normal[1] * centre[1] + geometry.plane.normal[2] * centre[2]);
+	geometry.surface_variation = trace > 0 ? std::fmax(smallest, 0.0) / trace : 0.0;
+	return geometry;
+}
+
+void mchtr_planes::accumulate(const mchtr_batch::neighbourhood_batch& batch, mchtr_batch::isa instruction_set, mchtr_planes::lane_moments& moments) {
+	/*
+	Sums the moments of every lane with the given instruction set, all of them give the same sums.
+	@param		batch - padded batch of neighbourhoods
+				instruction_set - result of mchtr_batch::detect_isa (or narrower)
+				moments - output
+	*/
+	switch (instruction_set) {
+	case mchtr_batch::ISA_AVX512:
+		mchtr_planes::accumulate_avx512(batch, moments);
+		break;
+	case mchtr_batch::ISA_AVX2:
+		mchtr_planes::accumulate_avx2(batch, moments);
+		break;
+	default:
+		mchtr_planes::accumulate_scalar(batch, moments);
+		break;
+	}
+}
+
+void mchtr_planes::accumulate_scalar(const mchtr_batch::neighbourhood_batch& batch, mchtr_planes::lane_moments& moments) {
+	/*
+	Portable kernel, point after point, every lane in the same order as the SIMD kernels.
+	@param		batch, moments - see accumulate
+	*/
+	for (int i = 0; i < 9; ++i) {
+		std::fill(moments.sums[i], moments.sums[i] + mchtr_batch::max_lanes, 0.0f);
+	}
+	for (int j = 0; j < batch.k; ++j) {
+		const float* xs = batch.xs.data() + j * mchtr_batch::max_lanes;
+		const float* ys = batch.ys.data() + j * mchtr_batch::max_lanes;
+		const float* zs = batch.zs.data() + j * mchtr_batch::max_lanes;
+		for (int lane = 0; lane < mchtr_batch::max_lanes; ++lane) {
+			const float x = xs[lane], y = ys[lane], z = zs[lane];
+			moments.sums[0][lane] += x;
+			moments.sums[1][lane] += y;
+			moments.sums[2][lane] += z;
+			moments.sums[3][lane] += x * x;
+			moments.sums[4][lane] += x * y;
+			moments.sums[5][lane] += x * z;
+			moments.sums[6][lane] += y * y;
+			moments.sums[7][lane] += y * z;
+			moments.sums[8][lane] += z * z;
+		}
+	}
+}
+
+#if defined(MCHTR_PLANES_X86)
+
+MCHTR_TARGET_AVX2 void mchtr_planes::accumulate_avx2(const mchtr_batch::neighbourhood_batch& batch, mchtr_planes::lane_moments& moments) {
+	/*
+	AVX2 kernel, 8 lanes per register, the two halves of the batch one after the other so the 9 sums stay in registers.
+	@param		batch, moments - see accumulate
+	*/
+	for (int half = 0; half < mchtr_batch::max_lanes; half += 8) {
+		__m256 sums[9];
+		for (int i = 0; i < 9; ++i) {
+			sums[i] = _mm256_setzero_ps();
+		}
+		for (int j = 0; j < batch.k; ++j) {
+			const std::size_t offset = static_cast<std::size_t>(j) * mchtr_batch::max_lanes + half;
+			const __m256 x = _mm256_loadu_ps(batch.xs.data() + offset);
+			const __m256 y = _mm256_loadu_ps(batch.ys.data() + offset);
+			const __m256 z = _mm256_loadu_ps(batch.zs.data() + offset);
+			sums[0] = _mm256_add_ps(sums[0], x);
+			sums[1] = _mm256_add_ps(sums[1], y);
+			sums[2] = _mm256_add_ps(sums[2], z);
+			sums[3] = _mm256_add_ps(sums[3], _mm256_mul_ps(x, x));
+			sums[4] = _mm256_add_ps(sums[4], _mm256_mul_ps(x, y));
+			sums[5] = _mm256_add_ps(sums[5], _mm256_mul_ps(x, z));
+			sums[6] = _mm256_add_ps(sums[6], _mm256_mul_ps(y, y));
+			sums[7] = _mm256_add_ps(sums[7], _mm256_mul_ps(y, z));
+			sums[8] = _mm256_add_ps(sums[8], _mm256_mul_ps(z, z));
+		}
+		for (int i = 0; i < 9; ++i) {
+			_mm256_storeu_ps(moments.sums[i] + half, sums[i]);
+		}
+	}
+}
+
+MCHTR_TARGET_AVX512 void mchtr_planes::accumulate_avx512(const mchtr_batch::neighbourhood_batch& batch, mchtr_planes::lane_moments& moments) {
+	/*
+	AVX-512 kernel, the whole batch in one register per sum.
+	@param		batch, moments - see accumulate
+	*/
+	__m512 sums[9];
+	for (int i = 0; i < 9; ++i) {
+		sums[i] = _mm512_setzero_ps();
+	}
+	for (int j = 0; j < batch.k; ++j) {
+		const std::size_t offset = static_cast<std::size_t>(j) * mchtr_batch::max_lanes;
+		const __m512 x = _mm512_loadu_ps(batch.xs.data() + offset);
+		const __m512 y = _mm512_loadu_ps(batch.ys.data() + offset);
+		const __m512 z = _mm512_loadu_ps(batch.zs.data() + offset);
+		sums[0] = _mm512_add_ps(sums[0], x);
+		sums[1] = _mm512_add_ps(sums[1], y);
+		sums[2] = _mm512_add_ps(sums[2], z);
+		sums[3] = _mm512_add_ps(sums[3], _mm512_mul_ps(x, x));
+		sums[4] = _mm512_add_ps(sums[4], _mm512_mul_ps(x, y));
+		sums[5] = _mm512_add_ps(sums[5], _mm512_mul_ps(x, z));
+		sums[6] = _mm512_add_ps(sums[6], _mm512_mul_ps(y, y));
+		sums[7] = _mm512_add_ps(sums[7], _mm512_mul_ps(y, z));
+		sums[8] = _mm512_add_ps(sums[8], _mm512_mul_ps(z, z));
+	}
+	for (int i = 0; i < 9; ++i) {
+		_mm512_storeu_ps(moments.sums[i], sums[i]);
+	}
+}
+
+#else
+
+void mchtr_planes::accumulate_avx2(const mchtr_batch::neighbourhood_batch& batch, mchtr_planes::lane_moments& moments) {
+	// not an x86 build, detect_isa never selects this
+	mchtr_planes::accumulate_scalar(batch, moments);
+}
+
+void mchtr_planes::accumulate_avx512(const mchtr_batch::neighbourhood_batch& batch, mchtr_planes::lane_moments& moments) {
+	// not an x86 build, detect_isa never selects this
+	mchtr_planes::accumulate_scalar(batch, moments);
+}
+
+#endif
+
+void mchtr_planes::fit_planes(const mchtr_batch::neighbourhood_batch& batch, const mchtr_geometry::point3* central_points, mchtr_batch::isa instruction_set,
+	mchtr_geometry::local_geometry* geometries) {
+	/*
+	Fits a least squares plane to every neighbourhood of a batch and measures its surface variation, the batched counterpart of
+	mchtr_geometry::fit_local_geometry (same planes up to rounding and the normal's sign).
+	@param		batch - padded batch of neighbourhoods, coordinates relative to their central points
+				central_points - the central point of every used lane
+				instruction_set - result of mchtr_batch::detect_isa (or narrower)
+				geometries - output, one per used lane (batch.lanes)
+	*/
+	mchtr_planes::lane_moments moments;
+	mchtr_planes::accumulate(batch, instruction_set, moments);
+	for (int lane = 0; lane < batch.lanes; ++lane) {
+		geometries[lane] = mchtr_planes::geometry_from_moments(moments, lane, batch.k, central_points[lane]);
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "mchtr_batch.h"
+#include "mchtr_geometry.h"
+
+/*
+Batched plane fitting functionality header file: covariance of many neighbourhoods accumulated in SIMD lanes in one streaming pass,
+planes and surface variations taken from it with a closed-form (trigonometric) 3x3 symmetric eigensolver
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_planes
+{
+	// first and second moments of the neighbourhoods of a batch, one per lane, coordinates relative to the lane's central point:
+	// sums of x, y, z, xx, xy, xz, yy, yz, zz in that order
+	struct lane_moments {
+		float sums[9][mchtr_batch::max_lanes];
+	};
+
+	double smallest_eigenpair(const double[3][3], double[3]);
+	mchtr_geometry::local_geometry geometry_from_moments(const lane_moments&, int, int, const mchtr_geometry::point3&);
+	void accumulate(const mchtr_batch::neighbourhood_batch&, mchtr_batch::isa, lane_moments&);
+	void accumulate_scalar(const mchtr_batch::neighbourhood_batch&, lane_moments&);
+	void accumulate_avx2(const mchtr_batch::neighbourhood_batch&, lane_moments&);
+	void accumulate_avx512(const mchtr_batch::neighbourhood_batch&, lane_moments&);
+	void fit_planes(const mchtr_batch::neighbourhood_batch&, const mchtr_geometry::point3*, mchtr_batch::isa, mchtr_geometry::local_geometry*);
+}
@@ -0,0 +1,279 @@
+#include "mchtr_profile.h"
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+/*
+Instrumentation functionality cpp file: scoped timers, per worker hot path counters and a JSON / CSV run report
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	std::string number(double value) {
+		/*
+		@param		value - a number
+		@return		the number as JSON / CSV text (non-finite values, which JSON lacks, become 0)
+		*/
+		if (!(value == value) || value > 1e300 || value < -1e300) {
+			value = 0;
+		}
+		char text[32];
+		std::snprintf(text, sizeof(text), "%.9g", value);
+		return text;
+	}
+
+	double seconds(std::uint64_t nanoseconds) {
+		return nanoseconds * 1e-9;
+	}
+
+	// per worker fields in report order, derived rates included
+	std::vector<std::pair<const char*, double>> worker_fields(const mchtr_profile::worker_stats& stats) {
+		return {
+			{ "points", static_cast<double>(stats.points) },
+			{ "busy_seconds", seconds(stats.busy_nanoseconds) },
+			{ "points_per_second", stats.busy_nanoseconds > 0 ? stats.points / seconds(stats.busy_nanoseconds) : 0.0 },
+			{ "knn_queries", static_cast<double>(stats.knn_queries) },
+			{ "knn_seconds", seconds(stats.knn_nanoseconds) },
+			{ "mean_neighbours_visited", stats.knn_queries > 0 ? static_cast<double>(stats.neighbours_visited) / stats.knn_queries : 0.0 },
+			{ "fits", static_cast<double>(stats.fits) },
+			{ "fit_seconds", seconds(stats.fit_nanoseconds) },
+			{ "mean_fit_iterations", stats.fits > 0 ? static_cast<double>(stats.fit_iterations) / stats.fits : 0.0 },
+			{ "mean_exit_loss", stats.exit_losses > 0 ? stats.exit_loss_sum / stats.exit_losses : 0.0 }
+		};
+	}
+
+	mchtr_profile::worker_stats total_of(const std::vector<mchtr_profile::worker_stats>& workers) {
+		mchtr_profile::worker_stats total;
+		for (const mchtr_profile::worker_stats& stats : workers) {
+			total.points += stats.points;
+			total.busy_nanoseconds += stats.busy_nanoseconds;
+			total.knn_queries += stats.knn_queries;
+			total.knn_nanoseconds += stats.knn_nanoseconds;
+			total.neighbours_visited += stats.neighbours_visited;
+			for (int bucket = 0; bucket < mchtr_profile::visited_buckets; ++bucket) {
+				total.visited_histogram[bucket] += stats.visited_histogram[bucket];
+			}
+			total.fits += stats.fits;
+			total.fit_nanoseconds += stats.fit_nanoseconds;
+			total.fit_iterations += stats.fit_iterations;
+			total.exit_losses += stats.exit_losses;
+			total.exit_loss_sum += stats.exit_loss_sum;
+		}
+		return total;
+	}
+}
+
+std::uint64_t (*mchtr_profile::thread_allocations)() = nullptr;
+
+void mchtr_profile::worker_stats::add_query(std::size_t visited) {
+	/*
+	Counts a KNN query.
+	@param		visited - number of points the query compared distances to
+	*/
+	++knn_queries;
+	neighbours_visited += visited;
+	int bucket = 0;
+	while (bucket < visited_buckets - 1 && (static_cast<std::size_t>(2) << bucket) <= visited) {
+		++bucket;
+	}
+	++visited_histogram[bucket];
+}
+
+void mchtr_profile::worker_stats::add_fit(std::uint64_t iterations, double exit_loss) {
+	/*
+	Counts a sphere fit.
+	@param		iterations - epochs (SGD) or solves (closed-form methods) the fit took
+				exit_loss - mean squared point to surface distance after the fit, skipped if not finite (flat neighbourhoods)
+	*/
+	++fits;
+	fit_iterations += iterations;
+	if (exit_loss == exit_loss && exit_loss < 1e300) {
+		++exit_losses;
+		exit_loss_sum += exit_loss;
+	}
+}
+
+mchtr_profile::recorder::recorder(const std::string& algorithm) : m_algorithm(algorithm) {
+	/*
+	@param		algorithm - name of the profiled algorithm, written to the report
+	*/
+}
+
+void mchtr_profile::recorder::add_stage(const std::string& name, double seconds) {
+	/*
+	Adds time spent in a stage, repeated stages (e.g. one per tile) are summed.
+	@param		name - stage name
+				seconds - duration
+	*/
+	for (stage& existing : m_stages) {
+		if (existing.name == name) {
+			existing.seconds += seconds;
+			++existing.calls;
+			return;
+		}
+	}
+	m_stages.push_back(stage{ name, seconds, 1 });
+}
+
+void mchtr_profile::recorder::set_value(const std::string& name, double value) {
+	/*
+	Sets a plain value of the run (parameters, points count, results...).
+	@param		name - value name
+				value - the value
+	*/
+	for (auto& existing : m_values) {
+		if (existing.first == name) {
+			existing.second = value;
+			return;
+		}
+	}
+	m_values.emplace_back(name, value);
+}
+
+std::vector<mchtr_profile::worker_stats>& mchtr_profile::recorder::workers(int count) {
+	/*
+	Makes room for per worker counters before a parallel run, counters of repeated runs add up.
+	@param		count - number of workers of the run
+	@return		counters, at least count of them, worker i writes only element i
+	*/
+	if (m_workers.size() < static_cast<std::size_t>(count)) {
+		m_workers.resize(count);
+	}
+	return m_workers;
+}
+
+std::string mchtr_profile::recorder::json() const {
+	/*
+	@return		the report as a JSON object: algorithm, values, stages, workers (with totals) and the visited points histogram
+	*/
+	std::string text = "{\n  \"algorithm\": \"" + m_algorithm + "\",\n  \"values\": {";
+	for (std::size_t i = 0; i < m_values.size(); ++i) {
+		text += (i ? ",\n    \"" : "\n    \"") + m_values[i].first + "\": " + number(m_values[i].second);
+	}
+	text += "\n  },\n  \"stages\": [";
+	for (std::size_t i = 0; i < m_stages.size(); ++i) {
+		text += (i ? ",\n    " : "\n    ");
+		text += "{ \"name\": \"" + m_stages[i].name + "\", \"seconds\": " + number(m_stages[i].seconds) +
+			", \"calls\": " + number(static_cast<double>(m_stages[i].calls)) + " }";
+	}
+	text += "\n  ],\n  \"workers\": [";
+	const mchtr_profile::worker_stats total = total_of(m_workers);
+	for (std::size_t i = 0; i <= m_workers.size(); ++i) {
+		const bool is_total = i == m_workers.size();
+		text += (i ? ",\n    { \"worker\": " : "\n    { \"worker\": ") + (is_total ? std::string("\"total\"") : number(static_cast<double>(i)));
+		for (const auto& field : worker_fields(is_total ? total : m_workers[i])) {
+			text += std::string(", \"") + field.first + "\": " + number(field.second);
+		}
+		text += " }";
+	}
+	text += "\n  ],\n  \"neighbours_visited\": [";
+	bool first = true;
+	for (int bucket = 0; bucket < mchtr_profile::visited_buckets; ++bucket) {
+		if (total.visited_histogram[bucket] == 0) {
+			continue;
+		}
+		text += first ? "\n    " : ",\n    ";
+		text += "{ \"from\": " + number(static_cast<double>(1ull << bucket)) + ", \"queries\": " + number(static_cast<double>(total.visited_histogram[bucket])) + " }";
+		first = false;
+	}
+	text += "\n  ]\n}\n";
+	return text;
+}
+
+std::string mchtr_profile::recorder::csv() const {
+	/*
+	@return		the report as CSV, one "algorithm,section,field,value" row per number so runs are easy to append and diff
+	*/
+	std::string text = "algorithm,section,field,value\n";
+	for (const auto& value : m_values) {
+		text += m_algorithm + ",value," + value.first + "," + number(value.second) + "\n";
+	}
+	for (const stage& existing : m_stages) {
+		text += m_algorithm + ",stage," + existing.name + "_seconds," + number(existing.seconds) + "\n";
+		text += m_algorithm + ",stage," + existing.name + "_calls," + number(static_cast<double>(existing.calls)) + "\n";
+	}
+	const mchtr_profile::worker_stats total = total_of(m_workers);
+	for (std::size_t i = 0; i <= m_workers.size(); ++i) {
+		const bool is_total = i == m_workers.size();
+		const std::string name = is_total ? "total" : "worker_" + std::to_string(i);
+		for (const auto& field : worker_fields(is_total ? total : m_workers[i])) {
+			text += m_algorithm + "," + name + "," + field.first + "," + number(field.second) + "\n";
+		}
+	}
+	for (int bucket = 0; bucket < mchtr_profile::visited_buckets; ++bucket) {
+		if (total.visited_histogram[bucket] > 0) {
+			text += m_algorithm + ",neighbours_visited,from_" + std::to_string(1ull << bucket) + "," + number(static_cast<double>(total.visited_histogram[bucket])) + "\n";
+		}
+	}
+	return text;
+}
+
+void mchtr_profile::recorder::write(const std::string& path) const {
+	/*
+	Writes the report, as CSV if the path ends with .csv, as JSON otherwise.
+	@param		path - output file, throws std::runtime_error if it can't be written
+	*/
+	const bool as_csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+	std::ofstream file(path, std::ios::binary);
+	file << (as_csv ? csv() : json());
+	if (!file) {
+		throw std::runtime_error("cannot write " + path);
+	}
+}
+
+void mchtr_profile::recorder::write(const std::wstring& path) const {
+	/*
+	Writes the report to a wide path (as plugin parameters come), as CSV if the path ends with .csv, as JSON otherwise.
+	@param		path - output file, throws std::runtime_error if it can't be written
+	*/
+#if defined(_MSC_VER)
+	const bool as_csv = path.size() >= 4 && path.compare(path.size() - 4, 4, L".csv") == 0;
+	std::ofstream file(path, std::ios::binary);
+	file << (as_csv ? csv() : json());
+	if (!file) {
+		throw std::runtime_error("cannot write the report");
+	}
+#else
+	// narrow paths elsewhere are UTF-8
+	std::string narrow;
+	for (wchar_t character : path) {
+		const std::uint32_t code = static_cast<std::uint32_t>(character);
+		if (code < 0x80) {
+			narrow += static_cast<char>(code);
+		}
+		else if (code < 0x800) {
+			narrow += static_cast<char>(0xc0 | (code >> 6));
+			narrow += static_cast<char>(0x80 | (code & 0x3f));
+		}
+		else if (code < 0x10000) {
+			narrow += static_cast<char>(0xe0 | (code >> 12));
+			narrow += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+			narrow += static_cast<char>(0x80 | (code & 0x3f));
+		}
+		else {
+			narrow += static_cast<char>(0xf0 | (code >> 18));
+			narrow += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+			narrow += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+			narrow += static_cast<char>(0x80 | (code & 0x3f));
+		}
+	}
+	write(narrow);
+#endif
+}
+
+mchtr_profile::scoped_stage::scoped_stage(mchtr_profile::recorder* target, const char* name) : m_recorder(target), m_name(name) {
+	/*
+	@param		target - recorder the stage is added to, may be nullptr (profiling off)
+				name - stage name
+	*/
+	if (m_recorder) {
+		m_start = clock::now();
+	}
+}
+
+mchtr_profile::scoped_stage::~scoped_stage() {
+	if (m_recorder) {
+		m_recorder->add_stage(m_name, std::chrono::duration<double>(clock::now() - m_start).count());
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Instrumentation functionality header file: scoped timers, per worker hot path counters and a JSON / CSV run report
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_profile
+{
+	using clock = std::chrono::steady_clock;
+
+	// histogram of points visited per KNN query, bucket i counts queries visiting [2^i, 2^(i+1)) points
+	constexpr int visited_buckets = 24;
+
+	// hot path counters of a single worker, only its own thread writes them (no atomics), merged into the report after a run;
+	// aligned to a cache line so neighbouring workers don't share one
+	struct alignas(64) worker_stats {
+		std::uint64_t points{ 0 };
+		std::uint64_t busy_nanoseconds{ 0 };
+		std::uint64_t knn_queries{ 0 };
+		std::uint64_t knn_nanoseconds{ 0 };
+		std::uint64_t neighbours_visited{ 0 };
+		std::uint64_t visited_histogram[visited_buckets]{};
+		std::uint64_t fits{ 0 };
+		std::uint64_t fit_nanoseconds{ 0 };
+		std::uint64_t fit_iterations{ 0 };
+		std::uint64_t exit_losses{ 0 };
+		double exit_loss_sum{ 0 };
+
+		void add_query(std::size_t);
+		void add_fit(std::uint64_t, double);
+	};
+
+	// named stage durations, plain values and per worker counters of a run, written as JSON or CSV
+	class recorder {
+	public:
+		explicit recorder(const std::string&);
+
+		void add_stage(const std::string&, double);
+		void set_value(const std::string&, double);
+		std::vector<worker_stats>& workers(int);
+
+		std::string json() const;
+		std::string csv() const;
+		void write(const std::string&) const;
+		void write(const std::wstring&) const;
+
+	private:
+		struct stage {
+			std::string name;
+			double seconds;
+			std::size_t calls;
+		};
+
+		std::string m_algorithm;
+		std::vector<stage> m_stages;
+		std::vector<std::pair<std::string, double>> m_values;
+		std::vector<worker_stats> m_workers;
+	};
+
+	// number of heap allocations the calling thread has made, set by a program that counts them (the benchmark replaces operator new);
+	// nullptr by default, then nothing is counted
+	extern std::uint64_t (*thread_allocations)();
+
+	// adds the time until the end of its scope as a stage of a recorder, does nothing for a nullptr recorder
+	class scoped_stage {
+	public:
+		scoped_stage(recorder*, const char*);
+		~scoped_stage();
+
+	private:
+		recorder* m_recorder;
+		const char* m_name;
+		clock::time_point m_start;
+	};
+
+	// adds the nanoseconds until the end of its scope to a counter, does nothing (not even read the clock) for a nullptr counter
+	class scoped_timer {
+	public:
+		explicit scoped_timer(std::uint64_t* counter) : m_counter(counter) {
+			if (m_counter) {
+				m_start = clock::now();
+			}
+		}
+		~scoped_timer() {
+			if (m_counter) {
+				*m_counter += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count());
+			}
+		}
+
+	private:
+		std::uint64_t* m_counter;
+		clock::time_point m_start;
+	};
+}
@@ -0,0 +1,617 @@
+#include "mchtr_segmentation.h"
+#include <algorithm>
+#include <cmath>
+#include <cwchar>
+#include <stdexcept>
+#include <string>
+#include "mchtr_batch.h"
+#include "mchtr_geometry.h"
+#include "mchtr_pipeline.h"
+#include "mchtr_planes.h"
+#include "mchtr_union_find.h"
+
+/*
+Building segmentation functionality cpp file (smoothing, surface normals, roof finding and grouping roofs into buildings), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	static_assert(sizeof(mchtr_segmentation::surface) == 4 * sizeof(float), "surfaces are cached as 4 floats per point");
+
+	void gather_neighbours(const float* xyz, const mchtr_knn_graph::graph& graph, std::size_t index, int k, std::uint32_t* scratch,
+		std::vector<mchtr_geometry::point3>& neighbouring_points) {
+		/*
+		Collects coordinates of a point's K nearest neighbours.
+		@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					graph - KNN graph of the points
+					index - index of the point
+					k - number of nearest neighbours
+					scratch - room for a decoded row, see mchtr_knn_graph::graph::read_row
+					neighbouring_points - output, cleared first
+		*/
+		neighbouring_points.clear();
+		std::size_t neighbours_found = 0;
+		const std::uint32_t* neighbours = graph.read_row(index, k, scratch, neighbours_found);
+		for (std::size_t j = 0; j < neighbours_found; ++j) {
+			const float* neighbour = xyz + 3 * static_cast<std::size_t>(neighbours[j]);
+			neighbouring_points.emplace_back(neighbour[0], neighbour[1], neighbour[2]);
+		}
+	}
+
+	// fits the planes of consecutive points' neighbourhoods: one at a time with mchtr_geometry::fit_local_geometry, or batched,
+	// up to max_lanes full neighbourhoods at once through mchtr_planes (short rows still go one by one)
+	class plane_fitter {
+	public:
+		plane_fitter(int k, bool batched) : m_k(k), m_batched(batched), m_isa(batched ? mchtr_batch::detect_isa() : mchtr_batch::ISA_SCALAR) {
+			m_points.reserve(k);
+			m_row.resize(k + mchtr_graph_codec::decode_slack);
+		}
+
+		std::size_t block_size() const { return m_batched ? mchtr_batch::max_lanes : 1; }
+
+		void fit(const float* xyz, const mchtr_knn_graph::graph& graph, const std::size_t* order, std::size_t begin, std::size_t end,
+			mchtr_geometry::local_geometry* geometries) {
+			/*
+			@param		xyz - coordinates of the points and their neighbours, interleaved (x0, y0, z0, x1, ...)
+						graph - KNN graph of the points
+						order - indices of the points in processing order, nullptr for index order
+						begin, end - positions (in the order) of the points to fit, at most block_size() of them
+						geometries - output, plane and surface variation of the point at position begin + i at [i]
+			*/
+			m_batch.reset(m_k);
+			for (std::size_t position = begin; position < end; ++position) {
+				const std::size_t index = order ? order[position] : position;
+				gather_neighbours(xyz, graph, index, m_k, m_row.data(), m_points);
+				if (m_batched && m_points.size() == static_cast<std::size_t>(m_k)) {
+					m_central_points[m_batch.lanes] = mchtr_geometry::point3(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2]);
+					m_batch.add(m_points, m_central_points[m_batch.lanes], static_cast<int>(position - begin));
+				}
+				else {
+					geometries[position - begin] = mchtr_geometry::fit_local_geometry(m_points.data(), m_points.size());
+				}
+			}
+			if (m_batch.lanes > 0) {
+				m_batch.pad();
+				mchtr_planes::fit_planes(m_batch, m_central_points, m_isa, m_lane_geometries);
+				for (int lane = 0; lane < m_batch.lanes; ++lane) {
+					geometries[m_batch.indices[lane]] = m_lane_geometries[lane];
+				}
+			}
+		}
+
+	private:
+		int m_k;
+		bool m_batched;
+		mchtr_batch::isa m_isa;
+		std::vector<mchtr_geometry::point3> m_points;
+		std::vector<std::uint32_t> m_row;
+		mchtr_batch::neighbourhood_batch m_batch;
+		mchtr_geometry::point3 m_central_points[mchtr_batch::max_lanes];
+		mchtr_geometry::local_geometry m_lane_geometries[mchtr_batch::max_lanes];
+	};
+
+	mchtr_segmentation::surface to_surface(const mchtr_geometry::local_geometry& geometry) {
+		/*
+		@param		geometry - plane and surface variation of a neighbourhood
+		@return		the same in single precision, with the normal turned up (+Z) so that normals of a roof agree
+		*/
+		const double sign = geometry.plane.normal[2] < 0 ? -1.0 : 1.0;
+		return { { static_cast<float>(sign * geometry.plane.normal[0]), static_cast<float>(sign * geometry.plane.normal[1]), static_cast<float>(sign * geometry.plane.normal[2]) },
+			static_cast<float>(geometry.surface_variation) };
+	}
+
+	float angle_to_vertical(const mchtr_segmentation::surface& surface) {
+		/*
+		@param		surface - surface of a neighbourhood
+		@return		angle between its normal and the Z axis in radians, 0 to pi/2 for upward normals
+		*/
+		const float* normal = surface.normal;
+		const float length = static_cast<float>(std::sqrt(static_cast<double>(normal[0]) * normal[0] + static_cast<double>(normal[1]) * normal[1] +
+			static_cast<double>(normal[2]) * normal[2]));
+		return std::acos(normal[2] / length);
+	}
+
+	void smooth_range(const float* source, const std::size_t* order, std::size_t begin, std::size_t end, const mchtr_knn_graph::graph& graph, plane_fitter& fitter,
+		float* smoothed, mchtr_segmentation::surface* surfaces) {
+		/*
+		Smooths the points at positions [begin, end) of the order, block by block, see mchtr_segmentation::smooth.
+		@param		source - coordinates of all points, interleaved (x0, y0, z0, x1, ...)
+					order - indices of the points in processing order, nullptr for index order
+					begin, end - positions of the points to smooth, begin a multiple of the fitter's block size
+					graph - KNN graph of the points before smoothing
+					fitter - fits the planes, block by block
+					smoothed - output, smoothed coordinates indexed like source; source itself smooths in place (a block is fitted before it moves)
+					surfaces - output, surfaces of the planes the points were projected onto, nullptr if not needed
+		*/
+		mchtr_geometry::local_geometry geometries[mchtr_batch::max_lanes];
+		for (std::size_t block_begin = begin; block_begin < end; block_begin += fitter.block_size()) {
+
+			// fit best fitting planes to KNNs
+			const std::size_t block_end = std::min(end, block_begin + fitter.block_size());
+			fitter.fit(source, graph, order, block_begin, block_end, geometries);
+
+			// project the points onto their best-fitted planes
+			for (std::size_t position = block_begin; position < block_end; ++position) {
+				const std::size_t index = order ? order[position] : position;
+				const mchtr_geometry::local_geometry& geometry = geometries[position - block_begin];
+				const float* point = source + 3 * index;
+				const mchtr_geometry::point3 projected_point = geometry.plane.project(mchtr_geometry::point3(point[0], point[1], point[2]));
+				smoothed[3 * index] = projected_point.x();
+				smoothed[3 * index + 1] = projected_point.y();
+				smoothed[3 * index + 2] = projected_point.z();
+				if (surfaces) {
+					surfaces[index] = to_surface(geometry);
+				}
+			}
+		}
+	}
+
+	void smooth_passes(float* xyz, std::size_t points_count, std::vector<float>& buffer, int passes_done, int iterations, const mchtr_knn_graph::graph& graph,
+		const std::size_t* order, std::vector<plane_fitter>& fitters, const mchtr_parallel::progress_function& report, mchtr_segmentation::surface* surfaces) {
+		/*
+		Runs the remaining passes of double-buffered smoothing, see mchtr_segmentation::smooth_buffered. Passes ping-pong between xyz and buffer
+		(the first one reads xyz), a pass reads one of them and writes the other, so any number of workers gets the same result.
+		@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), hold the result when done
+					points_count - number of points
+					buffer - 3 * points_count floats, the other buffer; after an odd number of passes it holds their result
+					passes_done - passes already run (the pipeline runs the first one)
+					iterations - number of passes in total
+					graph - KNN graph of the points before smoothing
+					order - points_count indices, the order points are smoothed in, nullptr for index order
+					fitters - a plane fitter per worker
+					report - receives the number of processed points of the current pass
+					surfaces - output, points_count surfaces of the planes of the last pass, nullptr if not needed
+		*/
+
+		// chunks of whole fitter blocks, so batches are grouped like sequential ones
+		const std::size_t chunk_size = 64 * fitters.front().block_size();
+		for (int pass = passes_done; pass < iterations; ++pass) {
+			const float* source = pass % 2 == 0 ? xyz : buffer.data();
+			float* target = pass % 2 == 0 ? buffer.data() : xyz;
+			mchtr_segmentation::surface* pass_surfaces = pass + 1 == iterations ? surfaces : nullptr;
+			mchtr_parallel::run_chunks(points_count, chunk_size, static_cast<int>(fitters.size()),
+				[&](std::size_t begin, std::size_t end, int worker) {
+					smooth_range(source, order, begin, end, graph, fitters[worker], target, pass_surfaces);
+				},
+				report);
+		}
+
+		// commit the result of an odd number of passes in one bulk write
+		if (iterations % 2 == 1) {
+			std::copy(buffer.begin(), buffer.begin() + 3 * points_count, xyz);
+		}
+	}
+
+	void estimate_range(const float* xyz, const std::size_t* order, std::size_t begin, std::size_t end, const mchtr_knn_graph::graph& graph, plane_fitter& fitter,
+		mchtr_segmentation::surface* surfaces) {
+		/*
+		Estimates surfaces of the points at positions [begin, end) of the order, see mchtr_segmentation::estimate_surfaces.
+		@param		xyz - coordinates of the points and their neighbours, interleaved (x0, y0, z0, x1, ...)
+					order - indices of the points in processing order, nullptr for index order
+					begin, end - positions of the points to estimate surfaces of, begin a multiple of the fitter's block size
+					graph - KNN graph of the points
+					fitter - fits the planes, block by block
+					surfaces - output, surfaces indexed like the points
+		*/
+		mchtr_geometry::local_geometry geometries[mchtr_batch::max_lanes];
+		for (std::size_t block_begin = begin; block_begin < end; block_begin += fitter.block_size()) {
+			const std::size_t block_end = std::min(end, block_begin + fitter.block_size());
+			fitter.fit(xyz, graph, order, block_begin, block_end, geometries);
+			for (std::size_t position = block_begin; position < block_end; ++position) {
+				surfaces[order ? order[position] : position] = to_surface(geometries[position - block_begin]);
+			}
+		}
+	}
+
+	mchtr_pipeline::options aligned_blocks(const mchtr_pipeline::options& pipeline, std::size_t block_size) {
+		/*
+		@param		pipeline - user's pipeline options
+					block_size - the plane fitter's block size
+		@return		the same with the batch size rounded up to whole fitter blocks, so pipelined planes are grouped exactly like sequential ones
+		*/
+		mchtr_pipeline::options aligned = pipeline;
+		aligned.batch_size = static_cast<int>((static_cast<std::size_t>(pipeline.batch_size) + block_size - 1) / block_size * block_size);
+		return aligned;
+	}
+}
+
+const wchar_t* mchtr_segmentation::validate(const mchtr_segmentation::options& settings) {
+	/*
+	@param		settings - user supplied options
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (settings.neighbours_count < 1 || settings.neighbours_count_segmentation < 1) {
+		return L"K of nearest neighbours lower than 1.";
+	}
+	if (settings.threads < 0) {
+		return L"Number of threads lower than 0 (0 means all cores).";
+	}
+	if (settings.smoothing_iterations < 1) {
+		return L"Number of smoothing iterations lower than 1.";
+	}
+	if (!mchtr_order::is_valid_curve(settings.order)) {
+		return L"Unknown order, use 0 (storage order), 1 (Morton curve) or 2 (Hilbert curve).";
+	}
+
+	// the smaller K caps the rows smoothing and roof finding read, the minimum has to fit in it
+	const wchar_t* error = mchtr_voxel_grid::validate(settings.neighbourhood, std::min(settings.neighbours_count, settings.neighbours_count_segmentation));
+	if (error) {
+		return error;
+	}
+	if (settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS && settings.pipeline.enabled) {
+		return L"Fixed radius neighbourhoods can't be combined with the pipeline.";
+	}
+	return mchtr_pipeline::validate(settings.pipeline);
+}
+
+void mchtr_segmentation::smooth(float* xyz, std::size_t points_count, const mchtr_knn_graph::graph& graph, int k, bool batched, const std::size_t* order,
+	const mchtr_parallel::progress_function& report, mchtr_segmentation::surface* surfaces) {
+	/*
+	Smooths the cloud (gets rid of thermal noise) by projecting every point onto the plane best fitted to its KNNs.
+	Points are updated in place and in order, so later points already see smoothed neighbours (batched, points see the neighbours
+	smoothed before their batch).
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), smoothed in place
+				points_count - number of points
+				graph - KNN graph of the points before smoothing
+				k - number of nearest neighbours
+				batched - fit planes a batch of neighbourhoods at a time, see plane_fitter
+				order - points_count indices, the order points are smoothed in (see mchtr_order), nullptr for index order
+				report - receives the number of processed points
+				surfaces - output, points_count surfaces of the planes the points were projected onto, nullptr if not needed
+	*/
+	plane_fitter fitter(k, batched);
+	for (std::size_t begin = 0; begin < points_count; begin += fitter.block_size()) {
+		const std::size_t end = std::min(points_count, begin + fitter.block_size());
+		smooth_range(xyz, order, begin, end, graph, fitter, xyz, surfaces);
+		report(end);
+	}
+}
+
+void mchtr_segmentation::smooth_into(const float* xyz, std::size_t points_count, const mchtr_knn_graph::graph& graph, int k, bool batched,
+	const mchtr_parallel::progress_function& report, float* smoothed, mchtr_segmentation::surface* surfaces) {
+	/*
+	Smooths points like smooth(), but every point is projected onto the plane fitted to unsmoothed neighbours,
+	so the result doesn't depend on the order of points (needed when a cloud is smoothed tile by tile).
+	@param		xyz - coordinates of the points and their neighbours, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points (a prefix of xyz) to smooth
+				graph - KNN graph of the points, at least points_count rows
+				k - number of nearest neighbours
+				batched - fit planes a batch of neighbourhoods at a time, see plane_fitter
+				report - receives the number of processed points
+				smoothed - output, points_count smoothed points, interleaved
+				surfaces - output, points_count surfaces of the planes the points were projected onto, nullptr if not needed
+	*/
+	plane_fitter fitter(k, batched);
+	for (std::size_t begin = 0; begin < points_count; begin += fitter.block_size()) {
+		const std::size_t end = std::min(points_count, begin + fitter.block_size());
+		smooth_range(xyz, nullptr, begin, end, graph, fitter, smoothed, surfaces);
+		report(end);
+	}
+}
+
+void mchtr_segmentation::smooth_buffered(float* xyz, std::size_t points_count, const mchtr_knn_graph::graph& graph, int k, bool batched, const std::size_t* order,
+	int iterations, int workers, const mchtr_parallel::progress_function& report, mchtr_segmentation::surface* surfaces) {
+	/*
+	Smooths points like smooth_into(), in parallel: every pass reads an unchanged snapshot of the coordinates and writes the projections
+	into a second buffer, so the result is the same for any number of workers and any order. More passes ping-pong between the two buffers,
+	each projecting the previous pass's points onto planes fitted to them, with the same KNN graph (neighbourhoods barely change).
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), replaced with the smoothed ones at the end
+				points_count - number of points
+				graph - KNN graph of the points before smoothing
+				k - number of nearest neighbours
+				batched - fit planes a batch of neighbourhoods at a time, see plane_fitter
+				order - points_count indices, the order points are fitted in (see mchtr_order), nullptr for index order; the result is the same
+				iterations - number of smoothing passes, at least 1
+				workers - number of worker threads
+				report - receives the number of processed points of the current pass
+				surfaces - output, points_count surfaces of the planes the last pass projected onto, nullptr if not needed
+	*/
+	std::vector<float> buffer(3 * points_count);
+	std::vector<plane_fitter> fitters;
+	fitters.reserve(workers);
+	for (int worker = 0; worker < workers; ++worker) {
+		fitters.emplace_back(k, batched);
+	}
+	smooth_passes(xyz, points_count, buffer, 0, iterations, graph, order, fitters, report, surfaces);
+}
+
+void mchtr_segmentation::estimate_surfaces(const float* xyz, std::size_t points_count, const mchtr_knn_graph::graph& graph, int k, bool batched,
+	const std::size_t* order, const mchtr_parallel::progress_function& report, mchtr_segmentation::surface* surfaces) {
+	/*
+	Fits a plane to every point's KNNs without moving the point.
+	@param		xyz - coordinates of the points and their neighbours, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points (a prefix of xyz) to estimate surfaces of
+				graph - KNN graph of the points, at least points_count rows
+				k - number of nearest neighbours
+				batched - fit planes a batch of neighbourhoods at a time, see plane_fitter
+				order - points_count indices, the order points are fitted in (see mchtr_order), nullptr for index order; the surfaces are the same
+				report - receives the number of processed points
+				surfaces - output, points_count surfaces
+	*/
+	plane_fitter fitter(k, batched);
+	for (std::size_t begin = 0; begin < points_count; begin += fitter.block_size()) {
+		const std::size_t end = std::min(points_count, begin + fitter.block_size());
+		estimate_range(xyz, order, begin, end, graph, fitter, surfaces);
+		report(end);
+	}
+}
+
+void mchtr_segmentation::classify_roofs(const float* xyz, std::size_t points_count, const mchtr_segmentation::surface* surfaces, std::vector<unsigned char>& flags) {
+	/*
+	Finds points whose neighbourhood is approximately horizontal and lies above the ground level.
+	@param		xyz - coordinates of the points, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points to classify
+				surfaces - surfaces of the points' neighbourhoods
+				flags - output, 1 for roof points, 0 for other points
+	*/
+	flags.assign(points_count, 0);
+
+	// plane for reduction of point cloud tilt in Z axis
+	const mchtr_geometry::point3 z_plane_points[] = {
+		mchtr_geometry::point3(-22.6403f, 11.2198f, -90.7701f),
+		mchtr_geometry::point3(-35.1771f, -27.5203f, -92.5725f),
+		mchtr_geometry::point3(-1.0683f, -30.5571f, -91.7308f),
+		mchtr_geometry::point3(23.9246f, 0.1567f, -88.2513f)
+	};
+	const mchtr_geometry::plane3 z_plane = mchtr_geometry::fit_plane(z_plane_points, 4);
+
+	for (std::size_t index = 0; index < points_count; ++index) {
+
+		// is the point below or above the Z correction plane? the answer lies in sign of the distance
+		const float point_z_position = static_cast<float>(z_plane.signed_distance(mchtr_geometry::point3(xyz[3 * index], xyz[3 * index + 1], xyz[3 * index + 2])));
+
+		// angle between vertical vector and the (upward) normal of the neighbourhood
+		const float angle = angle_to_vertical(surfaces[index]);
+
+		// if angle is 0 +- 15 degrees (normal vector is ~vertical, the surface ~horizontal) AND the point is above the Z correction plane, it's a roof
+		if (angle < 0.2618 && point_z_position > 0) {
+			flags[index] = 1;
+		}
+	}
+}
+
+void mchtr_segmentation::number_roofs(const std::vector<unsigned char>& flags, std::vector<float>& roofs) {
+	/*
+	Numbers roof points incrementally in point order (the first one gets 0, so like all other points it is not a part of any building).
+	@param		flags - 1 for roof points, 0 for other points
+				roofs - output, roof numbers, 0 for other points
+	*/
+	float current_roof_point = 0;
+	roofs.resize(flags.size());
+	for (std::size_t index = 0; index < flags.size(); ++index) {
+		if (flags[index]) {
+			roofs[index] = current_roof_point;
+			++current_roof_point;
+		}
+		else {
+			roofs[index] = 0;
+		}
+	}
+}
+
+std::size_t mchtr_segmentation::segment_buildings(float* xyz, std::size_t points_count, const mchtr_segmentation::options& settings,
+	mchtr_knn_graph::graph& knn_graph, const mchtr_segmentation::stage_function& stage, const mchtr_parallel::progress_function& report,
+	std::vector<float>& buildings, std::vector<mchtr_segmentation::surface>& surfaces) {
+	/*
+	Runs the whole algorithm: smoothing, roof finding and grouping roof points connected through their KNNs into buildings.
+	With fused_geometry the roof test reads the planes fitted for smoothing, so each neighbourhood's covariance is computed once instead of twice.
+	With a pipeline every KNN graph rebuild overlaps with the plane fits reading it, the results stay the same.
+	With an order other than storage order points are smoothed along the curve, which changes the in-place smoothing slightly; labels still follow point indices.
+	With a compressed graph the rows are built straight into their compressed form and decoded as they are read, the results stay the same.
+	With fixed radius neighbourhoods the graph's rows hold the nearest neighbours within the radius (up to each K, at least the minimum) from a voxel grid.
+	With buffered smoothing every pass reads a snapshot of the coordinates and writes a second buffer, in parallel and with the same result
+	for any number of threads and order; more smoothing iterations repeat smoothing with the first KNN graph.
+	With a persistent cache the smoothed cloud, the KNN graphs and the surfaces are taken from it whenever it has them for the current
+	coordinates and parameters, and saved to it otherwise; only grouping roofs into buildings always runs.
+	@param		xyz - coordinates of all points, interleaved (x0, y0, z0, x1, ...), smoothed in place
+				points_count - number of points
+				settings - neighbours counts, number of threads and labelling, throws std::invalid_argument if invalid
+				knn_graph - cached KNN graph, reused if it still matches the coordinates
+				stage - called when a stage starts
+				report - receives the number of processed points of the current stage
+				buildings - output, per point building label, 0 for points that are not roofs
+				surfaces - output, per point normal and surface variation the roof test read
+	@return		number of buildings
+	*/
+	const wchar_t* error = mchtr_segmentation::validate(settings);
+	if (error) {
+
+		// the messages are plain ASCII
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+	const int workers = mchtr_parallel::resolve_threads(settings.threads);
+	if (settings.profile) {
+		settings.profile->set_value("points", static_cast<double>(points_count));
+		settings.profile->set_value("neighbours_count", settings.neighbours_count);
+		settings.profile->set_value("neighbours_count_segmentation", settings.neighbours_count_segmentation);
+		settings.profile->set_value("workers", workers);
+		settings.profile->set_value("fused_geometry", settings.fused_geometry ? 1 : 0);
+		settings.profile->set_value("batched_planes", settings.batched_planes ? 1 : 0);
+		settings.profile->set_value("pipelined", settings.pipeline.enabled ? 1 : 0);
+		settings.profile->set_value("order", settings.order);
+		settings.profile->set_value("buffered_smoothing", settings.buffered_smoothing ? 1 : 0);
+		settings.profile->set_value("smoothing_iterations", settings.smoothing_iterations);
+		settings.profile->set_value("compressed_graph", settings.compressed_graph ? 1 : 0);
+		settings.profile->set_value("neighbourhood_mode", settings.neighbourhood.mode);
+		if (settings.neighbourhood.mode == mchtr_voxel_grid::NEIGHBOURHOOD_RADIUS) {
+			settings.profile->set_value("radius", settings.neighbourhood.radius);
+			settings.profile->set_value("min_neighbours", settings.neighbourhood.min_points);
+		}
+	}
+	knn_graph.compress = settings.compressed_graph;
+	knn_graph.neighbourhood = settings.neighbourhood;
+
+	// planes fitted along a space-filling curve read overlapping neighbourhoods one after another; smoothing moves points very little,
+	// so the order of the cloud before smoothing serves both stages
+	std::vector<std::size_t> ordered;
+	if (settings.order != mchtr_order::ORDER_STORAGE) {
+		mchtr_profile::scoped_stage timer(settings.profile, "ordering");
+		mchtr_order::sort_points(xyz, nullptr, points_count, settings.order, ordered);
+	}
+	const std::size_t* order = ordered.empty() ? nullptr : ordered.data();
+
+	// smoothing with KNNs of the cloud before smoothing
+	// pipelined: one fit worker smooths the blocks in order while the others query the next rows, so the result is the sequential one
+	// buffered and pipelined: the first pass reads only the snapshot, so it runs as many fit workers as searching leaves
+	stage(mchtr_segmentation::STAGE_SMOOTHING);
+	surfaces.resize(points_count);
+	mchtr_segmentation::surface* smoothing_surfaces = settings.fused_geometry ? surfaces.data() : nullptr;
+	mchtr_pipeline::run_stats smoothing_pipeline{ 0, 0, 0, 0, 0 }, roofs_pipeline{ 0, 0, 0, 0, 0 };
+
+	// a cached smoothed cloud replaces the whole stage; it depends on everything smoothing reads (batched fits round differently per instruction set)
+	mchtr_cache::store* cache = settings.cache;
+	const mchtr_batch::isa planes_isa = settings.batched_planes ? mchtr_batch::detect_isa() : mchtr_batch::ISA_SCALAR;
+	mchtr_cache::parameters smoothing_parameters;
+	smoothing_parameters.add(settings.neighbours_count).add(settings.batched_planes).add(static_cast<int>(planes_isa))
+		.add(settings.order).add(settings.buffered_smoothing).add(settings.smoothing_iterations);
+	mchtr_cache::parameters roofs_parameters;
+	roofs_parameters.add(settings.neighbours_count).add(settings.batched_planes).add(static_cast<int>(planes_isa));
+	// radius neighbourhoods are keyed too, KNN runs keep the keys they had
+	if (settings.neighbourhood.mode != mchtr_voxel_grid::NEIGHBOURHOOD_KNN) {
+		smoothing_parameters.add(mchtr_voxel_grid::key(settings.neighbourhood));
+		roofs_parameters.add(mchtr_voxel_grid::key(settings.neighbourhood));
+	}
+	const std::uint64_t smoothing_key = smoothing_parameters.value();
+	std::uint64_t source_fingerprint = 0;
+	bool smoothed = false;
+	if (cache) {
+		mchtr_profile::scoped_stage timer(settings.profile, "cache_load");
+		source_fingerprint = mchtr_knn_graph::fingerprint_of(xyz, points_count);
+		smoothed = (!smoothing_surfaces || cache->load_values(mchtr_cache::KIND_SURFACES, source_fingerprint, smoothing_key, 4 * points_count,
+			reinterpret_cast<float*>(smoothing_surfaces))) && cache->load_values(mchtr_cache::KIND_SMOOTHED, source_fingerprint, smoothing_key, 3 * points_count, xyz);
+	}
+	const bool smoothing_cached = smoothed;
+	if (smoothing_cached) {
+		report(points_count);
+	}
+	std::vector<float> buffer;
+	std::vector<plane_fitter> fitters;
+	int passes_done = 0;
+	if (!smoothed && settings.buffered_smoothing) {
+		buffer.resize(3 * points_count);
+	}
+	if (!smoothed && settings.pipeline.enabled) {
+		int search_workers = std::max(1, workers - 1), fit_workers = 1;
+		if (settings.buffered_smoothing) {
+			mchtr_pipeline::split_threads(workers, search_workers, fit_workers);
+		}
+		for (int worker = 0; worker < fit_workers; ++worker) {
+			fitters.emplace_back(settings.neighbours_count, settings.batched_planes);
+		}
+		float* first_pass = settings.buffered_smoothing ? buffer.data() : xyz;
+		mchtr_segmentation::surface* first_surfaces = settings.smoothing_iterations == 1 ? smoothing_surfaces : nullptr;
+		smoothed = mchtr_knn_graph::update_pipelined(knn_graph, xyz, points_count, settings.neighbours_count, order,
+			aligned_blocks(settings.pipeline, fitters.front().block_size()), search_workers, fit_workers,
+			[&](std::size_t begin, std::size_t end, std::size_t, int worker) {
+				smooth_range(xyz, order, begin, end, knn_graph, fitters[worker], first_pass, first_surfaces);
+			},
+			report, settings.profile, cache, smoothing_pipeline);
+		passes_done = smoothed ? 1 : 0;
+	}
+	std::size_t graph_builds = smoothed && !smoothing_cached ? 1 : 0;
+	if (!smoothed) {
+		graph_builds += mchtr_knn_graph::update(knn_graph, xyz, points_count, settings.neighbours_count, workers, report, settings.profile, cache) ? 1 : 0;
+	}
+	if (!smoothing_cached && (passes_done < settings.smoothing_iterations || settings.buffered_smoothing)) {
+		mchtr_profile::scoped_stage timer(settings.profile, "smoothing");
+		if (settings.buffered_smoothing) {
+			fitters.clear();
+			for (int worker = 0; worker < workers; ++worker) {
+				fitters.emplace_back(settings.neighbours_count, settings.batched_planes);
+			}
+			smooth_passes(xyz, points_count, buffer, passes_done, settings.smoothing_iterations, knn_graph, order, fitters, report, smoothing_surfaces);
+		}
+		else {
+			for (int pass = passes_done; pass < settings.smoothing_iterations; ++pass) {
+				mchtr_segmentation::smooth(xyz, points_count, knn_graph, settings.neighbours_count, settings.batched_planes, order, report,
+					pass + 1 == settings.smoothing_iterations ? smoothing_surfaces : nullptr);
+			}
+		}
+	}
+	if (cache && !smoothing_cached) {
+		mchtr_profile::scoped_stage timer(settings.profile, "cache_save");
+		cache->save_values(mchtr_cache::KIND_SMOOTHED, source_fingerprint, smoothing_key, 3 * points_count, xyz);
+		if (smoothing_surfaces) {
+			cache->save_values(mchtr_cache::KIND_SURFACES, source_fingerprint, smoothing_key, 4 * points_count, reinterpret_cast<const float*>(smoothing_surfaces));
+		}
+	}
+
+	// one KNN graph of the smoothed cloud serves roof finding and segmentation; pipelined (and not fused), the surfaces are estimated
+	// by the fit workers as its rows come in
+	stage(mchtr_segmentation::STAGE_ROOFS);
+	const int graph_k = std::max(settings.neighbours_count, settings.neighbours_count_segmentation);
+
+	// surfaces of the smoothed cloud don't depend on the order they're estimated in
+	const std::uint64_t roofs_key = roofs_parameters.value();
+	std::uint64_t smoothed_fingerprint = 0;
+	bool estimated = false;
+	if (cache && !settings.fused_geometry) {
+		mchtr_profile::scoped_stage timer(settings.profile, "cache_load");
+		smoothed_fingerprint = mchtr_knn_graph::fingerprint_of(xyz, points_count);
+		estimated = cache->load_values(mchtr_cache::KIND_SURFACES, smoothed_fingerprint, roofs_key, 4 * points_count, reinterpret_cast<float*>(surfaces.data()));
+	}
+	const bool surfaces_cached = estimated;
+	if (!estimated && settings.pipeline.enabled && !settings.fused_geometry) {
+		int search_workers = 0, fit_workers = 0;
+		mchtr_pipeline::split_threads(workers, search_workers, fit_workers);
+		std::vector<plane_fitter> fitters;
+		fitters.reserve(fit_workers);
+		for (int worker = 0; worker < fit_workers; ++worker) {
+			fitters.emplace_back(settings.neighbours_count, settings.batched_planes);
+		}
+		estimated = mchtr_knn_graph::update_pipelined(knn_graph, xyz, points_count, graph_k, order,
+			aligned_blocks(settings.pipeline, fitters.front().block_size()), search_workers, fit_workers,
+			[&](std::size_t begin, std::size_t end, std::size_t, int worker) {
+				estimate_range(xyz, order, begin, end, knn_graph, fitters[worker], surfaces.data());
+			},
+			report, settings.profile, cache, roofs_pipeline);
+	}
+	graph_builds += estimated && !surfaces_cached ? 1 : 0;
+	if (!estimated || surfaces_cached) {
+		graph_builds += mchtr_knn_graph::update(knn_graph, xyz, points_count, graph_k, workers, report, settings.profile, cache) ? 1 : 0;
+	}
+	std::vector<float> roofs;
+	{
+		mchtr_profile::scoped_stage timer(settings.profile, "roofs");
+		if (!settings.fused_geometry && !estimated) {
+			mchtr_segmentation::estimate_surfaces(xyz, points_count, knn_graph, settings.neighbours_count, settings.batched_planes, order, report, surfaces.data());
+		}
+		if (cache && !settings.fused_geometry && !surfaces_cached) {
+			cache->save_values(mchtr_cache::KIND_SURFACES, smoothed_fingerprint, roofs_key, 4 * points_count, reinterpret_cast<const float*>(surfaces.data()));
+		}
+		std::vector<unsigned char> flags;
+		mchtr_segmentation::classify_roofs(xyz, points_count, surfaces.data(), flags);
+		mchtr_segmentation::number_roofs(flags, roofs);
+		report(points_count);
+	}
+
+	// every connected group of roof points becomes one building, in a single pass
+	stage(mchtr_segmentation::STAGE_SEGMENTATION);
+	std::size_t buildings_count = 0;
+	{
+		mchtr_profile::scoped_stage timer(settings.profile, "segmentation");
+		buildings_count = mchtr_union_find::label_components(knn_graph, settings.neighbours_count_segmentation, roofs,
+			settings.compact_ids, workers, report, buildings);
+	}
+	if (settings.profile) {
+		settings.profile->set_value("knn_graph_builds", static_cast<double>(graph_builds));
+		settings.profile->set_value("knn_graph_bytes", static_cast<double>(knn_graph.bytes()));
+		if (settings.pipeline.enabled) {
+			settings.profile->set_value("pipeline_batch", settings.pipeline.batch_size);
+			settings.profile->set_value("pipeline_depth", settings.pipeline.depth);
+			settings.profile->set_value("pipeline_search_waits", static_cast<double>(smoothing_pipeline.search_waits + roofs_pipeline.search_waits));
+			settings.profile->set_value("pipeline_fit_waits", static_cast<double>(smoothing_pipeline.fit_waits + roofs_pipeline.fit_waits));
+		}
+		settings.profile->set_value("roof_points", static_cast<double>(std::count_if(roofs.begin(), roofs.end(), [](float roof) { return roof != 0; })));
+		settings.profile->set_value("buildings", static_cast<double>(buildings_count));
+		if (cache) {
+			settings.profile->set_value("cache_hits", static_cast<double>(cache->stats().hits));
+			settings.profile->set_value("cache_misses", static_cast<double>(cache->stats().misses));
+			settings.profile->set_value("cache_writes", static_cast<double>(cache->stats().writes));
+			settings.profile->set_value("cache_failed_writes", static_cast<double>(cache->stats().failed_writes));
+		}
+	}
+	stage(mchtr_segmentation::STAGE_DONE);
+	return buildings_count;
+}
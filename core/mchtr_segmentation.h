@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include "mchtr_cache.h"
+#include "mchtr_knn_graph.h"
+#include "mchtr_order.h"
+#include "mchtr_parallel.h"
+#include "mchtr_pipeline.h"
+#include "mchtr_profile.h"
+#include "mchtr_voxel_grid.h"
+
+/*
+Building segmentation functionality header file (smoothing, roof finding and grouping roofs into buildings), independent of the FRAMES3D SDK
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_segmentation
+{
+	struct options {
+		int neighbours_count{ 25 };
+		int neighbours_count_segmentation{ 100 };
+		int threads{ 1 };
+		bool compact_ids{ false };
+		bool fused_geometry{ false };	// the roof test reads the normals of the planes the points were smoothed onto, instead of fitting planes to the smoothed cloud
+		bool batched_planes{ false };	// fit planes 16 neighbourhoods at a time with SIMD moments and a closed-form eigensolver (see mchtr_planes) instead of one by one
+		mchtr_pipeline::options pipeline;	// fit planes of blocks whose KNN graph rows are ready while the next rows are queried, see mchtr_pipeline
+		int order{ mchtr_order::ORDER_STORAGE };	// one of mchtr_order::curve, the order planes are fitted in; in-place smoothing follows it
+		bool buffered_smoothing{ false };	// smooth in parallel from a snapshot of the coordinates into a second buffer, the same for any threads and order
+		int smoothing_iterations{ 1 };		// smoothing passes, all with the KNN graph of the cloud before smoothing
+		bool compressed_graph{ false };		// keep KNN graph rows compressed (see mchtr_graph_codec), less than half the memory, the same results
+		mchtr_voxel_grid::options neighbourhood;	// K nearest neighbours, or up to K nearest within a radius (see mchtr_voxel_grid), for both stages
+		mchtr_cache::store* cache{ nullptr };		// persistent cache of KNN graphs, smoothed coordinates and surfaces, off if nullptr
+		mchtr_profile::recorder* profile{ nullptr };	// instrumentation, off if nullptr
+	};
+
+	// what one covariance tells about a point's neighbourhood: the normal (pointing up, +Z) of its plane and its surface variation
+	struct surface {
+		float normal[3];
+		float variation;
+	};
+
+	enum stage {
+		STAGE_SMOOTHING = 0,
+		STAGE_ROOFS = 1,
+		STAGE_SEGMENTATION = 2,
+		STAGE_DONE = 3
+	};
+
+	// called on the calling thread when a stage starts (STAGE_DONE after the last one), progress restarts from 0 with every stage
+	using stage_function = std::function<void(int)>;
+
+	const wchar_t* validate(const options&);
+	void smooth(float*, std::size_t, const mchtr_knn_graph::graph&, int, bool, const std::size_t*, const mchtr_parallel::progress_function&, surface*);
+	void smooth_into(const float*, std::size_t, const mchtr_knn_graph::graph&, int, bool, const mchtr_parallel::progress_function&, float*, surface*);
+	void smooth_buffered(float*, std::size_t, const mchtr_knn_graph::graph&, int, bool, const std::size_t*, int, int, const mchtr_parallel::progress_function&, surface*);
+	void estimate_surfaces(const float*, std::size_t, const mchtr_knn_graph::graph&, int, bool, const std::size_t*, const mchtr_parallel::progress_function&, surface*);
+	void classify_roofs(const float*, std::size_t, const surface*, std::vector<unsigned char>&);
+	void number_roofs(const std::vector<unsigned char>&, std::vector<float>&);
+	std::size_t segment_buildings(float*, std::size_t, const options&, mchtr_knn_graph::graph&, const stage_function&,
+		const mchtr_parallel::progress_function&, std::vector<float>&, std::vector<surface>&);
+}
@@ -0,0 +1,68 @@
+#include "mchtr_sgd.h"
+#include "mchtr_kernels.h"
+
+/*
+Stochastic gradient descent functionality cpp file
+Author: Przemyslaw Wysocki
+*/
+
+double mchtr_sgd::find_sphere_r(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point) {
+	/*
+	Performs a stochastic gradient descent fitting a sphere to n 3D points.
+	@param		data - points which the sphere will be fit to
+				central_point - the original point whose "data" points are neighbours of
+	@returns	sphere.r - final radius of the sphere
+	*/
+	return mchtr_sgd::fit_sphere(data, central_point).r;
+}
+
+mchtr_sgd::sphere mchtr_sgd::fit_sphere(const std::vector<mchtr_geometry::point3>& data, const mchtr_geometry::point3& central_point) {
+	/*
+	Performs a stochastic gradient descent fitting a sphere to n 3D points.
+	@param		data - points which the sphere will be fit to
+				central_point - the original point whose "data" points are neighbours of
+	@returns	sphere - final fitted sphere
+	*/
+	int epochs = 0;
+	return mchtr_sgd::fit_sphere(data, mchtr_sgd::init_sphere(central_point, mchtr_sgd::init_coord_offset, mchtr_sgd::init_radius),
+		mchtr_sgd::convergence(), epochs);
+}
+
+mchtr_sgd::sphere mchtr_sgd::fit_sphere(const std::vector<mchtr_geometry::point3>& data, const mchtr_sgd::sphere& start,
+	const mchtr_sgd::convergence& stopping, int& epochs) {
+	/*
+	Performs a stochastic gradient descent fitting a sphere to n 3D points, from a given sphere and until it converges.
+	The loss of an epoch is the sum of the losses of its steps, each taken before the step's update.
+	@param		data - points which the sphere will be fit to
+				start - initial sphere (init_sphere near the central point, or a neighbour's fitted sphere)
+				stopping - maximum number of epochs and early stopping tolerance
+				epochs - output, number of epochs run
+	@returns	sphere - final fitted sphere
+	*/
+	return mchtr_kernels::fit_sphere_sgd<double>(data.data(), data.size(), start, stopping, epochs);
+}
+
+bool mchtr_sgd::has_converged(double previous_loss, double loss, float tolerance) {
+	/*
+	Early stopping rule shared by the single and batched fitters.
+	@param		previous_loss, loss - losses of two consecutive epochs
+				tolerance - smallest relative improvement worth another epoch, 0 never stops early
+	@return		true if the later epoch improved on the earlier one by less than tolerance (or made it worse)
+	*/
+	return tolerance > 0 && previous_loss - loss <= tolerance * previous_loss;
+}
+
+mchtr_sgd::sphere mchtr_sgd::init_sphere(const mchtr_geometry::point3& central_point, float coord_offset, float initial_radius) {
+	/*
+	Initialises a sphere which will be used for fitting to data.
+	@param		central_point - point which KNNs were found (which are the data)
+				coord_offset - offsets of central points coordinates, diffrence of which are parameters of returned sphere
+				initial_radius - initial sphere radius
+	@return		sphere which is near the central point
+	*/
+
+	return mchtr_sgd::sphere{ central_point.x() - coord_offset,
+							central_point.y() - coord_offset,
+							central_point.z() - coord_offset,
+							initial_radius };
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+#include "mchtr_geometry.h"
+
+/*
+Stochastic gradient descent functionality header file
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_sgd
+{
+	struct sphere {
+		float x, y, z, r;
+	};
+
+	// fitting hyperparameters
+	constexpr int no_epochs = 30;
+	constexpr float init_coord_offset = 0.01f;
+	constexpr float init_radius = 0.5f;
+	constexpr double xyz_learning_rate = 0.15;
+	constexpr double r_learning_rate = 0.15;
+
+	// when a fit stops: after max_epochs, or earlier once an epoch lowers the loss by less than tolerance (relative to the previous epoch's loss)
+	struct convergence {
+		int max_epochs{ no_epochs };
+		float tolerance{ 0 };	// 0 disables early stopping
+	};
+
+	double find_sphere_r(const std::vector<mchtr_geometry::point3>&, const mchtr_geometry::point3&);
+	mchtr_sgd::sphere fit_sphere(const std::vector<mchtr_geometry::point3>&, const mchtr_geometry::point3&);
+	mchtr_sgd::sphere fit_sphere(const std::vector<mchtr_geometry::point3>&, const mchtr_sgd::sphere&, const mchtr_sgd::convergence&, int&);
+	bool has_converged(double, double, float);
+	mchtr_sgd::sphere init_sphere(const mchtr_geometry::point3&, float, float);
+}
\ No newline at end of file
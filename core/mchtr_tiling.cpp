@@ -0,0 +1,528 @@
+#include "mchtr_tiling.h"
+#include <algorithm>
+#include <cmath>
+#include <cwchar>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "mchtr_kdtree.h"
+#include "mchtr_knn_graph.h"
+#include "mchtr_union_find.h"
+
+/*
+Tiled (out-of-core) processing functionality cpp file: the cloud is processed tile by tile, every tile with a halo of
+neighbouring points, so memory used for KNN state is bounded by the tile size instead of the cloud size
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// a tile's points: its own (core) points first, then the halo
+	struct tile_points {
+		std::vector<float> xyz;
+		std::vector<std::size_t> indices;
+		std::size_t core_count{ 0 };
+		mchtr_tiling::box region;
+	};
+
+	void load_tile(const mchtr_tiling::grid& tiles, int tile, float halo, const mchtr_tiling::tile_loader& loader, mchtr_profile::recorder* profile,
+		tile_points& points) {
+		/*
+		Loads a tile with its halo and moves the tile's own points to the front.
+		@param		tiles - tiling of the cloud
+					tile - tile to load
+					halo - halo width
+					loader - source of points
+					profile - instrumentation, nullptr if off
+					points - output
+		*/
+		mchtr_profile::scoped_stage timer(profile, "tile_loading");
+		std::vector<float> xyz;
+		std::vector<std::size_t> indices;
+		points.region = tiles.region(tile, halo);
+		loader(points.region, xyz, indices);
+
+		const std::size_t count = indices.size();
+		points.xyz.resize(3 * count);
+		points.indices.resize(count);
+		std::size_t core = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			if (tiles.tile_of(xyz[3 * i], xyz[3 * i + 1]) == tile) {
+				++core;
+			}
+		}
+		std::size_t next_core = 0;
+		std::size_t next_halo = core;
+		for (std::size_t i = 0; i < count; ++i) {
+			const std::size_t slot = tiles.tile_of(xyz[3 * i], xyz[3 * i + 1]) == tile ? next_core++ : next_halo++;
+			points.xyz[3 * slot] = xyz[3 * i];
+			points.xyz[3 * slot + 1] = xyz[3 * i + 1];
+			points.xyz[3 * slot + 2] = xyz[3 * i + 2];
+			points.indices[slot] = indices[i];
+		}
+		points.core_count = core;
+	}
+
+	bool exact_neighbourhood(const mchtr_tiling::box& region, const mchtr_tiling::box& bounds, float x, float y, float kth_distance_squared) {
+		/*
+		Checks whether KNNs found within a region are the KNNs within the whole cloud: no point outside the region can be closer than the farthest one found.
+		@param		region - loaded region (tile with its halo)
+					bounds - bounds of the whole cloud, region sides beyond them have no points behind
+					x, y - the point
+					kth_distance_squared - squared distance to the farthest neighbour found
+		@return		true if the neighbourhood is exact
+		*/
+		const float distance = std::sqrt(kth_distance_squared);
+		return (region.min[0] <= bounds.min[0] || x - region.min[0] >= distance) &&
+			(region.max[0] >= bounds.max[0] || region.max[0] - x >= distance) &&
+			(region.min[1] <= bounds.min[1] || y - region.min[1] >= distance) &&
+			(region.max[1] >= bounds.max[1] || region.max[1] - y >= distance);
+	}
+
+	std::size_t build_tile_graph(const tile_points& points, const mchtr_kdtree::kdtree& tree, const mchtr_tiling::box& bounds, int k, int workers,
+		mchtr_knn_graph::graph& graph) {
+		/*
+		Builds a KNN graph with rows for the tile's own points only, neighbours come from the whole loaded region.
+		@param		points - loaded tile
+					tree - kd-tree of the loaded tile
+					bounds - bounds of the whole cloud
+					k - number of nearest neighbours
+					workers - number of workers
+					graph - output, rows of the core points
+		@return		number of neighbourhoods the halo was too narrow for
+		*/
+		const std::size_t neighbours_found = std::min(static_cast<std::size_t>(k), tree.size());
+		graph.reset_rows(k, 0, points.core_count, neighbours_found);
+
+		std::vector<std::vector<mchtr_kdtree::neighbour>> buffers(workers, std::vector<mchtr_kdtree::neighbour>(neighbours_found));
+		std::vector<std::size_t> inexact(workers, 0);
+		constexpr std::size_t chunk_size = 1024;
+		mchtr_parallel::run_chunks(points.core_count, chunk_size, workers,
+			[&](std::size_t begin, std::size_t end, int worker) {
+				mchtr_kdtree::neighbour* neighbours = buffers[worker].data();
+				for (std::size_t i = begin; i < end; ++i) {
+					const float* xyz = points.xyz.data() + 3 * i;
+					const std::size_t found = tree.knn(xyz[0], xyz[1], xyz[2], k, neighbours);
+					std::uint32_t* row = graph.mutable_row(i);
+					for (std::size_t j = 0; j < found; ++j) {
+						row[j] = neighbours[j].index;
+					}
+					if (found > 0 && !exact_neighbourhood(points.region, bounds, xyz[0], xyz[1], neighbours[found - 1].distance_squared)) {
+						++inexact[worker];
+					}
+				}
+			},
+			[](std::size_t) {});
+
+		std::size_t inexact_count = 0;
+		for (std::size_t count : inexact) {
+			inexact_count += count;
+		}
+		return inexact_count;
+	}
+
+	bool inside(const mchtr_tiling::box& region, const float* point) {
+		return point[0] >= region.min[0] && point[0] <= region.max[0] && point[1] >= region.min[1] && point[1] <= region.max[1] &&
+			point[2] >= region.min[2] && point[2] <= region.max[2];
+	}
+
+	template <typename Body>
+	void for_each_tile(const mchtr_tiling::grid& tiles, const mchtr_tiling::box& region, Body body) {
+		/*
+		@param		tiles - tiling of the cloud
+					region - a box
+					body - called with every tile the box overlaps
+		*/
+		const int first = tiles.tile_of(region.min[0], region.min[1]);
+		const int last = tiles.tile_of(region.max[0], region.max[1]);
+		const int columns = tiles.columns();
+		for (int row = first / columns; row <= last / columns; ++row) {
+			for (int column = first % columns; column <= last % columns; ++column) {
+				body(row * columns + column);
+			}
+		}
+	}
+
+	void note_tile(const tile_points& points, mchtr_tiling::run_stats& stats) {
+		++stats.tiles;
+		stats.largest_tile = std::max(stats.largest_tile, points.indices.size());
+	}
+
+	void record_stats(const mchtr_tiling::run_stats& stats, mchtr_profile::recorder* profile) {
+		if (profile) {
+			profile->set_value("tiles", static_cast<double>(stats.tiles));
+			profile->set_value("largest_tile", static_cast<double>(stats.largest_tile));
+			profile->set_value("inexact_neighbourhoods", static_cast<double>(stats.inexact_neighbourhoods));
+		}
+	}
+}
+
+mchtr_tiling::box mchtr_tiling::bounds_of(const float* xyz, std::size_t points_count) {
+	/*
+	@param		xyz - coordinates, interleaved (x0, y0, z0, x1, ...)
+				points_count - number of points
+	@return		bounding box of the points
+	*/
+	mchtr_tiling::box bounds;
+	for (int axis = 0; axis < 3; ++axis) {
+		bounds.min[axis] = std::numeric_limits<float>::max();
+		bounds.max[axis] = std::numeric_limits<float>::lowest();
+	}
+	for (std::size_t i = 0; i < points_count; ++i) {
+		for (int axis = 0; axis < 3; ++axis) {
+			bounds.min[axis] = std::min(bounds.min[axis], xyz[3 * i + axis]);
+			bounds.max[axis] = std::max(bounds.max[axis], xyz[3 * i + axis]);
+		}
+	}
+	return bounds;
+}
+
+mchtr_tiling::grid::grid(const mchtr_tiling::box& bounds, float tile_size) : m_bounds(bounds), m_tile_size(tile_size) {
+	/*
+	@param		bounds - bounds of the cloud
+				tile_size - side of a tile (in X and Y)
+	*/
+	const double width = std::max(0.0f, bounds.max[0] - bounds.min[0]);
+	const double depth = std::max(0.0f, bounds.max[1] - bounds.min[1]);
+	m_columns = std::max(1, static_cast<int>(std::ceil(width / tile_size)));
+	m_rows = std::max(1, static_cast<int>(std::ceil(depth / tile_size)));
+}
+
+int mchtr_tiling::grid::tile_of(float x, float y) const {
+	/*
+	@param		x, y - coordinates of a point
+	@return		the only tile the point belongs to
+	*/
+	const int column = std::min(m_columns - 1, std::max(0, static_cast<int>((x - m_bounds.min[0]) / m_tile_size)));
+	const int row = std::min(m_rows - 1, std::max(0, static_cast<int>((y - m_bounds.min[1]) / m_tile_size)));
+	return row * m_columns + column;
+}
+
+mchtr_tiling::box mchtr_tiling::grid::region(int tile, float halo) const {
+	/*
+	@param		tile - a tile
+				halo - halo width
+	@return		box of the tile grown by the halo, plus a little margin so rounding never leaves out the tile's own points
+	*/
+	const int column = tile % m_columns;
+	const int row = tile / m_columns;
+	const float margin = 1e-4f * m_tile_size;
+	mchtr_tiling::box region;
+	region.min[0] = m_bounds.min[0] + column * m_tile_size - halo - margin;
+	region.max[0] = column == m_columns - 1 ? m_bounds.max[0] + halo + margin : m_bounds.min[0] + (column + 1) * m_tile_size + halo + margin;
+	region.min[1] = m_bounds.min[1] + row * m_tile_size - halo - margin;
+	region.max[1] = row == m_rows - 1 ? m_bounds.max[1] + halo + margin : m_bounds.min[1] + (row + 1) * m_tile_size + halo + margin;
+	region.min[2] = m_bounds.min[2];
+	region.max[2] = m_bounds.max[2];
+	return region;
+}
+
+mchtr_tiling::bucket_loader::bucket_loader(const mchtr_tiling::point_reader& read, std::size_t points_count, const mchtr_tiling::grid& tiles)
+	: m_read(read), m_grid(tiles) {
+	/*
+	Buckets points by tile (counting sort), reading every point twice in index order.
+	@param		read - reads a point's coordinates, must stay valid as long as the loader
+				points_count - number of points
+				tiles - tiling of the cloud
+	*/
+	float point[3];
+	m_offsets.assign(static_cast<std::size_t>(m_grid.tiles()) + 1, 0);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		m_read(i, point);
+		++m_offsets[m_grid.tile_of(point[0], point[1]) + 1];
+	}
+	for (std::size_t tile = 1; tile < m_offsets.size(); ++tile) {
+		m_offsets[tile] += m_offsets[tile - 1];
+	}
+	std::vector<std::size_t> next(m_offsets.begin(), m_offsets.end() - 1);
+	m_indices.resize(points_count);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		m_read(i, point);
+		m_indices[next[m_grid.tile_of(point[0], point[1])]++] = i;
+	}
+}
+
+void mchtr_tiling::bucket_loader::operator()(const mchtr_tiling::box& region, std::vector<float>& xyz, std::vector<std::size_t>& indices) const {
+	/*
+	Collects points inside a box from the buckets of the tiles it overlaps.
+	@param		region - box to load
+				xyz - output, coordinates, interleaved
+				indices - output, indices of the points
+	*/
+	xyz.clear();
+	indices.clear();
+	float point[3];
+	for_each_tile(m_grid, region, [&](int tile) {
+		for (std::size_t slot = m_offsets[tile]; slot < m_offsets[tile + 1]; ++slot) {
+			m_read(m_indices[slot], point);
+			if (inside(region, point)) {
+				xyz.insert(xyz.end(), point, point + 3);
+				indices.push_back(m_indices[slot]);
+			}
+		}
+	});
+}
+
+mchtr_tiling::stream_loader::stream_loader(const mchtr_tiling::grid& tiles)
+	: m_grid(tiles), m_xyz(static_cast<std::size_t>(tiles.tiles())), m_indices(static_cast<std::size_t>(tiles.tiles())) {
+	/*
+	@param		tiles - tiling of the cloud, points are added with add
+	*/
+}
+
+void mchtr_tiling::stream_loader::add(std::size_t index, float x, float y, float z) {
+	/*
+	Copies a point into the bucket of its tile.
+	@param		index - index of the point, loaded tiles report it
+				x, y, z - coordinates of the point
+	*/
+	const int tile = m_grid.tile_of(x, y);
+	m_xyz[tile].push_back(x);
+	m_xyz[tile].push_back(y);
+	m_xyz[tile].push_back(z);
+	m_indices[tile].push_back(index);
+}
+
+void mchtr_tiling::stream_loader::operator()(const mchtr_tiling::box& region, std::vector<float>& xyz, std::vector<std::size_t>& indices) const {
+	/*
+	Collects points inside a box from the buckets of the tiles it overlaps.
+	@param		region - box to load
+				xyz - output, coordinates, interleaved
+				indices - output, indices of the points
+	*/
+	xyz.clear();
+	indices.clear();
+	for_each_tile(m_grid, region, [&](int tile) {
+		const float* point = m_xyz[tile].data();
+		for (std::size_t slot = 0; slot < m_indices[tile].size(); ++slot, point += 3) {
+			if (inside(region, point)) {
+				xyz.insert(xyz.end(), point, point + 3);
+				indices.push_back(m_indices[tile][slot]);
+			}
+		}
+	});
+}
+
+mchtr_tiling::array_loader::array_loader(const float* xyz, std::size_t points_count, const mchtr_tiling::grid& tiles)
+	: bucket_loader([xyz](std::size_t index, float* point) { std::copy(xyz + 3 * index, xyz + 3 * index + 3, point); }, points_count, tiles) {
+	/*
+	@param		xyz - coordinates, interleaved (x0, y0, z0, x1, ...), must outlive the loader
+				points_count - number of points
+				tiles - tiling of the cloud
+	*/
+}
+
+const wchar_t* mchtr_tiling::validate(const mchtr_tiling::options& settings) {
+	/*
+	@param		settings - user supplied options
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (!(settings.tile_size >= 0)) {
+		return L"Tile size lower than 0 (0 means no tiling).";
+	}
+	if (!(settings.halo >= 0)) {
+		return L"Halo width lower than 0.";
+	}
+	return nullptr;
+}
+
+mchtr_tiling::run_stats mchtr_tiling::compute_curvature(const mchtr_tiling::grid& tiles, float halo, const mchtr_tiling::tile_loader& loader,
+	const mchtr_curvature::options& settings, const mchtr_parallel::progress_function& report, float* curvatures) {
+	/*
+	Calculates local curvature tile by tile, only the tiles' own points get curvatures from their tile.
+	@param		tiles - tiling of the cloud
+				halo - halo width, neighbourhoods are exact if it's wider than the distance to the K-th neighbour
+				loader - source of points
+				settings - curvature options
+				report - receives the number of processed points
+				curvatures - output, curvatures indexed like the cloud's points
+	@return		number of tiles, the largest loaded tile and the number of neighbourhoods the halo was too narrow for
+	*/
+	mchtr_tiling::run_stats stats;
+	tile_points points;
+	std::vector<float> tile_curvatures;
+	std::vector<float> kth_distances;
+	std::size_t finished = 0;
+	for (int tile = 0; tile < tiles.tiles(); ++tile) {
+		load_tile(tiles, tile, halo, loader, settings.profile, points);
+		if (points.core_count == 0) {
+			continue;
+		}
+		note_tile(points, stats);
+
+		tile_curvatures.resize(points.core_count);
+		kth_distances.resize(points.core_count);
+		mchtr_curvature::compute(points.xyz.data(), points.indices.size(), points.core_count, settings,
+			[&](std::size_t tile_finished) { report(finished + tile_finished); },
+			tile_curvatures.data(), kth_distances.data());
+
+		// write back the tile's own points only
+		for (std::size_t i = 0; i < points.core_count; ++i) {
+			curvatures[points.indices[i]] = tile_curvatures[i];
+			if (!exact_neighbourhood(points.region, tiles.bounds(), points.xyz[3 * i], points.xyz[3 * i + 1], kth_distances[i])) {
+				++stats.inexact_neighbourhoods;
+			}
+		}
+		finished += points.core_count;
+	}
+	record_stats(stats, settings.profile);
+	return stats;
+}
+
+mchtr_tiling::run_stats mchtr_tiling::segment_buildings(const mchtr_tiling::grid& tiles, float halo, const mchtr_tiling::tile_loader& loader,
+	std::size_t points_count, const mchtr_segmentation::options& settings, const mchtr_segmentation::stage_function& stage,
+	const mchtr_parallel::progress_function& report, float* smoothed, std::vector<float>& buildings, std::vector<mchtr_segmentation::surface>& surfaces,
+	std::size_t& buildings_count) {
+	/*
+	Runs building segmentation tile by tile in three passes (smoothing, roof finding, connecting roofs), the passes
+	after smoothing read the smoothed points. Buildings crossing tile borders are stitched by one union-find over
+	all points, so labels are the same as for the whole cloud at once. Smoothing projects points onto planes fitted
+	to unsmoothed neighbours, which (unlike smoothing in place) doesn't depend on the order tiles are processed in.
+	With fused_geometry the roof pass is skipped, roofs are found from the planes the smoothing pass fitted.
+	Only the KNN state is bounded by the tile size: the smoothed coordinates, surfaces, roof numbers, union-find parents
+	and labels are kept for the whole cloud (about 48 bytes per point), the later passes load their tiles from them.
+	@param		tiles - tiling of the cloud
+				halo - halo width, neighbourhoods are exact if it's wider than the distance to the K-th neighbour
+				loader - source of (unsmoothed) points
+				points_count - number of points in the cloud
+				settings - segmentation options (K nearest neighbours only), throws std::invalid_argument if invalid
+				stage - called when a stage starts
+				report - receives the number of processed points of the current stage
+				smoothed - output, smoothed coordinates, interleaved, indexed like the cloud's points
+				buildings - output, per point building label, 0 for points that are not roofs
+				surfaces - output, per point normal and surface variation the roof test read
+				buildings_count - output, number of buildings
+	@return		number of tiles, the largest loaded tile and the number of neighbourhoods the halo was too narrow for
+	*/
+	const wchar_t* error = mchtr_segmentation::validate(settings);
+	if (!error && settings.neighbourhood.mode != mchtr_voxel_grid::NEIGHBOURHOOD_KNN) {
+		error = L"Fixed radius neighbourhoods can't be combined with tiling.";
+	}
+	if (error) {
+
+		// the messages are plain ASCII
+		throw std::invalid_argument(std::string(error, error + std::wcslen(error)));
+	}
+	const int workers = mchtr_parallel::resolve_threads(settings.threads);
+	mchtr_tiling::run_stats stats;
+	tile_points points;
+	mchtr_kdtree::kdtree tree;
+	mchtr_knn_graph::graph graph;
+	std::size_t finished = 0;
+	auto tile_report = [&](std::size_t tile_finished) { report(finished + tile_finished); };
+
+	// smoothing, tile by tile into the smoothed copy
+	stage(mchtr_segmentation::STAGE_SMOOTHING);
+	std::vector<float> tile_smoothed;
+	std::vector<mchtr_segmentation::surface> tile_surfaces;
+	surfaces.resize(points_count);
+	{
+		mchtr_profile::scoped_stage timer(settings.profile, "smoothing");
+		for (int tile = 0; tile < tiles.tiles(); ++tile) {
+			load_tile(tiles, tile, halo, loader, settings.profile, points);
+			if (points.core_count == 0) {
+				continue;
+			}
+			note_tile(points, stats);
+			tree.build(points.xyz.data(), points.indices.size());
+			stats.inexact_neighbourhoods += build_tile_graph(points, tree, tiles.bounds(), settings.neighbours_count, workers, graph);
+			tile_smoothed.resize(3 * points.core_count);
+			tile_surfaces.resize(points.core_count);
+			mchtr_segmentation::smooth_into(points.xyz.data(), points.core_count, graph, settings.neighbours_count, settings.batched_planes, tile_report, tile_smoothed.data(),
+				settings.fused_geometry ? tile_surfaces.data() : nullptr);
+			for (std::size_t i = 0; i < points.core_count; ++i) {
+				std::copy(tile_smoothed.begin() + 3 * i, tile_smoothed.begin() + 3 * i + 3, smoothed + 3 * points.indices[i]);
+			}
+			if (settings.fused_geometry) {
+				for (std::size_t i = 0; i < points.core_count; ++i) {
+					surfaces[points.indices[i]] = tile_surfaces[i];
+				}
+			}
+			finished += points.core_count;
+		}
+	}
+
+	// roof finding on the smoothed points, unless smoothing already left the surfaces behind
+	stage(mchtr_segmentation::STAGE_ROOFS);
+	const mchtr_tiling::grid smoothed_tiles(mchtr_tiling::bounds_of(smoothed, points_count), tiles.tile_size());
+	const mchtr_tiling::array_loader smoothed_loader(smoothed, points_count, smoothed_tiles);
+	std::vector<unsigned char> flags;
+	finished = 0;
+	{
+		mchtr_profile::scoped_stage timer(settings.profile, "roofs");
+		if (!settings.fused_geometry) {
+			for (int tile = 0; tile < smoothed_tiles.tiles(); ++tile) {
+				load_tile(smoothed_tiles, tile, halo, std::cref(smoothed_loader), settings.profile, points);
+				if (points.core_count == 0) {
+					continue;
+				}
+				tree.build(points.xyz.data(), points.indices.size());
+				stats.inexact_neighbourhoods += build_tile_graph(points, tree, smoothed_tiles.bounds(), settings.neighbours_count, workers, graph);
+				tile_surfaces.resize(points.core_count);
+				mchtr_segmentation::estimate_surfaces(points.xyz.data(), points.core_count, graph, settings.neighbours_count, settings.batched_planes, nullptr,
+					tile_report, tile_surfaces.data());
+				for (std::size_t i = 0; i < points.core_count; ++i) {
+					surfaces[points.indices[i]] = tile_surfaces[i];
+				}
+				finished += points.core_count;
+			}
+		}
+		mchtr_segmentation::classify_roofs(smoothed, points_count, surfaces.data(), flags);
+		report(points_count);
+	}
+	std::vector<float> roofs;
+	mchtr_segmentation::number_roofs(flags, roofs);
+	std::vector<unsigned char>().swap(flags);
+
+	// connect roofs through their KNNs, the union-find spans all tiles, so buildings crossing borders are stitched on the way
+	stage(mchtr_segmentation::STAGE_SEGMENTATION);
+	mchtr_union_find::disjoint_sets sets(points_count);
+	std::vector<std::vector<mchtr_kdtree::neighbour>> buffers(workers, std::vector<mchtr_kdtree::neighbour>(settings.neighbours_count_segmentation));
+	std::vector<std::size_t> inexact(workers, 0);
+	finished = 0;
+	{
+		mchtr_profile::scoped_stage timer(settings.profile, "segmentation");
+		for (int tile = 0; tile < smoothed_tiles.tiles(); ++tile) {
+			load_tile(smoothed_tiles, tile, halo, std::cref(smoothed_loader), settings.profile, points);
+			if (points.core_count == 0) {
+				continue;
+			}
+			tree.build(points.xyz.data(), points.indices.size());
+			constexpr std::size_t chunk_size = 1024;
+			mchtr_parallel::run_chunks(points.core_count, chunk_size, workers,
+				[&](std::size_t begin, std::size_t end, int worker) {
+					mchtr_kdtree::neighbour* neighbours = buffers[worker].data();
+					for (std::size_t i = begin; i < end; ++i) {
+						const std::size_t point = points.indices[i];
+						if (roofs[point] == 0) {
+							continue;
+						}
+						const float* xyz = points.xyz.data() + 3 * i;
+						const std::size_t found = tree.knn(xyz[0], xyz[1], xyz[2], settings.neighbours_count_segmentation, neighbours);
+						for (std::size_t j = 0; j < found; ++j) {
+							const std::size_t neighbour = points.indices[neighbours[j].index];
+							if (neighbour != point && roofs[neighbour] != 0) {
+								sets.unite(static_cast<std::uint32_t>(point), static_cast<std::uint32_t>(neighbour));
+							}
+						}
+						if (found > 0 && !exact_neighbourhood(points.region, smoothed_tiles.bounds(), xyz[0], xyz[1], neighbours[found - 1].distance_squared)) {
+							++inexact[worker];
+						}
+					}
+				},
+				tile_report);
+			finished += points.core_count;
+		}
+	}
+	for (std::size_t count : inexact) {
+		stats.inexact_neighbourhoods += count;
+	}
+	buildings_count = mchtr_union_find::assign_labels(sets, roofs, settings.compact_ids, buildings);
+	record_stats(stats, settings.profile);
+	if (settings.profile) {
+		settings.profile->set_value("points", static_cast<double>(points_count));
+		settings.profile->set_value("buildings", static_cast<double>(buildings_count));
+	}
+	stage(mchtr_segmentation::STAGE_DONE);
+	return stats;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "mchtr_curvature.h"
+#include "mchtr_parallel.h"
+#include "mchtr_segmentation.h"
+
+/*
+Tiled (out-of-core) processing functionality header file: the cloud is processed tile by tile, every tile with a halo of
+neighbouring points, so memory used for KNN state is bounded by the tile size instead of the cloud size
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_tiling
+{
+	// axis aligned box, bounds inclusive
+	struct box {
+		float min[3];
+		float max[3];
+	};
+
+	box bounds_of(const float*, std::size_t);
+
+	// square tiles covering the cloud in X and Y (aerial scans are much wider than tall, tiles span all Z)
+	class grid {
+	public:
+		grid(const box&, float);
+
+		int tiles() const { return m_columns * m_rows; }
+		int columns() const { return m_columns; }
+		float tile_size() const { return m_tile_size; }
+		int tile_of(float, float) const;
+		box region(int, float) const;
+		const box& bounds() const { return m_bounds; }
+
+	private:
+		box m_bounds;
+		float m_tile_size;
+		int m_columns;
+		int m_rows;
+	};
+
+	// fills coordinates (interleaved x0, y0, z0, x1, ...) and indices of all points inside a box, in any order
+	using tile_loader = std::function<void(const box&, std::vector<float>&, std::vector<std::size_t>&)>;
+
+	// reads the coordinates of the point with an index into 3 floats
+	using point_reader = std::function<void(std::size_t, float*)>;
+
+	// tile loader over points read by index (from memory or a mapped file): point indices are bucketed by tile once
+	// (8 bytes per point), a box reads only the points of the tiles it overlaps
+	class bucket_loader {
+	public:
+		bucket_loader(const point_reader&, std::size_t, const grid&);
+		void operator()(const box&, std::vector<float>&, std::vector<std::size_t>&) const;
+
+	private:
+		point_reader m_read;
+		grid m_grid;
+		std::vector<std::size_t> m_offsets;
+		std::vector<std::size_t> m_indices;
+	};
+
+	// tile loader over points handed over once, in any order (e.g. one forward pass over a cloud's range): coordinates and indices
+	// are copied into buckets by tile (20 bytes per point), a box reads only the buckets of the tiles it overlaps
+	class stream_loader {
+	public:
+		explicit stream_loader(const grid&);
+		void add(std::size_t, float, float, float);
+		void operator()(const box&, std::vector<float>&, std::vector<std::size_t>&) const;
+
+	private:
+		grid m_grid;
+		std::vector<std::vector<float>> m_xyz;
+		std::vector<std::vector<std::size_t>> m_indices;
+	};
+
+	// bucket loader over coordinates in memory (or mapped from a file)
+	class array_loader : public bucket_loader {
+	public:
+		array_loader(const float*, std::size_t, const grid&);
+	};
+
+	struct options {
+		float tile_size{ 0 };
+		float halo{ 0 };
+	};
+
+	struct run_stats {
+		std::size_t tiles{ 0 };
+		std::size_t largest_tile{ 0 };
+		std::size_t inexact_neighbourhoods{ 0 };
+	};
+
+	const wchar_t* validate(const options&);
+	run_stats compute_curvature(const grid&, float, const tile_loader&, const mchtr_curvature::options&,
+		const mchtr_parallel::progress_function&, float*);
+	run_stats segment_buildings(const grid&, float, const tile_loader&, std::size_t, const mchtr_segmentation::options&,
+		const mchtr_segmentation::stage_function&, const mchtr_parallel::progress_function&, float*, std::vector<float>&, std::vector<mchtr_segmentation::surface>&, std::size_t&);
+}
@@ -0,0 +1,137 @@
+#include "mchtr_union_find.h"
+
+/*
+Union-find (connected components) functionality cpp file
+Author: Przemyslaw Wysocki
+*/
+
+mchtr_union_find::disjoint_sets::disjoint_sets(std::size_t count) : m_size(count), m_parents(new std::atomic<std::uint32_t>[count]) {
+	/*
+	Creates count singleton sets.
+	@param		count - number of elements
+	*/
+	for (std::size_t i = 0; i < count; ++i) {
+		m_parents[i].store(static_cast<std::uint32_t>(i), std::memory_order_relaxed);
+	}
+}
+
+std::uint32_t mchtr_union_find::disjoint_sets::find(std::uint32_t element) {
+	/*
+	Finds the root of an element's set, halving the path on the way (every visited node is relinked to its grandparent).
+	Safe to call concurrently with other finds and unites.
+	@param		element - element to look up
+	@return		root (smallest element) of the set
+	*/
+	while (true) {
+		std::uint32_t parent = m_parents[element].load(std::memory_order_acquire);
+		if (parent == element) {
+			return element;
+		}
+		std::uint32_t grandparent = m_parents[parent].load(std::memory_order_acquire);
+		if (parent != grandparent) {
+
+			// a failed exchange means someone else already moved the link up, which is just as good
+			m_parents[element].compare_exchange_weak(parent, grandparent, std::memory_order_acq_rel, std::memory_order_relaxed);
+		}
+		element = grandparent;
+	}
+}
+
+bool mchtr_union_find::disjoint_sets::unite(std::uint32_t a, std::uint32_t b) {
+	/*
+	Merges sets of two elements. Safe to call concurrently with other finds and unites.
+	@param		a, b - elements whose sets get merged
+	@return		false if they were in the same set already
+	*/
+	while (true) {
+		a = find(a);
+		b = find(b);
+		if (a == b) {
+			return false;
+		}
+
+		// link the larger root under the smaller one, retry if it stopped being a root meanwhile
+		if (a < b) {
+			std::uint32_t tmp = a;
+			a = b;
+			b = tmp;
+		}
+		std::uint32_t expected = a;
+		if (m_parents[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) {
+			return true;
+		}
+	}
+}
+
+std::size_t mchtr_union_find::label_components(const mchtr_knn_graph::graph& graph, int k, const std::vector<float>& values, bool compact, int threads,
+	const mchtr_parallel::progress_function& report, std::vector<float>& labels) {
+	/*
+	Labels connected components of marked points, two marked points are connected if one is among the other's K nearest neighbours.
+	A single pass over the graph replaces iterative propagation of the smallest value, and the result doesn't depend
+	on how far apart the points of a component are.
+	@param		graph - KNN graph of the points (built for at least k neighbours)
+				k - number of nearest neighbours that connect points
+				values - per point values, 0 = not marked (not a part of any component)
+				compact - label components 1, 2, 3... in order of their first point instead of with the value of their first point
+				threads - number of workers
+				report - receives the number of processed points
+				labels - output, per point component label, 0 for unmarked points
+	@return		number of components
+	*/
+	const std::size_t count = values.size();
+	mchtr_union_find::disjoint_sets sets(count);
+
+	// unite marked points with their marked neighbours, in parallel
+	constexpr std::size_t chunk_size = 4096;
+	const int workers = mchtr_parallel::resolve_threads(threads);
+	std::vector<std::vector<std::uint32_t>> rows(workers, std::vector<std::uint32_t>(k + mchtr_graph_codec::decode_slack));
+	mchtr_parallel::run_chunks(count, chunk_size, workers,
+		[&](std::size_t begin, std::size_t end, int worker) {
+			for (std::size_t point = begin; point < end; ++point) {
+				if (values[point] == 0) {
+					continue;
+				}
+				std::size_t neighbours_found = 0;
+				const std::uint32_t* neighbours = graph.read_row(point, k, rows[worker].data(), neighbours_found);
+				for (std::size_t j = 0; j < neighbours_found; ++j) {
+					if (neighbours[j] != point && values[neighbours[j]] != 0) {
+						sets.unite(static_cast<std::uint32_t>(point), neighbours[j]);
+					}
+				}
+			}
+		},
+		report);
+
+	return mchtr_union_find::assign_labels(sets, values, compact, labels);
+}
+
+std::size_t mchtr_union_find::assign_labels(mchtr_union_find::disjoint_sets& sets, const std::vector<float>& values, bool compact, std::vector<float>& labels) {
+	/*
+	Turns united sets of marked points into component labels.
+	@param		sets - sets of all points, marked points united with their marked neighbours
+				values - per point values, 0 = not marked (not a part of any component)
+				compact - label components 1, 2, 3... in order of their first point instead of with the value of their first point
+				labels - output, per point component label, 0 for unmarked points
+	@return		number of components
+	*/
+
+	// roots are the first points of their components, so going in order every root comes before its members
+	const std::size_t count = values.size();
+	std::vector<std::uint32_t> component_ids(compact ? count : 0);
+	std::size_t components = 0;
+	labels.assign(count, 0.0f);
+	for (std::size_t point = 0; point < count; ++point) {
+		if (values[point] == 0) {
+			continue;
+		}
+		const std::uint32_t root = sets.find(static_cast<std::uint32_t>(point));
+		if (root == point) {
+			++components;
+			if (compact) {
+				component_ids[point] = static_cast<std::uint32_t>(components);
+			}
+		}
+		labels[point] = compact ? static_cast<float>(component_ids[root]) : values[root];
+	}
+	return components;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "mchtr_knn_graph.h"
+#include "mchtr_parallel.h"
+
+/*
+Union-find (connected components) functionality header file
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_union_find
+{
+	// lock-free disjoint set forest: a root is always linked under the smaller root, so parents only decrease
+	// and the root of every set is its smallest element, whatever order threads unite in
+	class disjoint_sets {
+	public:
+		explicit disjoint_sets(std::size_t);
+
+		std::uint32_t find(std::uint32_t);
+		bool unite(std::uint32_t, std::uint32_t);
+		std::size_t size() const { return m_size; }
+
+	private:
+		std::size_t m_size;
+		std::unique_ptr<std::atomic<std::uint32_t>[]> m_parents;
+	};
+
+	std::size_t label_components(const mchtr_knn_graph::graph&, int, const std::vector<float>&, bool, int,
+		const mchtr_parallel::progress_function&, std::vector<float>&);
+	std::size_t assign_labels(disjoint_sets&, const std::vector<float>&, bool, std::vector<float>&);
+}
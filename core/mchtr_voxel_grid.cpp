@@ -0,0 +1,343 @@
+#include "mchtr_voxel_grid.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "mchtr_cache.h"
+#include "mchtr_order.h"
+
+/*
+Fixed-radius neighbourhood functionality cpp file: a hashed voxel grid with the cell size equal to the radius, so a radius query
+reads the 27 cells around the query point's cell; points with too few neighbours within the radius get their nearest ones instead
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	// a cell's key is the Morton key of its coordinates, 3 * 21 = 63 bits, so no key equals empty_key
+	constexpr std::int64_t max_extent = std::int64_t(1) << mchtr_order::key_bits;
+	constexpr std::uint64_t empty_key = ~std::uint64_t(0);
+
+	inline bool closer(const mchtr_kdtree::neighbour& a, const mchtr_kdtree::neighbour& b) {
+		// the same order as the kd-tree's, ties go to the smaller index
+		return a.distance_squared < b.distance_squared || (a.distance_squared == b.distance_squared && a.index < b.index);
+	}
+
+	inline std::uint64_t pack(std::int64_t x, std::int64_t y, std::int64_t z) {
+		return mchtr_order::morton_key(static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y), static_cast<std::uint32_t>(z));
+	}
+
+	inline std::size_t slot_of(std::uint64_t key, int shift) {
+		// Fibonacci hashing of the 2 x 2 x 2 block of cells (the top bits of the product), the block's cells then take consecutive slots,
+		// so the 27 cells of a query touch a few cache lines instead of 27
+		return static_cast<std::size_t>(((key >> 3) * 0x9e3779b97f4a7c15ull) >> shift) << 3 | static_cast<std::size_t>(key & 7);
+	}
+
+	inline bool covers(const std::int64_t* centre, std::int64_t shell, const std::int64_t* extent) {
+		// the shells up to this one hold every cell of the grid
+		for (int axis = 0; axis < 3; ++axis) {
+			if (centre[axis] - shell > 0 || centre[axis] + shell < extent[axis] - 1) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+bool mchtr_voxel_grid::grid::build(const float* xyz, std::size_t points_count, float cell_size) {
+	/*
+	Buckets the points into cells, sorted by cell with ties by index; points with a non-finite coordinate are left out.
+	@param		xyz - coordinates of the points, interleaved (x0, y0, z0, x1, ...), not referenced after the build
+				points_count - number of points
+				cell_size - edge of a cell, the radius of the queries
+	@return		false if the cloud spans more than 2^21 cells along an axis (or has 2^32 points or more), the grid is empty then
+	*/
+	m_table.clear();
+	m_xyz.clear();
+	m_indices.clear();
+	m_cell_size = cell_size;
+	if (!(cell_size > 0) || points_count >= std::numeric_limits<std::uint32_t>::max()) {
+		return false;
+	}
+
+	// bounds of the finite points, their minimum is the grid's origin
+	float lower[3] = { std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
+	float upper[3] = { -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+	std::size_t finite = 0;
+	for (std::size_t i = 0; i < points_count; ++i) {
+		const float* point = xyz + 3 * i;
+		if (!std::isfinite(point[0]) || !std::isfinite(point[1]) || !std::isfinite(point[2])) {
+			continue;
+		}
+		for (int axis = 0; axis < 3; ++axis) {
+			lower[axis] = std::min(lower[axis], point[axis]);
+			upper[axis] = std::max(upper[axis], point[axis]);
+		}
+		++finite;
+	}
+	if (finite == 0) {
+		return true;
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		m_origin[axis] = lower[axis];
+		m_extent[axis] = 0;
+		const double cells = std::floor((static_cast<double>(upper[axis]) - lower[axis]) / cell_size) + 1;
+		if (!(cells <= static_cast<double>(max_extent))) {
+			return false;
+		}
+		m_extent[axis] = static_cast<std::int64_t>(cells);
+	}
+
+	// points sorted by cell, coordinates copied in that order
+	std::vector<std::pair<std::uint64_t, std::uint32_t>> keyed;
+	keyed.reserve(finite);
+	for (std::size_t i = 0; i < points_count; ++i) {
+		std::int64_t cell[3];
+		if (cell_of(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2], cell)) {
+			keyed.emplace_back(pack(cell[0], cell[1], cell[2]), static_cast<std::uint32_t>(i));
+		}
+	}
+	std::sort(keyed.begin(), keyed.end());
+	m_indices.resize(finite);
+	m_xyz.resize(3 * finite);
+	std::size_t cells_count = 0;
+	for (std::size_t slot = 0; slot < finite; ++slot) {
+		const std::size_t index = keyed[slot].second;
+		m_indices[slot] = keyed[slot].second;
+		std::copy(xyz + 3 * index, xyz + 3 * index + 3, m_xyz.begin() + 3 * slot);
+		cells_count += slot == 0 || keyed[slot].first != keyed[slot - 1].first;
+	}
+
+	// at most half of the table's slots are taken
+	std::size_t capacity = 16;
+	m_table_shift = 63;
+	while (capacity < 2 * cells_count) {
+		capacity *= 2;
+		--m_table_shift;
+	}
+	m_table.assign(capacity, cell{ empty_key, 0, 0 });
+	for (std::size_t begin = 0; begin < finite;) {
+		std::size_t end = begin + 1;
+		while (end < finite && keyed[end].first == keyed[begin].first) {
+			++end;
+		}
+		std::size_t slot = slot_of(keyed[begin].first, m_table_shift);
+		while (m_table[slot].key != empty_key) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+		m_table[slot] = cell{ keyed[begin].first, static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(end) };
+		begin = end;
+	}
+	return true;
+}
+
+bool mchtr_voxel_grid::grid::cell_of(float x, float y, float z, std::int64_t* cell) const {
+	/*
+	@param		x, y, z - a point
+				cell - output, coordinates of the cell the point falls into (outside the grid for points outside its bounds)
+	@return		false if a coordinate isn't finite
+	*/
+	const float point[3] = { x, y, z };
+	for (int axis = 0; axis < 3; ++axis) {
+		if (!std::isfinite(point[axis])) {
+			return false;
+		}
+
+		// far outside the grid every cell coordinate is as good as another, clamped so it fits
+		const double position = std::floor((static_cast<double>(point[axis]) - m_origin[axis]) / m_cell_size);
+		cell[axis] = static_cast<std::int64_t>(std::min(std::max(position, -2.0 * max_extent), 2.0 * max_extent));
+	}
+	return true;
+}
+
+const mchtr_voxel_grid::grid::cell* mchtr_voxel_grid::grid::find(std::int64_t x, std::int64_t y, std::int64_t z) const {
+	/*
+	@param		x, y, z - coordinates of a cell inside the grid
+	@return		the cell's run of points, nullptr if it has none
+	*/
+	const std::uint64_t key = pack(x, y, z);
+	const std::size_t mask = m_table.size() - 1;
+	for (std::size_t slot = slot_of(key, m_table_shift);; slot = (slot + 1) & mask) {
+		if (m_table[slot].key == key) {
+			return &m_table[slot];
+		}
+		if (m_table[slot].key == empty_key) {
+			return nullptr;
+		}
+	}
+}
+
+void mchtr_voxel_grid::grid::scan(const cell& points, float x, float y, float z, float limit_squared, std::size_t wanted, mchtr_kdtree::neighbour* result,
+	std::size_t& found) const {
+	/*
+	Offers the points of one cell to the bounded max-heap of the nearest ones.
+	@param		points - the cell
+				x, y, z - query point
+				limit_squared - squared distance beyond which points are skipped
+				wanted - size of the heap
+				result - the heap, unordered until it holds wanted points
+				found - number of points in the heap, updated
+	*/
+	for (std::uint32_t slot = points.begin; slot < points.end; ++slot) {
+		const float px = m_xyz[3 * static_cast<std::size_t>(slot)];
+		const float py = m_xyz[3 * static_cast<std::size_t>(slot) + 1];
+		const float pz = m_xyz[3 * static_cast<std::size_t>(slot) + 2];
+		const float dx = px - x;
+		const float dy = py - y;
+		const float dz = pz - z;
+		const mchtr_kdtree::neighbour candidate{ dx * dx + dy * dy + dz * dz, m_indices[slot], px, py, pz };
+		if (candidate.distance_squared > limit_squared) {
+			continue;
+		}
+		// the heap is made only once the buffer fills up, most radius neighbourhoods never do
+		if (found < wanted) {
+			result[found++] = candidate;
+			if (found == wanted) {
+				std::make_heap(result, result + found, closer);
+			}
+		}
+		else if (closer(candidate, result[0])) {
+			std::pop_heap(result, result + found, closer);
+			result[found - 1] = candidate;
+			std::push_heap(result, result + found, closer);
+		}
+	}
+}
+
+std::size_t mchtr_voxel_grid::grid::query(float x, float y, float z, float radius, int max_count, int min_count, mchtr_kdtree::neighbour* result,
+	std::size_t* visited_count) const {
+	/*
+	Finds the neighbours of a point within a radius (the point itself included if it's in the grid), the nearest max_count of them if there are more;
+	with fewer than min_count within the radius, the min_count nearest points wherever they are. Cells are read in shells of growing
+	Chebyshev distance from the query's cell, with a radius equal to the cell size the radius search reads 27 cells.
+	The result array doubles as a bounded max-heap while searching, nothing is allocated.
+	@param		x, y, z - query point
+				radius - radius of the neighbourhood
+				max_count - most neighbours to return
+				min_count - fewest neighbours to return (at most max_count), unless the grid has fewer points
+				result - output, room for max_count neighbours, sorted nearest first with ties broken by index like the kd-tree's
+				visited_count - optional output (may be nullptr), number of points distances were calculated to
+	@return		number of neighbours found
+	*/
+	if (visited_count) {
+		*visited_count = 0;
+	}
+	std::int64_t centre[3];
+	if (m_table.empty() || max_count <= 0 || !cell_of(x, y, z, centre)) {
+		return 0;
+	}
+
+	// squared distance from the query to the slab of cells at a coordinate along an axis
+	const float query_point[3] = { x, y, z };
+	auto gap_squared = [&](int axis, std::int64_t coordinate) {
+		const double lower = m_origin[axis] + static_cast<double>(coordinate) * m_cell_size;
+		const double gap = std::max(std::max(lower - query_point[axis], query_point[axis] - (lower + m_cell_size)), 0.0);
+		return gap * gap;
+	};
+
+	// visits the cells of one shell that are inside the grid and not farther than the limit (or the farthest point of a full heap);
+	// the bound has a little slack, so rounding never skips a cell a point within the limit was put into
+	std::size_t found = 0;
+	auto scan_shell = [&](std::int64_t shell, float limit_squared, std::size_t wanted) {
+		auto bound = [&]() { return (found == wanted ? result[0].distance_squared : limit_squared) * (1 + 1e-4); };
+		const std::int64_t x_end = std::min(centre[0] + shell, m_extent[0] - 1);
+		const std::int64_t y_end = std::min(centre[1] + shell, m_extent[1] - 1);
+		for (std::int64_t cx = std::max<std::int64_t>(centre[0] - shell, 0); cx <= x_end; ++cx) {
+			const double x_gap = gap_squared(0, cx);
+			if (x_gap > bound()) {
+				continue;
+			}
+			for (std::int64_t cy = std::max<std::int64_t>(centre[1] - shell, 0); cy <= y_end; ++cy) {
+				const double xy_gap = x_gap + gap_squared(1, cy);
+				if (xy_gap > bound()) {
+					continue;
+				}
+
+				// inside the shell's faces along x and y only its two z faces belong to it
+				const bool face = cx == centre[0] - shell || cx == centre[0] + shell || cy == centre[1] - shell || cy == centre[1] + shell;
+				const std::int64_t step = face ? 1 : std::max<std::int64_t>(2 * shell, 1);
+				for (std::int64_t cz = centre[2] - shell; cz <= centre[2] + shell; cz += step) {
+					if (cz < 0 || cz >= m_extent[2] || xy_gap + gap_squared(2, cz) > bound()) {
+						continue;
+					}
+					const cell* points = find(cx, cy, cz);
+					if (points) {
+						scan(*points, x, y, z, limit_squared, wanted, result, found);
+						if (visited_count) {
+							*visited_count += points->end - points->begin;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	// the radius search, up to max_count nearest points within the radius
+	const float radius_squared = radius * radius;
+	const std::int64_t reach = static_cast<std::int64_t>(std::ceil(radius / m_cell_size));
+	for (std::int64_t shell = 0; shell <= reach; ++shell) {
+		scan_shell(shell, radius_squared, std::min(static_cast<std::size_t>(max_count), size()));
+	}
+
+	// too few, the nearest min_count: shells until the heap is full and no unread cell can be nearer than its farthest point
+	const std::size_t fallback = std::min(static_cast<std::size_t>(std::min(min_count, max_count)), size());
+	if (found < fallback) {
+		found = 0;
+		for (std::int64_t shell = 0;; ++shell) {
+			scan_shell(shell, std::numeric_limits<float>::infinity(), fallback);
+			const float bound = static_cast<float>(shell) * m_cell_size;
+			if ((found == fallback && result[0].distance_squared <= bound * bound) || covers(centre, shell, m_extent)) {
+				break;
+			}
+		}
+	}
+	std::sort(result, result + found, closer);
+	return found;
+}
+
+std::size_t mchtr_voxel_grid::grid::bytes() const {
+	/*
+	@return		memory the grid takes
+	*/
+	return m_table.size() * sizeof(cell) + m_xyz.size() * sizeof(float) + m_indices.size() * sizeof(std::uint32_t);
+}
+
+bool mchtr_voxel_grid::is_valid_mode(int mode) {
+	/*
+	Checks whether a user given neighbourhood mode (plugin parameter) is one of the known ones.
+	@param		mode - neighbourhood mode id
+	@return		true if the mode is known
+	*/
+	return mode == NEIGHBOURHOOD_KNN || mode == NEIGHBOURHOOD_RADIUS;
+}
+
+const wchar_t* mchtr_voxel_grid::validate(const mchtr_voxel_grid::options& settings, int neighbours_count) {
+	/*
+	@param		settings - user supplied options
+				neighbours_count - K of the run, the most neighbours a radius neighbourhood keeps
+	@return		description of the first invalid option, nullptr if all are valid
+	*/
+	if (!is_valid_mode(settings.mode)) {
+		return L"Unknown neighbourhood mode, use 0 (K nearest neighbours) or 1 (fixed radius).";
+	}
+	if (settings.mode == NEIGHBOURHOOD_KNN) {
+		return nullptr;
+	}
+	if (!(settings.radius > 0) || !std::isfinite(settings.radius)) {
+		return L"Neighbourhood radius must be greater than 0.";
+	}
+	if (settings.min_points < 1 || settings.min_points > neighbours_count) {
+		return L"Minimum number of neighbours must be between 1 and K.";
+	}
+	return nullptr;
+}
+
+std::uint64_t mchtr_voxel_grid::key(const mchtr_voxel_grid::options& settings) {
+	/*
+	@param		settings - neighbourhood options
+	@return		hash of what radius neighbourhoods depend on, 0 for K nearest neighbours (so cache entries of KNN runs keep their keys)
+	*/
+	if (settings.mode == NEIGHBOURHOOD_KNN) {
+		return 0;
+	}
+	return mchtr_cache::parameters().add(settings.mode).add(settings.radius).add(settings.min_points).value();
+}
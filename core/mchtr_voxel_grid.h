@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "mchtr_kdtree.h"
+
+/*
+Fixed-radius neighbourhood functionality header file: a hashed voxel grid with the cell size equal to the radius, so a radius query
+reads the 27 cells around the query point's cell; points with too few neighbours within the radius get their nearest ones instead
+Author: Przemyslaw Wysocki
+*/
+
+namespace mchtr_voxel_grid
+{
+	enum mode {
+		NEIGHBOURHOOD_KNN = 0,		// K nearest neighbours from a kd-tree
+		NEIGHBOURHOOD_RADIUS = 1	// neighbours within a radius (at most K, the nearest ones) from a voxel grid
+	};
+
+	struct options {
+		int mode{ NEIGHBOURHOOD_KNN };
+		float radius{ 0 };		// radius mode only, in the cloud's units
+		int min_points{ 8 };	// radius mode only, a point with fewer neighbours within the radius gets its min_points nearest ones
+	};
+
+	// points bucketed into cubic cells, an open addressing hash table maps a cell to its run of points, stored cell by cell
+	class grid {
+	public:
+		bool build(const float*, std::size_t, float);
+		std::size_t size() const { return m_indices.size(); }
+		std::size_t query(float, float, float, float, int, int, mchtr_kdtree::neighbour*, std::size_t*) const;
+		std::size_t bytes() const;
+
+	private:
+		struct cell {
+			std::uint64_t key;
+			std::uint32_t begin, end;
+		};
+
+		bool cell_of(float, float, float, std::int64_t*) const;
+		const cell* find(std::int64_t, std::int64_t, std::int64_t) const;
+		void scan(const cell&, float, float, float, float, std::size_t, mchtr_kdtree::neighbour*, std::size_t&) const;
+
+		std::vector<cell> m_table;			// capacity a power of 2, empty slots have key empty_key
+		std::vector<float> m_xyz;			// coordinates cell by cell, every cell reads one contiguous block
+		std::vector<std::uint32_t> m_indices;	// index of the point at every slot
+		float m_origin[3]{ 0, 0, 0 };		// corner of cell (0, 0, 0)
+		std::int64_t m_extent[3]{ 0, 0, 0 };	// number of cells along every axis
+		float m_cell_size{ 0 };
+		int m_table_shift{ 64 };
+	};
+
+	bool is_valid_mode(int);
+	const wchar_t* validate(const options&, int);
+	std::uint64_t key(const options&);
+}
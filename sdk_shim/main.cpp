@@ -0,0 +1,235 @@
+#include <ogx/Plugins/EasyPlugin.h>
+#include <chrono>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../bench/mchtr_synthetic.h"
+#include "../cli/mchtr_io.h"
+
+/*
+Plugin driver: runs the unmodified FRAMES3D plugins (built against the SDK stand-in in sdk_shim/ogx) on a generated or loaded cloud,
+so they can be timed and profiled outside FRAMES3D
+Author: Przemyslaw Wysocki
+*/
+
+namespace
+{
+	void print_usage() {
+		std::fwprintf(stderr,
+			L"usage: mchtr_plugins [options] <cloud> <method> [name=value ...] [+ <method> [name=value ...]] ...\n"
+			L"  cloud                 sphere, cylinder, plane, saddle or town (the bench's synthetic clouds), or a PLY / LAS / raw XYZ file\n"
+			L"  method                an exported plugin method, a method named again runs again on the same instance (e.g. incremental runs)\n"
+			L"  name=value            a parameter of the method, node_id is set to the cloud's node\n"
+			L"  --points <N>          points of a synthetic cloud (default 20000)\n"
+			L"  --noise <S>           standard deviation of noise added to a synthetic cloud (default 0)\n"
+			L"  --list                print the exported methods and exit\n");
+	}
+
+	bool parse_size(const char* text, std::size_t& value) {
+		char* end = nullptr;
+		const unsigned long long parsed = std::strtoull(text, &end, 10);
+		if (end == text || *end != '\0') {
+			return false;
+		}
+		value = static_cast<std::size_t>(parsed);
+		return true;
+	}
+
+	bool parse_float(const char* text, float& value) {
+		char* end = nullptr;
+		const float parsed = std::strtof(text, &end);
+		if (end == text || *end != '\0') {
+			return false;
+		}
+		value = parsed;
+		return true;
+	}
+
+	std::wstring widen(const std::string& text) {
+		// parameters and method names are plain ASCII
+		return std::wstring(text.begin(), text.end());
+	}
+
+	double seconds_since(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool load_cloud(const std::string& name, std::size_t points_count, float noise, ogx::Data::Clouds::ICloud& cloud) {
+		/*
+		Fills the cloud with a synthetic shape, the same ones the bench generates, or with the points of a file.
+		@param		name - shape name or file path
+					points_count - points of a synthetic shape
+					noise - noise of a synthetic shape
+					cloud - output
+		@return		false if the name is neither a shape nor a readable cloud file
+		*/
+		mchtr_synthetic::cloud shape;
+		if (name == "sphere") {
+			shape = mchtr_synthetic::sphere(points_count, 1.0f, noise, 2);
+		}
+		else if (name == "cylinder") {
+			shape = mchtr_synthetic::cylinder(points_count, 1.0f, 4.0f, noise, 5);
+		}
+		else if (name == "plane") {
+			shape = mchtr_synthetic::plane(points_count, 4.0f, noise, 6);
+		}
+		else if (name == "saddle") {
+			shape = mchtr_synthetic::saddle(points_count, 2.0f, 2.0f, noise, 7);
+		}
+		else if (name == "town") {
+			shape = mchtr_synthetic::town(points_count, 9, 0.05f, noise, 8);
+		}
+
+		const float* xyz = shape.xyz.data();
+		std::size_t count = shape.size();
+		std::unique_ptr<mchtr_io::mapped_file> file;
+		mchtr_io::point_cloud points;
+		if (shape.xyz.empty()) {
+			try {
+				file.reset(new mchtr_io::mapped_file(name));
+				mchtr_io::read_points(*file, points);
+			}
+			catch (const std::exception& exception) {
+				std::fwprintf(stderr, L"error: %hs\n", exception.what());
+				return false;
+			}
+			xyz = points.xyz;
+			count = points.count;
+		}
+		cloud.m_xyz.resize(count);
+		for (std::size_t i = 0; i < count; ++i) {
+			cloud.m_xyz[i] = ogx::Data::Clouds::Point3D(xyz[3 * i], xyz[3 * i + 1], xyz[3 * i + 2]);
+		}
+		cloud.m_state.assign(count, ogx::Data::Clouds::State());
+		return true;
+	}
+
+	void print_layer(ogx::Data::Clouds::ILayer& layer) {
+		/*
+		Prints a summary of a layer's values and a hash of their bits, equal hashes mean equal layers.
+		@param		layer - layer to summarise
+		*/
+		const std::vector<float>& values = layer.Values();
+		double sum = 0, minimum = 0, maximum = 0;
+		std::size_t finite = 0;
+		std::uint64_t hash = 14695981039346656037ull;
+		for (float value : values) {
+			std::uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			hash = (hash ^ bits) * 1099511628211ull;
+			if (!std::isfinite(value)) {
+				continue;
+			}
+			minimum = finite == 0 || value < minimum ? value : minimum;
+			maximum = finite == 0 || value > maximum ? value : maximum;
+			sum += value;
+			++finite;
+		}
+		std::wprintf(L"layer %-20ls mean %.6g  min %.6g  max %.6g  non_finite %zu  hash %016llx\n", layer.GetName().c_str(),
+			finite ? sum / finite : 0.0, minimum, maximum, values.size() - finite, static_cast<unsigned long long>(hash));
+	}
+}
+
+int main(int argc, char** argv) {
+	// the plugins log Polish messages, print them in the terminal's encoding (UTF-8 if the environment doesn't set one)
+	const char* locale = std::setlocale(LC_ALL, "");
+	if (!locale || std::strcmp(locale, "C") == 0) {
+		std::setlocale(LC_ALL, "C.UTF-8");
+	}
+	// results go to stdout, the plugins' log to stderr, line by line so they interleave in order
+	std::setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+
+	const std::map<std::string, ogx::Plugin::MethodRegistry::factory>& methods = ogx::Plugin::MethodRegistry::Methods();
+	std::size_t points_count = 20000;
+	float noise = 0;
+	int argument = 1;
+	for (; argument < argc && std::strncmp(argv[argument], "--", 2) == 0; ++argument) {
+		const std::string option = argv[argument];
+		if (option == "--list") {
+			for (const auto& method : methods) {
+				std::wprintf(L"%hs - %ls\n", method.first.c_str(), method.second()->Description().c_str());
+			}
+			return 0;
+		}
+		const bool valid = argument + 1 < argc && ((option == "--points" && parse_size(argv[argument + 1], points_count)) ||
+			(option == "--noise" && parse_float(argv[argument + 1], noise)));
+		if (!valid) {
+			print_usage();
+			return 2;
+		}
+		++argument;
+	}
+	if (argc - argument < 2) {
+		print_usage();
+		return 2;
+	}
+
+	ogx::Data::Project project;
+	const ogx::Data::ResourceID node_id = project.AddNode();
+	ogx::Data::Clouds::ICloud& cloud = *project.TransTreeFindNode(node_id)->GetElement()->GetData<ogx::Data::Clouds::ICloud>();
+	const auto start = std::chrono::steady_clock::now();
+	if (!load_cloud(argv[argument], points_count, noise, cloud)) {
+		return 2;
+	}
+	std::wprintf(L"cloud %hs: %zu points in %.3f s\n", argv[argument], cloud.m_xyz.size(), seconds_since(start));
+	++argument;
+
+	// every segment runs one method, a method named again keeps its instance and with it what it remembers between runs
+	std::map<std::string, std::unique_ptr<ogx::Plugin::EasyMethod>> instances;
+	std::size_t errors = 0;
+	while (argument < argc) {
+		const std::string name = argv[argument++];
+		const auto factory = methods.find(name);
+		if (factory == methods.end()) {
+			std::fwprintf(stderr, L"error: no method %hs, --list prints them\n", name.c_str());
+			return 2;
+		}
+		std::unique_ptr<ogx::Plugin::EasyMethod>& method = instances[name];
+		if (!method) {
+			method = factory->second();
+		}
+		ogx::Plugin::ParameterBank bank;
+		method->DefineParameters(bank);
+		if (bank.Has(L"node_id")) {
+			bank.Set(L"node_id", std::to_wstring(node_id));
+		}
+		for (; argument < argc && std::strcmp(argv[argument], "+") != 0; ++argument) {
+			const std::string parameter = argv[argument];
+			const std::size_t separator = parameter.find('=');
+			if (separator == std::string::npos || !bank.Set(widen(parameter.substr(0, separator)), widen(parameter.substr(separator + 1)))) {
+				std::fwprintf(stderr, L"error: %hs is not a parameter of %hs or its value is invalid\n", parameter.c_str(), name.c_str());
+				return 2;
+			}
+		}
+		++argument;
+
+		ogx::Plugin::Context context;
+		context.m_project = &project;
+		const std::size_t errors_before = method->m_errors;
+		const auto run_start = std::chrono::steady_clock::now();
+		method->Run(context);
+		const double seconds = seconds_since(run_start);
+		errors += method->m_errors - errors_before;
+		std::wprintf(L"run %hs: %.3f s, %zu errors, %zu progress updates\n", name.c_str(), seconds, method->m_errors - errors_before,
+			context.Feedback().m_updates);
+	}
+
+	for (const std::unique_ptr<ogx::Data::Clouds::ILayer>& layer : cloud.m_layers) {
+		print_layer(*layer);
+	}
+	std::size_t deleted = 0;
+	for (const ogx::Data::Clouds::State& state : cloud.m_state) {
+		deleted += state.test(ogx::Data::Clouds::PS_DELETED);
+	}
+	std::wprintf(L"deleted %zu of %zu points\n", deleted, cloud.m_state.size());
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include <ogx/Data/Primitives/PrimitiveHelpers.h>
+
+/*
+Stand-in for the FRAMES3D SDK's point cloud interfaces: an in-memory cloud with point states and float layers, point ranges over it
+and the coordinate and state views the plugins iterate
+Author: Przemyslaw Wysocki
+*/
+
+namespace ogx
+{
+	namespace Data
+	{
+		using ResourceID = std::size_t;
+
+		namespace Clouds
+		{
+			enum PointStateFlag : std::uint32_t {
+				PS_DELETED = 1u << 0
+			};
+
+			class State {
+			public:
+				void set(PointStateFlag flag) { m_bits |= flag; }
+				void reset(PointStateFlag flag) { m_bits &= ~static_cast<std::uint32_t>(flag); }
+				bool test(PointStateFlag flag) const { return (m_bits & flag) != 0; }
+
+			private:
+				std::uint32_t m_bits{ 0 };
+			};
+
+			// one float per point of the cloud
+			class ILayer {
+			public:
+				ILayer(const String& name, float default_value, std::size_t size) : m_name(name), m_values(size, default_value) {}
+
+				const String& GetName() const { return m_name; }
+
+				// shim only, not part of the SDK
+				std::vector<float>& Values() { return m_values; }
+
+			private:
+				String m_name;
+				std::vector<float> m_values;
+			};
+
+			class ICloud;
+			class KNNSearchKernel;
+			class SphericalSearchKernel;
+
+			// a selection of a cloud's points, in the order they were found
+			class PointsRange {
+			public:
+				std::size_t size() const { return m_indices.size(); }
+				bool empty() const { return m_indices.empty(); }
+
+				template <typename T>
+				void SetLayerVals(const std::vector<T>& values, ILayer& layer) {
+					std::vector<float>& destination = layer.Values();
+					for (std::size_t i = 0; i < m_indices.size() && i < values.size(); ++i) {
+						destination[m_indices[i]] = static_cast<float>(values[i]);
+					}
+				}
+
+				template <typename T>
+				void GetLayerVals(std::vector<T>& values, ILayer& layer) const {
+					const std::vector<float>& source = layer.Values();
+					values.resize(m_indices.size());
+					for (std::size_t i = 0; i < m_indices.size(); ++i) {
+						values[i] = static_cast<T>(source[m_indices[i]]);
+					}
+				}
+
+				// shim only, not part of the SDK
+				ICloud* m_cloud{ nullptr };
+				std::vector<std::size_t> m_indices;
+			};
+
+			class ICloud {
+			public:
+				class Access {
+				public:
+					explicit Access(ICloud& cloud) : m_cloud(cloud) {}
+
+					void GetAllPoints(PointsRange& range) {
+						range.m_cloud = &m_cloud;
+						range.m_indices.resize(m_cloud.m_xyz.size());
+						for (std::size_t i = 0; i < range.m_indices.size(); ++i) {
+							range.m_indices[i] = i;
+						}
+					}
+
+					void FindPoints(const KNNSearchKernel&, PointsRange&);
+					void FindPoints(const SphericalSearchKernel&, PointsRange&);
+
+				private:
+					ICloud& m_cloud;
+				};
+
+				Access GetAccess() { return Access(*this); }
+
+				ILayer* CreateLayer(const String& name, double default_value) {
+					m_layers.push_back(std::unique_ptr<ILayer>(new ILayer(name, static_cast<float>(default_value), m_xyz.size())));
+					return m_layers.back().get();
+				}
+
+				std::vector<ILayer*> FindLayers(const String& name) {
+					std::vector<ILayer*> found;
+					for (const std::unique_ptr<ILayer>& layer : m_layers) {
+						if (layer->GetName() == name) {
+							found.push_back(layer.get());
+						}
+					}
+					return found;
+				}
+
+				// shim only, not part of the SDK: filled by the driver, m_state as long as m_xyz
+				std::vector<Point3D> m_xyz;
+				std::vector<State> m_state;
+				std::vector<std::unique_ptr<ILayer>> m_layers;
+			};
+
+			// coordinates of a range's points, writable unless Const
+			template <bool Const>
+			class RangeLocalXYZBase {
+			public:
+				using value_type = typename std::conditional<Const, const Point3D, Point3D>::type;
+
+				class iterator {
+				public:
+					iterator(ICloud* cloud, const std::size_t* index) : m_cloud(cloud), m_index(index) {}
+					value_type& operator*() const { return m_cloud->m_xyz[*m_index]; }
+					iterator& operator++() { ++m_index; return *this; }
+					bool operator==(const iterator& other) const { return m_index == other.m_index; }
+					bool operator!=(const iterator& other) const { return m_index != other.m_index; }
+
+				private:
+					ICloud* m_cloud;
+					const std::size_t* m_index;
+				};
+
+				explicit RangeLocalXYZBase(const PointsRange& range) : m_range(range) {}
+
+				iterator begin() const { return iterator(m_range.m_cloud, m_range.m_indices.data()); }
+				iterator end() const { return iterator(m_range.m_cloud, m_range.m_indices.data() + m_range.m_indices.size()); }
+
+			private:
+				const PointsRange& m_range;
+			};
+
+			using RangeLocalXYZConst = RangeLocalXYZBase<true>;
+			using RangeLocalXYZ = RangeLocalXYZBase<false>;
+
+			// states of a range's points, writable
+			class RangeState {
+			public:
+				class iterator {
+				public:
+					iterator(ICloud* cloud, const std::size_t* index) : m_cloud(cloud), m_index(index) {}
+					State& operator*() const { return m_cloud->m_state[*m_index]; }
+					State* operator->() const { return &m_cloud->m_state[*m_index]; }
+					iterator& operator++() { ++m_index; return *this; }
+					bool operator==(const iterator& other) const { return m_index == other.m_index; }
+					bool operator!=(const iterator& other) const { return m_index != other.m_index; }
+
+				private:
+					ICloud* m_cloud;
+					const std::size_t* m_index;
+				};
+
+				explicit RangeState(const PointsRange& range) : m_range(range) {}
+
+				iterator begin() const { return iterator(m_range.m_cloud, m_range.m_indices.data()); }
+				iterator end() const { return iterator(m_range.m_cloud, m_range.m_indices.data() + m_range.m_indices.size()); }
+
+			private:
+				const PointsRange& m_range;
+			};
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <ogx/Data/Clouds/CloudHelpers.h>
+
+/*
+Stand-in for the FRAMES3D SDK's K nearest neighbours search: a brute force scan of the cloud, slow on large clouds but exact,
+so knn_benchmark still compares the plugins' kd-tree with a correct answer
+Author: Przemyslaw Wysocki
+*/
+
+namespace ogx
+{
+	namespace Data
+	{
+		namespace Clouds
+		{
+			class KNNSearchKernel {
+			public:
+				KNNSearchKernel(const Math::Point3D& point, int k) : m_point(point), m_k(k) {}
+
+				Math::Point3D& GetPoint() { return m_point; }
+				const Math::Point3D& GetPoint() const { return m_point; }
+				int GetK() const { return m_k; }
+
+			private:
+				Math::Point3D m_point;
+				int m_k;
+			};
+
+			inline void ICloud::Access::FindPoints(const KNNSearchKernel& kernel, PointsRange& range) {
+				/*
+				Finds the K points nearest to the kernel's point, deleted points excluded.
+				@param		kernel - query point and K
+							range - output, the points nearest first, ties by index
+				*/
+				const Math::Point3D& query = kernel.GetPoint();
+				std::vector<std::pair<double, std::size_t>> candidates;
+				candidates.reserve(m_cloud.m_xyz.size());
+				for (std::size_t i = 0; i < m_cloud.m_xyz.size(); ++i) {
+					if (m_cloud.m_state[i].test(PS_DELETED)) {
+						continue;
+					}
+					const Point3D& point = m_cloud.m_xyz[i];
+					const double dx = point.x() - query.x();
+					const double dy = point.y() - query.y();
+					const double dz = point.z() - query.z();
+					candidates.emplace_back(dx * dx + dy * dy + dz * dz, i);
+				}
+				const std::size_t k = std::min<std::size_t>(static_cast<std::size_t>(std::max(kernel.GetK(), 0)), candidates.size());
+				std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end());
+				range.m_cloud = &m_cloud;
+				range.m_indices.resize(k);
+				for (std::size_t i = 0; i < k; ++i) {
+					range.m_indices[i] = candidates[i].second;
+				}
+			}
+		}
+	}
+}
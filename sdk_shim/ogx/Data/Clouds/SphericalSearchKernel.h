@@ -0,0 +1,54 @@
+#pragma once
+
+#include <ogx/Data/Clouds/CloudHelpers.h>
+
+/*
+Stand-in for the FRAMES3D SDK's fixed radius search: a brute force scan of the cloud
+Author: Przemyslaw Wysocki
+*/
+
+namespace ogx
+{
+	namespace Data
+	{
+		namespace Clouds
+		{
+			class SphericalSearchKernel {
+			public:
+				SphericalSearchKernel(const Math::Point3D& point, double radius) : m_point(point), m_radius(radius) {}
+
+				Math::Point3D& GetPoint() { return m_point; }
+				const Math::Point3D& GetPoint() const { return m_point; }
+				double GetRadius() const { return m_radius; }
+
+			private:
+				Math::Point3D m_point;
+				double m_radius;
+			};
+
+			inline void ICloud::Access::FindPoints(const SphericalSearchKernel& kernel, PointsRange& range) {
+				/*
+				Finds the points within the kernel's radius (border included), deleted points excluded.
+				@param		kernel - query point and radius
+							range - output, the points in index order
+				*/
+				const Math::Point3D& query = kernel.GetPoint();
+				const double radius_squared = kernel.GetRadius() * kernel.GetRadius();
+				range.m_cloud = &m_cloud;
+				range.m_indices.clear();
+				for (std::size_t i = 0; i < m_cloud.m_xyz.size(); ++i) {
+					if (m_cloud.m_state[i].test(PS_DELETED)) {
+						continue;
+					}
+					const Point3D& point = m_cloud.m_xyz[i];
+					const double dx = point.x() - query.x();
+					const double dy = point.y() - query.y();
+					const double dz = point.z() - query.z();
+					if (dx * dx + dy * dy + dz * dz <= radius_squared) {
+						range.m_indices.push_back(i);
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+/*
+Stand-in for the FRAMES3D SDK's math primitives and log: the vectors, planes and plane fit the plugins use, nothing else
+Author: Przemyslaw Wysocki
+*/
+
+namespace ogx
+{
+	using Real = double;
+	using String = std::wstring;
+
+	enum class Level { Info, Warning, Error };
+
+	// FRAMES3D shows log lines in its console, the shim writes them to stderr
+	struct LogLine {
+		void Msg(Level level, const String& message) const {
+			const wchar_t* prefix = level == Level::Error ? L"[error] " : level == Level::Warning ? L"[warning] " : L"[info] ";
+			std::fwprintf(stderr, L"%ls%ls\n", prefix, message.c_str());
+		}
+	};
+
+	namespace Math
+	{
+		template <typename T>
+		struct Vector3 {
+			T v[3];
+
+			Vector3() : v{ 0, 0, 0 } {}
+			Vector3(T x, T y, T z) : v{ x, y, z } {}
+
+			T& x() { return v[0]; }
+			T& y() { return v[1]; }
+			T& z() { return v[2]; }
+			const T& x() const { return v[0]; }
+			const T& y() const { return v[1]; }
+			const T& z() const { return v[2]; }
+			T& operator[](int i) { return v[i]; }
+			const T& operator[](int i) const { return v[i]; }
+
+			template <typename U>
+			Vector3<U> cast() const { return Vector3<U>(static_cast<U>(v[0]), static_cast<U>(v[1]), static_cast<U>(v[2])); }
+
+			Vector3 operator+(const Vector3& other) const { return Vector3(v[0] + other.v[0], v[1] + other.v[1], v[2] + other.v[2]); }
+			Vector3 operator-(const Vector3& other) const { return Vector3(v[0] - other.v[0], v[1] - other.v[1], v[2] - other.v[2]); }
+			Vector3 operator*(T scale) const { return Vector3(v[0] * scale, v[1] * scale, v[2] * scale); }
+			T dot(const Vector3& other) const { return v[0] * other.v[0] + v[1] * other.v[1] + v[2] * other.v[2]; }
+			T norm() const { return std::sqrt(dot(*this)); }
+			Vector3 normalized() const { const T length = norm(); return length > 0 ? *this * (1 / length) : *this; }
+		};
+
+		using Point3D = Vector3<Real>;
+		using Vector3D = Vector3<Real>;
+
+		// points p with normal . p + offset = 0, the normal of unit length
+		class Plane3D {
+		public:
+			Plane3D() : m_normal(0, 0, 1), m_offset(0) {}
+			Plane3D(const Vector3D& normal, Real offset) : m_normal(normal), m_offset(offset) {}
+
+			const Vector3D& normal() const { return m_normal; }
+			Real offset() const { return m_offset; }
+			Real signedDistance(const Point3D& point) const { return m_normal.dot(point) + m_offset; }
+
+		private:
+			Vector3D m_normal;
+			Real m_offset;
+		};
+
+		inline Real CalcPointToPointDistance3D(const Point3D& a, const Point3D& b) {
+			return (a - b).norm();
+		}
+
+		inline Point3D ProjectPointOntoPlane(const Plane3D& plane, const Point3D& point) {
+			return point - plane.normal() * plane.signedDistance(point);
+		}
+
+		namespace detail
+		{
+			inline Vector3D smallest_eigenvector(double a[3][3]) {
+				/*
+				Diagonalises a symmetric matrix with cyclic Jacobi rotations.
+				@param		a - symmetric 3x3 matrix, overwritten
+				@return		unit eigenvector of the smallest eigenvalue
+				*/
+				double v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+				for (int sweep = 0; sweep < 50; ++sweep) {
+					const double off_diagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+					if (off_diagonal < 1e-30) {
+						break;
+					}
+					for (int p = 0; p < 2; ++p) {
+						for (int q = p + 1; q < 3; ++q) {
+							if (std::abs(a[p][q]) < 1e-300) {
+								continue;
+							}
+							const double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+							const double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+							const double c = 1 / std::sqrt(t * t + 1);
+							const double s = t * c;
+							for (int k = 0; k < 3; ++k) {
+								const double kp = a[k][p], kq = a[k][q];
+								a[k][p] = c * kp - s * kq;
+								a[k][q] = s * kp + c * kq;
+							}
+							for (int k = 0; k < 3; ++k) {
+								const double pk = a[p][k], qk = a[q][k];
+								a[p][k] = c * pk - s * qk;
+								a[q][k] = s * pk + c * qk;
+							}
+							for (int k = 0; k < 3; ++k) {
+								const double kp = v[k][p], kq = v[k][q];
+								v[k][p] = c * kp - s * kq;
+								v[k][q] = s * kp + c * kq;
+							}
+						}
+					}
+				}
+				int smallest = 0;
+				for (int i = 1; i < 3; ++i) {
+					if (a[i][i] < a[smallest][smallest]) {
+						smallest = i;
+					}
+				}
+				return Vector3D(v[0][smallest], v[1][smallest], v[2][smallest]).normalized();
+			}
+		}
+
+		template <typename Iterator>
+		Plane3D CalcBestPlane3D(Iterator begin, Iterator end) {
+			/*
+			Least squares plane through points: through their centroid, normal to the smallest principal axis of their covariance.
+			@param		begin, end - points, anything indexable with [0], [1], [2]
+			@return		the plane, the XY plane if there are no points
+			*/
+			double count = 0;
+			double mean[3] = { 0, 0, 0 };
+			for (Iterator it = begin; it != end; ++it) {
+				count += 1;
+				for (int i = 0; i < 3; ++i) {
+					mean[i] += static_cast<double>((*it)[i]);
+				}
+			}
+			if (count == 0) {
+				return Plane3D();
+			}
+			for (int i = 0; i < 3; ++i) {
+				mean[i] /= count;
+			}
+			double covariance[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+			for (Iterator it = begin; it != end; ++it) {
+				double d[3];
+				for (int i = 0; i < 3; ++i) {
+					d[i] = static_cast<double>((*it)[i]) - mean[i];
+				}
+				for (int i = 0; i < 3; ++i) {
+					for (int j = 0; j < 3; ++j) {
+						covariance[i][j] += d[i] * d[j];
+					}
+				}
+			}
+			const Vector3D normal = detail::smallest_eigenvector(covariance);
+			return Plane3D(normal, -normal.dot(Point3D(mean[0], mean[1], mean[2])));
+		}
+	}
+
+	namespace Data
+	{
+		namespace Clouds
+		{
+			// clouds store single precision coordinates
+			using Point3D = Math::Vector3<float>;
+		}
+	}
+}
+
+#define OGX_LINE ogx::LogLine{}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ogx/Data/Clouds/CloudHelpers.h>
+#include <ogx/Data/Primitives/PrimitiveHelpers.h>
+
+/*
+Stand-in for the FRAMES3D SDK's EasyPlugin interface: a project of nodes holding in-memory clouds, parameter banks set from text,
+progress feedback and a registry of the exported methods, enough to run EasyMethod subclasses unmodified outside FRAMES3D
+Author: Przemyslaw Wysocki
+*/
+
+namespace ogx
+{
+	namespace Data
+	{
+		class Element {
+		public:
+			template <typename T>
+			T* GetData() { return m_cloud.get(); }
+
+			// shim only, not part of the SDK: every element holds a cloud
+			std::unique_ptr<Clouds::ICloud> m_cloud{ new Clouds::ICloud() };
+		};
+
+		class Node {
+		public:
+			Element* GetElement() { return &m_element; }
+
+		private:
+			Element m_element;
+		};
+
+		class Project {
+		public:
+			Node* TransTreeFindNode(ResourceID id) { return id < m_nodes.size() ? m_nodes[id].get() : nullptr; }
+
+			// shim only, not part of the SDK: node ids are positions in m_nodes
+			ResourceID AddNode() {
+				m_nodes.emplace_back(new Node());
+				return m_nodes.size() - 1;
+			}
+
+			std::vector<std::unique_ptr<Node>> m_nodes;
+		};
+	}
+
+	namespace Plugin
+	{
+		// progress is only counted, the shim's runs can't be cancelled
+		class IFeedback {
+		public:
+			bool Update(float progress) {
+				m_progress = progress;
+				++m_updates;
+				return true;
+			}
+
+			// shim only, not part of the SDK
+			float m_progress{ 0 };
+			std::size_t m_updates{ 0 };
+		};
+
+		class Context {
+		public:
+			IFeedback& Feedback() { return m_feedback; }
+
+			Data::Project* m_project{ nullptr };
+
+		private:
+			IFeedback m_feedback;
+		};
+
+		// every parameter is bound to a member of the method, the driver sets them by name from text
+		class ParameterBank {
+		public:
+			class Parameter {
+			public:
+				Parameter& AsNode() { return *this; }
+			};
+
+			template <typename T>
+			Parameter& Add(const String& name, T& value) {
+				return bind(name, [&value](const String& text) {
+					std::wistringstream stream(text);
+					T parsed;
+					if (!(stream >> parsed) || !(stream >> std::ws).eof()) {
+						return false;
+					}
+					value = parsed;
+					return true;
+				});
+			}
+
+			Parameter& Add(const String& name, String& value) {
+				return bind(name, [&value](const String& text) {
+					value = text;
+					return true;
+				});
+			}
+
+			Parameter& Add(const String& name, bool& value) {
+				return bind(name, [&value](const String& text) {
+					if (text != L"0" && text != L"1" && text != L"false" && text != L"true") {
+						return false;
+					}
+					value = text == L"1" || text == L"true";
+					return true;
+				});
+			}
+
+			// shim only, not part of the SDK
+			bool Has(const String& name) const { return m_setters.count(name) != 0; }
+			bool Set(const String& name, const String& text) {
+				const auto setter = m_setters.find(name);
+				return setter != m_setters.end() && setter->second(text);
+			}
+
+		private:
+			Parameter& bind(const String& name, std::function<bool(const String&)> setter) {
+				m_setters[name] = std::move(setter);
+				m_parameters.emplace_back();
+				return m_parameters.back();
+			}
+
+			std::map<String, std::function<bool(const String&)>> m_setters;
+			std::vector<Parameter> m_parameters;
+		};
+
+		class EasyMethod {
+		public:
+			using ParameterBank = Plugin::ParameterBank;
+			using Context = Plugin::Context;
+
+			EasyMethod(const String& author, const String& description) : m_author(author), m_description(description) {}
+			virtual ~EasyMethod() {}
+
+			virtual void DefineParameters(ParameterBank&) = 0;
+			virtual void Run(Context&) = 0;
+
+			void ReportError(const String& message) {
+				++m_errors;
+				OGX_LINE.Msg(Level::Error, message);
+			}
+
+			// shim only, not part of the SDK
+			const String& Description() const { return m_description; }
+			std::size_t m_errors{ 0 };
+
+		private:
+			String m_author;
+			String m_description;
+		};
+
+		// shim only, not part of the SDK: OGX_EXPORT_METHOD registers a factory of the method under its class name
+		struct MethodRegistry {
+			using factory = std::function<std::unique_ptr<EasyMethod>()>;
+
+			static std::map<std::string, factory>& Methods() {
+				static std::map<std::string, factory> methods;
+				return methods;
+			}
+		};
+
+		template <typename T>
+		struct MethodRegistrar {
+			explicit MethodRegistrar(const char* name) {
+				MethodRegistry::Methods()[name] = []() { return std::unique_ptr<EasyMethod>(new T()); };
+			}
+		};
+	}
+}
+
+#define OGX_EXPORT_METHOD(T) static ogx::Plugin::MethodRegistrar<T> ogx_method_##T(#T);